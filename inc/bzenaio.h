@@ -0,0 +1,210 @@
+/**
+ * @file:	bzenaio.h
+ * @brief:	Asynchronous reads and writes of streams.
+ *
+ * Requests are queued with bzen_aio_read() and bzen_aio_write() and handed
+ * to the kernel in one batch by bzen_aio_submit(). Completions are reaped
+ * by bzen_aio_poll() or bzen_aio_wait(), which call the callback of each
+ * request in the calling thread.
+ *
+ * On Linux with io_uring, requests go through a submission ring shared with
+ * the kernel (raw system calls, no liburing). Buffers and streams may be
+ * registered with the ring, so the kernel does not map them per request.
+ * Where io_uring is missing or refused, a pool of threads serves requests
+ * with pread() and pwrite() behind the same interface.
+ *
+ * Requests read and write descriptors at explicit offsets and bypass the
+ * buffers of the stream; flush the stream before writing to it here. A
+ * context belongs to one thread at a time.
+ *
+ * @copyright:	Copyright (C) 2017 Kuhrman Technology Solutions LLC
+ * @license:	GPLv3+: GNU GPL version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BZENLIBC_AIO_H_
+#define _BZENLIBC_AIO_H_
+
+#include <config.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "bzenpriv.h"
+
+/**
+ * Flag of bzen_aio_create(): use threads even if io_uring is available.
+ */
+#define BZEN_AIO_EMULATE 0x1
+
+/**
+ * Number of threads serving requests where io_uring is not available.
+ */
+#define BZEN_AIO_THREADS 4
+
+/**
+ * Called once a request is complete.
+ *
+ * @param[in] ssize_t result Number of bytes transferred, which may be short,
+ * or a negative errno value.
+ * @param[in] void* arg Argument given with request.
+ */
+typedef void (*bzen_aio_callback_t)(ssize_t result, void* arg);
+
+/**
+ * @typedef bzen_aio_t
+ *
+ * Context of asynchronous requests. Private to bzenaio.
+ */
+typedef struct _bzen_aio_s bzen_aio_t;
+
+/**
+ * Create a context for up to entries requests in flight.
+ *
+ * @param[in] unsigned int entries Number of requests, rounded up to a power
+ * of 2.
+ * @param[in] unsigned int flags 0 or BZEN_AIO_EMULATE.
+ *
+ * @return bzen_aio_t* Pointer to new context or NULL on error.
+ */
+bzen_aio_t* bzen_aio_create(unsigned int entries, unsigned int flags);
+
+/**
+ * Complete all requests, calling their callbacks, and free context.
+ *
+ * @param[in] bzen_aio_t* aio Context or NULL.
+ *
+ * @return void
+ */
+void bzen_aio_destroy(bzen_aio_t* aio);
+
+/**
+ * Tell if context serves requests with threads rather than io_uring.
+ *
+ * @param[in] const bzen_aio_t* aio Context.
+ *
+ * @return int 1 if emulated, otherwise 0.
+ */
+int bzen_aio_emulated(const bzen_aio_t* aio);
+
+/**
+ * Reap completed requests and call their callbacks without blocking.
+ *
+ * @param[in,out] bzen_aio_t* aio Context.
+ *
+ * @return int Number of requests completed.
+ */
+int bzen_aio_poll(bzen_aio_t* aio);
+
+/**
+ * Queue read of up to n bytes at offset of stream into buf.
+ *
+ * If the context is full, queued requests are submitted and callbacks of
+ * earlier requests may be called before this returns.
+ *
+ * @param[in,out] bzen_aio_t* aio Context.
+ * @param[in] bzen_stream_t* stream Stream backed by a descriptor.
+ * @param[out] void* buf Destination of n bytes, valid until completion.
+ * @param[in] size_t n Number of bytes.
+ * @param[in] off_t offset Offset in stream.
+ * @param[in] bzen_aio_callback_t callback Called on completion.
+ * @param[in] void* arg Argument of callback.
+ *
+ * @return int 0 on success, otherwise -1.
+ */
+int bzen_aio_read(bzen_aio_t* aio,
+		  bzen_stream_t* stream,
+		  void* buf,
+		  size_t n,
+		  off_t offset,
+		  bzen_aio_callback_t callback,
+		  void* arg);
+
+/**
+ * Register buffers with the kernel for the life of the context.
+ *
+ * Later requests whose bytes lie inside one of the buffers use it without
+ * the kernel mapping its pages again. Replaces earlier registered buffers.
+ *
+ * @param[in,out] bzen_aio_t* aio Context without requests in flight.
+ * @param[in] const struct iovec* iov Array of n buffers.
+ * @param[in] unsigned int n Number of buffers.
+ *
+ * @return int 0 on success, otherwise -1.
+ */
+int bzen_aio_register_buffers(bzen_aio_t* aio,
+			      const struct iovec* iov,
+			      unsigned int n);
+
+/**
+ * Register descriptors of streams with the kernel for the life of context.
+ *
+ * Later requests on the streams skip looking up their descriptor. Streams
+ * must stay open as long as the context. Replaces earlier registered streams.
+ *
+ * @param[in,out] bzen_aio_t* aio Context without requests in flight.
+ * @param[in] bzen_stream_t** streams Array of n streams.
+ * @param[in] unsigned int n Number of streams.
+ *
+ * @return int 0 on success, otherwise -1.
+ */
+int bzen_aio_register_streams(bzen_aio_t* aio,
+			      bzen_stream_t** streams,
+			      unsigned int n);
+
+/**
+ * Hand all queued requests to the kernel (or threads) at once.
+ *
+ * @param[in,out] bzen_aio_t* aio Context.
+ *
+ * @return int Number of requests submitted or -1 on error.
+ */
+int bzen_aio_submit(bzen_aio_t* aio);
+
+/**
+ * Submit queued requests and wait until at least min of them complete.
+ *
+ * Callbacks of all completed requests are called. Waits for no more than
+ * the requests in flight.
+ *
+ * @param[in,out] bzen_aio_t* aio Context.
+ * @param[in] unsigned int min Number of completions to wait for.
+ *
+ * @return int Number of requests completed or -1 on error.
+ */
+int bzen_aio_wait(bzen_aio_t* aio, unsigned int min);
+
+/**
+ * Queue write of n bytes from buf at offset of stream.
+ *
+ * See bzen_aio_read().
+ *
+ * @param[in,out] bzen_aio_t* aio Context.
+ * @param[in] bzen_stream_t* stream Stream backed by a descriptor.
+ * @param[in] const void* buf Source of n bytes, valid until completion.
+ * @param[in] size_t n Number of bytes.
+ * @param[in] off_t offset Offset in stream.
+ * @param[in] bzen_aio_callback_t callback Called on completion.
+ * @param[in] void* arg Argument of callback.
+ *
+ * @return int 0 on success, otherwise -1.
+ */
+int bzen_aio_write(bzen_aio_t* aio,
+		   bzen_stream_t* stream,
+		   const void* buf,
+		   size_t n,
+		   off_t offset,
+		   bzen_aio_callback_t callback,
+		   void* arg);
+
+#endif /* _BZENLIBC_AIO_H_ */
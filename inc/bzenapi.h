@@ -26,6 +26,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 /**
  * @defgroup ipc Interprocess Communications
@@ -62,6 +63,9 @@ int bzen_ipc_fork(void* exitfn, void* ipcfn, void* ipcopt, void* logopt);
 #define BZEN_OPENTYPE_SIZE 3
 #define BZEN_STREAM_MIN_BUFFER_SIZE 32
 
+/** Byte count of bzen_stream_copy() which copies to end of input. */
+#define BZEN_STREAM_COPY_ALL ((size_t)-1)
+
 /**
  * @typedef bzen_stream_t
  * @{
@@ -80,6 +84,15 @@ typedef struct _bzen_stream_s
   /** Buffer for file name or IO.  */
   char** buffer;
 
+  /** Descriptor and buffers of native stream, NULL if stream uses file. */
+  struct _bzen_fdstream_s* fdstream;
+
+  /** Contents of chunked memory stream, owned by file. */
+  struct _bzen_chunkstream_s* chunkstream;
+
+  /** Block buffers of compressed stream, owned by file. */
+  struct _bzen_lzstream_s* lzstream;
+
 } bzen_stream_t;
 /**
  * @}
@@ -94,6 +107,24 @@ typedef struct _bzen_stream_s
  */
 int bzen_stream_close(bzen_stream_t* stream);
 
+/**
+ * Copy n bytes from one stream to another.
+ *
+ * If both streams are backed by file descriptors, bytes read ahead by in are
+ * written first and the rest is moved by the kernel with copy_file_range(),
+ * sendfile() or splice(), whichever the pair of descriptors supports, without
+ * passing through user space. Otherwise bytes are copied in blocks. File 
+ * positions of both streams are advanced by the number of bytes copied.
+ *
+ * @param[in,out] bzen_stream_t* out Stream to write to.
+ * @param[in,out] bzen_stream_t* in Stream to read from.
+ * @param[in] size_t n Number of bytes or BZEN_STREAM_COPY_ALL.
+ *
+ * @return ssize_t Number of bytes copied, fewer than n only at end of in, or
+ * @c -1 on error.
+ */
+ssize_t bzen_stream_copy(bzen_stream_t* out, bzen_stream_t* in, size_t n);
+
 /**
  * Free memory for given bzen_stream_t struct.
  *
@@ -103,6 +134,35 @@ int bzen_stream_close(bzen_stream_t* stream);
  */
 int bzen_stream_delete(bzen_stream_t* stream);
 
+/**
+ * Open stream on a file descriptor without stdio.
+ *
+ * Stream owns fd and closes it with the stream. Reads and writes go through 
+ * two buffers of the stream, taken from a pool, without the locking of stdio;
+ * a stream belongs to one thread at a time. Requests larger than a buffer go
+ * straight to the descriptor with readv() or writev(), together with bytes
+ * already buffered. If fd can seek, reads and writes share one position as 
+ * with fopen(); otherwise (pipes, sockets) input and output are independent.
+ *
+ * @param[in,out] bzen_stream_t* stream A pointer to the opened stream.
+ * @param[in] int fd Open file descriptor.
+ *
+ * @return @c 0 on success otherwise -1.
+ */
+int bzen_stream_fdopen(bzen_stream_t* stream, int fd);
+
+/**
+ * Write buffered output of stream.
+ *
+ * Native streams on descriptors which can seek also give back bytes read
+ * ahead, so the descriptor is at the position of the stream.
+ *
+ * @param[in,out] bzen_stream_t* stream Stream to flush.
+ *
+ * @return @c 0 on success otherwise @c -1 on error.
+ */
+int bzen_stream_flush(bzen_stream_t* stream);
+
 /**
  * Open stream as a file.
  *
@@ -142,9 +202,82 @@ int bzen_stream_fmemopen(bzen_stream_t* stream,
  */
 int bzen_stream_getc(bzen_stream_t* stream);
 
+/**
+ * Read a line from the given stream.
+ *
+ * Reads up to and including the next newline, or to end of stream, and stores
+ * the bytes NUL-terminated at *line. As with getline(3), *line is NULL or was
+ * allocated with malloc(); if it is NULL or its capacity *n too small, it is
+ * grown with realloc() and *n updated. Free it with free(). Lines may contain
+ * NUL bytes, use the returned length.
+ *
+ * @param[in,out] char** line Address of line buffer.
+ * @param[in,out] size_t* n Address of capacity of line buffer in bytes.
+ * @param[in] bzen_stream_t* stream Stream to read from.
+ *
+ * @return ssize_t Length of line in bytes or @c -1 at end of stream or on
+ * error. If memory runs out, the part of line read so far is returned and
+ * the rest is left in stream.
+ */
+ssize_t bzen_stream_getline(char** line, size_t* n, bzen_stream_t* stream);
+
+/**
+ * Describe contents of a stream in memory as array of struct iovec.
+ *
+ * Stream is flushed first. Views of a chunked stream stay valid until it is
+ * closed, a dynamic buffer is one view valid until it is written again.
+ *
+ * @param[in] bzen_stream_t* stream Stream in memory.
+ * @param[out] struct iovec* iov Array of iovcnt entries.
+ * @param[in] int iovcnt Number of entries of iov.
+ *
+ * @return int Number of entries filled, covering the start of contents if
+ * iov is too short, or @c -1 if stream is not in memory.
+ */
+int bzen_stream_iovec(bzen_stream_t* stream, struct iovec* iov, int iovcnt);
+
+/**
+ * Open stream as a list of chunks in memory.
+ *
+ * Writes fill the last chunk and then take another from a pool, so growing
+ * contents costs the same at any size and nothing is copied or moved. Writes 
+ * always append, as with "a+"; reads and seeks move a read position. Length
+ * of contents is at stream->size; contents are exported without copying by
+ * bzen_stream_iovec().
+ *
+ * @param[in,out] bzen_stream_t* stream A pointer to the opened stream.
+ *
+ * @return @c 0 on success otherwise -1.
+ */
+int bzen_stream_open_chunked(bzen_stream_t* stream);
+
+/**
+ * Open stream compressing to or decompressing from another stream.
+ *
+ * With type "w", bytes written are cut in blocks of 64 KiB, compressed with
+ * the LZ codec of bzenlz.h and written to inner; blocks that do not shrink
+ * are stored as they are. bzen_stream_flush() writes a short block so the
+ * reader gets all bytes so far. With type "r", bytes read are decompressed
+ * from inner. Stream cannot seek. Closing stream writes the last block and
+ * flushes inner but leaves it open; inner must stay open until then.
+ *
+ * @param[in,out] bzen_stream_t* stream A pointer to the opened stream.
+ * @param[in] bzen_stream_t* inner Stream of compressed blocks.
+ * @param[in] const char* type "r" or "w".
+ *
+ * @return @c 0 on success otherwise -1.
+ */
+int bzen_stream_open_compressed(bzen_stream_t* stream,
+				bzen_stream_t* inner,
+				const char* type);
+
 /**
  * Open stream as a dynamic buffer in memory.
  *
+ * Stream may be read, written and positioned. Contents are available at 
+ * *stream->buffer (always NUL-terminated) and their length at stream->size.
+ * Buffer grows without copying once it is larger than 64 KiB.
+ *
  * @param[in,out] bzen_stream_t* stream A pointer to the opened stream.
  *
  * @return @c 0 on success otherwise -1.
@@ -160,6 +293,22 @@ int bzen_stream_open_memstream(bzen_stream_t* stream);
  */
 int bzen_stream_new(bzen_stream_t** stream);
 
+/**
+ * Read up to n bytes at offset of stream without changing its position.
+ *
+ * @param[in] bzen_stream_t* stream Stream to read from.
+ * @param[out] void* ptr Destination of at least n bytes.
+ * @param[in] size_t n Number of bytes.
+ * @param[in] off_t offset Offset in stream.
+ *
+ * @return ssize_t Number of bytes read, fewer than n only at end of stream, 
+ * or @c -1 on error.
+ */
+ssize_t bzen_stream_pread(bzen_stream_t* stream, 
+			  void* ptr, 
+			  size_t n, 
+			  off_t offset);
+
 /**
  * Put a character to the given buffer.
  *
@@ -174,6 +323,47 @@ int bzen_stream_new(bzen_stream_t** stream);
  */
 int bzen_stream_putc(int c, bzen_stream_t* stream);
 
+/**
+ * Write n bytes at offset of stream without changing its position.
+ *
+ * @param[in,out] bzen_stream_t* stream Stream to write to.
+ * @param[in] const void* ptr Source of n bytes.
+ * @param[in] size_t n Number of bytes.
+ * @param[in] off_t offset Offset in stream.
+ *
+ * @return ssize_t Number of bytes written or @c -1 on error.
+ */
+ssize_t bzen_stream_pwrite(bzen_stream_t* stream, 
+			   const void* ptr, 
+			   size_t n, 
+			   off_t offset);
+
+/**
+ * Read up to n bytes from the given stream.
+ *
+ * @param[out] void* ptr Destination of at least n bytes.
+ * @param[in] size_t n Number of bytes.
+ * @param[in] bzen_stream_t* stream Stream to read from.
+ *
+ * @return size_t Number of bytes read, fewer than n at end of stream or on
+ * error (see feof() and ferror() of stream->file).
+ */
+size_t bzen_stream_read(void* ptr, size_t n, bzen_stream_t* stream);
+
+/**
+ * Read from the given stream into iovcnt buffers, filling each in turn.
+ *
+ * @param[in] bzen_stream_t* stream Stream to read from.
+ * @param[in] const struct iovec* iov Array of iovcnt buffers.
+ * @param[in] int iovcnt Number of buffers.
+ *
+ * @return ssize_t Number of bytes read, less than the buffers hold only at 
+ * end of stream, or @c -1 on error.
+ */
+ssize_t bzen_stream_readv(bzen_stream_t* stream, 
+			  const struct iovec* iov, 
+			  int iovcnt);
+
 /**
  * Set file position to beginning of stream and reset error indicator.
  *
@@ -183,6 +373,30 @@ int bzen_stream_putc(int c, bzen_stream_t* stream);
  */
 int  bzen_stream_rewind(bzen_stream_t* stream);
 
+/**
+ * Write n bytes to the given stream.
+ *
+ * @param[in] const void* ptr Source of n bytes.
+ * @param[in] size_t n Number of bytes.
+ * @param[in,out] bzen_stream_t* stream Stream to write to.
+ *
+ * @return size_t Number of bytes written, fewer than n on error.
+ */
+size_t bzen_stream_write(const void* ptr, size_t n, bzen_stream_t* stream);
+
+/**
+ * Write iovcnt buffers to the given stream, gathered in order.
+ *
+ * @param[in,out] bzen_stream_t* stream Stream to write to.
+ * @param[in] const struct iovec* iov Array of iovcnt buffers.
+ * @param[in] int iovcnt Number of buffers.
+ *
+ * @return ssize_t Number of bytes written or @c -1 on error.
+ */
+ssize_t bzen_stream_writev(bzen_stream_t* stream, 
+			   const struct iovec* iov, 
+			   int iovcnt);
+
 /**
  * @}
  */
@@ -0,0 +1,239 @@
+/**
+ * @file:	bzeniobuf.h
+ * @brief:	Chains of reference counted segments for scatter/gather I/O.
+ *
+ * A chain is a list of views into segments. Segments come from a pool and
+ * are shared between chains by reference count, so headers may be prepended,
+ * chains joined, split and cloned without copying payload, and a whole chain
+ * handed to writev() or sendmsg() as an array of struct iovec. Segments are
+ * never written once shared; only the chain that holds the sole reference to
+ * a segment appends into (or prepends in front of) its unused bytes.
+ *
+ * A chain belongs to one thread at a time. Segments shared by clones may be
+ * released from any thread.
+ *
+ * @copyright:	Copyright (C) 2017 Kuhrman Technology Solutions LLC
+ * @license:	GPLv3+: GNU GPL version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BZENLIBC_IOBUF_H_
+#define _BZENLIBC_IOBUF_H_
+
+#include <config.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "bzenpriv.h"
+#include "bzenmem.h"
+
+/**
+ * Payload bytes of a pooled segment.
+ */
+#define BZEN_IOBUF_SEGMENT_SIZE 2048
+
+/**
+ * @typedef bzen_iobuf_seg_t
+ *
+ * Reference counted segment. Pooled segments hold their payload right after
+ * this header; segments made by bzen_iobuf_append_ref() point to memory of
+ * the application and call release when the last reference goes.
+ */
+typedef struct _bzen_iobuf_seg_s
+{
+  unsigned int refs;
+  unsigned int pooled;
+  size_t capacity;
+  unsigned char* data;
+  void (*release)(void*);
+  void* arg;
+} bzen_iobuf_seg_t;
+
+/**
+ * @typedef bzen_iobuf_node_t
+ *
+ * View of length bytes at offset in segment.
+ */
+typedef struct _bzen_iobuf_node_s
+{
+  struct _bzen_iobuf_node_s* next;
+  bzen_iobuf_seg_t* seg;
+  size_t offset;
+  size_t length;
+} bzen_iobuf_node_t;
+
+/**
+ * @typedef bzen_iobuf_t
+ *
+ * Chain of views, with total length in bytes and number of views.
+ */
+typedef struct _bzen_iobuf_s
+{
+  bzen_iobuf_node_t* head;
+  bzen_iobuf_node_t* tail;
+  size_t length;
+  size_t count;
+} bzen_iobuf_t;
+
+/**
+ * Copy n bytes to end of chain.
+ *
+ * Bytes go into unused space of the last segment if chain owns it alone,
+ * then into new pooled segments.
+ *
+ * @param[in,out] bzen_iobuf_t* chain Chain.
+ * @param[in] const void* data Source of n bytes.
+ * @param[in] size_t n Number of bytes.
+ *
+ * @return int 0 on success, otherwise -1.
+ */
+int bzen_iobuf_append(bzen_iobuf_t* chain, const void* data, size_t n);
+
+/**
+ * Move all views of other chain to end of chain, leaving other empty.
+ *
+ * @param[in,out] bzen_iobuf_t* chain Chain.
+ * @param[in,out] bzen_iobuf_t* other Chain to take views from.
+ *
+ * @return void
+ */
+void bzen_iobuf_append_chain(bzen_iobuf_t* chain, bzen_iobuf_t* other);
+
+/**
+ * Add n bytes of application memory to end of chain without copying.
+ *
+ * Memory must stay valid and unchanged until release is called with arg,
+ * which happens once no chain refers to it any longer.
+ *
+ * @param[in,out] bzen_iobuf_t* chain Chain.
+ * @param[in] const void* data Memory of n bytes.
+ * @param[in] size_t n Number of bytes.
+ * @param[in] void (*release)(void*) Called with arg when memory is unused,
+ * or NULL.
+ * @param[in] void* arg Argument of release.
+ *
+ * @return int 0 on success, otherwise -1.
+ */
+int bzen_iobuf_append_ref(bzen_iobuf_t* chain,
+			  const void* data,
+			  size_t n,
+			  void (*release)(void*),
+			  void* arg);
+
+/**
+ * Add views of all bytes of source to end of chain, sharing its segments.
+ *
+ * Lets one payload be queued to many destinations without copying.
+ *
+ * @param[in,out] bzen_iobuf_t* chain Chain.
+ * @param[in] const bzen_iobuf_t* source Chain to share.
+ *
+ * @return int 0 on success, otherwise -1.
+ */
+int bzen_iobuf_clone(bzen_iobuf_t* chain, const bzen_iobuf_t* source);
+
+/**
+ * Drop up to n bytes from start of chain.
+ *
+ * @param[in,out] bzen_iobuf_t* chain Chain.
+ * @param[in] size_t n Number of bytes.
+ *
+ * @return size_t Number of bytes dropped.
+ */
+size_t bzen_iobuf_consume(bzen_iobuf_t* chain, size_t n);
+
+/**
+ * Copy up to n bytes starting at offset of chain out to ptr.
+ *
+ * @param[in] const bzen_iobuf_t* chain Chain.
+ * @param[in] size_t offset Offset in chain.
+ * @param[out] void* ptr Destination of at least n bytes.
+ * @param[in] size_t n Number of bytes.
+ *
+ * @return size_t Number of bytes copied.
+ */
+size_t bzen_iobuf_copy(const bzen_iobuf_t* chain,
+		       size_t offset,
+		       void* ptr,
+		       size_t n);
+
+/**
+ * Create an empty chain.
+ *
+ * @return bzen_iobuf_t* Pointer to new chain.
+ */
+bzen_iobuf_t* bzen_iobuf_create();
+
+/**
+ * Release all views of chain and free it.
+ *
+ * @param[in] bzen_iobuf_t* chain Chain or NULL.
+ *
+ * @return void
+ */
+void bzen_iobuf_destroy(bzen_iobuf_t* chain);
+
+/**
+ * Describe chain as array of struct iovec for writev() or sendmsg().
+ *
+ * @param[in] const bzen_iobuf_t* chain Chain.
+ * @param[out] struct iovec* iov Array of iovcnt entries.
+ * @param[in] int iovcnt Number of entries of iov.
+ *
+ * @return int Number of entries filled; fewer than chain->count if iov is
+ * too short, in which case they cover the start of the chain.
+ */
+int bzen_iobuf_iovec(const bzen_iobuf_t* chain, struct iovec* iov, int iovcnt);
+
+/**
+ * Copy n bytes to start of chain, typically a header.
+ *
+ * Bytes go in front of the first view if chain owns its segment alone and
+ * there is room, otherwise into a new segment that leaves room for more.
+ * Payload is never moved.
+ *
+ * @param[in,out] bzen_iobuf_t* chain Chain.
+ * @param[in] const void* data Source of n bytes.
+ * @param[in] size_t n Number of bytes.
+ *
+ * @return int 0 on success, otherwise -1.
+ */
+int bzen_iobuf_prepend(bzen_iobuf_t* chain, const void* data, size_t n);
+
+/**
+ * Move bytes of chain from offset on to end of tail.
+ *
+ * A view crossing offset is split in two sharing its segment.
+ *
+ * @param[in,out] bzen_iobuf_t* chain Chain, keeps first offset bytes.
+ * @param[in] size_t offset Offset of split, at most length of chain.
+ * @param[in,out] bzen_iobuf_t* tail Chain receiving the rest.
+ *
+ * @return int 0 on success, otherwise -1.
+ */
+int bzen_iobuf_split(bzen_iobuf_t* chain, size_t offset, bzen_iobuf_t* tail);
+
+/**
+ * Write chain to file descriptor with writev() and drop bytes written.
+ *
+ * Writes as much as one call of writev() takes (at most IOV_MAX views).
+ *
+ * @param[in] int fd File descriptor.
+ * @param[in,out] bzen_iobuf_t* chain Chain.
+ *
+ * @return ssize_t Number of bytes written or -1 on error (errno is set).
+ */
+ssize_t bzen_iobuf_write(int fd, bzen_iobuf_t* chain);
+
+#endif /* _BZENLIBC_IOBUF_H_ */
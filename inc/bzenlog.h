@@ -41,6 +41,7 @@
 #define _BZEN_LOG_H_
 
 #include <config.h>
+#include "bzenmem.h"
 #include "bzenpriv.h"
 
 /**
@@ -69,6 +70,8 @@
 /**
  * @typedef bzen_log_stat_t
  * 
+ * Aligned to a cache line so locks of different logs do not share one.
+ *
  * @property char status 'o' for open, 'c' for closed, 'n' for NULL.
  */
 typedef struct _bzen_loglock_s
@@ -76,7 +79,7 @@ typedef struct _bzen_loglock_s
   pthread_mutex_t mutex;
   FILE* fd;
   char status;
-} bzen_loglock_t;
+} __attribute__((aligned(BZEN_MEM_CACHE_LINE))) bzen_loglock_t;
 
 /**
  * @enum Log event severity codes.
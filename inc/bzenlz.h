@@ -0,0 +1,68 @@
+/**
+ * @file:	bzenlz.h
+ * @brief:	Fast LZ77 block compression in the format of LZ4 blocks.
+ *
+ * A block is a run of sequences, each a token byte, literals and a match
+ * copied from up to 64 KiB back in the output. Compression is greedy with
+ * a single hash table, for speed over ratio; decompression checks every
+ * length and offset, so malformed input is rejected rather than overrun.
+ *
+ * @copyright:	Copyright (C) 2017 Kuhrman Technology Solutions LLC
+ * @license:	GPLv3+: GNU GPL version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BZENLIBC_LZ_H_
+#define _BZENLIBC_LZ_H_
+
+#include <config.h>
+#include <sys/types.h>
+#include "bzenpriv.h"
+
+/**
+ * Largest compressed size of n bytes (incompressible input).
+ */
+#define BZEN_LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+/**
+ * Compress n bytes at src into at most capacity bytes at dst.
+ *
+ * @param[in] const void* src Source of n bytes.
+ * @param[in] size_t n Number of bytes.
+ * @param[out] void* dst Destination.
+ * @param[in] size_t capacity Size of destination in bytes.
+ *
+ * @return size_t Compressed size, or 0 if it exceeds capacity (never so if
+ * capacity is at least BZEN_LZ_BOUND(n)).
+ */
+size_t bzen_lz_compress(const void* src, size_t n, void* dst, size_t capacity);
+
+/**
+ * Decompress block of n bytes at src into at most capacity bytes at dst.
+ *
+ * @param[in] const void* src Compressed block of n bytes.
+ * @param[in] size_t n Size of block.
+ * @param[out] void* dst Destination.
+ * @param[in] size_t capacity Size of destination in bytes.
+ *
+ * @return ssize_t Decompressed size or -1 if block is malformed or does not
+ * fit.
+ */
+ssize_t bzen_lz_decompress(const void* src,
+			   size_t n,
+			   void* dst,
+			   size_t capacity);
+
+#endif /* _BZENLIBC_LZ_H_ */
@@ -23,11 +23,381 @@
 #define _BZENLIBC_MEM_H_
 
 #include <config.h>
+#include <pthread.h>
 #include "bzenpriv.h"
 
+/**
+ * Minimum alignment of blocks returned by the arena allocator (same guarantee
+ * as malloc() on GNU systems).
+ */
+#define BZEN_MEM_ALIGNMENT (2 * sizeof(void*))
+
+/**
+ * Largest request in bytes served by bzen_malloc() from per-thread magazines.
+ * Larger requests go straight to the heap.
+ */
+#define BZEN_MEM_MAGAZINE_MAX 1024
+
+/**
+ * Smallest request in bytes served by bzen_malloc() from a private mapping 
+ * of its own. Such blocks are resized by remapping pages instead of copying.
+ */
+#define BZEN_MEM_MAP_THRESHOLD 65536
+
+/**
+ * Size of a CPU cache line in bytes.
+ */
+#define BZEN_MEM_CACHE_LINE 64
+
+/**
+ * Node argument of bzen_malloc_node() and bzen_mem_set_thread_node() which
+ * stands for the NUMA node of the calling thread.
+ */
+#define BZEN_MEM_NODE_LOCAL (-1)
+
+/**
+ * Highest number of NUMA nodes supported by bzen_malloc_node().
+ */
+#define BZEN_MEM_MAX_NODES 1024
+
+/**
+ * Debug allocator checks (see bzen_mem_set_debug()).
+ *
+ * REDZONE surrounds blocks with patterns checked when they are freed. POISON
+ * fills new blocks with 0xAB and freed blocks with 0xDD, and holds freed 
+ * blocks in quarantine where writes to them are detected. GUARD places blocks
+ * of a page or more against an inaccessible page, so overflows fault at once.
+ */
+#define BZEN_MEM_DEBUG_REDZONE 0x1
+#define BZEN_MEM_DEBUG_POISON 0x2
+#define BZEN_MEM_DEBUG_GUARD 0x4
+#define BZEN_MEM_DEBUG_ALL \
+  (BZEN_MEM_DEBUG_REDZONE | BZEN_MEM_DEBUG_POISON | BZEN_MEM_DEBUG_GUARD)
+
+/**
+ * Subsystem which owns a block allocated by bzen_malloc_tagged().
+ *
+ * @typedef bzen_mem_tag_t
+ * @{
+ */
+typedef enum bzen_mem_tag_e
+  {
+    /** Untagged (bzen_malloc()). */
+    BZEN_MEM_TAG_OTHER = 0,
+
+    /** Stream buffers (bzensbuf). */
+    BZEN_MEM_TAG_SBUF,
+
+    /** Log files (bzenlog). */
+    BZEN_MEM_TAG_LOG,
+
+    /** Sockets (bzensock). */
+    BZEN_MEM_TAG_SOCK,
+
+    /** YAML parser (bzenyaml). */
+    BZEN_MEM_TAG_YAML,
+
+    /** Streams (bzenstrm). */
+    BZEN_MEM_TAG_STREAM,
+
+    /** Number of tags, or all tags combined where a tag is expected. */
+    BZEN_MEM_TAG_COUNT
+  } bzen_mem_tag_t;
+/**
+ * @}
+ */
+
+/**
+ * @typedef bzen_mem_stats_t
+ *
+ * Allocation counters of one tag. Sizes are usable block sizes in bytes.
+ */
+typedef struct _bzen_mem_stats_s
+{
+  /** Bytes currently allocated. */
+  size_t live_bytes;
+
+  /** High-water mark of live_bytes. */
+  size_t peak_bytes;
+
+  /** Number of allocations since start of program. */
+  size_t allocs;
+
+  /** Number of frees since start of program. */
+  size_t frees;
+} bzen_mem_stats_t;
+
+/**
+ * How bzen_realloc_grow() sizes a block which must grow.
+ *
+ * @typedef bzen_mem_growth_t
+ * @{
+ */
+typedef enum bzen_mem_growth_e
+  {
+    /** Exactly the number of objects required. */
+    BZEN_MEM_GROW_EXACT = 0,
+
+    /** Current capacity times factor, at least the number required. */
+    BZEN_MEM_GROW_GEOMETRIC,
+
+    /** Number required rounded up so the block fills whole pages. */
+    BZEN_MEM_GROW_PAGE,
+
+    /** Number required rounded up so the block fills whole huge pages. */
+    BZEN_MEM_GROW_HUGEPAGE
+  } bzen_mem_growth_t;
+/**
+ * @}
+ */
+
+/**
+ * @typedef bzen_mem_policy_t
+ *
+ * Growth policy of bzen_realloc_grow().
+ */
+typedef struct _bzen_mem_policy_s
+{
+  /** Sizing rule. */
+  bzen_mem_growth_t growth;
+
+  /** Growth factor in percent for BZEN_MEM_GROW_GEOMETRIC (e.g. 150). */
+  unsigned int factor;
+} bzen_mem_policy_t;
+
+/**
+ * Size in bytes of huge pages assumed by BZEN_MEM_GROW_HUGEPAGE.
+ */
+#define BZEN_MEM_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/**
+ * @typedef bzen_mem_header_t
+ *
+ * Header preceding every block returned by bzen_malloc(). Private to bzenmem.
+ */
+typedef struct _bzen_mem_header_s
+{
+  /** Usable size of block in bytes. */
+  size_t size;
+
+  /** Index of magazine block was taken from or BZEN_MEM_CLASS_LARGE. */
+  unsigned short int size_class;
+
+  /** Owner of block (bzen_mem_tag_t). */
+  unsigned short int tag;
+} bzen_mem_header_t;
+
+/**
+ * Kind of pages backing arena chunks.
+ *
+ * @typedef bzen_mem_pages_t
+ * @{
+ */
+typedef enum bzen_mem_pages_e
+  {
+    /** Heap memory on base pages. */
+    BZEN_MEM_PAGES_DEFAULT = 0,
+
+    /** Mappings aligned to BZEN_MEM_HUGEPAGE_SIZE and advised MADV_HUGEPAGE
+	(transparent huge pages). */
+    BZEN_MEM_PAGES_TRANSPARENT,
+
+    /** Huge pages reserved by administrator (MAP_HUGETLB), else as 
+	BZEN_MEM_PAGES_TRANSPARENT. */
+    BZEN_MEM_PAGES_HUGETLB
+  } bzen_mem_pages_t;
+/**
+ * @}
+ */
+
+/**
+ * @typedef bzen_arena_chunk_t
+ *
+ * One contiguous block of memory carved up by an arena. Chunks are linked in 
+ * the order they were allocated and the data area follows the header.
+ */
+typedef struct _bzen_arena_chunk_s
+{
+  /** Next chunk in arena. */
+  struct _bzen_arena_chunk_s* next;
+
+  /** Size of data area in bytes. */
+  size_t size;
+
+  /** Number of bytes of data area handed out since last reset. */
+  size_t used;
+
+  /** Length of mapping holding chunk or 0 if chunk is on the heap. */
+  size_t mapped;
+} bzen_arena_chunk_t;
+
+/**
+ * @typedef bzen_arena_t
+ *
+ * Bump allocator for request-scoped memory. Blocks are not freed individually;
+ * everything allocated from the arena is released at once by a call to 
+ * bzen_arena_reset() or bzen_arena_destroy(). An arena is NOT thread-safe.
+ */
+typedef struct _bzen_arena_s
+{
+  /** First chunk in arena. */
+  bzen_arena_chunk_t* head;
+
+  /** Chunk currently being allocated from. */
+  bzen_arena_chunk_t* current;
+
+  /** Dedicated chunks for requests too large for a regular chunk. */
+  bzen_arena_chunk_t* large;
+
+  /** Size in bytes of data area of regular chunks. */
+  size_t chunk_size;
+
+  /** Pages backing chunks allocated from now on. */
+  bzen_mem_pages_t pages;
+} bzen_arena_t;
+
+/**
+ * @typedef bzen_pool_cache_t
+ *
+ * Per-thread cache of free objects in a pool.
+ */
+typedef struct _bzen_pool_cache_s
+{
+  /** Pool the cache belongs to. */
+  struct _bzen_pool_s* pool;
+
+  /** Next spare cache (only used once owning thread has exited). */
+  struct _bzen_pool_cache_s* next;
+
+  /** First free object in cache. */
+  void* head;
+
+  /** Number of free objects in cache. */
+  size_t count;
+} bzen_pool_cache_t;
+
+/**
+ * @typedef bzen_pool_t
+ *
+ * Free-list allocator for objects of a single fixed size. Each thread keeps a
+ * small cache of free objects so most calls to bzen_pool_alloc() and 
+ * bzen_pool_free() do not touch the pool mutex. Objects are carved out of 
+ * slabs in an arena and are only returned to the heap by bzen_pool_destroy().
+ */
+typedef struct _bzen_pool_s
+{
+  /** Guards all members below. */
+  pthread_mutex_t mutex;
+
+  /** Key to per-thread cache. */
+  pthread_key_t cache_key;
+
+  /** Backing store for slabs and caches. */
+  bzen_arena_t* arena;
+
+  /** Free objects shared by all threads. */
+  void* head;
+
+  /** Caches released by threads which have exited. */
+  bzen_pool_cache_t* spare_caches;
+
+  /** Size of each object in bytes (rounded up to alignment). */
+  size_t object_size;
+
+  /** Alignment of objects in bytes (at least BZEN_MEM_ALIGNMENT). */
+  size_t alignment;
+
+  /** Number of objects carved out of arena at a time. */
+  size_t objects_per_slab;
+} bzen_pool_t;
+
+/**
+ * Create a pool for objects of type T with default slab size. Objects are
+ * aligned as T requires, so types aligned to BZEN_MEM_CACHE_LINE get a cache
+ * line of their own.
+ */
+#define BZEN_POOL_CREATE(T) \
+  bzen_pool_create_aligned(BZEN_SIZEOF(T), 0, __alignof__(T))
+
+/**
+ * Allocate n bytes from arena.
+ *
+ * Block is aligned on BZEN_MEM_ALIGNMENT bytes.
+ *
+ * @param[in,out] bzen_arena_t* arena Arena to allocate from.
+ * @param[in] size_t n Size of memory block to allocate in bytes.
+ *
+ * @return void* Pointer to allocated block of memory or NULL.
+ */
+void* bzen_arena_alloc(bzen_arena_t* arena, size_t n);
+
+/**
+ * Allocate n bytes from arena on given alignment boundary.
+ *
+ * @param[in,out] bzen_arena_t* arena Arena to allocate from.
+ * @param[in] size_t n Size of memory block to allocate in bytes.
+ * @param[in] size_t alignment Must be a power of two.
+ *
+ * @return void* Pointer to allocated block of memory or NULL.
+ */
+void* bzen_arena_alloc_aligned(bzen_arena_t* arena, size_t n, size_t alignment);
+
+/**
+ * Create a new arena.
+ *
+ * No memory is reserved for data until the first allocation. Requests larger
+ * than half of chunk_size are given a dedicated chunk of their own. Chunks are
+ * backed by pages set by bzen_mem_set_default_pages() (see 
+ * bzen_arena_set_pages()).
+ *
+ * @param[in] size_t chunk_size Size of regular chunks in bytes or 0 for default.
+ *
+ * @return bzen_arena_t* Pointer to new arena or NULL.
+ */
+bzen_arena_t* bzen_arena_create(size_t chunk_size);
+
+/**
+ * Free all memory held by arena including the arena itself.
+ *
+ * @param[in,out] bzen_arena_t* arena Arena to destroy.
+ *
+ * @return void
+ */
+void bzen_arena_destroy(bzen_arena_t* arena);
+
+/**
+ * Release all blocks allocated from arena in one operation.
+ *
+ * Regular chunks are kept for reuse, oversized chunks are returned to the heap.
+ * Pointers previously returned by the arena are invalid after the call.
+ *
+ * @param[in,out] bzen_arena_t* arena Arena to reset.
+ *
+ * @return void
+ */
+void bzen_arena_reset(bzen_arena_t* arena);
+
+/**
+ * Set kind of pages backing chunks arena allocates from now on.
+ *
+ * Huge pages cut TLB misses on large long-lived arenas and pools but round
+ * every chunk up to a multiple of BZEN_MEM_HUGEPAGE_SIZE. Where huge pages 
+ * are unavailable chunks fall back to base pages.
+ *
+ * @param[in,out] bzen_arena_t* arena Arena to configure.
+ * @param[in] bzen_mem_pages_t pages Kind of pages.
+ *
+ * @return int 0 on success or -1 on invalid pages.
+ */
+int bzen_arena_set_pages(bzen_arena_t* arena, bzen_mem_pages_t pages);
+
 /**
  * Free memory allocated dynamically.
  *
+ * Small blocks are returned to the magazine of the calling thread. The block
+ * must have been allocated by bzen_malloc() or bzen_realloc(), never pass
+ * memory allocated by malloc() or by the C library on behalf of caller.
+ *
  * @param void* ptr Pointer to block of memory to be freed.
  *
  * @return void
@@ -37,6 +407,10 @@ void bzen_free(void* ptr);
 /**
  * Allocate N bytes of memory dynamically, with error checking.
  *
+ * Requests up to BZEN_MEM_MAGAZINE_MAX bytes are rounded up to a size class
+ * and served from a cache owned by the calling thread without taking a lock
+ * in the common case. Program is terminated if memory is exhausted.
+ *
  * @param size_t n Size of memory block to allocate in bytes.
  *
  * @return void* Pointer to allocated block of memory.
@@ -44,7 +418,74 @@ void bzen_free(void* ptr);
 void* bzen_malloc(size_t n);
 
 /**
- * Prints statistics on memory allocated by malloc to stream.
+ * Allocate N bytes of memory dynamically on given alignment boundary.
+ *
+ * Use BZEN_MEM_CACHE_LINE to keep objects written by different threads off
+ * each other's cache lines. Blocks keep their alignment through 
+ * bzen_realloc() and are freed by bzen_free(). Blocks aligned beyond 
+ * BZEN_MEM_ALIGNMENT cost alignment bytes of overhead. Program is terminated
+ * if memory is exhausted.
+ *
+ * @param[in] size_t n Size of memory block to allocate in bytes.
+ * @param[in] size_t alignment Power of two.
+ *
+ * @return void* Pointer to allocated block or NULL if alignment is invalid.
+ */
+void* bzen_malloc_aligned(size_t n, size_t alignment);
+
+/**
+ * Take a snapshot of allocation counters for given tag.
+ *
+ * Counters are updated without locking, so a snapshot taken while other 
+ * threads allocate is approximate but each value is consistent in itself.
+ *
+ * @param[in] bzen_mem_tag_t tag Tag to report or BZEN_MEM_TAG_COUNT for total.
+ * @param[out] bzen_mem_stats_t* stats Snapshot.
+ *
+ * @return int 0 on success or -1 on invalid tag.
+ */
+int bzen_malloc_get_stats(bzen_mem_tag_t tag, bzen_mem_stats_t* stats);
+
+/**
+ * Allocate N bytes of memory dynamically from given NUMA node.
+ *
+ * Block gets pages of its own with a memory policy preferring node, set 
+ * before any page is touched. Node BZEN_MEM_NODE_LOCAL is the node of the
+ * calling thread, which is right for buffers owned by that thread even if
+ * another thread touches them first. Placement is best effort: on systems 
+ * without NUMA support the block is allocated as usual. Block is rounded up to
+ * whole pages and is meant for buffers rather than small objects. Program is
+ * terminated if memory is exhausted.
+ *
+ * @param[in] size_t n Size of memory block to allocate in bytes.
+ * @param[in] int node NUMA node or BZEN_MEM_NODE_LOCAL.
+ *
+ * @return void* Pointer to allocated block or NULL if node is invalid.
+ */
+void* bzen_malloc_node(size_t n, int node);
+
+/**
+ * Prints sampled allocation profile to stream.
+ *
+ * Output is in folded stack format, one line per distinct call stack: frames
+ * from outermost to innermost separated by ';', a space and estimated bytes
+ * allocated by that stack. It is accepted by flamegraph.pl and most profile 
+ * viewers. Frames are named where the symbol is exported (link with 
+ * -rdynamic) and given as addresses otherwise.
+ *
+ * @param FILE* stream Stream to print to.
+ *
+ * @return int 0 on success or -1 on invalid stream.
+ */
+int bzen_malloc_print_profile(FILE* stream);
+
+/**
+ * Prints statistics on dynamically allocated memory to stream.
+ *
+ * Output is one key=value pair per line so it can be sampled and parsed at 
+ * runtime. Keys are mem.<tag>.<counter> for bzenmem accounting (tag 'total'
+ * for all tags combined), mem.arena.reserved_bytes for memory held by arenas
+ * and pools and heap.<field> for statistics of the C library allocator.
  *
  * @param FILE* stream Stream to print to.
  * 
@@ -52,10 +493,153 @@ void* bzen_malloc(size_t n);
  */
 void bzen_malloc_print_stats(FILE* stream);
 
+/**
+ * Set number of bytes allocated between allocation profile samples.
+ *
+ * Each thread records the call stack of the allocation which crosses every
+ * interval bytes it allocates. Samples are aggregated by call stack and 
+ * printed by bzen_malloc_print_profile(). Sampling is off by default (0) and
+ * may be turned on from environment variable BZEN_MEM_SAMPLE_INTERVAL. An 
+ * interval of 512 KiB costs little enough for production use.
+ *
+ * @param size_t interval Sampling interval in bytes or 0 to stop sampling.
+ *
+ * @return size_t Previous interval.
+ */
+size_t bzen_malloc_set_sample_interval(size_t interval);
+
+/**
+ * Allocate N bytes of memory dynamically on behalf of given subsystem.
+ *
+ * Same as bzen_malloc() but block is accounted to tag. Blocks moved by 
+ * bzen_realloc() keep their tag.
+ *
+ * @param size_t n Size of memory block to allocate in bytes.
+ * @param bzen_mem_tag_t tag Owner of block.
+ *
+ * @return void* Pointer to allocated block of memory.
+ */
+void* bzen_malloc_tagged(size_t n, bzen_mem_tag_t tag);
+
+/**
+ * Set debug allocator checks applied to blocks allocated from now on.
+ *
+ * Checks are off by default unless library was configured with 
+ * --enable-mem-debug or environment variable BZEN_MEM_DEBUG is set at the 
+ * first allocation to a comma separated list of 'redzone', 'poison', 'guard'
+ * or 'all'. Blocks remember how they were allocated, so checks may be turned
+ * on and off at any time. With checks off bzen_malloc() pays a single load.
+ *
+ * On corruption, use after free or double free of a checked block a report 
+ * is printed to stderr and program is aborted. Checks do not apply to 
+ * bzen_malloc_aligned(), bzen_malloc_node(), arenas or pools.
+ *
+ * @param[in] unsigned int flags Bitwise OR of BZEN_MEM_DEBUG_* or 0.
+ *
+ * @return unsigned int Previous flags.
+ */
+unsigned int bzen_mem_set_debug(unsigned int flags);
+
+/**
+ * Set kind of pages backing chunks of arenas and pools created from now on.
+ *
+ * Default is BZEN_MEM_PAGES_DEFAULT unless environment variable 
+ * BZEN_MEM_HUGEPAGES is set to 'transparent' or 'hugetlb' at the first 
+ * allocation. bzen_malloc() magazines are created then as well and follow 
+ * the environment.
+ *
+ * @param[in] bzen_mem_pages_t pages Kind of pages.
+ *
+ * @return int 0 on success or -1 on invalid pages.
+ */
+int bzen_mem_set_default_pages(bzen_mem_pages_t pages);
+
+/**
+ * Set NUMA node preferred for memory the calling thread touches first.
+ *
+ * Wraps set_mempolicy(2) (without libnuma). Applies to all memory the thread
+ * faults in from now on, including heap and bzen_malloc() blocks.
+ *
+ * @param[in] int node NUMA node or BZEN_MEM_NODE_LOCAL.
+ *
+ * @return int 0 on success otherwise -1 and errno is set.
+ */
+int bzen_mem_set_thread_node(int node);
+
+/**
+ * Allocate one object from pool.
+ *
+ * Memory is NOT zeroed.
+ *
+ * @param[in,out] bzen_pool_t* pool Pool to allocate from.
+ *
+ * @return void* Pointer to object or NULL.
+ */
+void* bzen_pool_alloc(bzen_pool_t* pool);
+
+/**
+ * Create a new pool of fixed size objects.
+ *
+ * @param[in] size_t object_size Size of each object in bytes.
+ * @param[in] size_t objects_per_slab Objects to reserve at a time or 0 for default.
+ *
+ * @return bzen_pool_t* Pointer to new pool or NULL.
+ */
+bzen_pool_t* bzen_pool_create(size_t object_size, size_t objects_per_slab);
+
+/**
+ * Create a new pool of fixed size objects on given alignment boundary.
+ *
+ * Object size is rounded up to alignment, so alignment BZEN_MEM_CACHE_LINE
+ * keeps every object on cache lines of its own.
+ *
+ * @param[in] size_t object_size Size of each object in bytes.
+ * @param[in] size_t objects_per_slab Objects to reserve at a time or 0 for default.
+ * @param[in] size_t alignment Power of two.
+ *
+ * @return bzen_pool_t* Pointer to new pool or NULL.
+ */
+bzen_pool_t* bzen_pool_create_aligned(size_t object_size, 
+				      size_t objects_per_slab,
+				      size_t alignment);
+
+/**
+ * Free pool and all objects allocated from it.
+ *
+ * Application must ensure no other thread is using the pool.
+ *
+ * @param[in,out] bzen_pool_t* pool Pool to destroy.
+ *
+ * @return void
+ */
+void bzen_pool_destroy(bzen_pool_t* pool);
+
+/**
+ * Return object to pool.
+ *
+ * @param[in,out] bzen_pool_t* pool Pool object was allocated from.
+ * @param[in] void* ptr Object to free (NULL is ignored).
+ *
+ * @return void
+ */
+void bzen_pool_free(bzen_pool_t* pool, void* ptr);
+
+/**
+ * Set kind of pages backing slabs pool allocates from now on.
+ *
+ * @see bzen_arena_set_pages()
+ *
+ * @param[in,out] bzen_pool_t* pool Pool to configure.
+ * @param[in] bzen_mem_pages_t pages Kind of pages.
+ *
+ * @return int 0 on success or -1 on invalid pages.
+ */
+int bzen_pool_set_pages(bzen_pool_t* pool, bzen_mem_pages_t pages);
+
 /**
  * Reallocate a block at p of pn objects of s bytes each.
  *
- * @see x2nrealloc() in gnulib/xalloc.h
+ * Growth follows x2nrealloc() in gnulib/xalloc.h.
  *
  * Be mindful that pn returns with the 'new' size, which is likely to be greater
  * than the size requested as gnulib increments at a rate of about 1.5 * pn per 
@@ -71,4 +655,31 @@ void bzen_malloc_print_stats(FILE* stream);
  */
 void* bzen_realloc (void* p, size_t* pn, size_t s);
 
+/**
+ * Grow a block at p to hold at least n objects of s bytes each.
+ *
+ * New capacity is chosen by policy (NULL is geometric growth by 150%). On 
+ * return pn holds the real capacity of the block in objects, which includes
+ * any slack left by rounding to a size class or page and may therefore exceed
+ * what the policy asked for. Blocks never shrink: if pn already covers n, the
+ * block is returned as it is. Blocks of at least BZEN_MEM_MAP_THRESHOLD have a
+ * mapping of their own and are resized with mremap(), so their pages are not
+ * copied; smaller large blocks are resized in place by realloc() where there
+ * is room.
+ * Program is terminated if memory is exhausted.
+ *
+ * @param[in] void* p Block to grow or NULL for a new block.
+ * @param[in,out] size_t* pn Capacity of block in objects (ignored if p NULL).
+ * @param[in] size_t n Number of objects required.
+ * @param[in] size_t s Size of object.
+ * @param[in] const bzen_mem_policy_t* policy Growth policy or NULL.
+ *
+ * @return void* Pointer to block.
+ */
+void* bzen_realloc_grow(void* p, 
+			size_t* pn, 
+			size_t n, 
+			size_t s, 
+			const bzen_mem_policy_t* policy);
+
 #endif /* _BZENLIBC_MEM_H_ */
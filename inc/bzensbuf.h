@@ -32,23 +32,125 @@
 #define _BZEN_SBUF_H_
 
 #include <config.h>
+#include <stdint.h>
+#include <sys/types.h>
 #include "bzenpriv.h"
+#include "bzenmem.h"
 #include "bzenthread.h"
 
+/**
+ * Single-producer/single-consumer ring (see bzen_sbuf_create_ring()).
+ */
+struct _bzen_sbuf_ring_s;
+
+/**
+ * Memory of growable buffer (see bzen_sbuf_create_growable()).
+ */
+struct _bzen_sbuf_growable_s;
+
+/**
+ * Read-only mapping of file (see bzen_sbuf_create_mapped()).
+ */
+struct _bzen_sbuf_map_s;
+
+/**
+ * Access hints for bzen_sbuf_create_mapped(): file is read from start to end,
+ * or will be read soon and should be read ahead now.
+ */
+#define BZEN_SBUF_MAP_SEQUENTIAL 0x1
+#define BZEN_SBUF_MAP_WILLNEED 0x2
+
+/**
+ * Counters of buffer (see bzen_sbuf_set_stats()).
+ */
+struct _bzen_sbuf_counters_s;
+
+/**
+ * @typedef bzen_sbuf_stats_t
+ *
+ * Counters of one buffer, or sums over buffers.
+ */
+typedef struct _bzen_sbuf_stats_s
+{
+  /** Id of buffer (0 in sums). */
+  unsigned int id;
+
+  /** Bytes written to buffer. */
+  size_t bytes_in;
+
+  /** Bytes read from buffer. */
+  size_t bytes_out;
+
+  /** Number of times buffer was locked. */
+  size_t locks;
+
+  /** Number of those times another thread held the lock. */
+  size_t contended;
+
+  /** Nanoseconds spent waiting for the lock held by another thread. */
+  uint64_t wait_ns;
+
+  /** Largest stream position reached by writes, or fill of ring. */
+  size_t high_water;
+} bzen_sbuf_stats_t;
+
 /**
  * @typedef bzen_cbuflock
+ *
+ * Aligned to a cache line so locks of different buffers do not share one.
+ * id and generation name the slot of buffer in the buffer table, which 
+ * counts references to buffer; the last one to let go of a destroyed buffer
+ * frees it. ring is NULL unless buffer was created by 
+ * bzen_sbuf_create_ring(). stage holds spans of stream buffers 
+ * between bzen_sbuf_reserve() and bzen_sbuf_commit() or bzen_sbuf_peek() and
+ * bzen_sbuf_consume(); spanned is set while such a span holds the lock.
+ * Shared buffers (bzen_sbuf_set_shared()) use rwlock instead of mutex and 
+ * keep length of their contents; memory holds contents of buffers made by
+ * bzen_sbuf_create() and growable that of buffers made by 
+ * bzen_sbuf_create_growable(), whose size follows their capacity. map is 
+ * NULL unless buffer was made by bzen_sbuf_create_mapped(). stats is NULL 
+ * unless buffer was created while statistics were on.
  */
 typedef struct _bzen_cbuflock_s
 {
-  unsigned short int id;
+  unsigned int id;
+  unsigned int generation;
   unsigned short int keep_open;
+  unsigned short int shared;
+  unsigned short int spanned;
   pthread_mutex_t mutex;
+  pthread_rwlock_t rwlock;
   size_t size;
-} bzen_cbuflock_t;
+  size_t length;
+  unsigned char* memory;
+  struct _bzen_sbuf_ring_s* ring;
+  struct _bzen_sbuf_growable_s* growable;
+  struct _bzen_sbuf_map_s* map;
+  unsigned char* stage;
+  size_t stage_size;
+  size_t staged;
+  struct _bzen_sbuf_counters_s* stats;
+} __attribute__((aligned(BZEN_MEM_CACHE_LINE))) bzen_cbuflock_t;
+
+/**
+ * @typedef bzen_sbuf_handle
+ *
+ * Names a buffer by slot and generation of slot, which changes when buffer
+ * is freed, so a handle outliving its buffer is refused rather than naming
+ * whatever buffer reuses its slot or memory.
+ */
+typedef struct _bzen_sbuf_handle_s
+{
+  unsigned int id;
+  unsigned int generation;
+} bzen_sbuf_handle_t;
 
 /**
  * Return a count of the number of buffers currently allocated.
  *
+ * Counts slots of buffer table, which grows in segments and never shrinks;
+ * slots of destroyed buffers are reused.
+ *
  * @return size_t
  */
 size_t bzen_sbuf_count_allocated();
@@ -60,9 +162,43 @@ size_t bzen_sbuf_count_allocated();
  */
 size_t bzen_sbuf_count_used(); 
 
+/**
+ * Publish bytes written to span returned by bzen_sbuf_reserve().
+ *
+ * Stream buffers are unlocked. Fails without unlocking if stream buffer
+ * holds no span.
+ *
+ * @param size_t n Number of bytes written, at most number reserved (0 to 
+ * publish nothing).
+ * @param bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
+ *
+ * @return int 0 on success, otherwise -1.
+ */
+int bzen_sbuf_commit(size_t n, bzen_cbuflock_t* cbuflock);
+
+/**
+ * Release bytes of span returned by bzen_sbuf_peek().
+ *
+ * Bytes not consumed are read again by the next read. Stream buffers are 
+ * unlocked, and must be seekable to consume fewer bytes than were peeked.
+ * Fails without unlocking if stream buffer holds no span.
+ *
+ * @param size_t n Number of bytes consumed, at most number peeked.
+ * @param bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
+ *
+ * @return int 0 on success, otherwise -1.
+ */
+int bzen_sbuf_consume(size_t n, bzen_cbuflock_t* cbuflock);
+
 /**
  * Allocate memory for a new character buffer.
  *
+ * Buffer holds at most size bytes. See bzen_sbuf_create_growable() for 
+ * buffers which need to hold messages of widely varying size.
+ *
+ * Contents start zeroed and the whole buffer is readable, as with fmemopen()
+ * mode "r+": bzen_sbuf_length() is size, also once buffer is shared.
+ *
  * @param size_t size Size in bytes of buffer.
  *
  * @return bzen_cbuflock_t* Pointer to new buffer lock.
@@ -86,28 +222,191 @@ bzen_cbuflock_t* bzen_sbuf_create(size_t size);
  */
 bzen_cbuflock_t* bzen_sbuf_create_file(FILE* file);
 
+/**
+ * Allocate a stream buffer whose memory grows with its contents.
+ *
+ * Buffer starts with size bytes of memory and grows by whole pages when a
+ * write needs more, up to max_size bytes; writes past max_size are cut short
+ * and set the error indicator of the stream, as when a fixed buffer is full.
+ * bzen_sbuf_reset() empties buffer and gives back memory grown past size once
+ * buffer has not needed it for a while, so one large message does not keep 
+ * memory tied up for good; bzen_sbuf_shrink() gives it back at once.
+ *
+ * @param size_t size Initial size in bytes of buffer.
+ * @param size_t max_size Largest size in bytes buffer may grow to.
+ *
+ * @return bzen_cbuflock_t* Pointer to new buffer lock or NULL.
+ */
+bzen_cbuflock_t* bzen_sbuf_create_growable(size_t size, size_t max_size);
+
+/**
+ * Allocate read-only buffer serving contents of a regular file from memory.
+ *
+ * Behaves as bzen_sbuf_create_file(), except that a non-empty regular file is
+ * mapped read-only into memory and bzen_sbuf_getc(), bzen_sbuf_read(), 
+ * bzen_sbuf_readline() and bzen_sbuf_read_at() copy from the mapping with no
+ * stdio buffer in between, bzen_sbuf_peek() returns a span of the mapping 
+ * itself, and pages are shared with the page cache of other processes. 
+ * Reading starts at current position of stream. Writes to such a buffer 
+ * fail. The mapping holds contents as they were when buffer was made; file 
+ * must not be truncated meanwhile (reading past its new end raises SIGBUS).
+ * Other streams, such as pipes, are read through stdio as usual.
+ *
+ * @param[in] FILE* file Stream open for reading.
+ * @param[in] unsigned int advice BZEN_SBUF_MAP_SEQUENTIAL and/or 
+ * BZEN_SBUF_MAP_WILLNEED, or 0.
+ *
+ * @return bzen_cbuflock_t* Pointer to new buffer lock or NULL.
+ */
+bzen_cbuflock_t* bzen_sbuf_create_mapped(FILE* file, unsigned int advice);
+
+/**
+ * Allocate a lock-free ring buffer for one producer and one consumer thread.
+ *
+ * Size is rounded up to a power of two. Exactly one thread may write to the
+ * buffer (bzen_sbuf_putc(), bzen_sbuf_write()) and one other thread read from 
+ * it (bzen_sbuf_getc(), bzen_sbuf_read(), bzen_sbuf_readline()) at a time; no
+ * mutex is taken on either side. Calls never block: writes stop when the ring
+ * is full and reads when it is empty, so EOF or a short count only means the
+ * other side has not caught up yet. bzen_sbuf_rewind() and bzen_sbuf_lock()
+ * do not apply to ring buffers and fail.
+ *
+ * @param size_t size Capacity in bytes of buffer.
+ *
+ * @return bzen_cbuflock_t* Pointer to new buffer lock or NULL.
+ */
+bzen_cbuflock_t* bzen_sbuf_create_ring(size_t size);
+
 /**
  * Thread-safe stream buffer destructor.
  * 
- * bzen_sbuf_destroy() will try to get a lock on corresponding mutex before
- * destroying the mutex and freeing any memory.
+ * bzen_sbuf_destroy() waits for the lock on the buffer until a deadline on 
+ * CLOCK_MONOTONIC, with millisecond resolution, without sleeping once the 
+ * lock is free. While it waits, new attempts to lock the buffer fail; threads
+ * already waiting for the lock get it in turn. Once it has the lock, the 
+ * buffer is freed at once or, if other threads are still waiting for the 
+ * lock, by the last of them to give up (they all fail).
+ *
+ * If the lock is still held at the deadline, the buffer is left intact and
+ * still owned by the caller, and can be locked again. Only a concurrent
+ * bzen_sbuf_destroy_async() is not undone: the buffer is then freed by its
+ * last holder, or by this call. A buffer already being destroyed is left to
+ * that call and EBUSY returned at once.
  *
  * bzen_cbuflock_t* cbuflock Pointer to lock for targeted buffer.
  * double timeout Timeout period in seconds (wait for lock on mutex).
  *
- * @return int 0 on success
+ * @return int 0 on success, EBUSY if buffer stayed locked past timeout or is
+ * already being destroyed, or error of fclose().
  */
 int bzen_sbuf_destroy(bzen_cbuflock_t* cbuflock, double timeout);
 
+/**
+ * Stream buffer destructor that does not wait.
+ *
+ * Buffer is freed at once if nobody holds or waits for its lock, otherwise
+ * by the thread that unlocks it last. Attempts to lock it fail from now on.
+ * Caller must not use cbuflock after this call.
+ *
+ * @param bzen_cbuflock_t* cbuflock Pointer to lock for targeted buffer.
+ *
+ * @return int 0 on success, or error of fclose() if freed at once.
+ */
+int bzen_sbuf_destroy_async(bzen_cbuflock_t* cbuflock);
+
+/**
+ * Get handle of buffer for threads which may outlive it.
+ *
+ * @param const bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
+ *
+ * @return bzen_sbuf_handle_t Handle, which names no buffer if cbuflock is 
+ * NULL.
+ */
+bzen_sbuf_handle_t bzen_sbuf_handle(const bzen_cbuflock_t* cbuflock);
+
 /**
  * Performs safety check on buffer and attempts to lock it.
  *
+ * cbuflock is only read while it is valid, so caller must own buffer or 
+ * otherwise know it is not freed during the call; it fails if buffer is 
+ * being destroyed. Threads which may outlive buffer use 
+ * bzen_sbuf_lock_handle() instead.
+ *
  * @param bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
  *
  * @return int Id of the buffer if safe and locked, otherwise -1.
  */
 int bzen_sbuf_lock(bzen_cbuflock_t* cbuflock);
 
+/**
+ * Lock buffer named by handle.
+ *
+ * Reference to buffer is taken through buffer table before buffer is read,
+ * so this is safe against concurrent bzen_sbuf_destroy() or 
+ * bzen_sbuf_destroy_async(). Unlock with bzen_sbuf_unlock().
+ *
+ * @param bzen_sbuf_handle_t handle Handle of buffer (bzen_sbuf_handle()).
+ *
+ * @return bzen_cbuflock_t* Pointer to locked buffer, or NULL if buffer was 
+ * freed or is being destroyed.
+ */
+bzen_cbuflock_t* bzen_sbuf_lock_handle(bzen_sbuf_handle_t handle);
+
+/**
+ * Get counters of the given buffer.
+ *
+ * @param bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
+ * @param bzen_sbuf_stats_t* stats Snapshot.
+ *
+ * @return int 0 on success, or -1 if no counters are kept for buffer.
+ */
+int bzen_sbuf_get_stats(bzen_cbuflock_t* cbuflock, bzen_sbuf_stats_t* stats);
+
+/**
+ * Get counters of all live buffers which keep them.
+ *
+ * Counters are read while other threads update them, so a snapshot is 
+ * approximate but each value is consistent in itself. Sorting entries by
+ * contended or wait_ns shows the hot buffers.
+ *
+ * @param bzen_sbuf_stats_t* stats Array of n entries filled with counters of
+ * up to n buffers, or NULL.
+ * @param size_t n Number of entries of stats.
+ * @param bzen_sbuf_stats_t* totals Set to sums over all buffers created 
+ * while statistics were on, destroyed ones included (high_water is the 
+ * largest), or NULL.
+ *
+ * @return size_t Number of live buffers with counters, which may exceed n.
+ */
+size_t bzen_sbuf_get_stats_all(bzen_sbuf_stats_t* stats, 
+			       size_t n, 
+			       bzen_sbuf_stats_t* totals);
+
+/**
+ * Lock buffer for read-only access.
+ *
+ * Shared buffers may be locked this way by any number of threads at once;
+ * other buffers are locked exclusively as by bzen_sbuf_lock(). Unlock with
+ * bzen_sbuf_unlock(). Only bzen_sbuf_length() and bzen_sbuf_read_at() may be
+ * used under such a lock; calls that move stream position do not qualify.
+ *
+ * @param bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
+ *
+ * @return int Id of the buffer if safe and locked, otherwise -1.
+ */
+int bzen_sbuf_lock_shared(bzen_cbuflock_t* cbuflock);
+
+/**
+ * Return length in bytes of contents of the given buffer.
+ *
+ * Read-only: on shared buffers it runs alongside other readers.
+ *
+ * @param bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
+ *
+ * @return size_t Length, or 0 if buffer cannot be locked.
+ */
+size_t bzen_sbuf_length(bzen_cbuflock_t* cbuflock);
+
 /**
  * Attempts to unlock the given buffer.
  *
@@ -144,6 +443,103 @@ int bzen_sbuf_getc(bzen_cbuflock_t* cbuflock);
  */
 int bzen_sbuf_putc(int c, bzen_cbuflock_t* cbuflock);
 
+/**
+ * Get span of up to n readable bytes without consuming them.
+ *
+ * Must be followed by bzen_sbuf_consume(). On ring buffers span points into
+ * the ring itself (zero copy, consumer side only) and holds contiguous bytes
+ * up to the end of the ring. Stream buffers are read into a staging span and
+ * stay locked until bzen_sbuf_consume().
+ *
+ * @param size_t n Number of bytes wanted.
+ * @param size_t* available Set to number of bytes in span.
+ * @param bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
+ *
+ * @return const void* Span or NULL if no bytes are available (buffer is not
+ * left locked).
+ */
+const void* bzen_sbuf_peek(size_t n, size_t* available, bzen_cbuflock_t* cbuflock);
+
+/**
+ * Read up to n bytes from the given buffer.
+ *
+ * Unlike bzen_sbuf_getc(), buffer is locked once for the whole span. Fewer 
+ * than n bytes are read only at end of stream or on a read error.
+ *
+ * @param void* ptr Destination of at least n bytes.
+ * @param size_t n Number of bytes to read.
+ * @param bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
+ *
+ * @return size_t Number of bytes read.
+ */
+size_t bzen_sbuf_read(void* ptr, size_t n, bzen_cbuflock_t* cbuflock);
+
+/**
+ * Read up to n bytes at offset without moving stream position.
+ *
+ * Read-only: on shared buffers it runs alongside other readers, which lets 
+ * many consumers inspect one payload at the same time.
+ *
+ * @param void* ptr Destination of at least n bytes.
+ * @param size_t n Number of bytes to read.
+ * @param off_t offset Offset from start of contents.
+ * @param bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
+ *
+ * @return size_t Number of bytes read (short at end of contents).
+ */
+size_t bzen_sbuf_read_at(void* ptr, size_t n, off_t offset, 
+			 bzen_cbuflock_t* cbuflock);
+
+/**
+ * Read a line from the given buffer.
+ *
+ * Reads characters up to and including the next newline, until end of stream
+ * or until size - 1 characters are read, and terminates them with a null 
+ * character. Buffer is locked once for the whole line. Unlike fgets(), length
+ * of line is returned, so lines holding null characters are read whole.
+ *
+ * @param char* s Destination of at least size bytes.
+ * @param size_t size Size of destination in bytes.
+ * @param bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
+ *
+ * With a ring buffer only a whole line (or size - 1 characters) is consumed;
+ * -1 is returned with errno set to EAGAIN while the rest of it is pending.
+ *
+ * @return ssize_t Number of characters read, or -1 at end of stream or error.
+ */
+ssize_t bzen_sbuf_readline(char* s, size_t size, bzen_cbuflock_t* cbuflock);
+
+/**
+ * Get writable span of up to n bytes to be published by bzen_sbuf_commit().
+ *
+ * Lets callers such as socket receive paths fill buffer memory directly. On
+ * ring buffers span points into the ring itself (zero copy, producer side 
+ * only) and holds contiguous free bytes up to the end of the ring. Stream 
+ * buffers return a staging span of n bytes and stay locked until 
+ * bzen_sbuf_commit(), which writes it out.
+ *
+ * @param size_t n Number of bytes wanted.
+ * @param size_t* reserved Set to number of bytes in span.
+ * @param bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
+ *
+ * @return void* Span or NULL if no space is available (buffer is not left 
+ * locked).
+ */
+void* bzen_sbuf_reserve(size_t n, size_t* reserved, bzen_cbuflock_t* cbuflock);
+
+/**
+ * Empty growable buffer, giving back memory it has not needed lately.
+ *
+ * Length and position of buffer go to zero. Memory grown past initial size
+ * is given back if contents have not needed it for about a second.
+ *
+ * @param bzen_cbuflock_t* cbuflock Pointer to lock for growable buffer.
+ *
+ * @return int 0 on success, or -1 if buffer is not growable or cannot be 
+ * locked.
+ */
+int bzen_sbuf_reset(bzen_cbuflock_t* cbuflock);
+
 /**
  * Set file position to beginning of stream and reset error indicator.
  *
@@ -153,4 +549,61 @@ int bzen_sbuf_putc(int c, bzen_cbuflock_t* cbuflock);
  */
 int  bzen_sbuf_rewind(bzen_cbuflock_t* cbuflock);
 
+/**
+ * Switch buffer to reader/writer locking.
+ *
+ * Calls that move stream position or write still lock buffer exclusively 
+ * (and flush it, so readers see their data), while bzen_sbuf_length() and 
+ * bzen_sbuf_read_at() share it. Must be called before buffer is used by more
+ * than one thread. Applies to buffers made by bzen_sbuf_create() or 
+ * bzen_sbuf_create_growable() and to those whose stream has a file 
+ * descriptor, not to ring buffers.
+ *
+ * @param bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
+ *
+ * @return int 0 on success, otherwise -1.
+ */
+int bzen_sbuf_set_shared(bzen_cbuflock_t* cbuflock);
+
+/**
+ * Turn counters of buffers created from now on on or off.
+ *
+ * With statistics off, as by default, buffers carry no counters and the only
+ * cost is a test of a null pointer per call. With them on, each lock is first
+ * tried without waiting, so contended locks are counted and timed, and bytes
+ * moved are added up with atomic operations. Setting BZEN_SBUF_STATS=1 in 
+ * environment turns statistics on at start of program.
+ *
+ * @param int enable Nonzero to keep counters.
+ *
+ * @return int Previous setting.
+ */
+int bzen_sbuf_set_stats(int enable);
+
+/**
+ * Give back memory of growable buffer not needed by its contents.
+ *
+ * Memory shrinks to initial size of buffer, or length of contents if larger.
+ *
+ * @param bzen_cbuflock_t* cbuflock Pointer to lock for growable buffer.
+ *
+ * @return int 0 on success, or -1 if buffer is not growable or cannot be 
+ * locked.
+ */
+int bzen_sbuf_shrink(bzen_cbuflock_t* cbuflock);
+
+/**
+ * Write n bytes to the given buffer.
+ *
+ * Unlike bzen_sbuf_putc(), buffer is locked once for the whole span. Fewer 
+ * than n bytes are written only when the stream is full or on a write error.
+ *
+ * @param const void* ptr Source of n bytes.
+ * @param size_t n Number of bytes to write.
+ * @param bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
+ *
+ * @return size_t Number of bytes written.
+ */
+size_t bzen_sbuf_write(const void* ptr, size_t n, bzen_cbuflock_t* cbuflock);
+
 #endif /* _BZEN_SBUF_H_ */
@@ -45,6 +45,7 @@
 #include <unistd.h>
 
 #include "bzenpriv.h"
+#include "bzeniobuf.h"
 
 /* libzenc includes */
 
@@ -196,6 +197,20 @@ ssize_t bzen_socket_receive_from(int socket_fd,
  */
 ssize_t bzen_socket_send(int socket_fd, const void* data, size_t data_size, int flags);
 
+/**
+ * Send chain to connected peer with one sendmsg() and drop bytes sent.
+ *
+ * Segments go to the kernel as they are, so prepended headers and payload
+ * need not be copied into one buffer first.
+ *
+ * @param int socket_fd File descriptor of transmitting socket.
+ * @param bzen_iobuf_t* chain Chain of data to transmit.
+ * @param int flags MSG_OOB | MSG_DONTROUTE | MSG_NOSIGNAL | 0
+ *
+ * @return ssize_t Number of bytes transmitted or -1 on error.
+ */
+ssize_t bzen_socket_send_iobuf(int socket_fd, bzen_iobuf_t* chain, int flags);
+
 /**
  * Send data to connectionless peer.
  *
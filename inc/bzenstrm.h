@@ -28,6 +28,15 @@
 /** Size of opentype attribute in bytes. */
 #define BZEN_STREAM_OPENTYPE_SIZE 3
 
+/**
+ * Helper function returns descriptor of stream.
+ *
+ * @param[in] bzen_stream_t* stream The stream.
+ *
+ * @return int Descriptor or @c -1 if stream is closed or in memory.
+ */
+int bzen_stream_get_fd(bzen_stream_t* stream);
+
 /**
  * Helper function returns open file status flags.
  *
@@ -24,8 +24,25 @@
 
 #include <config.h>
 #include <pthread.h>
+#include <time.h>
 #include "bzenpriv.h"
 
+/**
+ * Lock mutex, waiting no later than a CLOCK_MONOTONIC deadline.
+ *
+ * Encapsulates pthread_mutex_clocklock() where available. Otherwise mutex is
+ * polled with pthread_mutex_trylock() and short sleeps that grow up to 1 ms,
+ * so wall clock changes do not affect the wait either way.
+ *
+ * @see: pthread_mutex_clocklock()
+ *
+ * @param pthread_mutex_t* mutex
+ * @param const struct timespec* deadline Absolute time on CLOCK_MONOTONIC.
+ *
+ * @return int 0 on success, ETIMEDOUT if deadline passed, or errno.
+ */
+int bzen_mutex_clocklock(pthread_mutex_t* mutex, const struct timespec* deadline);
+
 /**
  * Encapsulates pthread_mutex_destroy().
  * 
@@ -49,6 +66,21 @@ int bzen_mutex_destroy(pthread_mutex_t* mutex);
  */
 int bzen_mutex_init(pthread_mutex_t* mutex, const pthread_mutexattr_t* attr);
 
+/**
+ * Write-lock rwlock, waiting no later than a CLOCK_MONOTONIC deadline.
+ *
+ * Same as bzen_mutex_clocklock() for pthread_rwlock_clockwrlock().
+ *
+ * @see: pthread_rwlock_clockwrlock()
+ *
+ * @param pthread_rwlock_t* rwlock
+ * @param const struct timespec* deadline Absolute time on CLOCK_MONOTONIC.
+ *
+ * @return int 0 on success, ETIMEDOUT if deadline passed, or errno.
+ */
+int bzen_rwlock_clockwrlock(pthread_rwlock_t* rwlock, 
+			    const struct timespec* deadline);
+
 /**
  * Encapsulates pthread_create().
  * 
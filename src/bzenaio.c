@@ -0,0 +1,1060 @@
+/**
+ * @file:	bzenaio.c
+ * @brief:	Asynchronous reads and writes of streams.
+ *
+ * @copyright:	Copyright (C) 2017 Kuhrman Technology Solutions LLC
+ * @license:	GPLv3+: GNU GPL version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+#include "bzenaio.h"
+#include "bzenmem.h"
+#include "bzenstrm.h"
+#include "bzenthread.h"
+
+/**
+ * Number of requests of a context if none is given, and most allowed.
+ */
+#define BZEN_AIO_DEFAULT_ENTRIES 64
+#define BZEN_AIO_MAX_ENTRIES 4096
+
+/**
+ * Most bytes of one request, as the kernel takes 32 bit lengths.
+ */
+#define BZEN_AIO_MAX_LENGTH (1U << 30)
+
+/**
+ * Kinds of request.
+ */
+enum
+  {
+    BZEN_AIO_OP_READ,
+    BZEN_AIO_OP_WRITE
+  };
+
+/**
+ * @typedef bzen_aio_req_t
+ *
+ * Request from queueing to completion.
+ */
+typedef struct _bzen_aio_req_s
+{
+  struct _bzen_aio_req_s* next;
+  int opcode;
+  int fd;
+  void* buf;
+  size_t n;
+  off_t offset;
+  bzen_aio_callback_t callback;
+  void* arg;
+  ssize_t result;
+} bzen_aio_req_t;
+
+#ifdef HAVE_LINUX_IO_URING_H
+/**
+ * @typedef bzen_aio_ring_t
+ *
+ * Submission and completion queues shared with the kernel.
+ */
+typedef struct _bzen_aio_ring_s
+{
+  int fd;
+
+  /** Mapping of both queues, and of submission queue entries. */
+  unsigned char* map;
+  size_t map_size;
+  struct io_uring_sqe* sqes;
+  size_t sqes_size;
+
+  /** Submission queue. */
+  unsigned int* sq_head;
+  unsigned int* sq_tail;
+  unsigned int sq_mask;
+  unsigned int sq_entries;
+
+  /** Completion queue. */
+  unsigned int* cq_head;
+  unsigned int* cq_tail;
+  unsigned int cq_mask;
+  struct io_uring_cqe* cqes;
+
+  /** Tail including entries queued but not yet published to the kernel. */
+  unsigned int tail;
+} bzen_aio_ring_t;
+#endif
+
+/**
+ * Context of asynchronous requests.
+ */
+struct _bzen_aio_s
+{
+  /** Non-zero if served by threads. */
+  int emulated;
+
+  /** Most requests in flight, requests in flight and not yet submitted. */
+  unsigned int entries;
+  unsigned int inflight;
+  unsigned int queued;
+
+  /** Registered descriptors and buffers. */
+  int* files;
+  unsigned int n_files;
+  struct iovec* buffers;
+  unsigned int n_buffers;
+
+#ifdef HAVE_LINUX_IO_URING_H
+  bzen_aio_ring_t ring;
+#endif
+
+  /** Emulation: requests not yet submitted, owned by the calling thread. */
+  bzen_aio_req_t* queue_head;
+  bzen_aio_req_t* queue_tail;
+
+  /** Emulation: requests for and from threads, guarded by mutex. */
+  pthread_mutex_t mutex;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+  bzen_aio_req_t* work_head;
+  bzen_aio_req_t* work_tail;
+  bzen_aio_req_t* done_head;
+  bzen_aio_req_t* done_tail;
+  int stop;
+  pthread_t threads[BZEN_AIO_THREADS];
+  unsigned int n_threads;
+};
+
+/**
+ * Pool of requests.
+ */
+static bzen_pool_t* aio_req_pool = NULL;
+static pthread_once_t aio_pool_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Create pool of requests (once).
+ *
+ * @return void
+ */
+static void bzen_aio_pool_init()
+{
+  aio_req_pool = BZEN_POOL_CREATE(bzen_aio_req_t);
+}
+
+/**
+ * Release request and call its callback.
+ *
+ * Request is freed first, so callback may queue another in its place.
+ *
+ * @param[in,out] bzen_aio_t* aio Context.
+ * @param[in] bzen_aio_req_t* req Completed request.
+ * @param[in] ssize_t result Bytes transferred or negative errno value.
+ *
+ * @return void
+ */
+static void bzen_aio_complete(bzen_aio_t* aio,
+			      bzen_aio_req_t* req,
+			      ssize_t result)
+{
+  bzen_aio_callback_t callback = req->callback;
+  void* arg = req->arg;
+
+  aio->inflight--;
+  bzen_pool_free(aio_req_pool, req);
+  if (callback != NULL)
+    {
+      callback(result, arg);
+    }
+}
+
+/**
+ * Index of fd among registered descriptors.
+ *
+ * @param[in] const bzen_aio_t* aio Context.
+ * @param[in] int fd Descriptor.
+ *
+ * @return int Index or -1 if fd is not registered.
+ */
+static int bzen_aio_find_file(const bzen_aio_t* aio, int fd)
+{
+  unsigned int i;
+  int result = -1;
+
+  for (i = 0; i < aio->n_files && result < 0; i++)
+    {
+      if (aio->files[i] == fd)
+	{
+	  result = (int)i;
+	}
+    }
+
+  return result;
+}
+
+/**
+ * Index of registered buffer holding all n bytes at buf.
+ *
+ * @param[in] const bzen_aio_t* aio Context.
+ * @param[in] const void* buf Start of bytes.
+ * @param[in] size_t n Number of bytes.
+ *
+ * @return int Index or -1 if no buffer holds them.
+ */
+static int bzen_aio_find_buffer(const bzen_aio_t* aio,
+				const void* buf,
+				size_t n)
+{
+  const unsigned char* start = (const unsigned char*)buf;
+  const unsigned char* base;
+  unsigned int i;
+  int result = -1;
+
+  for (i = 0; i < aio->n_buffers && result < 0; i++)
+    {
+      base = (const unsigned char*)aio->buffers[i].iov_base;
+      if (start >= base &&
+	  n <= aio->buffers[i].iov_len &&
+	  (size_t)(start - base) <= aio->buffers[i].iov_len - n)
+	{
+	  result = (int)i;
+	}
+    }
+
+  return result;
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+/**
+ * Enter ring to submit entries and/or wait for completions.
+ *
+ * @param[in] int fd Ring.
+ * @param[in] unsigned int to_submit Number of entries to submit.
+ * @param[in] unsigned int min_complete Number of completions to wait for.
+ * @param[in] unsigned int flags IORING_ENTER_* flags.
+ *
+ * @return int Number of entries submitted or -1 on error (errno is set).
+ */
+static int bzen_aio_ring_enter(int fd,
+			       unsigned int to_submit,
+			       unsigned int min_complete,
+			       unsigned int flags)
+{
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		      flags, NULL, 0);
+}
+
+/**
+ * Set up ring of entries requests and map its queues.
+ *
+ * Kernels whose io_uring lacks plain reads and writes (before 5.6) are
+ * refused, as are rings denied by seccomp or sysctl.
+ *
+ * @param[in,out] bzen_aio_t* aio Context.
+ * @param[in] unsigned int entries Number of requests.
+ *
+ * @return int 0 on success otherwise -1.
+ */
+static int bzen_aio_ring_setup(bzen_aio_t* aio, unsigned int entries)
+{
+  bzen_aio_ring_t* ring = &aio->ring;
+  struct io_uring_params params;
+  size_t sq_size, cq_size;
+  unsigned int* array;
+  unsigned int i;
+  int result = -1;
+
+  memset(&params, 0, sizeof(params));
+  ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0)
+    {
+      goto SETUP_FAIL;
+    }
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(params.features & IORING_FEAT_RW_CUR_POS))
+    {
+      goto SETUP_FAIL_CLOSE;
+    }
+
+  /* Both queues share one mapping. */
+  sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->map_size = (sq_size > cq_size) ? sq_size : cq_size;
+  ring->map = (unsigned char*)mmap(NULL, ring->map_size,
+				   PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE,
+				   ring->fd, IORING_OFF_SQ_RING);
+  if (ring->map == MAP_FAILED)
+    {
+      goto SETUP_FAIL_CLOSE;
+    }
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_size,
+					  PROT_READ | PROT_WRITE,
+					  MAP_SHARED | MAP_POPULATE,
+					  ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+    {
+      goto SETUP_FAIL_UNMAP;
+    }
+
+  ring->sq_head = (unsigned int*)(ring->map + params.sq_off.head);
+  ring->sq_tail = (unsigned int*)(ring->map + params.sq_off.tail);
+  ring->sq_mask = *(unsigned int*)(ring->map + params.sq_off.ring_mask);
+  ring->sq_entries = params.sq_entries;
+  ring->cq_head = (unsigned int*)(ring->map + params.cq_off.head);
+  ring->cq_tail = (unsigned int*)(ring->map + params.cq_off.tail);
+  ring->cq_mask = *(unsigned int*)(ring->map + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)(ring->map + params.cq_off.cqes);
+  ring->tail = *ring->sq_tail;
+
+  /* Entry i always sits in slot i, so the array is filled once. */
+  array = (unsigned int*)(ring->map + params.sq_off.array);
+  for (i = 0; i < params.sq_entries; i++)
+    {
+      array[i] = i;
+    }
+
+  /* Completion queue is twice as long, so it never overflows. */
+  aio->entries = params.sq_entries;
+  result = 0;
+  goto SETUP_DONE;
+
+ SETUP_FAIL_UNMAP:
+
+  munmap(ring->map, ring->map_size);
+
+ SETUP_FAIL_CLOSE:
+
+  close(ring->fd);
+
+ SETUP_FAIL:
+ SETUP_DONE:
+
+  return result;
+}
+
+/**
+ * Unmap queues and close ring.
+ *
+ * @param[in,out] bzen_aio_t* aio Context.
+ *
+ * @return void
+ */
+static void bzen_aio_ring_teardown(bzen_aio_t* aio)
+{
+  munmap(aio->ring.sqes, aio->ring.sqes_size);
+  munmap(aio->ring.map, aio->ring.map_size);
+  close(aio->ring.fd);
+}
+
+/**
+ * Fill next submission queue entry with request.
+ *
+ * Registered descriptors and buffers are used where they apply. Context
+ * never holds more requests than entries, so there is always a free entry.
+ *
+ * @param[in,out] bzen_aio_t* aio Context.
+ * @param[in] bzen_aio_req_t* req Request.
+ *
+ * @return void
+ */
+static void bzen_aio_ring_queue(bzen_aio_t* aio, bzen_aio_req_t* req)
+{
+  bzen_aio_ring_t* ring = &aio->ring;
+  struct io_uring_sqe* sqe;
+  int file, buffer;
+
+  sqe = &ring->sqes[ring->tail & ring->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+
+  buffer = bzen_aio_find_buffer(aio, req->buf, req->n);
+  if (buffer >= 0)
+    {
+      sqe->opcode = (req->opcode == BZEN_AIO_OP_READ) ?
+	IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+      sqe->buf_index = (unsigned short)buffer;
+    }
+  else
+    {
+      sqe->opcode = (req->opcode == BZEN_AIO_OP_READ) ?
+	IORING_OP_READ : IORING_OP_WRITE;
+    }
+  file = bzen_aio_find_file(aio, req->fd);
+  if (file >= 0)
+    {
+      sqe->fd = file;
+      sqe->flags |= IOSQE_FIXED_FILE;
+    }
+  else
+    {
+      sqe->fd = req->fd;
+    }
+  sqe->off = (unsigned long long)req->offset;
+  sqe->addr = (unsigned long long)(uintptr_t)req->buf;
+  sqe->len = (unsigned int)req->n;
+  sqe->user_data = (unsigned long long)(uintptr_t)req;
+  ring->tail++;
+}
+
+/**
+ * Publish queued entries and submit them with as few calls as possible.
+ *
+ * @param[in,out] bzen_aio_t* aio Context.
+ *
+ * @return int Number of entries submitted or -1 on error.
+ */
+static int bzen_aio_ring_submit(bzen_aio_t* aio)
+{
+  int submitted = 0;
+  int status;
+
+  __atomic_store_n(aio->ring.sq_tail, aio->ring.tail, __ATOMIC_RELEASE);
+  while (aio->queued > 0)
+    {
+      status = bzen_aio_ring_enter(aio->ring.fd, aio->queued, 0, 0);
+      if (status < 0)
+	{
+	  if (errno == EINTR)
+	    {
+	      continue;
+	    }
+	  submitted = -1;
+	  break;
+	}
+      aio->queued -= (unsigned int)status;
+      submitted += status;
+    }
+
+  return submitted;
+}
+
+/**
+ * Complete all requests in completion queue.
+ *
+ * Head is advanced before each callback, so callbacks may reap in turn.
+ *
+ * @param[in,out] bzen_aio_t* aio Context.
+ *
+ * @return int Number of requests completed.
+ */
+static int bzen_aio_ring_reap(bzen_aio_t* aio)
+{
+  bzen_aio_ring_t* ring = &aio->ring;
+  struct io_uring_cqe* cqe;
+  bzen_aio_req_t* req;
+  unsigned int head;
+  ssize_t res;
+  int count = 0;
+
+  for (;;)
+    {
+      head = __atomic_load_n(ring->cq_head, __ATOMIC_RELAXED);
+      if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+	{
+	  break;
+	}
+      cqe = &ring->cqes[head & ring->cq_mask];
+      req = (bzen_aio_req_t*)(uintptr_t)cqe->user_data;
+      res = cqe->res;
+      __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+      bzen_aio_complete(aio, req, res);
+      count++;
+    }
+
+  return count;
+}
+#endif /* HAVE_LINUX_IO_URING_H */
+
+/**
+ * Thread serving requests of an emulated context.
+ *
+ * @param[in] void* arg Context.
+ *
+ * @return void* NULL
+ */
+static void* bzen_aio_worker(void* arg)
+{
+  bzen_aio_t* aio = (bzen_aio_t*)arg;
+  bzen_aio_req_t* req;
+  ssize_t moved;
+
+  pthread_mutex_lock(&aio->mutex);
+  for (;;)
+    {
+      while (aio->work_head == NULL && !aio->stop)
+	{
+	  pthread_cond_wait(&aio->work_cond, &aio->mutex);
+	}
+      if (aio->work_head == NULL)
+	{
+	  break;
+	}
+      req = aio->work_head;
+      aio->work_head = req->next;
+      if (aio->work_head == NULL)
+	{
+	  aio->work_tail = NULL;
+	}
+      pthread_mutex_unlock(&aio->mutex);
+
+      do
+	{
+	  if (req->opcode == BZEN_AIO_OP_READ)
+	    {
+	      moved = pread(req->fd, req->buf, req->n, req->offset);
+	    }
+	  else
+	    {
+	      moved = pwrite(req->fd, req->buf, req->n, req->offset);
+	    }
+	}
+      while (moved < 0 && errno == EINTR);
+      req->result = (moved < 0) ? -(ssize_t)errno : moved;
+
+      pthread_mutex_lock(&aio->mutex);
+      req->next = NULL;
+      if (aio->done_tail != NULL)
+	{
+	  aio->done_tail->next = req;
+	}
+      else
+	{
+	  aio->done_head = req;
+	}
+      aio->done_tail = req;
+      pthread_cond_signal(&aio->done_cond);
+    }
+  pthread_mutex_unlock(&aio->mutex);
+
+  return NULL;
+}
+
+/**
+ * Start threads of an emulated context.
+ *
+ * @param[in,out] bzen_aio_t* aio Context.
+ *
+ * @return int 0 on success otherwise -1.
+ */
+static int bzen_aio_threads_start(bzen_aio_t* aio)
+{
+  int status;
+  int result = -1;
+
+  status = bzen_mutex_init(&aio->mutex, NULL);
+  if (status != 0)
+    {
+      goto START_FAIL;
+    }
+  pthread_cond_init(&aio->work_cond, NULL);
+  pthread_cond_init(&aio->done_cond, NULL);
+
+  for (aio->n_threads = 0; aio->n_threads < BZEN_AIO_THREADS; aio->n_threads++)
+    {
+      status = bzen_thread_create(&aio->threads[aio->n_threads], NULL,
+				  bzen_aio_worker, aio);
+      if (status != 0)
+	{
+	  break;
+	}
+    }
+  if (aio->n_threads > 0)
+    {
+      result = 0;
+    }
+  else
+    {
+      pthread_cond_destroy(&aio->work_cond);
+      pthread_cond_destroy(&aio->done_cond);
+      bzen_mutex_destroy(&aio->mutex);
+    }
+
+ START_FAIL:
+
+  return result;
+}
+
+/**
+ * Stop and join threads of an emulated context.
+ *
+ * @param[in,out] bzen_aio_t* aio Context.
+ *
+ * @return void
+ */
+static void bzen_aio_threads_stop(bzen_aio_t* aio)
+{
+  unsigned int i;
+
+  pthread_mutex_lock(&aio->mutex);
+  aio->stop = 1;
+  pthread_cond_broadcast(&aio->work_cond);
+  pthread_mutex_unlock(&aio->mutex);
+  for (i = 0; i < aio->n_threads; i++)
+    {
+      bzen_thread_join(aio->threads[i], NULL);
+    }
+  pthread_cond_destroy(&aio->work_cond);
+  pthread_cond_destroy(&aio->done_cond);
+  bzen_mutex_destroy(&aio->mutex);
+}
+
+/**
+ * Complete requests done by threads.
+ *
+ * @param[in,out] bzen_aio_t* aio Context.
+ * @param[in] int block Non-zero to wait until a request is done.
+ *
+ * @return int Number of requests completed.
+ */
+static int bzen_aio_threads_reap(bzen_aio_t* aio, int block)
+{
+  bzen_aio_req_t* req;
+  bzen_aio_req_t* next;
+  int count = 0;
+
+  pthread_mutex_lock(&aio->mutex);
+  while (block && aio->done_head == NULL)
+    {
+      pthread_cond_wait(&aio->done_cond, &aio->mutex);
+    }
+  req = aio->done_head;
+  aio->done_head = aio->done_tail = NULL;
+  pthread_mutex_unlock(&aio->mutex);
+
+  while (req != NULL)
+    {
+      next = req->next;
+      bzen_aio_complete(aio, req, req->result);
+      req = next;
+      count++;
+    }
+
+  return count;
+}
+
+/**
+ * Queue request of either kind.
+ *
+ * @param[in,out] bzen_aio_t* aio Context.
+ * @param[in] int opcode BZEN_AIO_OP_READ or BZEN_AIO_OP_WRITE.
+ * @param[in] bzen_stream_t* stream Stream.
+ * @param[in] void* buf Buffer.
+ * @param[in] size_t n Number of bytes.
+ * @param[in] off_t offset Offset in stream.
+ * @param[in] bzen_aio_callback_t callback Called on completion.
+ * @param[in] void* arg Argument of callback.
+ *
+ * @return int 0 on success, otherwise -1.
+ */
+static int bzen_aio_queue(bzen_aio_t* aio,
+			  int opcode,
+			  bzen_stream_t* stream,
+			  void* buf,
+			  size_t n,
+			  off_t offset,
+			  bzen_aio_callback_t callback,
+			  void* arg)
+{
+  bzen_aio_req_t* req;
+  int fd;
+  int result = -1;
+
+  fd = bzen_stream_get_fd(stream);
+  if (fd < 0)
+    {
+      errno = EBADF;
+      goto QUEUE_FAIL;
+    }
+
+  /* Make room by completing a request. */
+  if (aio->inflight == aio->entries && bzen_aio_wait(aio, 1) < 0)
+    {
+      goto QUEUE_FAIL;
+    }
+
+  req = (bzen_aio_req_t*)bzen_pool_alloc(aio_req_pool);
+  if (req == NULL)
+    {
+      goto QUEUE_FAIL;
+    }
+  req->next = NULL;
+  req->opcode = opcode;
+  req->fd = fd;
+  req->buf = buf;
+  req->n = (n < BZEN_AIO_MAX_LENGTH) ? n : BZEN_AIO_MAX_LENGTH;
+  req->offset = offset;
+  req->callback = callback;
+  req->arg = arg;
+  req->result = 0;
+
+  if (aio->emulated)
+    {
+      if (aio->queue_tail != NULL)
+	{
+	  aio->queue_tail->next = req;
+	}
+      else
+	{
+	  aio->queue_head = req;
+	}
+      aio->queue_tail = req;
+    }
+#ifdef HAVE_LINUX_IO_URING_H
+  else
+    {
+      bzen_aio_ring_queue(aio, req);
+    }
+#endif
+  aio->inflight++;
+  aio->queued++;
+  result = 0;
+
+ QUEUE_FAIL:
+
+  return result;
+}
+
+/* Create a context for up to entries requests in flight. */
+bzen_aio_t* bzen_aio_create(unsigned int entries, unsigned int flags)
+{
+  bzen_aio_t* aio;
+  unsigned int size;
+
+  pthread_once(&aio_pool_once, bzen_aio_pool_init);
+
+  /* Round up to a power of 2 as the kernel does. */
+  if (entries == 0)
+    {
+      entries = BZEN_AIO_DEFAULT_ENTRIES;
+    }
+  if (entries > BZEN_AIO_MAX_ENTRIES)
+    {
+      entries = BZEN_AIO_MAX_ENTRIES;
+    }
+  for (size = 1; size < entries; size <<= 1)
+    ;
+
+  aio = (bzen_aio_t*)bzen_malloc_tagged(BZEN_SIZEOF(bzen_aio_t),
+					BZEN_MEM_TAG_STREAM);
+  memset(aio, 0, BZEN_SIZEOF(bzen_aio_t));
+  aio->entries = size;
+
+#ifdef HAVE_LINUX_IO_URING_H
+  if (!(flags & BZEN_AIO_EMULATE) && bzen_aio_ring_setup(aio, size) == 0)
+    {
+      goto CREATE_DONE;
+    }
+#endif
+
+  /* No io_uring: threads behind the same interface. */
+  aio->emulated = 1;
+  if (bzen_aio_threads_start(aio) != 0)
+    {
+      bzen_free(aio);
+      aio = NULL;
+    }
+
+#ifdef HAVE_LINUX_IO_URING_H
+ CREATE_DONE:
+#endif
+
+  return aio;
+}
+
+/* Complete all requests, calling their callbacks, and free context. */
+void bzen_aio_destroy(bzen_aio_t* aio)
+{
+  if (aio == NULL)
+    {
+      return;
+    }
+
+  while (aio->inflight > 0)
+    {
+      if (bzen_aio_wait(aio, aio->inflight) < 0)
+	{
+	  perror("bzen_aio_destroy");
+	  break;
+	}
+    }
+
+  if (aio->emulated)
+    {
+      bzen_aio_threads_stop(aio);
+    }
+#ifdef HAVE_LINUX_IO_URING_H
+  else
+    {
+      bzen_aio_ring_teardown(aio);
+    }
+#endif
+  bzen_free(aio->files);
+  bzen_free(aio->buffers);
+  bzen_free(aio);
+}
+
+/* Tell if context serves requests with threads rather than io_uring. */
+int bzen_aio_emulated(const bzen_aio_t* aio)
+{
+  return aio->emulated;
+}
+
+/* Reap completed requests and call their callbacks without blocking. */
+int bzen_aio_poll(bzen_aio_t* aio)
+{
+  int result = 0;
+
+  if (aio->emulated)
+    {
+      result = bzen_aio_threads_reap(aio, 0);
+    }
+#ifdef HAVE_LINUX_IO_URING_H
+  else
+    {
+      result = bzen_aio_ring_reap(aio);
+    }
+#endif
+
+  return result;
+}
+
+/* Queue read of up to n bytes at offset of stream into buf. */
+int bzen_aio_read(bzen_aio_t* aio,
+		  bzen_stream_t* stream,
+		  void* buf,
+		  size_t n,
+		  off_t offset,
+		  bzen_aio_callback_t callback,
+		  void* arg)
+{
+  return bzen_aio_queue(aio, BZEN_AIO_OP_READ, stream, buf, n, offset,
+			callback, arg);
+}
+
+/* Register buffers with the kernel for the life of the context. */
+int bzen_aio_register_buffers(bzen_aio_t* aio,
+			      const struct iovec* iov,
+			      unsigned int n)
+{
+  struct iovec* buffers = NULL;
+  int result = -1;
+
+  if (aio->inflight > 0)
+    {
+      errno = EBUSY;
+      goto REGISTER_FAIL;
+    }
+
+#ifdef HAVE_LINUX_IO_URING_H
+  if (!aio->emulated)
+    {
+      if (aio->n_buffers > 0)
+	{
+	  syscall(__NR_io_uring_register, aio->ring.fd,
+		  IORING_UNREGISTER_BUFFERS, NULL, 0);
+	  aio->n_buffers = 0;
+	}
+      if (n > 0 &&
+	  syscall(__NR_io_uring_register, aio->ring.fd,
+		  IORING_REGISTER_BUFFERS, iov, n) < 0)
+	{
+	  goto REGISTER_FAIL;
+	}
+    }
+#endif
+
+  /* Threads have nothing to register; record buffers all the same. */
+  if (n > 0)
+    {
+      buffers = (struct iovec*)bzen_malloc_tagged(n * sizeof(struct iovec),
+						  BZEN_MEM_TAG_STREAM);
+      memcpy(buffers, iov, n * sizeof(struct iovec));
+    }
+  bzen_free(aio->buffers);
+  aio->buffers = buffers;
+  aio->n_buffers = n;
+  result = 0;
+
+ REGISTER_FAIL:
+
+  return result;
+}
+
+/* Register descriptors of streams with the kernel for the life of context. */
+int bzen_aio_register_streams(bzen_aio_t* aio,
+			      bzen_stream_t** streams,
+			      unsigned int n)
+{
+  int* files = NULL;
+  unsigned int i;
+  int result = -1;
+
+  if (aio->inflight > 0)
+    {
+      errno = EBUSY;
+      goto REGISTER_FAIL;
+    }
+
+  if (n > 0)
+    {
+      files = (int*)bzen_malloc_tagged(n * sizeof(int), BZEN_MEM_TAG_STREAM);
+      for (i = 0; i < n; i++)
+	{
+	  files[i] = bzen_stream_get_fd(streams[i]);
+	  if (files[i] < 0)
+	    {
+	      errno = EBADF;
+	      goto REGISTER_FAIL_FREE;
+	    }
+	}
+    }
+
+#ifdef HAVE_LINUX_IO_URING_H
+  if (!aio->emulated)
+    {
+      if (aio->n_files > 0)
+	{
+	  syscall(__NR_io_uring_register, aio->ring.fd,
+		  IORING_UNREGISTER_FILES, NULL, 0);
+	  aio->n_files = 0;
+	}
+      if (n > 0 &&
+	  syscall(__NR_io_uring_register, aio->ring.fd,
+		  IORING_REGISTER_FILES, files, n) < 0)
+	{
+	  goto REGISTER_FAIL_FREE;
+	}
+    }
+#endif
+
+  bzen_free(aio->files);
+  aio->files = files;
+  aio->n_files = n;
+  result = 0;
+  goto REGISTER_FAIL;
+
+ REGISTER_FAIL_FREE:
+
+  bzen_free(files);
+
+ REGISTER_FAIL:
+
+  return result;
+}
+
+/* Hand all queued requests to the kernel (or threads) at once. */
+int bzen_aio_submit(bzen_aio_t* aio)
+{
+  int result = 0;
+
+  if (aio->queued == 0)
+    {
+      goto SUBMIT_DONE;
+    }
+
+  if (aio->emulated)
+    {
+      pthread_mutex_lock(&aio->mutex);
+      if (aio->work_tail != NULL)
+	{
+	  aio->work_tail->next = aio->queue_head;
+	}
+      else
+	{
+	  aio->work_head = aio->queue_head;
+	}
+      aio->work_tail = aio->queue_tail;
+      pthread_cond_broadcast(&aio->work_cond);
+      pthread_mutex_unlock(&aio->mutex);
+      aio->queue_head = aio->queue_tail = NULL;
+      result = (int)aio->queued;
+      aio->queued = 0;
+    }
+#ifdef HAVE_LINUX_IO_URING_H
+  else
+    {
+      result = bzen_aio_ring_submit(aio);
+    }
+#endif
+
+ SUBMIT_DONE:
+
+  return result;
+}
+
+/* Submit queued requests and wait until at least min of them complete. */
+int bzen_aio_wait(bzen_aio_t* aio, unsigned int min)
+{
+  unsigned int done = 0;
+  int result = -1;
+
+  if (min > aio->inflight)
+    {
+      min = aio->inflight;
+    }
+
+  while (done < min)
+    {
+      /* Callbacks may have queued more. */
+      if (bzen_aio_submit(aio) < 0)
+	{
+	  goto WAIT_FAIL;
+	}
+      if (aio->emulated)
+	{
+	  done += (unsigned int)bzen_aio_threads_reap(aio, 1);
+	}
+#ifdef HAVE_LINUX_IO_URING_H
+      else
+	{
+	  done += (unsigned int)bzen_aio_ring_reap(aio);
+	  if (done < min &&
+	      bzen_aio_ring_enter(aio->ring.fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+	      errno != EINTR)
+	    {
+	      goto WAIT_FAIL;
+	    }
+	}
+#endif
+    }
+  done += (unsigned int)bzen_aio_poll(aio);
+  result = (int)done;
+
+ WAIT_FAIL:
+
+  return result;
+}
+
+/* Queue write of n bytes from buf at offset of stream. */
+int bzen_aio_write(bzen_aio_t* aio,
+		   bzen_stream_t* stream,
+		   const void* buf,
+		   size_t n,
+		   off_t offset,
+		   bzen_aio_callback_t callback,
+		   void* arg)
+{
+  return bzen_aio_queue(aio, BZEN_AIO_OP_WRITE, stream, (void*)buf, n, offset,
+			callback, arg);
+}
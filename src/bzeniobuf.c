@@ -0,0 +1,747 @@
+/**
+ * @file:	bzeniobuf.c
+ * @brief:	Chains of reference counted segments for scatter/gather I/O.
+ *
+ * @copyright:	Copyright (C) 2017 Kuhrman Technology Solutions LLC
+ * @license:	GPLv3+: GNU GPL version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include "bzenmem.h"
+#include "bzeniobuf.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
+/**
+ * Pools of segments with payload, of segments referring to memory of the
+ * application, of views and of chains.
+ */
+static bzen_pool_t* iobuf_segment_pool = NULL;
+static bzen_pool_t* iobuf_ref_pool = NULL;
+static bzen_pool_t* iobuf_node_pool = NULL;
+static bzen_pool_t* iobuf_chain_pool = NULL;
+static pthread_once_t iobuf_pool_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Create pools of segments, views and chains (once).
+ *
+ * @return void
+ */
+static void bzen_iobuf_pool_init()
+{
+  iobuf_segment_pool =
+    bzen_pool_create(BZEN_SIZEOF(bzen_iobuf_seg_t) + BZEN_IOBUF_SEGMENT_SIZE,
+		     0);
+  iobuf_ref_pool = BZEN_POOL_CREATE(bzen_iobuf_seg_t);
+  iobuf_node_pool = BZEN_POOL_CREATE(bzen_iobuf_node_t);
+  iobuf_chain_pool = BZEN_POOL_CREATE(bzen_iobuf_t);
+}
+
+/**
+ * Check that all pools exist.
+ *
+ * @return int 0 if pools are ready, otherwise -1.
+ */
+static int bzen_iobuf_pools()
+{
+  int result = 0;
+
+  pthread_once(&iobuf_pool_once, bzen_iobuf_pool_init);
+  if ((iobuf_segment_pool == NULL) || (iobuf_ref_pool == NULL) ||
+      (iobuf_node_pool == NULL) || (iobuf_chain_pool == NULL))
+    {
+      result = -1;
+    }
+
+  return result;
+}
+
+/**
+ * Allocate pooled segment with one reference.
+ *
+ * @return bzen_iobuf_seg_t* New segment or NULL.
+ */
+static bzen_iobuf_seg_t* bzen_iobuf_segment()
+{
+  bzen_iobuf_seg_t* seg;
+
+  seg = (bzen_iobuf_seg_t*)bzen_pool_alloc(iobuf_segment_pool);
+  if (seg != NULL)
+    {
+      seg->refs = 1;
+      seg->pooled = 1;
+      seg->capacity = BZEN_IOBUF_SEGMENT_SIZE;
+      seg->data = (unsigned char*)(seg + 1);
+      seg->release = NULL;
+      seg->arg = NULL;
+    }
+
+  return seg;
+}
+
+/**
+ * Drop one reference to segment, freeing it with the last.
+ *
+ * @param[in] bzen_iobuf_seg_t* seg Segment.
+ *
+ * @return void
+ */
+static void bzen_iobuf_segment_release(bzen_iobuf_seg_t* seg)
+{
+  if (__atomic_sub_fetch(&seg->refs, 1, __ATOMIC_ACQ_REL) != 0)
+    {
+      goto RELEASE_DONE;
+    }
+
+  if (seg->pooled)
+    {
+      bzen_pool_free(iobuf_segment_pool, seg);
+    }
+  else
+    {
+      if (seg->release != NULL)
+	{
+	  seg->release(seg->arg);
+	}
+      bzen_pool_free(iobuf_ref_pool, seg);
+    }
+
+ RELEASE_DONE:
+
+  return;
+}
+
+/**
+ * Check whether segment may be written, that is only caller refers to it.
+ *
+ * @param[in] const bzen_iobuf_seg_t* seg Segment.
+ *
+ * @return int 1 if segment is pooled and not shared, otherwise 0.
+ */
+static int bzen_iobuf_segment_exclusive(const bzen_iobuf_seg_t* seg)
+{
+  return (seg->pooled &&
+	  (__atomic_load_n(&seg->refs, __ATOMIC_ACQUIRE) == 1));
+}
+
+/**
+ * Allocate view of segment, taking over one reference of caller.
+ *
+ * @param[in] bzen_iobuf_seg_t* seg Segment.
+ * @param[in] size_t offset Offset of view in segment.
+ * @param[in] size_t length Length of view.
+ *
+ * @return bzen_iobuf_node_t* New view or NULL.
+ */
+static bzen_iobuf_node_t* bzen_iobuf_node(bzen_iobuf_seg_t* seg,
+					  size_t offset,
+					  size_t length)
+{
+  bzen_iobuf_node_t* node;
+
+  node = (bzen_iobuf_node_t*)bzen_pool_alloc(iobuf_node_pool);
+  if (node != NULL)
+    {
+      node->next = NULL;
+      node->seg = seg;
+      node->offset = offset;
+      node->length = length;
+    }
+
+  return node;
+}
+
+/**
+ * Free view and its reference to segment.
+ *
+ * @param[in] bzen_iobuf_node_t* node View.
+ *
+ * @return void
+ */
+static void bzen_iobuf_node_free(bzen_iobuf_node_t* node)
+{
+  bzen_iobuf_segment_release(node->seg);
+  bzen_pool_free(iobuf_node_pool, node);
+}
+
+/**
+ * Add view to end of chain.
+ *
+ * @param[in,out] bzen_iobuf_t* chain Chain.
+ * @param[in] bzen_iobuf_node_t* node View.
+ *
+ * @return void
+ */
+static void bzen_iobuf_push(bzen_iobuf_t* chain, bzen_iobuf_node_t* node)
+{
+  node->next = NULL;
+  if (chain->tail == NULL)
+    {
+      chain->head = node;
+    }
+  else
+    {
+      chain->tail->next = node;
+    }
+  chain->tail = node;
+  chain->length += node->length;
+  chain->count++;
+}
+
+/**
+ * Drop all views of chain, leaving it empty.
+ *
+ * @param[in,out] bzen_iobuf_t* chain Chain.
+ *
+ * @return void
+ */
+static void bzen_iobuf_clear(bzen_iobuf_t* chain)
+{
+  bzen_iobuf_node_t* node;
+  bzen_iobuf_node_t* next;
+
+  for (node = chain->head; node != NULL; node = next)
+    {
+      next = node->next;
+      bzen_iobuf_node_free(node);
+    }
+
+  memset(chain, 0, BZEN_SIZEOF(bzen_iobuf_t));
+}
+
+/**
+ * Add n new pooled segments to end of chain as empty views.
+ *
+ * @param[in,out] bzen_iobuf_t* chain Chain to add to.
+ * @param[in] size_t n Number of segments.
+ *
+ * @return int 0 on success, otherwise -1 and chain is cleared.
+ */
+static int bzen_iobuf_reserve(bzen_iobuf_t* chain, size_t n)
+{
+  bzen_iobuf_seg_t* seg;
+  bzen_iobuf_node_t* node;
+  int result = -1;
+
+  for (; n > 0; n--)
+    {
+      seg = bzen_iobuf_segment();
+      if (seg == NULL)
+	{
+	  bzen_iobuf_clear(chain);
+	  goto RESERVE_FAIL;
+	}
+
+      node = bzen_iobuf_node(seg, 0, 0);
+      if (node == NULL)
+	{
+	  bzen_iobuf_segment_release(seg);
+	  bzen_iobuf_clear(chain);
+	  goto RESERVE_FAIL;
+	}
+
+      bzen_iobuf_push(chain, node);
+    }
+  result = 0;
+
+ RESERVE_FAIL:
+
+  return result;
+}
+
+/* Copy n bytes to end of chain. */
+int bzen_iobuf_append(bzen_iobuf_t* chain, const void* data, size_t n)
+{
+  const unsigned char* source = (const unsigned char*)data;
+  bzen_iobuf_t fresh;
+  bzen_iobuf_node_t* node;
+  size_t room;
+  size_t chunk;
+  int result = -1;
+
+  BZEN_ASSERT(chain);
+
+  room = 0;
+  node = chain->tail;
+  if ((node != NULL) && bzen_iobuf_segment_exclusive(node->seg))
+    {
+      room = node->seg->capacity - (node->offset + node->length);
+    }
+  if (room > n)
+    {
+      room = n;
+    }
+
+  /* Allocate every new segment before touching chain, so failure leaves
+     chain as it was. */
+  memset(&fresh, 0, BZEN_SIZEOF(bzen_iobuf_t));
+  if ((bzen_iobuf_pools() != 0) ||
+      (bzen_iobuf_reserve(&fresh,
+			  ((n - room) + BZEN_IOBUF_SEGMENT_SIZE - 1) /
+			  BZEN_IOBUF_SEGMENT_SIZE) != 0))
+    {
+      goto APPEND_FAIL;
+    }
+
+  if (room > 0)
+    {
+      memcpy(node->seg->data + node->offset + node->length, source, room);
+      node->length += room;
+      chain->length += room;
+      source += room;
+      n -= room;
+    }
+
+  for (node = fresh.head; node != NULL; node = node->next)
+    {
+      chunk = n;
+      if (chunk > node->seg->capacity)
+	{
+	  chunk = node->seg->capacity;
+	}
+      memcpy(node->seg->data, source, chunk);
+      node->length = chunk;
+      fresh.length += chunk;
+      source += chunk;
+      n -= chunk;
+    }
+
+  bzen_iobuf_append_chain(chain, &fresh);
+  result = 0;
+
+ APPEND_FAIL:
+
+  return result;
+}
+
+/* Move all views of other chain to end of chain, leaving other empty. */
+void bzen_iobuf_append_chain(bzen_iobuf_t* chain, bzen_iobuf_t* other)
+{
+  BZEN_ASSERT(chain);
+  BZEN_ASSERT(other);
+
+  if ((other == chain) || (other->head == NULL))
+    {
+      goto APPEND_DONE;
+    }
+
+  if (chain->tail == NULL)
+    {
+      chain->head = other->head;
+    }
+  else
+    {
+      chain->tail->next = other->head;
+    }
+  chain->tail = other->tail;
+  chain->length += other->length;
+  chain->count += other->count;
+
+  memset(other, 0, BZEN_SIZEOF(bzen_iobuf_t));
+
+ APPEND_DONE:
+
+  return;
+}
+
+/* Add n bytes of application memory to end of chain without copying. */
+int bzen_iobuf_append_ref(bzen_iobuf_t* chain,
+			  const void* data,
+			  size_t n,
+			  void (*release)(void*),
+			  void* arg)
+{
+  bzen_iobuf_seg_t* seg;
+  bzen_iobuf_node_t* node;
+  int result = -1;
+
+  BZEN_ASSERT(chain);
+
+  if (bzen_iobuf_pools() != 0)
+    {
+      goto APPEND_FAIL;
+    }
+
+  seg = (bzen_iobuf_seg_t*)bzen_pool_alloc(iobuf_ref_pool);
+  if (seg == NULL)
+    {
+      goto APPEND_FAIL;
+    }
+  seg->refs = 1;
+  seg->pooled = 0;
+  seg->capacity = n;
+  seg->data = (unsigned char*)data;
+  seg->release = release;
+  seg->arg = arg;
+
+  node = bzen_iobuf_node(seg, 0, n);
+  if (node == NULL)
+    {
+      /* Application still owns memory; do not call release. */
+      bzen_pool_free(iobuf_ref_pool, seg);
+      goto APPEND_FAIL;
+    }
+
+  bzen_iobuf_push(chain, node);
+  result = 0;
+
+ APPEND_FAIL:
+
+  return result;
+}
+
+/* Add views of all bytes of source to end of chain, sharing its segments. */
+int bzen_iobuf_clone(bzen_iobuf_t* chain, const bzen_iobuf_t* source)
+{
+  bzen_iobuf_t copy;
+  bzen_iobuf_node_t* from;
+  bzen_iobuf_node_t* node;
+  int result = -1;
+
+  BZEN_ASSERT(chain);
+  BZEN_ASSERT(source);
+
+  memset(&copy, 0, BZEN_SIZEOF(bzen_iobuf_t));
+  if (bzen_iobuf_pools() != 0)
+    {
+      goto CLONE_FAIL;
+    }
+
+  for (from = source->head; from != NULL; from = from->next)
+    {
+      node = bzen_iobuf_node(from->seg, from->offset, from->length);
+      if (node == NULL)
+	{
+	  bzen_iobuf_clear(&copy);
+	  goto CLONE_FAIL;
+	}
+      __atomic_add_fetch(&from->seg->refs, 1, __ATOMIC_RELAXED);
+      bzen_iobuf_push(&copy, node);
+    }
+
+  bzen_iobuf_append_chain(chain, &copy);
+  result = 0;
+
+ CLONE_FAIL:
+
+  return result;
+}
+
+/* Drop up to n bytes from start of chain. */
+size_t bzen_iobuf_consume(bzen_iobuf_t* chain, size_t n)
+{
+  bzen_iobuf_node_t* node;
+  size_t dropped = 0;
+
+  BZEN_ASSERT(chain);
+
+  while ((n > 0) && (chain->head != NULL))
+    {
+      node = chain->head;
+      if (node->length > n)
+	{
+	  node->offset += n;
+	  node->length -= n;
+	  dropped += n;
+	  break;
+	}
+
+      n -= node->length;
+      dropped += node->length;
+      chain->head = node->next;
+      chain->count--;
+      bzen_iobuf_node_free(node);
+    }
+
+  if (chain->head == NULL)
+    {
+      chain->tail = NULL;
+    }
+  chain->length -= dropped;
+
+  return dropped;
+}
+
+/* Copy up to n bytes starting at offset of chain out to ptr. */
+size_t bzen_iobuf_copy(const bzen_iobuf_t* chain,
+		       size_t offset,
+		       void* ptr,
+		       size_t n)
+{
+  unsigned char* destination = (unsigned char*)ptr;
+  const bzen_iobuf_node_t* node;
+  size_t copied = 0;
+  size_t chunk;
+
+  BZEN_ASSERT(chain);
+
+  for (node = chain->head; (node != NULL) && (copied < n); node = node->next)
+    {
+      if (offset >= node->length)
+	{
+	  offset -= node->length;
+	  continue;
+	}
+
+      chunk = node->length - offset;
+      if (chunk > n - copied)
+	{
+	  chunk = n - copied;
+	}
+      memcpy(destination + copied, node->seg->data + node->offset + offset,
+	     chunk);
+      copied += chunk;
+      offset = 0;
+    }
+
+  return copied;
+}
+
+/* Create an empty chain. */
+bzen_iobuf_t* bzen_iobuf_create()
+{
+  bzen_iobuf_t* chain = NULL;
+
+  if (bzen_iobuf_pools() != 0)
+    {
+      goto CREATE_FAIL;
+    }
+
+  chain = (bzen_iobuf_t*)bzen_pool_alloc(iobuf_chain_pool);
+  if (chain != NULL)
+    {
+      memset(chain, 0, BZEN_SIZEOF(bzen_iobuf_t));
+    }
+
+ CREATE_FAIL:
+
+  return chain;
+}
+
+/* Release all views of chain and free it. */
+void bzen_iobuf_destroy(bzen_iobuf_t* chain)
+{
+  if (chain != NULL)
+    {
+      bzen_iobuf_clear(chain);
+      bzen_pool_free(iobuf_chain_pool, chain);
+    }
+}
+
+/* Describe chain as array of struct iovec for writev() or sendmsg(). */
+int bzen_iobuf_iovec(const bzen_iobuf_t* chain, struct iovec* iov, int iovcnt)
+{
+  const bzen_iobuf_node_t* node;
+  int count = 0;
+
+  BZEN_ASSERT(chain);
+
+  for (node = chain->head; (node != NULL) && (count < iovcnt);
+       node = node->next)
+    {
+      if (node->length == 0)
+	{
+	  continue;
+	}
+      iov[count].iov_base = node->seg->data + node->offset;
+      iov[count].iov_len = node->length;
+      count++;
+    }
+
+  return count;
+}
+
+/* Copy n bytes to start of chain, typically a header. */
+int bzen_iobuf_prepend(bzen_iobuf_t* chain, const void* data, size_t n)
+{
+  const unsigned char* source = (const unsigned char*)data;
+  bzen_iobuf_t fresh;
+  bzen_iobuf_node_t* node;
+  size_t segments;
+  size_t chunk;
+  int result = 0;
+
+  BZEN_ASSERT(chain);
+
+  if (n == 0)
+    {
+      goto PREPEND_FAIL;
+    }
+
+  node = chain->head;
+  if ((node != NULL) && (node->offset >= n) &&
+      bzen_iobuf_segment_exclusive(node->seg))
+    {
+      node->offset -= n;
+      node->length += n;
+      chain->length += n;
+      memcpy(node->seg->data + node->offset, data, n);
+      goto PREPEND_FAIL;
+    }
+
+  memset(&fresh, 0, BZEN_SIZEOF(bzen_iobuf_t));
+  segments = (n + BZEN_IOBUF_SEGMENT_SIZE - 1) / BZEN_IOBUF_SEGMENT_SIZE;
+  if ((bzen_iobuf_pools() != 0) || (bzen_iobuf_reserve(&fresh, segments) != 0))
+    {
+      result = -1;
+      goto PREPEND_FAIL;
+    }
+
+  /* First segment is filled from its end, so that the next header fits in
+     front of this one without another segment. */
+  chunk = n - (segments - 1) * BZEN_IOBUF_SEGMENT_SIZE;
+  for (node = fresh.head; node != NULL; node = node->next)
+    {
+      node->offset = node->seg->capacity - chunk;
+      node->length = chunk;
+      memcpy(node->seg->data + node->offset, source, chunk);
+      source += chunk;
+      chunk = BZEN_IOBUF_SEGMENT_SIZE;
+    }
+  fresh.length = n;
+
+  bzen_iobuf_append_chain(&fresh, chain);
+  bzen_iobuf_append_chain(chain, &fresh);
+
+ PREPEND_FAIL:
+
+  return result;
+}
+
+/* Move bytes of chain from offset on to end of tail. */
+int bzen_iobuf_split(bzen_iobuf_t* chain, size_t offset, bzen_iobuf_t* tail)
+{
+  bzen_iobuf_t rest;
+  bzen_iobuf_node_t* node;
+  bzen_iobuf_node_t* last = NULL;
+  bzen_iobuf_node_t* half;
+  size_t position = 0;
+  size_t count = 0;
+  int result = -1;
+
+  BZEN_ASSERT(chain);
+  BZEN_ASSERT(tail);
+
+  if ((offset > chain->length) || (tail == chain))
+    {
+      errno = EINVAL;
+      goto SPLIT_FAIL;
+    }
+  if (offset == chain->length)
+    {
+      result = 0;
+      goto SPLIT_FAIL;
+    }
+
+  /* Find view holding byte at offset; last is the view before it. */
+  for (node = chain->head; position + node->length <= offset;
+       node = node->next)
+    {
+      position += node->length;
+      last = node;
+      count++;
+    }
+
+  if (position < offset)
+    {
+      if (bzen_iobuf_pools() != 0)
+	{
+	  goto SPLIT_FAIL;
+	}
+
+      half = bzen_iobuf_node(node->seg, node->offset + (offset - position),
+			     node->length - (offset - position));
+      if (half == NULL)
+	{
+	  goto SPLIT_FAIL;
+	}
+      __atomic_add_fetch(&node->seg->refs, 1, __ATOMIC_RELAXED);
+
+      half->next = node->next;
+      node->length = offset - position;
+      node->next = half;
+      if (chain->tail == node)
+	{
+	  chain->tail = half;
+	}
+      chain->count++;
+      last = node;
+      count++;
+      node = half;
+    }
+
+  rest.head = node;
+  rest.tail = chain->tail;
+  rest.length = chain->length - offset;
+  rest.count = chain->count - count;
+
+  if (last == NULL)
+    {
+      chain->head = NULL;
+    }
+  else
+    {
+      last->next = NULL;
+    }
+  chain->tail = last;
+  chain->length = offset;
+  chain->count = count;
+
+  bzen_iobuf_append_chain(tail, &rest);
+  result = 0;
+
+ SPLIT_FAIL:
+
+  return result;
+}
+
+/* Write chain to file descriptor with writev() and drop bytes written. */
+ssize_t bzen_iobuf_write(int fd, bzen_iobuf_t* chain)
+{
+  struct iovec iov[IOV_MAX];
+  ssize_t result = 0;
+  int count;
+
+  BZEN_ASSERT(chain);
+
+  count = bzen_iobuf_iovec(chain, iov, IOV_MAX);
+  if (count == 0)
+    {
+      goto WRITE_FAIL;
+    }
+
+  do
+    {
+      result = writev(fd, iov, count);
+    }
+  while ((result < 0) && (errno == EINTR));
+
+  if (result > 0)
+    {
+      bzen_iobuf_consume(chain, (size_t)result);
+    }
+
+ WRITE_FAIL:
+
+  return result;
+}
@@ -20,11 +20,14 @@
  */
 
 #include <config.h>
+#include <ctype.h>
+#include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include "bzenmem.h"
+#include "bzenthread.h"
 #include "bzentime.h"
 #include "bzenlog.h"
 
@@ -62,6 +65,22 @@ static bzen_loglock_t** log_locks = NULL;
 static size_t logs_used = 0;
 static size_t logs_allocated = 0;
 
+/**
+ * Pool of bzen_loglock_t structs.
+ */
+static bzen_pool_t* loglock_pool = NULL;
+static pthread_once_t loglock_pool_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Create pool of bzen_loglock_t structs (once).
+ *
+ * @return void
+ */
+static void bzen_log_pool_init()
+{
+  loglock_pool = BZEN_POOL_CREATE(bzen_loglock_t);
+}
+
 /* Report to syslog failure to access log resource. */
 static void bzen_log_handle_access_fail(const char* package,
 					const char* resource,
@@ -366,10 +385,9 @@ int bzen_log_open(const char* name, const char* attr)
   FILE* log;
   size_t log_name_size;
   size_t log_path_size;
-  size_t log_lock_size;
-  size_t actual_cbuf_allocate;
-  size_t actual_cbuf_allocate_min;
-  size_t actual_lock_allocate;
+  const bzen_mem_policy_t log_growth = { BZEN_MEM_GROW_EXACT, 0 };
+  size_t logs_required;
+  size_t capacity;
   int log_id;
   int log_find;
   int status;
@@ -389,16 +407,21 @@ int bzen_log_open(const char* name, const char* attr)
       /* Allocate memory for log names and locks. */
       log_id = -1;
       logs_allocated = BZEN_DEFAULT_NUMBER_LOGS;
-      log_names = (char**)bzen_malloc(BZEN_SIZE(sizeof(char*) * 
-						logs_allocated));
-      log_paths = (char**)bzen_malloc(BZEN_SIZE(sizeof(char*) * 
-						logs_allocated));
-      log_evtline_buffers = (char**)bzen_malloc(BZEN_SIZE(sizeof(char*) * 
-							  logs_allocated));
-      log_message_buffers = (char**)bzen_malloc(BZEN_SIZE(sizeof(char*) * 
-							  logs_allocated));
-      log_locks = (bzen_loglock_t**)bzen_malloc(BZEN_SIZE(sizeof(bzen_loglock_t*) * 
-							  logs_allocated));
+      log_names = (char**)bzen_malloc_tagged(BZEN_SIZE(sizeof(char*) * 
+						logs_allocated),
+					     BZEN_MEM_TAG_LOG);
+      log_paths = (char**)bzen_malloc_tagged(BZEN_SIZE(sizeof(char*) * 
+						logs_allocated),
+					     BZEN_MEM_TAG_LOG);
+      log_evtline_buffers = (char**)bzen_malloc_tagged(BZEN_SIZE(sizeof(char*) * 
+							  logs_allocated),
+						     BZEN_MEM_TAG_LOG);
+      log_message_buffers = (char**)bzen_malloc_tagged(BZEN_SIZE(sizeof(char*) * 
+							  logs_allocated),
+						     BZEN_MEM_TAG_LOG);
+      log_locks = (bzen_loglock_t**)bzen_malloc_tagged(BZEN_SIZE(sizeof(bzen_loglock_t*) * 
+							  logs_allocated),
+						     BZEN_MEM_TAG_LOG);
     }
   else
     {
@@ -417,46 +440,41 @@ int bzen_log_open(const char* name, const char* attr)
 	  /* No match found. Ensure there is space for new entry. */
 	  if (logs_used == logs_allocated)
 	    {
-	      /* Out of space. Grow by default size. */
-	      logs_allocated += BZEN_DEFAULT_NUMBER_LOGS;
-	      actual_cbuf_allocate = logs_allocated;
-	      actual_lock_allocate = logs_allocated;
-
-	      /* See comment below about log_locks allocated count. 
-	         We want to use minimum allocated size as upper index. */
-	      log_names = (char**)bzen_realloc(log_names,
-					       &actual_cbuf_allocate,
-					       BZEN_SIZEOF(char*));
-	      actual_cbuf_allocate_min = actual_cbuf_allocate;
-
-	      log_paths = (char**)bzen_realloc(log_paths,
-					       &actual_cbuf_allocate,
-					       BZEN_SIZEOF(char*));
-	      actual_cbuf_allocate_min = (actual_cbuf_allocate_min < actual_cbuf_allocate) ?
-		actual_cbuf_allocate_min : actual_cbuf_allocate;
-
-	      log_evtline_buffers = (char**)bzen_realloc(log_evtline_buffers,
-					       &actual_cbuf_allocate,
-					       BZEN_SIZEOF(char*));
-	      actual_cbuf_allocate_min = (actual_cbuf_allocate_min < actual_cbuf_allocate) ?
-		actual_cbuf_allocate_min : actual_cbuf_allocate;
-
-	      log_message_buffers = (char**)bzen_realloc(log_message_buffers,
-					       &actual_cbuf_allocate,
-					       BZEN_SIZEOF(char*));
-	      actual_cbuf_allocate_min = (actual_cbuf_allocate_min < actual_cbuf_allocate) ?
-		actual_cbuf_allocate_min : actual_cbuf_allocate;
-
-	      log_locks = (bzen_loglock_t**)bzen_realloc(log_locks,
-							 &actual_lock_allocate,
-							 BZEN_SIZEOF(bzen_loglock_t*));
-
-	      /* @todo: A  disparity in number of names vs. locks presents a 
-	         potentially unsafe situation. We need to correct any disparity 
-	         prior to proceeding. The gnulib xrealloc() increases block size
-	         by a factor of 1.5. At present, we simply pick smaller or two. */
-	      logs_allocated = (actual_lock_allocate < actual_cbuf_allocate_min) ?
-		actual_lock_allocate : actual_cbuf_allocate_min;
+	      /* Out of space. Grow by default size. Each array is asked for
+	         the same number of entries and comes back with at least that
+	         many, so all arrays share one capacity. */
+	      logs_required = logs_allocated + BZEN_DEFAULT_NUMBER_LOGS;
+	      capacity = logs_allocated;
+	      log_names = (char**)bzen_realloc_grow(log_names,
+						    &capacity,
+						    logs_required,
+						    BZEN_SIZEOF(char*),
+						    &log_growth);
+	      capacity = logs_allocated;
+	      log_paths = (char**)bzen_realloc_grow(log_paths,
+						    &capacity,
+						    logs_required,
+						    BZEN_SIZEOF(char*),
+						    &log_growth);
+	      capacity = logs_allocated;
+	      log_evtline_buffers = (char**)bzen_realloc_grow(log_evtline_buffers,
+							      &capacity,
+							      logs_required,
+							      BZEN_SIZEOF(char*),
+							      &log_growth);
+	      capacity = logs_allocated;
+	      log_message_buffers = (char**)bzen_realloc_grow(log_message_buffers,
+							      &capacity,
+							      logs_required,
+							      BZEN_SIZEOF(char*),
+							      &log_growth);
+	      capacity = logs_allocated;
+	      log_locks = (bzen_loglock_t**)bzen_realloc_grow(log_locks,
+							      &capacity,
+							      logs_required,
+							      BZEN_SIZEOF(bzen_loglock_t*),
+							      &log_growth);
+	      logs_allocated = logs_required;
 	    }
 	}
     }
@@ -467,7 +485,8 @@ int bzen_log_open(const char* name, const char* attr)
       /* No. Create new entry.  Allocate memory for name.  */
       log_id = logs_used++;
       log_name_size = BZEN_SIZE(sizeof(char) * strlen(name));
-      log_names[log_id] = (char*)bzen_malloc(log_name_size);
+      log_names[log_id] = (char*)bzen_malloc_tagged(log_name_size + 1,
+						    BZEN_MEM_TAG_LOG);
       memcpy(log_names[log_id], name, log_name_size);
       log_names[log_id][log_name_size] = '\0';
 
@@ -476,28 +495,31 @@ int bzen_log_open(const char* name, const char* attr)
 				   strlen(logdir) +
 				   strlen(name) +
 				   2); /* path delimiter & terminating null */
-      log_paths[log_id] = (char*)bzen_malloc(log_path_size);
+      log_paths[log_id] = (char*)bzen_malloc_tagged(log_path_size,
+						    BZEN_MEM_TAG_LOG);
       sprintf(log_paths[log_id], "%s%s%s", 
 	      logdir,
 	      BZEN_PATH_DELIMITER, 
 	      name);
 
       /* Allocate memory for string buffers. */
-      log_evtline_buffers[log_id] = (char*)bzen_malloc(BZEN_SIZE(sizeof(char) *
-								    BZEN_LOG_EVENT_LINE_MAX_CHARS));
-      log_message_buffers[log_id] = (char*)bzen_malloc(BZEN_SIZE(sizeof(char) *
-								    BZEN_LOG_MESSAGE_MAX_CHARS));
+      log_evtline_buffers[log_id] = (char*)bzen_malloc_tagged(BZEN_SIZE(sizeof(char) *
+								    BZEN_LOG_EVENT_LINE_MAX_CHARS),
+							      BZEN_MEM_TAG_LOG);
+      log_message_buffers[log_id] = (char*)bzen_malloc_tagged(BZEN_SIZE(sizeof(char) *
+								    BZEN_LOG_MESSAGE_MAX_CHARS),
+							      BZEN_MEM_TAG_LOG);
 
       /* Allocate memory for lock. */
-      log_lock_size = BZEN_SIZEOF(bzen_loglock_t);
-      log_locks[log_id] = (bzen_loglock_t*)bzen_malloc(log_lock_size);
+      pthread_once(&loglock_pool_once, bzen_log_pool_init);
+      log_locks[log_id] = (bzen_loglock_t*)bzen_pool_alloc(loglock_pool);
 
       /* Initialize the mutex. */
       status = bzen_mutex_init(&log_locks[log_id]->mutex, NULL);
       if (status != 0)
 	{
 	  bzen_free(log_names[log_id]);
-	  bzen_free(log_locks[log_id]);
+	  bzen_pool_free(loglock_pool, log_locks[log_id]);
 	  goto OPEN_FAIL;
 	}
     }
@@ -517,7 +539,7 @@ int bzen_log_open(const char* name, const char* attr)
       bzen_mutex_destroy(&log_locks[log_id]->mutex);
       bzen_free(log_names[log_id]);
       bzen_free(log_paths[log_id]);
-      bzen_free(log_locks[log_id]);
+      bzen_pool_free(loglock_pool, log_locks[log_id]);
       result = -1;
       goto OPEN_FAIL;
     }
@@ -528,7 +550,7 @@ int bzen_log_open(const char* name, const char* attr)
     {
       bzen_mutex_destroy(&log_locks[log_id]->mutex);
       bzen_free(log_names[log_id]);
-      bzen_free(log_locks[log_id]);
+      bzen_pool_free(loglock_pool, log_locks[log_id]);
       result = -1;
       goto OPEN_FAIL;
     }
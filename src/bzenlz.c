@@ -0,0 +1,333 @@
+/**
+ * @file:	bzenlz.c
+ * @brief:	Fast LZ77 block compression in the format of LZ4 blocks.
+ *
+ * @copyright:	Copyright (C) 2017 Kuhrman Technology Solutions LLC
+ * @license:	GPLv3+: GNU GPL version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdint.h>
+#include <string.h>
+#include "bzenlz.h"
+
+/**
+ * Shortest match, and largest distance back a match may start.
+ */
+#define BZEN_LZ_MIN_MATCH 4
+#define BZEN_LZ_MAX_DISTANCE 65535
+
+/**
+ * Last bytes of a block are always literals, and no match starts within
+ * the last BZEN_LZ_MATCH_LIMIT bytes (as in LZ4, so blocks decode there).
+ */
+#define BZEN_LZ_LAST_LITERALS 5
+#define BZEN_LZ_MATCH_LIMIT 12
+
+/**
+ * Bits of hash of 4 bytes; table holds last position of each hash.
+ */
+#define BZEN_LZ_HASH_BITS 12
+
+/**
+ * Lengths up to this value fit in a nibble of the token.
+ */
+#define BZEN_LZ_RUN_MASK 15
+
+/**
+ * Read 4 bytes at p in any alignment.
+ *
+ * @param[in] const unsigned char* p Bytes.
+ *
+ * @return uint32_t Value.
+ */
+static inline uint32_t bzen_lz_read32(const unsigned char* p)
+{
+  uint32_t value;
+
+  memcpy(&value, p, sizeof(value));
+
+  return value;
+}
+
+/**
+ * Hash of 4 bytes.
+ *
+ * @param[in] uint32_t value Bytes.
+ *
+ * @return unsigned int Index in hash table.
+ */
+static inline unsigned int bzen_lz_hash(uint32_t value)
+{
+  return (unsigned int)((value * 2654435761U) >> (32 - BZEN_LZ_HASH_BITS));
+}
+
+/**
+ * Write length beyond a full nibble as bytes of 255 and a remainder.
+ *
+ * @param[in] unsigned char* op Output.
+ * @param[in] size_t length Length less BZEN_LZ_RUN_MASK.
+ *
+ * @return unsigned char* Output after length.
+ */
+static unsigned char* bzen_lz_put_length(unsigned char* op, size_t length)
+{
+  while (length >= 255)
+    {
+      *op++ = 255;
+      length -= 255;
+    }
+  *op++ = (unsigned char)length;
+
+  return op;
+}
+
+/**
+ * Write sequence of literals and a match (none if length is 0).
+ *
+ * @param[in] unsigned char* op Output.
+ * @param[in] const unsigned char* oend End of output.
+ * @param[in] const unsigned char* literals Literals.
+ * @param[in] size_t n Number of literals.
+ * @param[in] size_t distance Distance back to match.
+ * @param[in] size_t length Length of match or 0 for last sequence.
+ *
+ * @return unsigned char* Output after sequence or NULL if it does not fit.
+ */
+static unsigned char* bzen_lz_put_sequence(unsigned char* op,
+					   const unsigned char* oend,
+					   const unsigned char* literals,
+					   size_t n,
+					   size_t distance,
+					   size_t length)
+{
+  unsigned char* token = op;
+  size_t match = (length > 0) ? length - BZEN_LZ_MIN_MATCH : 0;
+
+  /* Token, literal length, literals, offset and match length at worst. */
+  if ((size_t)(oend - op) < 1 + n / 255 + 1 + n + 2 + match / 255 + 1)
+    {
+      op = NULL;
+      goto PUT_FAIL;
+    }
+
+  op++;
+  if (n >= BZEN_LZ_RUN_MASK)
+    {
+      *token = BZEN_LZ_RUN_MASK << 4;
+      op = bzen_lz_put_length(op, n - BZEN_LZ_RUN_MASK);
+    }
+  else
+    {
+      *token = (unsigned char)(n << 4);
+    }
+  memcpy(op, literals, n);
+  op += n;
+
+  if (length > 0)
+    {
+      *op++ = (unsigned char)(distance & 0xff);
+      *op++ = (unsigned char)(distance >> 8);
+      if (match >= BZEN_LZ_RUN_MASK)
+	{
+	  *token |= BZEN_LZ_RUN_MASK;
+	  op = bzen_lz_put_length(op, match - BZEN_LZ_RUN_MASK);
+	}
+      else
+	{
+	  *token |= (unsigned char)match;
+	}
+    }
+
+ PUT_FAIL:
+
+  return op;
+}
+
+/* Compress n bytes at src into at most capacity bytes at dst. */
+size_t bzen_lz_compress(const void* src, size_t n, void* dst, size_t capacity)
+{
+  uint32_t table[1 << BZEN_LZ_HASH_BITS];
+  const unsigned char* base = (const unsigned char*)src;
+  const unsigned char* ip = base;
+  const unsigned char* anchor = base;
+  const unsigned char* end = base + n;
+  const unsigned char* ref;
+  unsigned char* op = (unsigned char*)dst;
+  unsigned char* oend = op + capacity;
+  size_t length;
+  uint32_t value;
+  unsigned int h;
+  size_t result = 0;
+
+  memset(table, 0, sizeof(table));
+
+  if (n > BZEN_LZ_MATCH_LIMIT)
+    {
+      while (ip < end - BZEN_LZ_MATCH_LIMIT)
+	{
+	  value = bzen_lz_read32(ip);
+	  h = bzen_lz_hash(value);
+	  ref = base + table[h];
+	  table[h] = (uint32_t)(ip - base);
+
+	  if (ref >= ip ||
+	      (size_t)(ip - ref) > BZEN_LZ_MAX_DISTANCE ||
+	      bzen_lz_read32(ref) != value)
+	    {
+	      /* Step faster through input that does not compress. */
+	      ip += 1 + ((size_t)(ip - anchor) >> 6);
+	      continue;
+	    }
+
+	  /* Extend match forward, and backward over pending literals. */
+	  length = BZEN_LZ_MIN_MATCH;
+	  while (ip + length < end - BZEN_LZ_LAST_LITERALS &&
+		 ref[length] == ip[length])
+	    {
+	      length++;
+	    }
+	  while (ip > anchor && ref > base && ip[-1] == ref[-1])
+	    {
+	      ip--;
+	      ref--;
+	      length++;
+	    }
+
+	  op = bzen_lz_put_sequence(op, oend, anchor, (size_t)(ip - anchor),
+				    (size_t)(ip - ref), length);
+	  if (op == NULL)
+	    {
+	      goto COMPRESS_FAIL;
+	    }
+	  ip += length;
+	  anchor = ip;
+	}
+    }
+
+  /* Rest is literals. */
+  op = bzen_lz_put_sequence(op, oend, anchor, (size_t)(end - anchor), 0, 0);
+  if (op == NULL)
+    {
+      goto COMPRESS_FAIL;
+    }
+  result = (size_t)(op - (unsigned char*)dst);
+
+ COMPRESS_FAIL:
+
+  return result;
+}
+
+/* Decompress block of n bytes at src into at most capacity bytes at dst. */
+ssize_t bzen_lz_decompress(const void* src,
+			   size_t n,
+			   void* dst,
+			   size_t capacity)
+{
+  const unsigned char* ip = (const unsigned char*)src;
+  const unsigned char* iend = ip + n;
+  unsigned char* op = (unsigned char*)dst;
+  unsigned char* oend = op + capacity;
+  const unsigned char* ref;
+  size_t literals, length, distance;
+  unsigned char token, b;
+  ssize_t result = -1;
+
+  while (ip < iend)
+    {
+      token = *ip++;
+
+      /* Literals. */
+      literals = token >> 4;
+      if (literals == BZEN_LZ_RUN_MASK)
+	{
+	  do
+	    {
+	      if (ip >= iend)
+		{
+		  goto DECOMPRESS_FAIL;
+		}
+	      b = *ip++;
+	      literals += b;
+	    }
+	  while (b == 255);
+	}
+      if (literals > (size_t)(iend - ip) || literals > (size_t)(oend - op))
+	{
+	  goto DECOMPRESS_FAIL;
+	}
+      memcpy(op, ip, literals);
+      ip += literals;
+      op += literals;
+
+      /* Last sequence has no match. */
+      if (ip == iend)
+	{
+	  break;
+	}
+
+      /* Match. */
+      if (iend - ip < 2)
+	{
+	  goto DECOMPRESS_FAIL;
+	}
+      distance = (size_t)ip[0] | ((size_t)ip[1] << 8);
+      ip += 2;
+      if (distance == 0 || distance > (size_t)(op - (unsigned char*)dst))
+	{
+	  goto DECOMPRESS_FAIL;
+	}
+      length = token & BZEN_LZ_RUN_MASK;
+      if (length == BZEN_LZ_RUN_MASK)
+	{
+	  do
+	    {
+	      if (ip >= iend)
+		{
+		  goto DECOMPRESS_FAIL;
+		}
+	      b = *ip++;
+	      length += b;
+	    }
+	  while (b == 255);
+	}
+      length += BZEN_LZ_MIN_MATCH;
+      if (length > (size_t)(oend - op))
+	{
+	  goto DECOMPRESS_FAIL;
+	}
+
+      /* Overlapping matches repeat the bytes just written. */
+      ref = op - distance;
+      if (distance >= length)
+	{
+	  memcpy(op, ref, length);
+	  op += length;
+	}
+      else
+	{
+	  while (length-- > 0)
+	    {
+	      *op++ = *ref++;
+	    }
+	}
+    }
+  result = (ssize_t)(op - (unsigned char*)dst);
+
+ DECOMPRESS_FAIL:
+
+  return result;
+}
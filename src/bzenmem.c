@@ -21,70 +21,2136 @@
 
 #include <config.h>
 #include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef HAVE_EXECINFO_H
+#include <execinfo.h>
+#endif
 #include "xalloc.h"
+#include "bzenthread.h"
 #include "bzenmem.h"
 
+/**
+ * Default size in bytes of data area of arena chunks.
+ */
+const size_t BZEN_ARENA_DEFAULT_CHUNK_SIZE = 65536;
+#define BZEN_ARENA_DEFAULT_CHUNK_SIZE BZEN_ARENA_DEFAULT_CHUNK_SIZE
+
+/**
+ * Default number of objects carved out of arena per pool slab.
+ */
+const size_t BZEN_POOL_DEFAULT_OBJECTS_PER_SLAB = 64;
+#define BZEN_POOL_DEFAULT_OBJECTS_PER_SLAB BZEN_POOL_DEFAULT_OBJECTS_PER_SLAB
+
+/**
+ * Maximum number of free objects held in a per-thread pool cache. Half a 
+ * cache is exchanged with the shared free list when it runs empty or full.
+ */
+const size_t BZEN_POOL_CACHE_SIZE = 32;
+#define BZEN_POOL_CACHE_SIZE BZEN_POOL_CACHE_SIZE
+
+/**
+ * Free pool objects store the link to the next free object in first word.
+ */
+#define BZEN_POOL_NEXT(obj) (*(void**)(obj))
+
+/**
+ * Usable sizes of blocks in bzen_malloc() magazines.
+ */
+static const size_t bzen_mem_class_sizes[] =
+  {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256, 320, 384, 448, 512,
+    640, 768, 896, 1024
+  };
+#define BZEN_MEM_N_CLASSES \
+  (sizeof(bzen_mem_class_sizes) / sizeof(bzen_mem_class_sizes[0]))
+
+/**
+ * Size class granularity in bytes (smallest class size).
+ */
+#define BZEN_MEM_CLASS_GRANULE 16
+
+/**
+ * Size class of blocks allocated straight from the heap.
+ */
+#define BZEN_MEM_CLASS_LARGE 0xFFFF
+
+/**
+ * Size class of blocks with a mapping of their own.
+ */
+#define BZEN_MEM_CLASS_MAPPED 0xFFFE
+
+/**
+ * Size classes of heap blocks aligned beyond BZEN_MEM_ALIGNMENT. Low byte is
+ * log2 of alignment, which is also the offset of the block from the start of
+ * its heap allocation.
+ */
+#define BZEN_MEM_CLASS_ALIGNED 0xFE00
+#define BZEN_MEM_CLASS_IS_ALIGNED(c) (((c) & 0xFF00) == BZEN_MEM_CLASS_ALIGNED)
+#define BZEN_MEM_CLASS_ALIGNMENT(c) ((size_t)1 << ((c) & 0xFF))
+
+/**
+ * Size classes of debug allocator: blocks with redzones on the heap, blocks
+ * against a guard page and blocks in quarantine.
+ */
+#define BZEN_MEM_CLASS_DEBUG 0xFFFD
+#define BZEN_MEM_CLASS_GUARDED 0xFFFC
+#define BZEN_MEM_CLASS_FREED 0xFFFB
+
+/**
+ * Debug allocator patterns, size of each redzone (keeps block alignment) and
+ * limits of quarantine.
+ */
+#define BZEN_MEM_REDZONE_BYTE 0xFA
+#define BZEN_MEM_ALLOC_BYTE 0xAB
+#define BZEN_MEM_FREE_BYTE 0xDD
+#define BZEN_MEM_REDZONE_SIZE 32
+#define BZEN_MEM_QUARANTINE_SLOTS 4096
+#define BZEN_MEM_QUARANTINE_BYTES (64 * 1024 * 1024)
+
+/**
+ * Node argument of bzen_mem_map() for no memory policy.
+ */
+#define BZEN_MEM_NODE_NONE (-2)
+
+/**
+ * Memory policy mode of mbind(2) and set_mempolicy(2) (see numaif.h).
+ */
+#define BZEN_MEM_MPOL_PREFERRED 1
+
+/**
+ * Size in bytes of a magazine slab (approximate).
+ */
+#define BZEN_MEM_MAGAZINE_SLAB_SIZE 16384
+
+/**
+ * Initial allocation of bzen_realloc() when called with p NULL and pn 0.
+ */
+#define BZEN_MEM_REALLOC_DEFAULT_SIZE 128
+
+/**
+ * Growth factor in percent of bzen_realloc_grow() without a policy.
+ */
+#define BZEN_MEM_GROW_DEFAULT_FACTOR 150
+
+/**
+ * Magazines (one pool per size class) and size class lookup by granule.
+ */
+static bzen_pool_t* bzen_mem_magazines[BZEN_MEM_N_CLASSES];
+static unsigned char bzen_mem_class_index[BZEN_MEM_MAGAZINE_MAX / 
+					  BZEN_MEM_CLASS_GRANULE + 1];
+static pthread_once_t bzen_mem_magazines_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Size of a page in bytes and kind of pages backing new arenas, set from
+ * environment once.
+ */
+static size_t bzen_mem_page_size = 4096;
+static bzen_mem_pages_t bzen_mem_default_pages = BZEN_MEM_PAGES_DEFAULT;
+static pthread_once_t bzen_mem_config_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Debug allocator checks and quarantine of freed blocks (oldest first).
+ */
+#ifndef BZEN_MEM_DEBUG_DEFAULT
+#define BZEN_MEM_DEBUG_DEFAULT 0
+#endif
+static unsigned int bzen_mem_debug = BZEN_MEM_DEBUG_DEFAULT;
+static bzen_mem_header_t* bzen_mem_quarantine[BZEN_MEM_QUARANTINE_SLOTS];
+static size_t bzen_mem_quarantine_first = 0;
+static size_t bzen_mem_quarantine_count = 0;
+static size_t bzen_mem_quarantine_bytes = 0;
+static pthread_mutex_t bzen_mem_quarantine_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Names of tags as printed by bzen_malloc_print_stats().
+ */
+static const char* bzen_mem_tag_names[BZEN_MEM_TAG_COUNT] =
+  {
+    "other", "sbuf", "log", "sock", "yaml", "stream"
+  };
+
+/**
+ * Allocation counters per tag plus one for total. Each set of counters has a
+ * cache line of its own so subsystems do not contend with each other.
+ */
+typedef struct _bzen_mem_counter_s
+{
+  bzen_mem_stats_t stats;
+} __attribute__((aligned(BZEN_MEM_CACHE_LINE))) bzen_mem_counter_t;
+
+static bzen_mem_counter_t bzen_mem_counters[BZEN_MEM_TAG_COUNT + 1];
+
+/**
+ * Bytes of memory held by arena chunks (includes pools and magazines) and 
+ * part of it mapped for huge pages.
+ */
+static size_t bzen_mem_arena_reserved = 0;
+static size_t bzen_mem_arena_huge = 0;
+
+/**
+ * Maximum number of frames recorded per sampled allocation and number of 
+ * frames belonging to bzenmem itself, which are dropped.
+ */
+#define BZEN_MEM_PROFILE_MAX_DEPTH 32
+#define BZEN_MEM_PROFILE_SKIP_DEPTH 2
+
+/**
+ * Number of hash buckets of allocation profile.
+ */
+#define BZEN_MEM_PROFILE_BUCKETS 1024
+
+/**
+ * Call site of sampled allocations (one distinct stack).
+ */
+typedef struct _bzen_mem_site_s
+{
+  struct _bzen_mem_site_s* next;
+  size_t hash;
+  size_t samples;
+  size_t bytes;
+  int depth;
+  void* frames[BZEN_MEM_PROFILE_MAX_DEPTH];
+} bzen_mem_site_t;
+
+/**
+ * Allocation profile. Sampling is off while interval is 0. Each thread counts
+ * down bytes allocated until it takes its next sample.
+ */
+static size_t bzen_mem_sample_interval = 0;
+static __thread size_t bzen_mem_sample_countdown = 0;
+static bzen_mem_site_t* bzen_mem_sites[BZEN_MEM_PROFILE_BUCKETS];
+static pthread_mutex_t bzen_mem_sites_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Round n up to next multiple of a (a must be a power of two).
+ */
+#define BZEN_MEM_ALIGN_UP(n, a) (((n) + ((a) - 1)) & ~((a) - 1))
+
+/**
+ * Size of chunk header, padded so data area is aligned.
+ */
+#define BZEN_ARENA_CHUNK_HEADER_SIZE \
+  BZEN_MEM_ALIGN_UP(sizeof(bzen_arena_chunk_t), BZEN_MEM_ALIGNMENT)
+
+/**
+ * Address of data area of given chunk.
+ */
+#define BZEN_ARENA_CHUNK_DATA(chunk) \
+  ((char*)(chunk) + BZEN_ARENA_CHUNK_HEADER_SIZE)
+
+/**
+ * Size of bzen_malloc() block header, padded so block is aligned.
+ */
+#define BZEN_MEM_HEADER_SIZE \
+  BZEN_MEM_ALIGN_UP(sizeof(bzen_mem_header_t), BZEN_MEM_ALIGNMENT)
+
+/**
+ * Header of given bzen_malloc() block.
+ */
+#define BZEN_MEM_HEADER(ptr) \
+  ((bzen_mem_header_t*)((char*)(ptr) - BZEN_MEM_HEADER_SIZE))
+
+/**
+ * Raise high-water mark to live if greater.
+ *
+ * @param[in,out] size_t* peak High-water mark.
+ * @param[in] size_t live Current value.
+ *
+ * @return void
+ */
+static void bzen_mem_count_peak(size_t* peak, size_t live)
+{
+  size_t current;
+
+  current = __atomic_load_n(peak, __ATOMIC_RELAXED);
+  while ((live > current) &&
+	 !__atomic_compare_exchange_n(peak, &current, live, 1,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+      /* current was reloaded, try again. */
+    }
+}
+
+/**
+ * Account allocation of size bytes to tag and total.
+ *
+ * @param[in] unsigned int tag Owner of block.
+ * @param[in] size_t size Usable size of block.
+ *
+ * @return void
+ */
+static void bzen_mem_count_alloc(unsigned int tag, size_t size)
+{
+  bzen_mem_stats_t* stats;
+  size_t live;
+
+  stats = &bzen_mem_counters[tag].stats;
+  live = __atomic_add_fetch(&stats->live_bytes, size, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stats->allocs, 1, __ATOMIC_RELAXED);
+  bzen_mem_count_peak(&stats->peak_bytes, live);
+
+  stats = &bzen_mem_counters[BZEN_MEM_TAG_COUNT].stats;
+  live = __atomic_add_fetch(&stats->live_bytes, size, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stats->allocs, 1, __ATOMIC_RELAXED);
+  bzen_mem_count_peak(&stats->peak_bytes, live);
+}
+
+/**
+ * Account release of size bytes from tag and total.
+ *
+ * @param[in] unsigned int tag Owner of block.
+ * @param[in] size_t size Usable size of block.
+ *
+ * @return void
+ */
+static void bzen_mem_count_free(unsigned int tag, size_t size)
+{
+  bzen_mem_stats_t* stats;
+
+  stats = &bzen_mem_counters[tag].stats;
+  __atomic_sub_fetch(&stats->live_bytes, size, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stats->frees, 1, __ATOMIC_RELAXED);
+
+  stats = &bzen_mem_counters[BZEN_MEM_TAG_COUNT].stats;
+  __atomic_sub_fetch(&stats->live_bytes, size, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stats->frees, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Add samples to profile under given call stack.
+ *
+ * @param[in] void** frames Return addresses, innermost first.
+ * @param[in] int depth Number of frames.
+ * @param[in] size_t samples Number of samples taken.
+ * @param[in] size_t bytes Bytes represented by samples.
+ *
+ * @return void
+ */
+static void bzen_mem_sample_record(void** frames, int depth, 
+				   size_t samples, size_t bytes)
+{
+  bzen_mem_site_t* site;
+  size_t hash = 0;
+  int frame;
+
+  for (frame = 0; frame < depth; frame++)
+    {
+      hash = (hash ^ (size_t)(uintptr_t)frames[frame]) * (size_t)0x100000001b3ULL;
+    }
+
+  pthread_mutex_lock(&bzen_mem_sites_mutex);
+
+  for (site = bzen_mem_sites[hash % BZEN_MEM_PROFILE_BUCKETS]; 
+       site != NULL; 
+       site = site->next)
+    {
+      if ((site->hash == hash) && (site->depth == depth) &&
+	  (memcmp(site->frames, frames, depth * sizeof(void*)) == 0))
+	{
+	  break;
+	}
+    }
+
+  if (site == NULL)
+    {
+      /* First sample of this stack. Not allocated by bzen_malloc() lest 
+	 profiling recurse. */
+      site = (bzen_mem_site_t*)xmalloc(BZEN_SIZEOF(bzen_mem_site_t));
+      site->hash = hash;
+      site->samples = 0;
+      site->bytes = 0;
+      site->depth = depth;
+      memcpy(site->frames, frames, depth * sizeof(void*));
+      site->next = bzen_mem_sites[hash % BZEN_MEM_PROFILE_BUCKETS];
+      bzen_mem_sites[hash % BZEN_MEM_PROFILE_BUCKETS] = site;
+    }
+  site->samples += samples;
+  site->bytes += bytes;
+
+  pthread_mutex_unlock(&bzen_mem_sites_mutex);
+}
+
+/**
+ * Count size bytes against sampling interval and take a sample for every
+ * interval bytes allocated by calling thread.
+ *
+ * Each sample stands for interval bytes, so totals per call site are 
+ * unbiased estimates of bytes allocated there. Never inlined, so the stack 
+ * always starts with this function and bzen_malloc_tagged(), which are 
+ * dropped from the sample.
+ *
+ * @param[in] size_t size Usable size of block allocated.
+ * @param[in] size_t interval Sampling interval in bytes.
+ *
+ * @return void
+ */
+static void __attribute__((noinline)) 
+bzen_mem_sample(size_t size, size_t interval)
+{
+  void* frames[BZEN_MEM_PROFILE_MAX_DEPTH + BZEN_MEM_PROFILE_SKIP_DEPTH];
+  size_t samples;
+  int depth = 0;
+
+  if ((bzen_mem_sample_countdown == 0) || 
+      (bzen_mem_sample_countdown > interval))
+    {
+      /* First allocation of thread or interval lowered. */
+      bzen_mem_sample_countdown = interval;
+    }
+
+  if (size < bzen_mem_sample_countdown)
+    {
+      bzen_mem_sample_countdown -= size;
+      goto SAMPLE_DONE;
+    }
+
+  samples = 1 + (size - bzen_mem_sample_countdown) / interval;
+  bzen_mem_sample_countdown = interval - 
+    (size - bzen_mem_sample_countdown) % interval;
+
+#ifdef HAVE_EXECINFO_H
+  depth = backtrace(frames, BZEN_MEM_PROFILE_MAX_DEPTH + 
+		    BZEN_MEM_PROFILE_SKIP_DEPTH);
+#endif
+  depth = (depth > BZEN_MEM_PROFILE_SKIP_DEPTH) ? 
+    depth - BZEN_MEM_PROFILE_SKIP_DEPTH : 0;
+  bzen_mem_sample_record(frames + BZEN_MEM_PROFILE_SKIP_DEPTH, depth, 
+			 samples, samples * interval);
+
+ SAMPLE_DONE:
+
+  return;
+}
+
+/**
+ * Map memory for an arena chunk of chunk_size bytes on huge pages.
+ *
+ * Length is rounded up to whole huge pages. Reserved huge pages are tried
+ * first for BZEN_MEM_PAGES_HUGETLB. Otherwise the mapping is aligned to a huge
+ * page boundary and advised MADV_HUGEPAGE, which the kernel ignores where
+ * transparent huge pages are disabled.
+ *
+ * @param[in] size_t chunk_size Size of chunk including header in bytes.
+ * @param[in] bzen_mem_pages_t pages Kind of pages.
+ *
+ * @return bzen_arena_chunk_t* Chunk with size and mapped set or NULL.
+ */
+static bzen_arena_chunk_t* bzen_arena_chunk_map(size_t chunk_size, 
+						bzen_mem_pages_t pages)
+{
+  bzen_arena_chunk_t* chunk = NULL;
+  uintptr_t aligned;
+  size_t length;
+  char* ptr = MAP_FAILED;
+  char* raw;
+
+  length = xsum(chunk_size, BZEN_MEM_HUGEPAGE_SIZE - 1);
+  if (size_overflow_p(xsum(length, BZEN_MEM_HUGEPAGE_SIZE)))
+    {
+      goto MAP_FAIL;
+    }
+  length -= length % BZEN_MEM_HUGEPAGE_SIZE;
+
+#ifdef MAP_HUGETLB
+  if (pages == BZEN_MEM_PAGES_HUGETLB)
+    {
+      ptr = (char*)mmap(NULL, length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+
+  if (ptr == MAP_FAILED)
+    {
+      /* Map one huge page extra and trim to a huge page boundary. */
+      raw = (char*)mmap(NULL, length + BZEN_MEM_HUGEPAGE_SIZE, 
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, 
+			-1, 0);
+      if (raw == MAP_FAILED)
+	{
+	  goto MAP_FAIL;
+	}
+      aligned = BZEN_MEM_ALIGN_UP((uintptr_t)raw, (uintptr_t)BZEN_MEM_HUGEPAGE_SIZE);
+      ptr = (char*)aligned;
+      if (ptr > raw)
+	{
+	  munmap(raw, ptr - raw);
+	}
+      if (ptr + length < raw + length + BZEN_MEM_HUGEPAGE_SIZE)
+	{
+	  munmap(ptr + length, (raw + BZEN_MEM_HUGEPAGE_SIZE) - ptr);
+	}
+#ifdef MADV_HUGEPAGE
+      madvise(ptr, length, MADV_HUGEPAGE);
+#endif
+    }
+
+  chunk = (bzen_arena_chunk_t*)ptr;
+  chunk->size = length - BZEN_ARENA_CHUNK_HEADER_SIZE;
+  chunk->mapped = length;
+  __atomic_add_fetch(&bzen_mem_arena_huge, length, __ATOMIC_RELAXED);
+
+ MAP_FAIL:
+
+  return chunk;
+}
+
+/**
+ * Allocate a new arena chunk with a data area of at least given size.
+ *
+ * Chunks on huge pages get all of the rounded up mapping as data area. If 
+ * huge pages cannot be mapped chunk falls back to the heap.
+ *
+ * @param[in] size_t size Size of data area in bytes.
+ * @param[in] bzen_mem_pages_t pages Kind of pages.
+ *
+ * @return bzen_arena_chunk_t* Pointer to new chunk or NULL.
+ */
+static bzen_arena_chunk_t* bzen_arena_chunk_new(size_t size, 
+						bzen_mem_pages_t pages)
+{
+  bzen_arena_chunk_t* chunk = NULL;
+  size_t chunk_size;
+
+  chunk_size = xsum(BZEN_ARENA_CHUNK_HEADER_SIZE, size);
+  if (size_overflow_p(chunk_size))
+    {
+      goto CHUNK_FAIL;
+    }
+
+  if (pages != BZEN_MEM_PAGES_DEFAULT)
+    {
+      chunk = bzen_arena_chunk_map(chunk_size, pages);
+    }
+
+  if (chunk == NULL)
+    {
+      chunk = (bzen_arena_chunk_t*)xmalloc(chunk_size);
+      if (chunk == NULL)
+	{
+	  goto CHUNK_FAIL;
+	}
+      chunk->size = size;
+      chunk->mapped = 0;
+    }
+
+  chunk->next = NULL;
+  chunk->used = 0;
+  __atomic_add_fetch(&bzen_mem_arena_reserved, 
+		     BZEN_ARENA_CHUNK_HEADER_SIZE + chunk->size, 
+		     __ATOMIC_RELAXED);
+
+ CHUNK_FAIL:
+
+  return chunk;
+}
+
+/**
+ * Carve n bytes on given alignment out of chunk if there is room.
+ *
+ * @param[in,out] bzen_arena_chunk_t* chunk Chunk to allocate from.
+ * @param[in] size_t n Size of block in bytes.
+ * @param[in] size_t alignment Power of two.
+ *
+ * @return void* Pointer to block or NULL if chunk is too full.
+ */
+static void* bzen_arena_chunk_alloc(bzen_arena_chunk_t* chunk,
+				    size_t n,
+				    size_t alignment)
+{
+  uintptr_t base;
+  uintptr_t start;
+  size_t offset;
+  void* ptr = NULL;
+
+  base = (uintptr_t)BZEN_ARENA_CHUNK_DATA(chunk);
+  start = BZEN_MEM_ALIGN_UP(base + chunk->used, (uintptr_t)alignment);
+  offset = (size_t)(start - base);
+  if ((offset <= chunk->size) && (n <= chunk->size - offset))
+    {
+      chunk->used = offset + n;
+      ptr = (void*)start;
+    }
+
+  return ptr;
+}
+
+/**
+ * Free a list of arena chunks.
+ *
+ * @param[in,out] bzen_arena_chunk_t* chunk First chunk in list.
+ *
+ * @return void
+ */
+static void bzen_arena_chunk_free_list(bzen_arena_chunk_t* chunk)
+{
+  bzen_arena_chunk_t* next;
+
+  while (chunk != NULL)
+    {
+      next = chunk->next;
+      __atomic_sub_fetch(&bzen_mem_arena_reserved,
+			 BZEN_ARENA_CHUNK_HEADER_SIZE + chunk->size,
+			 __ATOMIC_RELAXED);
+      if (chunk->mapped > 0)
+	{
+	  __atomic_sub_fetch(&bzen_mem_arena_huge, chunk->mapped, 
+			     __ATOMIC_RELAXED);
+	  munmap(chunk, chunk->mapped);
+	}
+      else
+	{
+	  free(chunk);
+	}
+      chunk = next;
+    }
+}
+
+/**
+ * Set memory policy preferring node for range of pages or calling thread.
+ *
+ * An empty node mask asks for the node of the faulting thread.
+ *
+ * @param[in] void* addr Start of range or NULL for calling thread.
+ * @param[in] size_t length Length of range in bytes.
+ * @param[in] int node NUMA node or BZEN_MEM_NODE_LOCAL.
+ *
+ * @return int 0 on success otherwise -1 and errno is set.
+ */
+static int bzen_mem_set_policy(void* addr, size_t length, int node)
+{
+  unsigned long nodemask[BZEN_MEM_MAX_NODES / (8 * sizeof(unsigned long))];
+  unsigned long maxnode = 0;
+  int result = -1;
+
+  if ((node < BZEN_MEM_NODE_LOCAL) || (node >= BZEN_MEM_MAX_NODES))
+    {
+      errno = EINVAL;
+      goto POLICY_FAIL;
+    }
+
+  memset(nodemask, 0, sizeof(nodemask));
+  if (node != BZEN_MEM_NODE_LOCAL)
+    {
+      nodemask[node / (8 * sizeof(unsigned long))] |= 
+	1UL << (node % (8 * sizeof(unsigned long)));
+      /* Kernel reads maxnode - 1 bits. */
+      maxnode = BZEN_MEM_MAX_NODES + 1;
+    }
+
+#if defined(SYS_mbind) && defined(SYS_set_mempolicy)
+  if (addr != NULL)
+    {
+      result = (int)syscall(SYS_mbind, addr, length, BZEN_MEM_MPOL_PREFERRED,
+			    (maxnode > 0) ? nodemask : NULL, maxnode, 0);
+    }
+  else
+    {
+      result = (int)syscall(SYS_set_mempolicy, BZEN_MEM_MPOL_PREFERRED,
+			    (maxnode > 0) ? nodemask : NULL, maxnode);
+    }
+#else
+  errno = ENOSYS;
+#endif
+
+ POLICY_FAIL:
+
+  return result;
+}
+
+/**
+ * Map a block with room for size bytes.
+ *
+ * Mapping is rounded up to whole pages, the slack is usable. Memory policy
+ * is set before header touches the first page.
+ *
+ * @param[in] size_t size Required size in bytes.
+ * @param[in] int node NUMA node, BZEN_MEM_NODE_LOCAL or BZEN_MEM_NODE_NONE.
+ *
+ * @return bzen_mem_header_t* Header of mapped block.
+ */
+static bzen_mem_header_t* bzen_mem_map(size_t size, int node)
+{
+  bzen_mem_header_t* header;
+  size_t length;
+
+  length = xsum3(BZEN_MEM_HEADER_SIZE, size, bzen_mem_page_size - 1);
+  if (size_overflow_p(length))
+    {
+      xalloc_die();
+    }
+  length -= length % bzen_mem_page_size;
+
+  header = (bzen_mem_header_t*)mmap(NULL, length, PROT_READ | PROT_WRITE, 
+				    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (header == MAP_FAILED)
+    {
+      xalloc_die();
+    }
+  if (node != BZEN_MEM_NODE_NONE)
+    {
+      /* Best effort, placement is only a hint. */
+      bzen_mem_set_policy(header, length, node);
+    }
+  header->size = length - BZEN_MEM_HEADER_SIZE;
+  header->size_class = BZEN_MEM_CLASS_MAPPED;
+
+  return header;
+}
+
+/**
+ * Resize mapped block to room for size bytes.
+ *
+ * Pages move to their new address without being copied where mremap() is 
+ * available.
+ *
+ * @param[in] bzen_mem_header_t* header Header of mapped block.
+ * @param[in] size_t size Required size in bytes.
+ *
+ * @return bzen_mem_header_t* Header of block, which may have moved.
+ */
+static bzen_mem_header_t* bzen_mem_remap(bzen_mem_header_t* header, size_t size)
+{
+  size_t old_length;
+  size_t length;
+
+  old_length = BZEN_MEM_HEADER_SIZE + header->size;
+  length = xsum3(BZEN_MEM_HEADER_SIZE, size, bzen_mem_page_size - 1);
+  if (size_overflow_p(length))
+    {
+      xalloc_die();
+    }
+  length -= length % bzen_mem_page_size;
+
+#ifdef HAVE_MREMAP
+  header = (bzen_mem_header_t*)mremap(header, old_length, length, 
+				      MREMAP_MAYMOVE);
+  if (header == MAP_FAILED)
+    {
+      xalloc_die();
+    }
+  header->size = length - BZEN_MEM_HEADER_SIZE;
+#else
+  {
+    bzen_mem_header_t* old_header = header;
+
+    header = bzen_mem_map(size, BZEN_MEM_NODE_NONE);
+    memcpy(header, old_header, (length < old_length) ? length : old_length);
+    header->size = length - BZEN_MEM_HEADER_SIZE;
+    munmap(old_header, old_length);
+  }
+#endif
+
+  return header;
+}
+
+/**
+ * Allocate n bytes on alignment boundary on behalf of tag.
+ *
+ * @param[in] size_t n Size of block in bytes.
+ * @param[in] size_t alignment Power of two.
+ * @param[in] unsigned int tag Owner of block.
+ *
+ * @return void* Pointer to block or NULL if alignment is invalid.
+ */
+static void* bzen_mem_alloc_aligned(size_t n, size_t alignment, unsigned int tag)
+{
+  bzen_mem_header_t* header;
+  size_t interval;
+  size_t shift;
+  void* raw;
+  void* ptr = NULL;
+  int status;
+
+  if ((alignment == 0) || ((alignment & (alignment - 1)) != 0))
+    {
+      goto ALIGNED_FAIL;
+    }
+
+  if (alignment <= BZEN_MEM_ALIGNMENT)
+    {
+      /* Every block is aligned this far. */
+      ptr = bzen_malloc_tagged(n, (bzen_mem_tag_t)tag);
+      goto ALIGNED_FAIL;
+    }
+
+  /* Block starts one alignment into the allocation, which leaves room for
+     header in front of it. */
+  if (size_overflow_p(xsum(alignment, n)))
+    {
+      xalloc_die();
+    }
+  status = posix_memalign(&raw, alignment, alignment + n);
+  if (status != 0)
+    {
+      xalloc_die();
+    }
+  for (shift = 0; ((size_t)1 << shift) < alignment; shift++)
+    {
+      /* log2 of alignment. */
+    }
+
+  ptr = (char*)raw + alignment;
+  header = BZEN_MEM_HEADER(ptr);
+  header->size = n;
+  header->size_class = (unsigned short int)(BZEN_MEM_CLASS_ALIGNED | shift);
+  header->tag = (unsigned short int)tag;
+  bzen_mem_count_alloc(header->tag, header->size);
+
+  interval = __atomic_load_n(&bzen_mem_sample_interval, __ATOMIC_RELAXED);
+  if (interval != 0)
+    {
+      bzen_mem_sample(header->size, interval);
+    }
+
+ ALIGNED_FAIL:
+
+  return ptr;
+}
+
+/**
+ * Report corruption of a debug block and abort program.
+ *
+ * @param[in] const char* what Kind of corruption.
+ * @param[in] bzen_mem_header_t* header Header of block.
+ * @param[in] size_t offset Offset of first bad byte from start of block.
+ *
+ * @return void (does not return)
+ */
+static void bzen_mem_debug_report(const char* what, 
+				  bzen_mem_header_t* header, 
+				  size_t offset)
+{
+  fprintf(stderr, "bzenmem: %s at offset %zd of block %p of %zu bytes\n",
+	  what, (ssize_t)offset, (char*)header + BZEN_MEM_HEADER_SIZE, 
+	  header->size);
+  abort();
+}
+
+/**
+ * Verify n bytes at ptr hold pattern.
+ *
+ * @param[in] const unsigned char* ptr Start of range.
+ * @param[in] size_t n Length of range.
+ * @param[in] unsigned char pattern Expected byte.
+ *
+ * @return size_t Offset of first byte not matching or n.
+ */
+static size_t bzen_mem_debug_scan(const unsigned char* ptr, 
+				  size_t n, 
+				  unsigned char pattern)
+{
+  size_t offset;
+
+  for (offset = 0; (offset < n) && (ptr[offset] == pattern); offset++)
+    {
+      /* Scan. */
+    }
+
+  return offset;
+}
+
+/**
+ * Verify redzones of debug block or slack of guarded block.
+ *
+ * @param[in] bzen_mem_header_t* header Header of block.
+ *
+ * @return void
+ */
+static void bzen_mem_debug_check(bzen_mem_header_t* header)
+{
+  unsigned char* data;
+  size_t back;
+  size_t offset;
+
+  data = (unsigned char*)header + BZEN_MEM_HEADER_SIZE;
+  if (header->size_class == BZEN_MEM_CLASS_DEBUG)
+    {
+      offset = bzen_mem_debug_scan((unsigned char*)header - BZEN_MEM_REDZONE_SIZE,
+				   BZEN_MEM_REDZONE_SIZE, BZEN_MEM_REDZONE_BYTE);
+      if (offset < BZEN_MEM_REDZONE_SIZE)
+	{
+	  bzen_mem_debug_report("buffer underflow", header, 
+				offset - BZEN_MEM_REDZONE_SIZE - BZEN_MEM_HEADER_SIZE);
+	}
+      back = BZEN_MEM_REDZONE_SIZE;
+    }
+  else
+    {
+      /* Guarded block ends at page boundary rounded to alignment. */
+      back = BZEN_MEM_ALIGN_UP(header->size, BZEN_MEM_ALIGNMENT) - header->size;
+    }
+
+  offset = bzen_mem_debug_scan(data + header->size, back, BZEN_MEM_REDZONE_BYTE);
+  if (offset < back)
+    {
+      bzen_mem_debug_report("buffer overflow", header, header->size + offset);
+    }
+}
+
+/**
+ * Allocate n bytes in debug layout for given checks.
+ *
+ * Blocks of a page or more get a mapping of their own which ends in a 
+ * PROT_NONE page, with block placed right against it. Other blocks come from
+ * the heap with a redzone in front of header and one after data.
+ *
+ * @param[in] size_t n Size of block in bytes.
+ * @param[in] unsigned int flags Checks.
+ *
+ * @return bzen_mem_header_t* Header of block or NULL if no layout applies.
+ */
+static bzen_mem_header_t* bzen_mem_debug_alloc(size_t n, unsigned int flags)
+{
+  bzen_mem_header_t* header = NULL;
+  unsigned char* base;
+  size_t rounded;
+  size_t length;
+
+  if (size_overflow_p(xsum(n, BZEN_MEM_ALIGNMENT)))
+    {
+      xalloc_die();
+    }
+  rounded = BZEN_MEM_ALIGN_UP(n, BZEN_MEM_ALIGNMENT);
+  if ((flags & BZEN_MEM_DEBUG_GUARD) && (n >= bzen_mem_page_size))
+    {
+      length = xsum3(BZEN_MEM_HEADER_SIZE, rounded, bzen_mem_page_size - 1);
+      if (size_overflow_p(xsum(length, bzen_mem_page_size)))
+	{
+	  xalloc_die();
+	}
+      length -= length % bzen_mem_page_size;
+      base = (unsigned char*)mmap(NULL, length + bzen_mem_page_size, 
+				  PROT_READ | PROT_WRITE, 
+				  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (base == MAP_FAILED)
+	{
+	  xalloc_die();
+	}
+      mprotect(base + length, bzen_mem_page_size, PROT_NONE);
+      header = (bzen_mem_header_t*)(base + length - rounded - BZEN_MEM_HEADER_SIZE);
+      header->size_class = BZEN_MEM_CLASS_GUARDED;
+    }
+  else if (flags & (BZEN_MEM_DEBUG_REDZONE | BZEN_MEM_DEBUG_POISON))
+    {
+      length = xsum3(2 * BZEN_MEM_REDZONE_SIZE, BZEN_MEM_HEADER_SIZE, n);
+      if (size_overflow_p(length))
+	{
+	  xalloc_die();
+	}
+      base = (unsigned char*)xmalloc(length);
+      memset(base, BZEN_MEM_REDZONE_BYTE, BZEN_MEM_REDZONE_SIZE);
+      header = (bzen_mem_header_t*)(base + BZEN_MEM_REDZONE_SIZE);
+      header->size_class = BZEN_MEM_CLASS_DEBUG;
+      rounded = n + BZEN_MEM_REDZONE_SIZE;
+    }
+  else
+    {
+      goto DEBUG_DONE;
+    }
+
+  /* Pattern behind data, then data itself. */
+  header->size = n;
+  base = (unsigned char*)header + BZEN_MEM_HEADER_SIZE;
+  memset(base + n, BZEN_MEM_REDZONE_BYTE, rounded - n);
+  if (flags & BZEN_MEM_DEBUG_POISON)
+    {
+      memset(base, BZEN_MEM_ALLOC_BYTE, n);
+    }
+
+ DEBUG_DONE:
+
+  return header;
+}
+
+/**
+ * Release debug block after verifying it.
+ *
+ * Guarded blocks are unmapped, so later access faults. With poisoning on, 
+ * blocks with redzones are filled with a pattern and held in quarantine; a 
+ * block leaving quarantine is verified for writes made after it was freed.
+ *
+ * @param[in] bzen_mem_header_t* header Header of block.
+ *
+ * @return void
+ */
+static void bzen_mem_debug_free(bzen_mem_header_t* header)
+{
+  bzen_mem_header_t* evicted;
+  uintptr_t base;
+  size_t offset;
+  size_t end;
+
+  bzen_mem_debug_check(header);
+
+  if (header->size_class == BZEN_MEM_CLASS_GUARDED)
+    {
+      base = (uintptr_t)header & ~((uintptr_t)bzen_mem_page_size - 1);
+      end = (uintptr_t)header + BZEN_MEM_HEADER_SIZE + 
+	BZEN_MEM_ALIGN_UP(header->size, BZEN_MEM_ALIGNMENT);
+      munmap((void*)base, end - base + bzen_mem_page_size);
+      goto DEBUG_FREE_DONE;
+    }
+
+  if (!(__atomic_load_n(&bzen_mem_debug, __ATOMIC_RELAXED) & BZEN_MEM_DEBUG_POISON))
+    {
+      free((char*)header - BZEN_MEM_REDZONE_SIZE);
+      goto DEBUG_FREE_DONE;
+    }
+
+  memset((char*)header + BZEN_MEM_HEADER_SIZE, BZEN_MEM_FREE_BYTE, header->size);
+  header->size_class = BZEN_MEM_CLASS_FREED;
+
+  pthread_mutex_lock(&bzen_mem_quarantine_mutex);
+
+  bzen_mem_quarantine[(bzen_mem_quarantine_first + bzen_mem_quarantine_count) %
+		      BZEN_MEM_QUARANTINE_SLOTS] = header;
+  bzen_mem_quarantine_count++;
+  bzen_mem_quarantine_bytes += header->size;
+
+  while ((bzen_mem_quarantine_count > BZEN_MEM_QUARANTINE_SLOTS - 1) ||
+	 ((bzen_mem_quarantine_bytes > BZEN_MEM_QUARANTINE_BYTES) && 
+	  (bzen_mem_quarantine_count > 1)))
+    {
+      evicted = bzen_mem_quarantine[bzen_mem_quarantine_first];
+      bzen_mem_quarantine_first = (bzen_mem_quarantine_first + 1) % 
+	BZEN_MEM_QUARANTINE_SLOTS;
+      bzen_mem_quarantine_count--;
+      bzen_mem_quarantine_bytes -= evicted->size;
+
+      offset = bzen_mem_debug_scan((unsigned char*)evicted + BZEN_MEM_HEADER_SIZE,
+				   evicted->size, BZEN_MEM_FREE_BYTE);
+      if (offset < evicted->size)
+	{
+	  bzen_mem_debug_report("write after free", evicted, offset);
+	}
+      evicted->size_class = BZEN_MEM_CLASS_DEBUG;
+      bzen_mem_debug_check(evicted);
+      free((char*)evicted - BZEN_MEM_REDZONE_SIZE);
+    }
+
+  pthread_mutex_unlock(&bzen_mem_quarantine_mutex);
+
+ DEBUG_FREE_DONE:
+
+  return;
+}
+
+/**
+ * Resize block at p (NULL for new block) to hold size bytes.
+ *
+ * Mapped blocks which stay above BZEN_MEM_MAP_THRESHOLD are remapped and 
+ * large blocks which stay large are resized by xrealloc(). Other blocks keep
+ * their place if there is room or else move to a larger size class, to the 
+ * heap or to a mapping. Moved blocks keep their tag and alignment. Debug 
+ * blocks always move.
+ *
+ * @param[in] void* p Block to resize or NULL.
+ * @param[in] size_t size Required size in bytes.
+ *
+ * @return void* Pointer to block.
+ */
+static void* bzen_mem_resize(void* p, size_t size)
+{
+  bzen_mem_header_t* header;
+  void* ptr;
+
+  if (p == NULL)
+    {
+      ptr = bzen_malloc(size);
+      goto RESIZE_DONE;
+    }
+
+  header = BZEN_MEM_HEADER(p);
+  if ((header->size_class == BZEN_MEM_CLASS_DEBUG) || 
+      (header->size_class == BZEN_MEM_CLASS_GUARDED))
+    {
+      /* Debug block always moves, so stale pointers to it are caught. */
+      ptr = bzen_malloc_tagged(size, header->tag);
+      memcpy(ptr, p, (size < header->size) ? size : header->size);
+      bzen_free(p);
+    }
+  else if ((header->size_class == BZEN_MEM_CLASS_MAPPED) && 
+	   (size >= BZEN_MEM_MAP_THRESHOLD))
+    {
+      /* Mapped block stays mapped. */
+      bzen_mem_count_free(header->tag, header->size);
+      header = bzen_mem_remap(header, size);
+      bzen_mem_count_alloc(header->tag, header->size);
+      ptr = (char*)header + BZEN_MEM_HEADER_SIZE;
+    }
+  else if ((header->size_class == BZEN_MEM_CLASS_LARGE) && 
+	   (size > BZEN_MEM_MAGAZINE_MAX) && (size < BZEN_MEM_MAP_THRESHOLD))
+    {
+      /* Large block stays on the heap. */
+      bzen_mem_count_free(header->tag, header->size);
+      header = (bzen_mem_header_t*)xrealloc(header, 
+					    xsum(BZEN_MEM_HEADER_SIZE, size));
+      header->size = size;
+      bzen_mem_count_alloc(header->tag, header->size);
+      ptr = (char*)header + BZEN_MEM_HEADER_SIZE;
+    }
+  else if (size <= header->size)
+    {
+      /* Block already has room. */
+      ptr = p;
+    }
+  else
+    {
+      /* Move block to larger size class or to the heap. */
+      if (BZEN_MEM_CLASS_IS_ALIGNED(header->size_class))
+	{
+	  ptr = bzen_mem_alloc_aligned(size, 
+				       BZEN_MEM_CLASS_ALIGNMENT(header->size_class),
+				       header->tag);
+	}
+      else
+	{
+	  ptr = bzen_malloc_tagged(size, header->tag);
+	}
+      memcpy(ptr, p, header->size);
+      bzen_free(p);
+    }
+
+ RESIZE_DONE:
+
+  return ptr;
+}
+
+/**
+ * Read page size and settings from environment (once).
+ *
+ * @return void
+ */
+static void bzen_mem_config_init()
+{
+  char* setting;
+  long page_size;
+
+  page_size = sysconf(_SC_PAGESIZE);
+  if (page_size > 0)
+    {
+      bzen_mem_page_size = (size_t)page_size;
+    }
+
+  /* Allocation profiling may be turned on from environment. */
+  setting = getenv("BZEN_MEM_SAMPLE_INTERVAL");
+  if ((setting != NULL) && 
+      (__atomic_load_n(&bzen_mem_sample_interval, __ATOMIC_RELAXED) == 0))
+    {
+      bzen_malloc_set_sample_interval(strtoul(setting, NULL, 10));
+    }
+
+  /* So may debug allocator checks. */
+  setting = getenv("BZEN_MEM_DEBUG");
+  if (setting != NULL)
+    {
+      bzen_mem_set_debug(((strstr(setting, "all") != NULL) ? 
+			  BZEN_MEM_DEBUG_ALL : 0) |
+			 ((strstr(setting, "redzone") != NULL) ? 
+			  BZEN_MEM_DEBUG_REDZONE : 0) |
+			 ((strstr(setting, "poison") != NULL) ? 
+			  BZEN_MEM_DEBUG_POISON : 0) |
+			 ((strstr(setting, "guard") != NULL) ? 
+			  BZEN_MEM_DEBUG_GUARD : 0));
+    }
+
+  /* So may huge pages. */
+  setting = getenv("BZEN_MEM_HUGEPAGES");
+  if (setting != NULL)
+    {
+      if (strcmp(setting, "transparent") == 0)
+	{
+	  bzen_mem_set_default_pages(BZEN_MEM_PAGES_TRANSPARENT);
+	}
+      else if (strcmp(setting, "hugetlb") == 0)
+	{
+	  bzen_mem_set_default_pages(BZEN_MEM_PAGES_HUGETLB);
+	}
+    }
+}
+
+/**
+ * Create one pool per size class to serve as bzen_malloc() magazines (once).
+ *
+ * If any pool cannot be created all blocks are allocated from the heap.
+ *
+ * @return void
+ */
+static void bzen_mem_magazines_init()
+{
+  size_t size_class;
+  size_t granule;
+  size_t object_size;
+
+  pthread_once(&bzen_mem_config_once, bzen_mem_config_init);
+
+  for (size_class = 0; size_class < BZEN_MEM_N_CLASSES; size_class++)
+    {
+      object_size = BZEN_MEM_HEADER_SIZE + bzen_mem_class_sizes[size_class];
+      bzen_mem_magazines[size_class] = 
+	bzen_pool_create(object_size, 
+			 (BZEN_MEM_MAGAZINE_SLAB_SIZE / object_size) + 1);
+      if (bzen_mem_magazines[size_class] == NULL)
+	{
+	  goto INIT_FAIL;
+	}
+    }
+
+  /* Map each granule to smallest class which can hold it. */
+  size_class = 0;
+  for (granule = 0; granule <= BZEN_MEM_MAGAZINE_MAX / BZEN_MEM_CLASS_GRANULE; granule++)
+    {
+      while (bzen_mem_class_sizes[size_class] < granule * BZEN_MEM_CLASS_GRANULE)
+	{
+	  size_class++;
+	}
+      bzen_mem_class_index[granule] = (unsigned char)size_class;
+    }
+
+  return;
+
+ INIT_FAIL:
+
+  while (size_class > 0)
+    {
+      size_class--;
+      bzen_pool_destroy(bzen_mem_magazines[size_class]);
+      bzen_mem_magazines[size_class] = NULL;
+    }
+}
+
+/* Allocate n bytes from arena. */
+void* bzen_arena_alloc(bzen_arena_t* arena, size_t n)
+{
+  return bzen_arena_alloc_aligned(arena, n, BZEN_MEM_ALIGNMENT);
+}
+
+/* Allocate n bytes from arena on given alignment boundary. */
+void* bzen_arena_alloc_aligned(bzen_arena_t* arena, size_t n, size_t alignment)
+{
+  bzen_arena_chunk_t* chunk;
+  bzen_arena_chunk_t* last;
+  size_t chunk_size;
+  void* ptr = NULL;
+
+  /* Expect non-null pointer. */
+  BZEN_ASSERT(arena);
+
+  /* Alignment must be a power of two. */
+  if ((alignment == 0) || ((alignment & (alignment - 1)) != 0))
+    {
+      goto ALLOC_FAIL;
+    }
+  if (alignment < BZEN_MEM_ALIGNMENT)
+    {
+      alignment = BZEN_MEM_ALIGNMENT;
+    }
+
+  /* Large requests get a dedicated chunk, which is freed on reset. Worst case
+     padding is alignment less the alignment the chunk data already has. */
+  if (n > arena->chunk_size / 2)
+    {
+      chunk_size = xsum(n, alignment - BZEN_MEM_ALIGNMENT);
+      chunk = bzen_arena_chunk_new(chunk_size, arena->pages);
+      if (chunk == NULL)
+	{
+	  goto ALLOC_FAIL;
+	}
+      chunk->next = arena->large;
+      arena->large = chunk;
+      ptr = bzen_arena_chunk_alloc(chunk, n, alignment);
+      goto ALLOC_DONE;
+    }
+
+  /* Try current chunk, then any chunks retained by a previous reset. */
+  last = NULL;
+  for (chunk = arena->current; chunk != NULL; chunk = chunk->next)
+    {
+      ptr = bzen_arena_chunk_alloc(chunk, n, alignment);
+      if (ptr != NULL)
+	{
+	  arena->current = chunk;
+	  goto ALLOC_DONE;
+	}
+      last = chunk;
+    }
+
+  /* Out of room. Append a new regular chunk. */
+  chunk = bzen_arena_chunk_new(arena->chunk_size, arena->pages);
+  if (chunk == NULL)
+    {
+      goto ALLOC_FAIL;
+    }
+  if (last == NULL)
+    {
+      arena->head = chunk;
+    }
+  else
+    {
+      last->next = chunk;
+    }
+  arena->current = chunk;
+  ptr = bzen_arena_chunk_alloc(chunk, n, alignment);
+
+ ALLOC_FAIL:
+ ALLOC_DONE:
+
+  return ptr;
+}
+
+/* Create a new arena. */
+bzen_arena_t* bzen_arena_create(size_t chunk_size)
+{
+  bzen_arena_t* arena;
+
+  pthread_once(&bzen_mem_config_once, bzen_mem_config_init);
+
+  arena = (bzen_arena_t*)xmalloc(BZEN_SIZEOF(bzen_arena_t));
+  if (arena == NULL)
+    {
+      goto CREATE_FAIL;
+    }
+
+  arena->head = NULL;
+  arena->current = NULL;
+  arena->large = NULL;
+  arena->chunk_size = (chunk_size > 0) ? chunk_size : BZEN_ARENA_DEFAULT_CHUNK_SIZE;
+  arena->pages = __atomic_load_n(&bzen_mem_default_pages, __ATOMIC_RELAXED);
+
+ CREATE_FAIL:
+
+  return arena;
+}
+
+/* Free all memory held by arena including the arena itself. */
+void bzen_arena_destroy(bzen_arena_t* arena)
+{
+  if (arena != NULL)
+    {
+      bzen_arena_chunk_free_list(arena->head);
+      bzen_arena_chunk_free_list(arena->large);
+      free(arena);
+    }
+}
+
+/* Release all blocks allocated from arena in one operation. */
+void bzen_arena_reset(bzen_arena_t* arena)
+{
+  bzen_arena_chunk_t* chunk;
+
+  /* Expect non-null pointer. */
+  BZEN_ASSERT(arena);
+
+  /* Keep regular chunks for reuse. */
+  for (chunk = arena->head; chunk != NULL; chunk = chunk->next)
+    {
+      chunk->used = 0;
+    }
+  arena->current = arena->head;
+
+  /* Return dedicated chunks to the heap. */
+  bzen_arena_chunk_free_list(arena->large);
+  arena->large = NULL;
+}
+
+/* Set kind of pages backing chunks arena allocates from now on. */
+int bzen_arena_set_pages(bzen_arena_t* arena, bzen_mem_pages_t pages)
+{
+  int result = -1;
+
+  /* Expect non-null pointer. */
+  BZEN_ASSERT(arena);
+
+  if ((pages < BZEN_MEM_PAGES_DEFAULT) || (pages > BZEN_MEM_PAGES_HUGETLB))
+    {
+      goto PAGES_FAIL;
+    }
+  arena->pages = pages;
+  result = 0;
+
+ PAGES_FAIL:
+
+  return result;
+}
+
 /* Free memory allocated dynamically. */
 void bzen_free(void* ptr)
 {
-  free(ptr);
+  bzen_mem_header_t* header;
+
+  if (ptr == NULL)
+    {
+      goto FREE_DONE;
+    }
+
+  header = BZEN_MEM_HEADER(ptr);
+  if (header->size_class == BZEN_MEM_CLASS_FREED)
+    {
+      bzen_mem_debug_report("double free", header, 0);
+    }
+  bzen_mem_count_free(header->tag, header->size);
+  if (header->size_class == BZEN_MEM_CLASS_LARGE)
+    {
+      free(header);
+    }
+  else if ((header->size_class == BZEN_MEM_CLASS_DEBUG) ||
+	   (header->size_class == BZEN_MEM_CLASS_GUARDED))
+    {
+      bzen_mem_debug_free(header);
+    }
+  else if (header->size_class == BZEN_MEM_CLASS_MAPPED)
+    {
+      munmap(header, BZEN_MEM_HEADER_SIZE + header->size);
+    }
+  else if (BZEN_MEM_CLASS_IS_ALIGNED(header->size_class))
+    {
+      free((char*)ptr - BZEN_MEM_CLASS_ALIGNMENT(header->size_class));
+    }
+  else
+    {
+      bzen_pool_free(bzen_mem_magazines[header->size_class], header);
+    }
+
+ FREE_DONE:
+
+  return;
 }
 
 /* Allocate N bytes of memory dynamically, with error checking. */
 void* bzen_malloc(size_t n) 
 {
-  void* ptr;
+  return bzen_malloc_tagged(n, BZEN_MEM_TAG_OTHER);
+}
 
-  /* @todo: manage cleanup of heap. */
+/* Allocate N bytes of memory dynamically on given alignment boundary. */
+void* bzen_malloc_aligned(size_t n, size_t alignment)
+{
+  pthread_once(&bzen_mem_magazines_once, bzen_mem_magazines_init);
+
+  return bzen_mem_alloc_aligned(n, alignment, BZEN_MEM_TAG_OTHER);
+}
+
+/* Take a snapshot of allocation counters for given tag. */
+int bzen_malloc_get_stats(bzen_mem_tag_t tag, bzen_mem_stats_t* stats)
+{
+  bzen_mem_stats_t* counters;
+  int result = -1;
+
+  /* Expect non-null pointer. */
+  BZEN_ASSERT(stats);
+
+  if ((tag < BZEN_MEM_TAG_OTHER) || (tag > BZEN_MEM_TAG_COUNT))
+    {
+      goto STATS_FAIL;
+    }
+
+  counters = &bzen_mem_counters[tag].stats;
+  stats->live_bytes = __atomic_load_n(&counters->live_bytes, __ATOMIC_RELAXED);
+  stats->peak_bytes = __atomic_load_n(&counters->peak_bytes, __ATOMIC_RELAXED);
+  stats->allocs = __atomic_load_n(&counters->allocs, __ATOMIC_RELAXED);
+  stats->frees = __atomic_load_n(&counters->frees, __ATOMIC_RELAXED);
+  result = 0;
+
+ STATS_FAIL:
+
+  return result;
+}
+
+/* Allocate N bytes of memory dynamically from given NUMA node. */
+void* bzen_malloc_node(size_t n, int node)
+{
+  bzen_mem_header_t* header;
+  void* ptr = NULL;
+
+  if ((node < BZEN_MEM_NODE_LOCAL) || (node >= BZEN_MEM_MAX_NODES))
+    {
+      goto NODE_FAIL;
+    }
+
+  pthread_once(&bzen_mem_magazines_once, bzen_mem_magazines_init);
+
+  /* Mapped blocks keep their pages (and policy) when resized. */
+  header = bzen_mem_map(n, node);
+  header->tag = BZEN_MEM_TAG_OTHER;
+  bzen_mem_count_alloc(header->tag, header->size);
+  ptr = (char*)header + BZEN_MEM_HEADER_SIZE;
+
+ NODE_FAIL:
 
-  /* Allocate n bytes @ ptr. */
-  ptr =  xmalloc(n);
-  
-  /* zero-out newly allocated memory. */
-  /* memset(ptr, 0, n); */
-  
   return ptr;
 }
 
-/* Prints statistics on memory allocated by malloc to stream. */
+/* Prints sampled allocation profile to stream as folded stacks. */
+int bzen_malloc_print_profile(FILE* stream)
+{
+  bzen_mem_site_t* site;
+  char** symbols;
+  char* name;
+  size_t name_length;
+  size_t bucket;
+  int frame;
+  int result = -1;
+
+  if (stream == NULL)
+    {
+      goto PROFILE_FAIL;
+    }
+
+  pthread_mutex_lock(&bzen_mem_sites_mutex);
+
+  for (bucket = 0; bucket < BZEN_MEM_PROFILE_BUCKETS; bucket++)
+    {
+      for (site = bzen_mem_sites[bucket]; site != NULL; site = site->next)
+	{
+	  symbols = NULL;
+#ifdef HAVE_EXECINFO_H
+	  if (site->depth > 0)
+	    {
+	      symbols = backtrace_symbols(site->frames, site->depth);
+	    }
+#endif
+	  if (site->depth == 0)
+	    {
+	      fputs("[unknown]", stream);
+	    }
+
+	  /* Outermost frame first. Symbols look like "object(name+0x1f) [addr]",
+	     fall back to address if name is not exported. */
+	  for (frame = site->depth - 1; frame >= 0; frame--)
+	    {
+	      name = (symbols != NULL) ? strchr(symbols[frame], '(') : NULL;
+	      name_length = (name != NULL) ? strcspn(++name, "+)") : 0;
+	      if (name_length > 0)
+		{
+		  fprintf(stream, "%.*s", (int)name_length, name);
+		}
+	      else
+		{
+		  fprintf(stream, "%p", site->frames[frame]);
+		}
+	      fputc((frame > 0) ? ';' : ' ', stream);
+	    }
+	  if (site->depth == 0)
+	    {
+	      fputc(' ', stream);
+	    }
+	  fprintf(stream, "%zu\n", site->bytes);
+	  free(symbols);
+	}
+    }
+
+  pthread_mutex_unlock(&bzen_mem_sites_mutex);
+  result = 0;
+
+ PROFILE_FAIL:
+
+  return result;
+}
+
+/* Prints statistics on dynamically allocated memory to stream. */
 void bzen_malloc_print_stats(FILE* stream)
 {
-  if (stream != NULL)
+  bzen_mem_stats_t stats;
+  const char* name;
+  int tag;
+
+  if (stream == NULL)
+    {
+      goto PRINT_DONE;
+    }
+
+  /* bzenmem accounting. */
+  for (tag = BZEN_MEM_TAG_OTHER; tag <= BZEN_MEM_TAG_COUNT; tag++)
+    {
+      name = (tag < BZEN_MEM_TAG_COUNT) ? bzen_mem_tag_names[tag] : "total";
+      bzen_malloc_get_stats(tag, &stats);
+      fprintf(stream, "mem.%s.live_bytes=%zu\n", name, stats.live_bytes);
+      fprintf(stream, "mem.%s.peak_bytes=%zu\n", name, stats.peak_bytes);
+      fprintf(stream, "mem.%s.allocs=%zu\n", name, stats.allocs);
+      fprintf(stream, "mem.%s.frees=%zu\n", name, stats.frees);
+    }
+  fprintf(stream, "mem.arena.reserved_bytes=%zu\n",
+	  __atomic_load_n(&bzen_mem_arena_reserved, __ATOMIC_RELAXED));
+  fprintf(stream, "mem.arena.hugepage_bytes=%zu\n",
+	  __atomic_load_n(&bzen_mem_arena_huge, __ATOMIC_RELAXED));
+
+  /* C library allocator. mallinfo() fields are int and wrap past 2 GiB, 
+     prefer mallinfo2() where available.
+     @see: https://www.gnu.org/software/libc/manual/html_node/
+           Statistics-of-Malloc.html#Statistics-of-Malloc */
+  {
+#ifdef HAVE_MALLINFO2
+    struct mallinfo2 info;
+    info = mallinfo2();
+#else
+    struct mallinfo info;
+    info = mallinfo();
+#endif
+
+    /* Total size of memory allocated with sbrk by malloc, in bytes. */
+    fprintf(stream, "heap.arena_bytes=%zu\n", (size_t)info.arena);
+
+    /* Number of chunks not in use. */
+    fprintf(stream, "heap.free_chunks=%zu\n", (size_t)info.ordblks);
+
+    /* Total number of chunks allocated with mmap. */
+    fprintf(stream, "heap.mmap_chunks=%zu\n", (size_t)info.hblks);
+
+    /* Total size of memory allocated with mmap, in bytes. */
+    fprintf(stream, "heap.mmap_bytes=%zu\n", (size_t)info.hblkhd);
+
+    /* Total size of memory occupied by chunks handed out by malloc. */
+    fprintf(stream, "heap.in_use_bytes=%zu\n", (size_t)info.uordblks);
+
+    /* Total size of memory occupied by free (not in use) chunks. */
+    fprintf(stream, "heap.free_bytes=%zu\n", (size_t)info.fordblks);
+
+    /* Size of the top-most releasable chunk that normally borders the end
+       of the heap. */
+    fprintf(stream, "heap.releasable_bytes=%zu\n", (size_t)info.keepcost);
+  }
+
+ PRINT_DONE:
+
+  return;
+}
+
+/* Set number of bytes allocated between allocation profile samples. */
+size_t bzen_malloc_set_sample_interval(size_t interval)
+{
+  return __atomic_exchange_n(&bzen_mem_sample_interval, interval, 
+			     __ATOMIC_RELAXED);
+}
+
+/* Allocate N bytes of memory dynamically on behalf of given subsystem. */
+void* bzen_malloc_tagged(size_t n, bzen_mem_tag_t tag)
+{
+  bzen_mem_header_t* header;
+  size_t size_class;
+  size_t block_size;
+  size_t interval;
+  unsigned int debug;
+
+  /* Invalid tag is accounted as untagged. */
+  if ((tag < BZEN_MEM_TAG_OTHER) || (tag >= BZEN_MEM_TAG_COUNT))
+    {
+      tag = BZEN_MEM_TAG_OTHER;
+    }
+
+  pthread_once(&bzen_mem_magazines_once, bzen_mem_magazines_init);
+
+  /* Debug checks (bzen_mem_set_debug()) lay block out with redzones, which
+     bzen_free() checks, or against a guard page, instead of the layouts 
+     below. */
+  header = NULL;
+  debug = __atomic_load_n(&bzen_mem_debug, __ATOMIC_RELAXED);
+  if (debug != 0)
+    {
+      header = bzen_mem_debug_alloc(n, debug);
+    }
+
+  if (header != NULL)
+    {
+      /* Debug block. */
+      size_class = header->size_class;
+    }
+  else if ((n <= BZEN_MEM_MAGAZINE_MAX) && (bzen_mem_magazines[0] != NULL))
+    {
+      /* Small block. Take one from magazine of calling thread. */
+      size_class = bzen_mem_class_index[(n + BZEN_MEM_CLASS_GRANULE - 1) / 
+					BZEN_MEM_CLASS_GRANULE];
+      header = (bzen_mem_header_t*)bzen_pool_alloc(bzen_mem_magazines[size_class]);
+      if (header == NULL)
+	{
+	  xalloc_die();
+	}
+      header->size = bzen_mem_class_sizes[size_class];
+    }
+  else if (n >= BZEN_MEM_MAP_THRESHOLD)
+    {
+      /* Very large block. Give it a mapping of its own. */
+      header = bzen_mem_map(n, BZEN_MEM_NODE_NONE);
+      size_class = BZEN_MEM_CLASS_MAPPED;
+    }
+  else
+    {
+      /* Large block. Allocate n bytes plus header from heap. */
+      block_size = xsum(BZEN_MEM_HEADER_SIZE, n);
+      if (size_overflow_p(block_size))
+	{
+	  xalloc_die();
+	}
+      header = (bzen_mem_header_t*)xmalloc(block_size);
+      header->size = n;
+      size_class = BZEN_MEM_CLASS_LARGE;
+    }
+  header->size_class = (unsigned short int)size_class;
+  header->tag = (unsigned short int)tag;
+  bzen_mem_count_alloc(header->tag, header->size);
+
+  /* Sample for allocation profile. */
+  interval = __atomic_load_n(&bzen_mem_sample_interval, __ATOMIC_RELAXED);
+  if (interval != 0)
+    {
+      bzen_mem_sample(header->size, interval);
+    }
+
+  return (char*)header + BZEN_MEM_HEADER_SIZE;
+}
+
+/* Set debug allocator checks applied to blocks allocated from now on. */
+unsigned int bzen_mem_set_debug(unsigned int flags)
+{
+  return __atomic_exchange_n(&bzen_mem_debug, flags & BZEN_MEM_DEBUG_ALL,
+			     __ATOMIC_RELAXED);
+}
+
+/* Set kind of pages backing chunks of arenas and pools created from now on. */
+int bzen_mem_set_default_pages(bzen_mem_pages_t pages)
+{
+  int result = -1;
+
+  if ((pages < BZEN_MEM_PAGES_DEFAULT) || (pages > BZEN_MEM_PAGES_HUGETLB))
+    {
+      goto PAGES_FAIL;
+    }
+  __atomic_store_n(&bzen_mem_default_pages, pages, __ATOMIC_RELAXED);
+  result = 0;
+
+ PAGES_FAIL:
+
+  return result;
+}
+
+/* Set NUMA node preferred for memory the calling thread touches first. */
+int bzen_mem_set_thread_node(int node)
+{
+  return bzen_mem_set_policy(NULL, 0, node);
+}
+
+/**
+ * Move free objects from per-thread cache back to shared list of pool.
+ *
+ * Caller must hold pool mutex.
+ *
+ * @param[in,out] bzen_pool_cache_t* cache Cache to drain.
+ * @param[in] size_t n Maximum number of objects to move.
+ *
+ * @return void
+ */
+static void bzen_pool_cache_drain(bzen_pool_cache_t* cache, size_t n)
+{
+  bzen_pool_t* pool = cache->pool;
+  void* obj;
+
+  while ((n > 0) && (cache->head != NULL))
+    {
+      obj = cache->head;
+      cache->head = BZEN_POOL_NEXT(obj);
+      BZEN_POOL_NEXT(obj) = pool->head;
+      pool->head = obj;
+      cache->count--;
+      n--;
+    }
+}
+
+/**
+ * Destructor called on thread exit. Returns cache content to pool.
+ *
+ * @param[in] void* arg The exiting thread's bzen_pool_cache_t.
+ *
+ * @return void
+ */
+static void bzen_pool_cache_release(void* arg)
+{
+  bzen_pool_cache_t* cache = (bzen_pool_cache_t*)arg;
+  bzen_pool_t* pool = cache->pool;
+
+  pthread_mutex_lock(&pool->mutex);
+  bzen_pool_cache_drain(cache, cache->count);
+  cache->next = pool->spare_caches;
+  pool->spare_caches = cache;
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+/**
+ * Return cache of calling thread, creating it on first use.
+ *
+ * @param[in,out] bzen_pool_t* pool Pool the cache belongs to.
+ *
+ * @return bzen_pool_cache_t* Cache or NULL on error.
+ */
+static bzen_pool_cache_t* bzen_pool_cache_get(bzen_pool_t* pool)
+{
+  bzen_pool_cache_t* cache;
+
+  cache = (bzen_pool_cache_t*)pthread_getspecific(pool->cache_key);
+  if (cache != NULL)
+    {
+      goto CACHE_DONE;
+    }
+
+  /* Recycle cache of an exited thread if there is one. */
+  pthread_mutex_lock(&pool->mutex);
+  if (pool->spare_caches != NULL)
+    {
+      cache = pool->spare_caches;
+      pool->spare_caches = cache->next;
+    }
+  else
+    {
+      cache = (bzen_pool_cache_t*)bzen_arena_alloc(pool->arena,
+						   BZEN_SIZEOF(bzen_pool_cache_t));
+    }
+  pthread_mutex_unlock(&pool->mutex);
+  if (cache == NULL)
+    {
+      goto CACHE_DONE;
+    }
+
+  cache->pool = pool;
+  cache->next = NULL;
+  cache->head = NULL;
+  cache->count = 0;
+  pthread_setspecific(pool->cache_key, cache);
+
+ CACHE_DONE:
+
+  return cache;
+}
+
+/**
+ * Move free objects from shared list of pool to per-thread cache.
+ *
+ * A new slab is carved out of pool arena if shared list is empty.
+ *
+ * @param[in,out] bzen_pool_cache_t* cache Cache to refill.
+ *
+ * @return void
+ */
+static void bzen_pool_cache_refill(bzen_pool_cache_t* cache)
+{
+  bzen_pool_t* pool = cache->pool;
+  char* slab;
+  void* obj;
+  size_t nobj;
+
+  pthread_mutex_lock(&pool->mutex);
+
+  if (pool->head == NULL)
+    {
+      slab = (char*)bzen_arena_alloc_aligned(pool->arena, 
+					     xtimes(pool->objects_per_slab, 
+						    pool->object_size),
+					     pool->alignment);
+      if (slab != NULL)
+	{
+	  for (nobj = pool->objects_per_slab; nobj > 0; nobj--)
+	    {
+	      obj = slab + ((nobj - 1) * pool->object_size);
+	      BZEN_POOL_NEXT(obj) = pool->head;
+	      pool->head = obj;
+	    }
+	}
+    }
+
+  for (nobj = BZEN_POOL_CACHE_SIZE / 2; (nobj > 0) && (pool->head != NULL); nobj--)
+    {
+      obj = pool->head;
+      pool->head = BZEN_POOL_NEXT(obj);
+      BZEN_POOL_NEXT(obj) = cache->head;
+      cache->head = obj;
+      cache->count++;
+    }
+
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+/* Allocate one object from pool. */
+void* bzen_pool_alloc(bzen_pool_t* pool)
+{
+  bzen_pool_cache_t* cache;
+  void* ptr = NULL;
+
+  /* Expect non-null pointer. */
+  BZEN_ASSERT(pool);
+
+  cache = bzen_pool_cache_get(pool);
+  if (cache == NULL)
+    {
+      goto ALLOC_FAIL;
+    }
+
+  if (cache->head == NULL)
+    {
+      bzen_pool_cache_refill(cache);
+      if (cache->head == NULL)
+	{
+	  goto ALLOC_FAIL;
+	}
+    }
+
+  ptr = cache->head;
+  cache->head = BZEN_POOL_NEXT(ptr);
+  cache->count--;
+
+ ALLOC_FAIL:
+
+  return ptr;
+}
+
+/* Create a new pool of fixed size objects. */
+bzen_pool_t* bzen_pool_create(size_t object_size, size_t objects_per_slab)
+{
+  return bzen_pool_create_aligned(object_size, objects_per_slab, 
+				  BZEN_MEM_ALIGNMENT);
+}
+
+/* Create a new pool of fixed size objects on given alignment boundary. */
+bzen_pool_t* bzen_pool_create_aligned(size_t object_size, 
+				      size_t objects_per_slab,
+				      size_t alignment)
+{
+  bzen_pool_t* pool;
+  int status;
+
+  if ((alignment == 0) || ((alignment & (alignment - 1)) != 0))
+    {
+      pool = NULL;
+      goto CREATE_FAIL;
+    }
+
+  pool = (bzen_pool_t*)xmalloc(BZEN_SIZEOF(bzen_pool_t));
+  if (pool == NULL)
+    {
+      goto CREATE_FAIL;
+    }
+
+  /* Free objects must be able to hold link to next free object. */
+  if (object_size < sizeof(void*))
+    {
+      object_size = sizeof(void*);
+    }
+  pool->alignment = (alignment > BZEN_MEM_ALIGNMENT) ? alignment : BZEN_MEM_ALIGNMENT;
+  pool->object_size = BZEN_MEM_ALIGN_UP(object_size, pool->alignment);
+  pool->objects_per_slab = (objects_per_slab > 0) ? 
+    objects_per_slab : BZEN_POOL_DEFAULT_OBJECTS_PER_SLAB;
+  pool->head = NULL;
+  pool->spare_caches = NULL;
+
+  pool->arena = bzen_arena_create(0);
+  if (pool->arena == NULL)
+    {
+      goto CREATE_FAIL_FREE;
+    }
+
+  status = bzen_mutex_init(&pool->mutex, NULL);
+  if (status != 0)
+    {
+      goto CREATE_FAIL_ARENA;
+    }
+
+  status = pthread_key_create(&pool->cache_key, bzen_pool_cache_release);
+  if (status != 0)
     {
-      struct mallinfo stats;
-      stats = mallinfo();
+      bzen_thread_print_error("pthread_key_create", status);
+      bzen_mutex_destroy(&pool->mutex);
+      goto CREATE_FAIL_ARENA;
+    }
+
+  goto CREATE_FAIL;
+
+ CREATE_FAIL_ARENA:
+  bzen_arena_destroy(pool->arena);
+
+ CREATE_FAIL_FREE:
+  free(pool);
+  pool = NULL;
 
-      /* @see: https://www.gnu.org/software/libc/manual/html_node/
-               Statistics-of-Malloc.html#Statistics-of-Malloc */
-      fprintf(stream, "\nDYNAMIC MEMORY STATISTICS\n");
+ CREATE_FAIL:
 
-      /* This is the total size of memory allocated with sbrk by malloc, in bytes.  */
-      fprintf(stream, "\n\tarena size: %d", stats.arena);
+  return pool;
+}
+
+/* Free pool and all objects allocated from it. */
+void bzen_pool_destroy(bzen_pool_t* pool)
+{
+  if (pool != NULL)
+    {
+      /* Deleting key ensures cache destructor is not called on exit of threads
+	 still holding a cache. Caches live in arena and go with it. */
+      pthread_key_delete(pool->cache_key);
+      bzen_mutex_destroy(&pool->mutex);
+      bzen_arena_destroy(pool->arena);
+      free(pool);
+    }
+}
 
-      /* This is the number of chunks not in use.  */
-      fprintf(stream, "\n\tChunks not in use: %d", stats.ordblks);
+/* Return object to pool. */
+void bzen_pool_free(bzen_pool_t* pool, void* ptr)
+{
+  bzen_pool_cache_t* cache;
 
-      /* This is the total number of chunks allocated with mmap. */
-      fprintf(stream, "\n\tChunks allocated with mmap: %d", stats.hblks);
+  /* Expect non-null pointer. */
+  BZEN_ASSERT(pool);
 
-      /* This is the total size of memory allocated with mmap, in bytes.  */
-      fprintf(stream, "\n\tTotal memory allocated with mmap: %d", stats.hblkhd);
+  if (ptr == NULL)
+    {
+      goto FREE_DONE;
+    }
 
-      /* This is the total size of memory occupied by chunks handed out by malloc.  */
-      fprintf(stream, "\n\tMemory allocated with malloc(): %d", stats.uordblks);
+  cache = bzen_pool_cache_get(pool);
+  if (cache == NULL)
+    {
+      /* No cache. Return object straight to shared list. */
+      pthread_mutex_lock(&pool->mutex);
+      BZEN_POOL_NEXT(ptr) = pool->head;
+      pool->head = ptr;
+      pthread_mutex_unlock(&pool->mutex);
+      goto FREE_DONE;
+    }
 
-      /* This is the total size of memory occupied by free (not in use) chunks.  */
-      fprintf(stream, "\n\tMemory occupied by free(): %d", stats.fordblks);
+  BZEN_POOL_NEXT(ptr) = cache->head;
+  cache->head = ptr;
+  cache->count++;
 
-      /* This is the size of the top-most releasable chunk that normally borders 
-	 the end of the heap. */
-      fprintf(stream, "\n\tSize of top-most releasable chunk: %d\n", stats.keepcost);
+  /* Cache is full. Give half back to other threads. */
+  if (cache->count >= BZEN_POOL_CACHE_SIZE)
+    {
+      pthread_mutex_lock(&pool->mutex);
+      bzen_pool_cache_drain(cache, BZEN_POOL_CACHE_SIZE / 2);
+      pthread_mutex_unlock(&pool->mutex);
     }
+
+ FREE_DONE:
+
+  return;
+}
+
+/* Set kind of pages backing slabs pool allocates from now on. */
+int bzen_pool_set_pages(bzen_pool_t* pool, bzen_mem_pages_t pages)
+{
+  int result;
+
+  /* Expect non-null pointer. */
+  BZEN_ASSERT(pool);
+
+  pthread_mutex_lock(&pool->mutex);
+  result = bzen_arena_set_pages(pool->arena, pages);
+  pthread_mutex_unlock(&pool->mutex);
+
+  return result;
 }
 
 /* Reallocate a block at p of pn objects of s bytes each. */
 void* bzen_realloc (void* p, size_t* pn, size_t s) 
 {
+  void* ptr;
+  size_t n;
+  size_t size;
+
   /* @todo: manage cleanup of heap. */
-  return x2nrealloc(p, pn, s);
+
+  /* Same growth rule as x2nrealloc(). */
+  n = *pn;
+  if (p == NULL)
+    {
+      if (n == 0)
+	{
+	  n = BZEN_MEM_REALLOC_DEFAULT_SIZE / s;
+	  n += !n;
+	}
+    }
+  else
+    {
+      n = xsum3(n, n / 2, 1);
+    }
+  size = xtimes(n, s);
+  if (size_overflow_p(size))
+    {
+      xalloc_die();
+    }
+
+  ptr = bzen_mem_resize(p, size);
+
+  *pn = n;
+  return ptr;
+}
+
+/* Grow a block at p to hold at least n objects of s bytes each. */
+void* bzen_realloc_grow(void* p, 
+			size_t* pn, 
+			size_t n, 
+			size_t s, 
+			const bzen_mem_policy_t* policy)
+{
+  bzen_mem_growth_t growth = BZEN_MEM_GROW_GEOMETRIC;
+  unsigned int factor = BZEN_MEM_GROW_DEFAULT_FACTOR;
+  size_t granule;
+  size_t count;
+  size_t size;
+  void* ptr;
+
+  /* Expect non-null pointer. */
+  BZEN_ASSERT(pn);
+
+  if ((p != NULL) && (*pn >= n))
+    {
+      ptr = p;
+      goto GROW_DONE;
+    }
+
+  if (policy != NULL)
+    {
+      growth = policy->growth;
+      factor = policy->factor;
+    }
+
+  /* Number of objects asked for. */
+  count = n;
+  if ((growth == BZEN_MEM_GROW_GEOMETRIC) && (p != NULL) && (factor > 100))
+    {
+      size = xtimes(*pn, factor) / 100;
+      count = (size > n) ? size : n;
+    }
+  size = xtimes(count, s);
+
+  /* Round block including header up to whole pages. */
+  granule = 0;
+  if (growth == BZEN_MEM_GROW_PAGE)
+    {
+      granule = (size_t)sysconf(_SC_PAGESIZE);
+    }
+  else if (growth == BZEN_MEM_GROW_HUGEPAGE)
+    {
+      granule = BZEN_MEM_HUGEPAGE_SIZE;
+    }
+  if (granule > 0)
+    {
+      size = xsum(size, BZEN_MEM_HEADER_SIZE + granule - 1);
+      if (!size_overflow_p(size))
+	{
+	  size = size - (size % granule) - BZEN_MEM_HEADER_SIZE;
+	}
+    }
+  if (size_overflow_p(size))
+    {
+      xalloc_die();
+    }
+
+  ptr = bzen_mem_resize(p, size);
+
+ GROW_DONE:
+
+  /* Report what the block really holds, slack included. */
+  *pn = BZEN_MEM_HEADER(ptr)->size / s;
+
+  return ptr;
 }
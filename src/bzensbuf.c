@@ -21,23 +21,34 @@
 
 #include <config.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "bzenmem.h"
 #include "bzenthread.h"
 #include "bzensbuf.h"
 
 /**
- * @todo: allow conf file declare number of buffers.
+ * Buffer table grows by segments of slots, up to a fixed number of segments.
+ * Segments never move, so slots are read without a lock.
  */
-const size_t BZEN_DEFAULT_NUMBER_OF_BUFFERS = 4;
-#define BZEN_DEFAULT_NUMBER_OF_BUFFERS BZEN_DEFAULT_NUMBER_OF_BUFFERS
+#define BZEN_SBUF_SEGMENT_SLOTS 1024
+#define BZEN_SBUF_MAX_SEGMENTS 4096
 
 /**
- * default wait time in seconds for lock on mutex.
+ * State of slot: generation in high 32 bits, doomed bit, destroying bit 
+ * (bzen_sbuf_destroy() waits for lock) and references to buffer in low 30
+ * bits.
  */
-const double BZEN_SBUF_DEFAULT_WAIT = 1;
-#define BZEN_SBUF_DEFAULT_WAIT BZEN_SBUF_DEFAULT_WAIT
+#define BZEN_SBUF_DOOMED ((uint64_t)1 << 31)
+#define BZEN_SBUF_DESTROYING ((uint64_t)1 << 30)
+#define BZEN_SBUF_REFS ((uint64_t)0x3FFFFFFF)
 
 /**
  * default size for io stream buffer.
@@ -50,10 +61,108 @@ const size_t BZEN_SBUF_DEFAULT_SIZE = 1024;
  */
 #define BZEN_FILE_SIZE_UNKNOWN -1;
 
+/**
+ * Growable buffer gives back memory grown past its initial size when it is
+ * reset after not needing that memory for this long (milliseconds).
+ */
+#define BZEN_SBUF_SHRINK_IDLE_MS 1000
+
+/**
+ * Growable buffers grow by whole pages.
+ */
+static const bzen_mem_policy_t bzen_sbuf_growth = { BZEN_MEM_GROW_PAGE, 0 };
+
+/**
+ * Memory of growable buffer, the cookie of its stream.
+ *
+ * Contents grow on demand up to max_size, not past it. grown is when 
+ * contents last went past initial size; sizeloc is where capacity is 
+ * published (size of lock of buffer).
+ */
+typedef struct _bzen_sbuf_growable_s
+{
+  unsigned char* data;
+  size_t capacity;
+  size_t length;
+  size_t position;
+  size_t initial;
+  size_t max_size;
+  struct timespec grown;
+  size_t* sizeloc;
+} bzen_sbuf_growable_t;
+
+/**
+ * Ring of single-producer/single-consumer buffer.
+ *
+ * head and tail run freely and are masked on access. Each is written by one
+ * side only, published with release and read by the other side with acquire.
+ * Each side keeps its last view of the other's index on its own cache line, 
+ * so shared lines are touched only when the ring looks full or empty.
+ */
+typedef struct _bzen_sbuf_ring_s
+{
+  /* Producer. */
+  size_t head __attribute__((aligned(BZEN_MEM_CACHE_LINE)));
+  size_t tail_cache;
+
+  /* Consumer. */
+  size_t tail __attribute__((aligned(BZEN_MEM_CACHE_LINE)));
+  size_t head_cache;
+
+  /* Shared, read only. */
+  size_t mask __attribute__((aligned(BZEN_MEM_CACHE_LINE)));
+  unsigned char* data;
+} bzen_sbuf_ring_t;
+
+/**
+ * Counters of buffer. They belong to a slot of buffer table and are reused
+ * by buffers taking the slot, so snapshots may read them while buffers come
+ * and go. live is set while a buffer holds the slot.
+ */
+typedef struct _bzen_sbuf_counters_s
+{
+  bzen_sbuf_stats_t stats;
+  unsigned int live;
+} __attribute__((aligned(BZEN_MEM_CACHE_LINE))) bzen_sbuf_counters_t;
+
+/**
+ * Read-only mapping of a regular file, read from position on.
+ */
+typedef struct _bzen_sbuf_map_s
+{
+  const unsigned char* data;
+  size_t length;
+  size_t position;
+} bzen_sbuf_map_t;
+
+/**
+ * Slot of buffer table. state counts owner and threads in bzen_sbuf_lock()
+ * or holding buffer locked; references are only taken by a swap on state 
+ * which checks generation, so a released slot or a buffer being destroyed is
+ * never referred to anew. next links free slots (index + 1, 0 ends list).
+ * counters are allocated for the first buffer created in slot while 
+ * statistics are on.
+ */
+typedef struct _bzen_sbuf_slot_s
+{
+  FILE* file;
+  bzen_cbuflock_t* cbuflock;
+  uint64_t state;
+  unsigned int next;
+  bzen_sbuf_counters_t* counters;
+} bzen_sbuf_slot_t;
+
 /**
  * Encapsulated buffers.
+ *
+ * buffers_free is head of free list: index + 1 of first free slot in low 32
+ * bits, and a count bumped on every change in high 32 bits so a slot popped
+ * and pushed back between load and swap cannot be mistaken (ABA). Slots never
+ * used before are taken from buffers_next.
  */
-static FILE** buffers = NULL;
+static bzen_sbuf_slot_t* buffers[BZEN_SBUF_MAX_SEGMENTS];
+static uint64_t buffers_free = 0;
+static size_t buffers_next = 0;
 
 /**
  * Encapsulated buffer counters.
@@ -61,248 +170,2086 @@ static FILE** buffers = NULL;
 static size_t buffers_used = 0;
 static size_t buffers_allocated = 0;
 
-/* Return a count of the number of buffers currently allocated. */
-size_t bzen_sbuf_count_allocated()
-{
-  return buffers_allocated;
-}
+/**
+ * Statistics setting, and sums of counters of destroyed buffers.
+ */
+static int stats_enabled = 0;
+static bzen_sbuf_stats_t stats_retired;
+
+/**
+ * Pool of bzen_cbuflock_t structs.
+ */
+static bzen_pool_t* cbuflock_pool = NULL;
+static pthread_once_t cbuflock_pool_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Create pool of bzen_cbuflock_t structs (once).
+ *
+ * @return void
+ */
+static void bzen_sbuf_pool_init()
+{
+  char* setting;
+
+  cbuflock_pool = BZEN_POOL_CREATE(bzen_cbuflock_t);
+
+  /* Statistics may be turned on from environment. */
+  setting = getenv("BZEN_SBUF_STATS");
+  if ((setting != NULL) && (atoi(setting) != 0))
+    {
+      bzen_sbuf_set_stats(1);
+    }
+}
+
+/**
+ * Copy up to n bytes into ring (producer side).
+ *
+ * @param[in] bzen_sbuf_ring_t* ring Ring.
+ * @param[in] const unsigned char* ptr Source.
+ * @param[in] size_t n Number of bytes.
+ *
+ * @return size_t Number of bytes copied.
+ */
+static size_t bzen_sbuf_ring_write(bzen_sbuf_ring_t* ring, 
+				   const unsigned char* ptr, 
+				   size_t n)
+{
+  size_t head;
+  size_t space;
+  size_t offset;
+  size_t first;
+  size_t result = 0;
+
+  head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  space = ring->mask + 1 - (head - ring->tail_cache);
+  if (space < n)
+    {
+      /* Refresh view of consumer. */
+      ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+      space = ring->mask + 1 - (head - ring->tail_cache);
+    }
+  if (n > space)
+    {
+      n = space;
+    }
+  if (n == 0)
+    {
+      /* Ring is full. */
+      goto WRITE_DONE;
+    }
+
+  /* Copy in at most two pieces around end of ring. */
+  offset = head & ring->mask;
+  first = ring->mask + 1 - offset;
+  if (first > n)
+    {
+      first = n;
+    }
+  memcpy(ring->data + offset, ptr, first);
+  memcpy(ring->data, ptr + first, n - first);
+
+  __atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+  result = n;
+
+ WRITE_DONE:
+
+  return result;
+}
+
+/**
+ * Refresh and return number of bytes available to consumer.
+ *
+ * @param[in] bzen_sbuf_ring_t* ring Ring.
+ * @param[in] size_t n Number of bytes wanted.
+ *
+ * @return size_t Number of bytes available (may exceed n).
+ */
+static size_t bzen_sbuf_ring_available(bzen_sbuf_ring_t* ring, size_t n)
+{
+  size_t tail;
+
+  tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  if (ring->head_cache - tail < n)
+    {
+      /* Refresh view of producer. */
+      ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    }
+
+  return ring->head_cache - tail;
+}
+
+/**
+ * Copy n available bytes out of ring starting skip bytes past tail.
+ *
+ * @param[in] bzen_sbuf_ring_t* ring Ring.
+ * @param[in] unsigned char* ptr Destination.
+ * @param[in] size_t skip Offset from tail.
+ * @param[in] size_t n Number of bytes.
+ *
+ * @return void
+ */
+static void bzen_sbuf_ring_copy(bzen_sbuf_ring_t* ring, 
+				unsigned char* ptr,
+				size_t skip,
+				size_t n)
+{
+  size_t offset;
+  size_t first;
+
+  offset = (__atomic_load_n(&ring->tail, __ATOMIC_RELAXED) + skip) & ring->mask;
+  first = ring->mask + 1 - offset;
+  if (first > n)
+    {
+      first = n;
+    }
+  memcpy(ptr, ring->data + offset, first);
+  memcpy(ptr + first, ring->data, n - first);
+}
+
+/**
+ * Release n bytes at tail of ring back to producer.
+ *
+ * @param[in] bzen_sbuf_ring_t* ring Ring.
+ * @param[in] size_t n Number of bytes.
+ *
+ * @return void
+ */
+static void bzen_sbuf_ring_consume(bzen_sbuf_ring_t* ring, size_t n)
+{
+  __atomic_store_n(&ring->tail, 
+		   __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) + n, 
+		   __ATOMIC_RELEASE);
+}
+
+/**
+ * Copy up to n bytes out of ring (consumer side).
+ *
+ * @param[in] bzen_sbuf_ring_t* ring Ring.
+ * @param[in] unsigned char* ptr Destination.
+ * @param[in] size_t n Number of bytes.
+ *
+ * @return size_t Number of bytes copied.
+ */
+static size_t bzen_sbuf_ring_read(bzen_sbuf_ring_t* ring, 
+				  unsigned char* ptr, 
+				  size_t n)
+{
+  size_t available;
+
+  available = bzen_sbuf_ring_available(ring, n);
+  if (n > available)
+    {
+      n = available;
+    }
+  bzen_sbuf_ring_copy(ring, ptr, 0, n);
+  bzen_sbuf_ring_consume(ring, n);
+
+  return n;
+}
+
+/**
+ * Read up to size bytes from growable buffer at current position.
+ *
+ * @param[in] void* cookie Growable buffer.
+ * @param[out] char* buf Destination.
+ * @param[in] size_t size Number of bytes requested.
+ *
+ * @return ssize_t Number of bytes read, 0 at end of contents.
+ */
+static ssize_t bzen_sbuf_growable_read(void* cookie, char* buf, size_t size)
+{
+  bzen_sbuf_growable_t* growable = (bzen_sbuf_growable_t*)cookie;
+  size_t available = 0;
+
+  if (growable->position < growable->length)
+    {
+      available = growable->length - growable->position;
+      available = (size < available) ? size : available;
+      memcpy(buf, growable->data + growable->position, available);
+      growable->position += available;
+    }
+
+  return (ssize_t)available;
+}
+
+/**
+ * Write up to size bytes to growable buffer at current position.
+ *
+ * Memory grows by whole pages, and not past max_size: a write beyond it is
+ * cut short, which the stream reports as an error.
+ *
+ * @param[in] void* cookie Growable buffer.
+ * @param[in] const char* buf Source.
+ * @param[in] size_t size Number of bytes to write.
+ *
+ * @return ssize_t Number of bytes written.
+ */
+static ssize_t bzen_sbuf_growable_write(void* cookie, 
+					const char* buf, 
+					size_t size)
+{
+  bzen_sbuf_growable_t* growable = (bzen_sbuf_growable_t*)cookie;
+  size_t end;
+  ssize_t result = 0;
+
+  if (growable->position >= growable->max_size)
+    {
+      goto WRITE_FAIL;
+    }
+  if (size > growable->max_size - growable->position)
+    {
+      size = growable->max_size - growable->position;
+    }
+
+  end = growable->position + size;
+  if (end > growable->capacity)
+    {
+      growable->data = (unsigned char*)bzen_realloc_grow(growable->data,
+							 &growable->capacity,
+							 end, 1,
+							 &bzen_sbuf_growth);
+      *growable->sizeloc = growable->capacity;
+    }
+
+  if (growable->position > growable->length)
+    {
+      memset(growable->data + growable->length, 0, 
+	     growable->position - growable->length);
+    }
+  memcpy(growable->data + growable->position, buf, size);
+  growable->position = end;
+  if (end > growable->length)
+    {
+      growable->length = end;
+    }
+  if (growable->length > growable->initial)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &growable->grown);
+    }
+  result = (ssize_t)size;
+
+ WRITE_FAIL:
+
+  return result;
+}
+
+/**
+ * Set current position of growable buffer.
+ *
+ * @param[in] void* cookie Growable buffer.
+ * @param[in,out] off64_t* offset Offset in, new position out.
+ * @param[in] int whence SEEK_SET, SEEK_CUR or SEEK_END.
+ *
+ * @return int 0 on success otherwise -1.
+ */
+static int bzen_sbuf_growable_seek(void* cookie, off64_t* offset, int whence)
+{
+  bzen_sbuf_growable_t* growable = (bzen_sbuf_growable_t*)cookie;
+  off64_t position;
+  int result = -1;
+
+  switch (whence)
+    {
+    case SEEK_SET:
+      position = *offset;
+      break;
+    case SEEK_CUR:
+      position = (off64_t)growable->position + *offset;
+      break;
+    case SEEK_END:
+      position = (off64_t)growable->length + *offset;
+      break;
+    default:
+      goto SEEK_FAIL;
+    }
+  if ((position < 0) || ((size_t)position > growable->max_size))
+    {
+      goto SEEK_FAIL;
+    }
+
+  growable->position = (size_t)position;
+  *offset = position;
+  result = 0;
+
+ SEEK_FAIL:
+
+  return result;
+}
+
+/**
+ * Free memory of growable buffer when its stream is closed.
+ *
+ * @param[in] void* cookie Growable buffer.
+ *
+ * @return int 0
+ */
+static int bzen_sbuf_growable_close(void* cookie)
+{
+  bzen_sbuf_growable_t* growable = (bzen_sbuf_growable_t*)cookie;
+
+  bzen_free(growable->data);
+  bzen_free(growable);
+
+  return 0;
+}
+
+/**
+ * Give back memory of growable buffer not needed by its contents.
+ *
+ * Memory shrinks to initial size, or length of contents if larger.
+ *
+ * @param[in] bzen_sbuf_growable_t* growable Growable buffer, locked.
+ *
+ * @return void
+ */
+static void bzen_sbuf_growable_shrink(bzen_sbuf_growable_t* growable)
+{
+  unsigned char* data;
+  size_t capacity;
+
+  capacity = (growable->length > growable->initial) ? 
+    growable->length : growable->initial;
+  if (capacity >= growable->capacity)
+    {
+      goto SHRINK_DONE;
+    }
+
+  data = (unsigned char*)bzen_malloc_tagged(capacity, BZEN_MEM_TAG_SBUF);
+  memcpy(data, growable->data, growable->length);
+  bzen_free(growable->data);
+  growable->data = data;
+  growable->capacity = capacity;
+  *growable->sizeloc = capacity;
+
+ SHRINK_DONE:
+
+  return;
+}
+
+/**
+ * Copy up to n bytes from mapping at its position and move past them.
+ *
+ * @param[in] bzen_sbuf_map_t* map Mapping of locked buffer.
+ * @param[out] unsigned char* ptr Destination.
+ * @param[in] size_t n Number of bytes.
+ *
+ * @return size_t Number of bytes copied, short at end of file.
+ */
+static size_t bzen_sbuf_map_read(bzen_sbuf_map_t* map, 
+				 unsigned char* ptr, 
+				 size_t n)
+{
+  if (n > map->length - map->position)
+    {
+      n = map->length - map->position;
+    }
+  memcpy(ptr, map->data + map->position, n);
+  map->position += n;
+
+  return n;
+}
+
+/**
+ * Find slot of buffer table.
+ *
+ * @param[in] size_t id Index of slot.
+ *
+ * @return bzen_sbuf_slot_t* Slot or NULL if its segment does not exist.
+ */
+static bzen_sbuf_slot_t* bzen_sbuf_slot(size_t id)
+{
+  bzen_sbuf_slot_t* segment = NULL;
+
+  if (id < BZEN_SBUF_MAX_SEGMENTS * BZEN_SBUF_SEGMENT_SLOTS)
+    {
+      segment = __atomic_load_n(&buffers[id / BZEN_SBUF_SEGMENT_SLOTS], 
+				__ATOMIC_ACQUIRE);
+    }
+
+  return (segment == NULL) ? NULL : &segment[id % BZEN_SBUF_SEGMENT_SLOTS];
+}
+
+/**
+ * Take a free slot of buffer table, growing table if needed.
+ *
+ * @return size_t Index of slot or (size_t)-1 if table is full.
+ */
+static size_t bzen_sbuf_slot_take()
+{
+  bzen_sbuf_slot_t* segment;
+  bzen_sbuf_slot_t* expected;
+  uint64_t head;
+  uint64_t next;
+  size_t id;
+
+  /* Reuse a released slot. */
+  head = __atomic_load_n(&buffers_free, __ATOMIC_ACQUIRE);
+  while ((head & 0xFFFFFFFF) != 0)
+    {
+      id = (size_t)(head & 0xFFFFFFFF) - 1;
+      next = ((head >> 32) + 1) << 32 | 
+	__atomic_load_n(&bzen_sbuf_slot(id)->next, __ATOMIC_RELAXED);
+      if (__atomic_compare_exchange_n(&buffers_free, &head, next, 0,
+				      __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+	{
+	  goto TAKE_DONE;
+	}
+    }
+
+  /* Or a slot never used before. */
+  id = __atomic_fetch_add(&buffers_next, 1, __ATOMIC_RELAXED);
+  if (id >= BZEN_SBUF_MAX_SEGMENTS * BZEN_SBUF_SEGMENT_SLOTS)
+    {
+      __atomic_fetch_sub(&buffers_next, 1, __ATOMIC_RELAXED);
+      id = (size_t)-1;
+      goto TAKE_DONE;
+    }
+
+  /* First thread to reach a new segment publishes it. */
+  if (bzen_sbuf_slot(id) == NULL)
+    {
+      segment = (bzen_sbuf_slot_t*)bzen_malloc_tagged(sizeof(bzen_sbuf_slot_t) *
+						      BZEN_SBUF_SEGMENT_SLOTS,
+						      BZEN_MEM_TAG_SBUF);
+      memset(segment, 0, sizeof(bzen_sbuf_slot_t) * BZEN_SBUF_SEGMENT_SLOTS);
+      expected = NULL;
+      if (__atomic_compare_exchange_n(&buffers[id / BZEN_SBUF_SEGMENT_SLOTS],
+				      &expected, segment, 0,
+				      __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+	{
+	  __atomic_fetch_add(&buffers_allocated, BZEN_SBUF_SEGMENT_SLOTS, 
+			     __ATOMIC_RELAXED);
+	}
+      else
+	{
+	  bzen_free(segment);
+	}
+    }
+
+ TAKE_DONE:
+
+  return id;
+}
+
+/**
+ * Release slot of buffer table to free list.
+ *
+ * @param[in] size_t id Index of slot.
+ *
+ * @return void
+ */
+static void bzen_sbuf_slot_release(size_t id)
+{
+  bzen_sbuf_slot_t* slot;
+  uint64_t head;
+  uint64_t next;
+
+  /* New generation refuses handles of old buffer. Nobody refers to it, so
+     nobody swaps state meanwhile. */
+  slot = bzen_sbuf_slot(id);
+  __atomic_store_n(&slot->file, NULL, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->cbuflock, NULL, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->state, 
+		   ((__atomic_load_n(&slot->state, __ATOMIC_RELAXED) >> 32) + 1)
+		   << 32, __ATOMIC_RELEASE);
+
+  head = __atomic_load_n(&buffers_free, __ATOMIC_RELAXED);
+  do
+    {
+      __atomic_store_n(&slot->next, (unsigned int)(head & 0xFFFFFFFF), 
+		       __ATOMIC_RELAXED);
+      next = ((head >> 32) + 1) << 32 | (uint64_t)(id + 1);
+    } while (!__atomic_compare_exchange_n(&buffers_free, &head, next, 0,
+					  __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**
+ * Raise high-water mark to value.
+ *
+ * @param[in,out] size_t* mark High-water mark.
+ * @param[in] size_t value Value reached.
+ *
+ * @return void
+ */
+static void bzen_sbuf_stats_max(size_t* mark, size_t value)
+{
+  size_t current;
+
+  current = __atomic_load_n(mark, __ATOMIC_RELAXED);
+  while ((value > current) &&
+	 !__atomic_compare_exchange_n(mark, &current, value, 0,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+      /* current was reloaded. */
+    }
+}
+
+/**
+ * Add counters to sums.
+ *
+ * @param[in,out] bzen_sbuf_stats_t* sum Sums, possibly updated by other 
+ * threads.
+ * @param[in] const bzen_sbuf_stats_t* stats Counters, possibly being updated.
+ *
+ * @return void
+ */
+static void bzen_sbuf_stats_sum(bzen_sbuf_stats_t* sum, 
+				const bzen_sbuf_stats_t* stats)
+{
+  __atomic_add_fetch(&sum->bytes_in, 
+		     __atomic_load_n(&stats->bytes_in, __ATOMIC_RELAXED),
+		     __ATOMIC_RELAXED);
+  __atomic_add_fetch(&sum->bytes_out, 
+		     __atomic_load_n(&stats->bytes_out, __ATOMIC_RELAXED),
+		     __ATOMIC_RELAXED);
+  __atomic_add_fetch(&sum->locks, 
+		     __atomic_load_n(&stats->locks, __ATOMIC_RELAXED),
+		     __ATOMIC_RELAXED);
+  __atomic_add_fetch(&sum->contended, 
+		     __atomic_load_n(&stats->contended, __ATOMIC_RELAXED),
+		     __ATOMIC_RELAXED);
+  __atomic_add_fetch(&sum->wait_ns, 
+		     __atomic_load_n(&stats->wait_ns, __ATOMIC_RELAXED),
+		     __ATOMIC_RELAXED);
+  bzen_sbuf_stats_max(&sum->high_water, 
+		      __atomic_load_n(&stats->high_water, __ATOMIC_RELAXED));
+}
+
+/**
+ * Count bytes written to and read from buffer, if it keeps counters.
+ *
+ * @param[in] bzen_cbuflock_t* cbuflock Pointer to buffer, locked exclusively
+ * when bytes were written to a stream.
+ * @param[in] size_t in Number of bytes written.
+ * @param[in] size_t out Number of bytes read.
+ *
+ * @return void
+ */
+static inline void bzen_sbuf_count(bzen_cbuflock_t* cbuflock, 
+				   size_t in, 
+				   size_t out)
+{
+  bzen_sbuf_stats_t* stats;
+  size_t level;
+  off_t position;
+
+  if (cbuflock->stats == NULL)
+    {
+      goto COUNT_DONE;
+    }
+
+  stats = &cbuflock->stats->stats;
+  if (out > 0)
+    {
+      __atomic_add_fetch(&stats->bytes_out, out, __ATOMIC_RELAXED);
+    }
+  if (in > 0)
+    {
+      __atomic_add_fetch(&stats->bytes_in, in, __ATOMIC_RELAXED);
+      if (cbuflock->ring != NULL)
+	{
+	  level = __atomic_load_n(&cbuflock->ring->head, __ATOMIC_RELAXED) -
+	    __atomic_load_n(&cbuflock->ring->tail, __ATOMIC_RELAXED);
+	}
+      else
+	{
+	  position = ftello(bzen_sbuf_slot(cbuflock->id)->file);
+	  level = (position < 0) ? 0 : (size_t)position;
+	}
+      bzen_sbuf_stats_max(&stats->high_water, level);
+    }
+
+ COUNT_DONE:
+
+  return;
+}
+
+/**
+ * Lock mutex, or rwlock of shared buffer in given mode.
+ *
+ * @param[in] bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
+ * @param[in] int shared Nonzero to take read side of rwlock.
+ * @param[in] int wait Nonzero to wait for lock, zero to try only.
+ *
+ * @return int 0 on success, otherwise error of pthread lock function.
+ */
+static int bzen_sbuf_acquire(bzen_cbuflock_t* cbuflock, int shared, int wait)
+{
+  int result;
+
+  if (!cbuflock->shared)
+    {
+      result = wait ? pthread_mutex_lock(&cbuflock->mutex) : 
+	pthread_mutex_trylock(&cbuflock->mutex);
+      goto ACQUIRE_DONE;
+    }
+  if (shared)
+    {
+      result = wait ? pthread_rwlock_rdlock(&cbuflock->rwlock) :
+	pthread_rwlock_tryrdlock(&cbuflock->rwlock);
+      goto ACQUIRE_DONE;
+    }
+
+  result = wait ? pthread_rwlock_wrlock(&cbuflock->rwlock) :
+    pthread_rwlock_trywrlock(&cbuflock->rwlock);
+
+ ACQUIRE_DONE:
+
+  return result;
+}
+
+/**
+ * Lock buffer which keeps counters, counting and timing contention.
+ *
+ * @param[in] bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
+ * @param[in] int shared Nonzero to take read side of rwlock.
+ *
+ * @return int 0 on success, otherwise error of pthread lock function.
+ */
+static int bzen_sbuf_acquire_counted(bzen_cbuflock_t* cbuflock, int shared)
+{
+  bzen_sbuf_stats_t* stats = &cbuflock->stats->stats;
+  struct timespec start;
+  struct timespec end;
+  int status;
+
+  status = bzen_sbuf_acquire(cbuflock, shared, 0);
+  if (status == EBUSY)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      status = bzen_sbuf_acquire(cbuflock, shared, 1);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      __atomic_add_fetch(&stats->contended, 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&stats->wait_ns, 
+			 (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL +
+			 (uint64_t)end.tv_nsec - (uint64_t)start.tv_nsec,
+			 __ATOMIC_RELAXED);
+    }
+  if (status == 0)
+    {
+      __atomic_add_fetch(&stats->locks, 1, __ATOMIC_RELAXED);
+    }
+
+  return status;
+}
+
+/**
+ * Allocate lock for new buffer and register its stream.
+ *
+ * @param[in] FILE* file Stream of buffer (NULL for ring buffer).
+ *
+ * @return bzen_cbuflock_t* Pointer to new buffer lock or NULL.
+ */
+static bzen_cbuflock_t* bzen_sbuf_register(FILE* file)
+{
+  bzen_cbuflock_t* pcbuflock;
+  bzen_sbuf_slot_t* slot;
+  int status;
+  size_t buffer_id;
+
+  /* Allocate memory for buffer struct. */
+  pthread_once(&cbuflock_pool_once, bzen_sbuf_pool_init);
+  pcbuflock = (bzen_cbuflock_t*)bzen_pool_alloc(cbuflock_pool);
+  if (pcbuflock == NULL)
+    {
+      goto REGISTER_FAIL;
+    }
+
+  /* Initialize the mutex. */
+  status = bzen_mutex_init(&pcbuflock->mutex, NULL);
+  if (status != 0)
+    {
+      bzen_pool_free(cbuflock_pool, pcbuflock);
+      pcbuflock = NULL;
+      goto REGISTER_FAIL;
+    }
+
+  /* Set file descriptor as I/O stream of a free slot. */
+  buffer_id = bzen_sbuf_slot_take();
+  if (buffer_id == (size_t)-1)
+    {
+      bzen_mutex_destroy(&pcbuflock->mutex);
+      bzen_pool_free(cbuflock_pool, pcbuflock);
+      pcbuflock = NULL;
+      goto REGISTER_FAIL;
+    }
+  slot = bzen_sbuf_slot(buffer_id);
+  slot->file = file;
+  slot->cbuflock = pcbuflock;
+  __atomic_fetch_add(&buffers_used, 1, __ATOMIC_RELAXED);
+
+  /* Counters of slot start over for new buffer. */
+  pcbuflock->stats = NULL;
+  if (__atomic_load_n(&stats_enabled, __ATOMIC_RELAXED))
+    {
+      if (slot->counters == NULL)
+	{
+	  __atomic_store_n(&slot->counters, 
+			   (bzen_sbuf_counters_t*)
+			   bzen_malloc_aligned(sizeof(bzen_sbuf_counters_t),
+					       BZEN_MEM_CACHE_LINE),
+			   __ATOMIC_RELEASE);
+	}
+      if (slot->counters != NULL)
+	{
+	  memset(&slot->counters->stats, 0, sizeof(bzen_sbuf_stats_t));
+	  slot->counters->stats.id = (unsigned int)buffer_id;
+	  __atomic_store_n(&slot->counters->live, 1, __ATOMIC_RELEASE);
+	  pcbuflock->stats = slot->counters;
+	}
+    }
+
+  /* Initialize other members. */
+  pcbuflock->id = (unsigned int)buffer_id;  
+  pcbuflock->generation = 
+    (unsigned int)(__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) >> 32);
+  pcbuflock->shared = 0;
+  pcbuflock->length = 0;
+  pcbuflock->memory = NULL;
+  pcbuflock->keep_open = 1; /* application is responsible for fclose(). */
+  pcbuflock->size = BZEN_FILE_SIZE_UNKNOWN; /* @todo: */
+  pcbuflock->ring = NULL;
+  pcbuflock->growable = NULL;
+  pcbuflock->map = NULL;
+  pcbuflock->stage = NULL;
+  pcbuflock->stage_size = 0;
+  pcbuflock->staged = 0;
+  pcbuflock->spanned = 0;
+
+  /* Publish buffer with reference of owner. */
+  __atomic_store_n(&slot->state, 
+		   ((uint64_t)pcbuflock->generation << 32) | 1, 
+		   __ATOMIC_RELEASE);
+
+ REGISTER_FAIL:
+
+  return pcbuflock;
+}
+
+/**
+ * Free buffer nobody refers to any longer.
+ *
+ * @param[in] bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
+ *
+ * @return int 0 on success or error of fclose().
+ */
+static int bzen_sbuf_teardown(bzen_cbuflock_t* cbuflock)
+{
+  int result = 0;
+
+  /* Nobody holds or waits for lock, so it is safe to destroy. */
+  bzen_mutex_destroy(&cbuflock->mutex);
+  if (cbuflock->shared)
+    {
+      pthread_rwlock_destroy(&cbuflock->rwlock);
+    }
+  if (cbuflock->ring != NULL)
+    {
+      bzen_free(cbuflock->ring->data);
+      bzen_free(cbuflock->ring);
+      cbuflock->ring = NULL;
+    }
+  else if (cbuflock->keep_open == 0)
+    {
+      result = fclose(bzen_sbuf_slot(cbuflock->id)->file);
+    }
+  bzen_free(cbuflock->memory);
+  if (cbuflock->map != NULL)
+    {
+      munmap((void*)cbuflock->map->data, cbuflock->map->length);
+      bzen_free(cbuflock->map);
+      cbuflock->map = NULL;
+    }
+  if (cbuflock->stats != NULL)
+    {
+      bzen_sbuf_stats_sum(&stats_retired, &cbuflock->stats->stats);
+      __atomic_store_n(&cbuflock->stats->live, 0, __ATOMIC_RELEASE);
+    }
+  bzen_sbuf_slot_release(cbuflock->id);
+  bzen_free(cbuflock->stage);
+  bzen_pool_free(cbuflock_pool, cbuflock);
+  __atomic_fetch_sub(&buffers_used, 1, __ATOMIC_RELAXED);
+
+  return result;
+}
+
+/**
+ * Drop a reference to buffer, freeing it with the last one.
+ *
+ * @param[in] bzen_cbuflock_t* cbuflock Pointer to lock for buffer.
+ *
+ * @return int 0 on success or error of fclose().
+ */
+static int bzen_sbuf_release(bzen_cbuflock_t* cbuflock)
+{
+  int result = 0;
+  uint64_t state;
+
+  state = __atomic_sub_fetch(&bzen_sbuf_slot(cbuflock->id)->state, 1, 
+			     __ATOMIC_ACQ_REL);
+  if ((state & BZEN_SBUF_REFS) == 0)
+    {
+      result = bzen_sbuf_teardown(cbuflock);
+    }
+
+  return result;
+}
+
+/**
+ * Take a reference to live buffer through buffer table.
+ *
+ * @param[in] size_t id Index of slot.
+ * @param[in] unsigned int generation Generation of slot when buffer was made.
+ *
+ * @return bzen_cbuflock_t* Pointer to lock for buffer, or NULL if slot was
+ * released or reused since, or buffer is being destroyed.
+ */
+static bzen_cbuflock_t* bzen_sbuf_ref(size_t id, unsigned int generation)
+{
+  bzen_cbuflock_t* cbuflock = NULL;
+  bzen_sbuf_slot_t* slot;
+  uint64_t state;
+
+  slot = bzen_sbuf_slot(id);
+  if (slot == NULL)
+    {
+      goto REF_FAIL;
+    }
+
+  state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+  do
+    {
+      if (((state >> 32) != generation) || 
+	  (state & (BZEN_SBUF_DOOMED | BZEN_SBUF_DESTROYING)) ||
+	  ((state & BZEN_SBUF_REFS) == 0))
+	{
+	  goto REF_FAIL;
+	}
+    } while (!__atomic_compare_exchange_n(&slot->state, &state, state + 1, 0,
+					  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+  /* Reference keeps buffer in slot until bzen_sbuf_release(). */
+  cbuflock = __atomic_load_n(&slot->cbuflock, __ATOMIC_ACQUIRE);
+
+ REF_FAIL:
+
+  return cbuflock;
+}
+
+/**
+ * Find length of contents of stream, keeping its position.
+ *
+ * @param[in] FILE* file Stream of locked buffer.
+ *
+ * @return size_t Length in bytes.
+ */
+static size_t bzen_sbuf_stream_length(FILE* file)
+{
+  off_t position;
+  off_t length;
+
+  position = ftello(file);
+  fseeko(file, 0, SEEK_END);
+  length = ftello(file);
+  fseeko(file, position, SEEK_SET);
+
+  return (length < 0) ? 0 : (size_t)length;
+}
+
+/**
+ * Flush writes to shared buffer and extend its length past them.
+ *
+ * @param[in] bzen_cbuflock_t* cbuflock Pointer to buffer locked exclusively.
+ *
+ * @return void
+ */
+static void bzen_sbuf_written(bzen_cbuflock_t* cbuflock)
+{
+  FILE* file;
+  off_t position;
+
+  if (cbuflock->shared)
+    {
+      file = bzen_sbuf_slot(cbuflock->id)->file;
+      fflush(file);
+      position = ftello(file);
+      if ((position > 0) && ((size_t)position > cbuflock->length))
+	{
+	  cbuflock->length = (size_t)position;
+	}
+    }
+}
+
+/**
+ * Performs safety check on buffer and attempts to lock it in given mode.
+ *
+ * @param[in] size_t id Index of slot of buffer.
+ * @param[in] unsigned int generation Generation of slot when buffer was made.
+ * @param[in] int shared Nonzero to take read side of rwlock of shared buffer.
+ *
+ * @return bzen_cbuflock_t* Pointer to buffer if safe and locked, otherwise 
+ * NULL.
+ */
+static bzen_cbuflock_t* bzen_sbuf_lock_mode(size_t id, 
+					    unsigned int generation, 
+					    int shared)
+{
+  bzen_cbuflock_t* cbuflock;
+  int lock_status;
+
+  /* Reference keeps buffer alive until bzen_sbuf_unlock(). Buffer being 
+     destroyed takes no new lockers. */
+  cbuflock = bzen_sbuf_ref(id, generation);
+  if (cbuflock == NULL)
+    {
+      goto LOCK_FAIL;
+    }
+
+  /* Ring buffers have no stream to lock. */
+  if (cbuflock->ring != NULL)
+    {
+      bzen_sbuf_release(cbuflock);
+      cbuflock = NULL;
+      goto LOCK_FAIL;
+    }
+
+  /* Lock mutex or rwlock. */
+  if (cbuflock->stats == NULL)
+    {
+      lock_status = bzen_sbuf_acquire(cbuflock, shared, 1);
+    }
+  else
+    {
+      lock_status = bzen_sbuf_acquire_counted(cbuflock, shared);
+    }
+  if (lock_status != 0)
+    {
+      /* @todo: error loging */
+      bzen_sbuf_release(cbuflock);
+      cbuflock = NULL;
+      goto LOCK_FAIL;
+    }
+
+  /* Safety check for buffer doomed while we waited, or null stream. */
+  if ((__atomic_load_n(&bzen_sbuf_slot(id)->state, __ATOMIC_ACQUIRE) & 
+       BZEN_SBUF_DOOMED) || 
+      (bzen_sbuf_slot(id)->file == NULL))
+    {
+      bzen_sbuf_unlock(cbuflock);
+      cbuflock = NULL;
+      goto LOCK_FAIL;
+    }
+
+ LOCK_FAIL:
+
+  return cbuflock;
+}
+
+/**
+ * Grow staging span of stream buffer to hold n bytes.
+ *
+ * @param[in] bzen_cbuflock_t* cbuflock Pointer to locked buffer.
+ * @param[in] size_t n Number of bytes.
+ *
+ * @return unsigned char* Staging span.
+ */
+static unsigned char* bzen_sbuf_stage(bzen_cbuflock_t* cbuflock, size_t n)
+{
+  if (n > cbuflock->stage_size)
+    {
+      cbuflock->stage = (unsigned char*)bzen_realloc_grow(cbuflock->stage,
+							  &cbuflock->stage_size,
+							  n, 1, NULL);
+    }
+
+  return cbuflock->stage;
+}
+
+/* Publish bytes written to span returned by bzen_sbuf_reserve(). */
+int bzen_sbuf_commit(size_t n, bzen_cbuflock_t* cbuflock)
+{
+  int result = -1;
+  bzen_sbuf_ring_t* ring;
+  FILE* file;
+  size_t head;
+
+  if (cbuflock == NULL)
+    {
+      goto COMMIT_FAIL;
+    }
+
+  /* Ring publishes in place. */
+  if (cbuflock->ring != NULL)
+    {
+      ring = cbuflock->ring;
+      head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+      if (n > ring->mask + 1 - (head - ring->tail_cache))
+	{
+	  goto COMMIT_FAIL;
+	}
+      __atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+      bzen_sbuf_count(cbuflock, n, 0);
+      result = 0;
+      goto COMMIT_FAIL;
+    }
+
+  /* Without a span there is no lock to drop. */
+  if (!cbuflock->spanned)
+    {
+      goto COMMIT_FAIL;
+    }
+
+  /* Write out staging span under lock taken by bzen_sbuf_reserve(). */
+  if (n <= cbuflock->staged)
+    {
+      file = bzen_sbuf_slot(cbuflock->id)->file;
+      result = (fwrite(cbuflock->stage, 1, n, file) == n) ? 0 : -1;
+      bzen_sbuf_written(cbuflock);
+      bzen_sbuf_count(cbuflock, (result == 0) ? n : 0, 0);
+    }
+  cbuflock->staged = 0;
+  cbuflock->spanned = 0;
+  bzen_sbuf_unlock(cbuflock);
+
+ COMMIT_FAIL:
+
+  return result;
+}
+
+/* Release bytes of span returned by bzen_sbuf_peek(). */
+int bzen_sbuf_consume(size_t n, bzen_cbuflock_t* cbuflock)
+{
+  int result = -1;
+
+  if (cbuflock == NULL)
+    {
+      goto CONSUME_FAIL;
+    }
+
+  /* Ring releases in place. */
+  if (cbuflock->ring != NULL)
+    {
+      if (n > bzen_sbuf_ring_available(cbuflock->ring, n))
+	{
+	  goto CONSUME_FAIL;
+	}
+      bzen_sbuf_ring_consume(cbuflock->ring, n);
+      bzen_sbuf_count(cbuflock, 0, n);
+      result = 0;
+      goto CONSUME_FAIL;
+    }
+
+  /* Without a span there is no lock to drop. */
+  if (!cbuflock->spanned)
+    {
+      goto CONSUME_FAIL;
+    }
+
+  /* Give back what was peeked but not consumed, then drop lock taken by
+     bzen_sbuf_peek(). Mappings were not moved by peek. */
+  if ((n <= cbuflock->staged) && (cbuflock->map != NULL))
+    {
+      cbuflock->map->position += n;
+      bzen_sbuf_count(cbuflock, 0, n);
+      result = 0;
+    }
+  else if (n <= cbuflock->staged)
+    {
+      result = (n == cbuflock->staged) ? 0 :
+	fseeko(bzen_sbuf_slot(cbuflock->id)->file, -(off_t)(cbuflock->staged - n), SEEK_CUR);
+      bzen_sbuf_count(cbuflock, 0, (result == 0) ? n : 0);
+    }
+  cbuflock->staged = 0;
+  cbuflock->spanned = 0;
+  bzen_sbuf_unlock(cbuflock);
+
+ CONSUME_FAIL:
+
+  return result;
+}
+
+/* Return a count of the number of buffers currently allocated. */
+size_t bzen_sbuf_count_allocated()
+{
+  return __atomic_load_n(&buffers_allocated, __ATOMIC_RELAXED);
+}
+
+/* Return a count of the number of buffers currently in use. */
+size_t bzen_sbuf_count_used()
+{
+  return __atomic_load_n(&buffers_used, __ATOMIC_RELAXED);
+}
+
+/* Allocate memory for a new stream buffer. */
+bzen_cbuflock_t* bzen_sbuf_create(size_t size)
+{
+  /* Create the buffer as an IO stream (FILE) in memory. Memory belongs to 
+     the buffer, so shared readers may copy from it in place, but it is not
+     handed out: access goes through stdio functions under the buffer lock, 
+     and it is freed along with the stream. Memory is zeroed and opened in
+     mode "r+", so the whole buffer is readable as when the C library 
+     allocated it. */
+  bzen_cbuflock_t* pcbuflock = NULL;
+  FILE* file;
+  unsigned char* memory;
+  size_t new_buffer_size;
+
+  new_buffer_size = BZEN_SIZE(size);
+  memory = (unsigned char*)bzen_malloc_tagged(new_buffer_size, BZEN_MEM_TAG_SBUF);
+  memset(memory, 0, new_buffer_size);
+  file = fmemopen(memory, new_buffer_size, "r+");
+  if (file == NULL)
+    {
+      bzen_free(memory);
+      goto CREATE_FAIL;
+    }
+  pcbuflock = bzen_sbuf_create_file(file);
+  if (pcbuflock == NULL)
+    {
+      fclose(file);
+      bzen_free(memory);
+      goto CREATE_FAIL;
+    }
+
+  /* bzen_sbuf_create_file() leaves decision to close stream to application. */
+  pcbuflock->keep_open = 0;
+  pcbuflock->size = new_buffer_size;
+  pcbuflock->memory = memory;
+
+ CREATE_FAIL:
+
+  return pcbuflock;
+}
+
+/* Allocate memory for new character buffer and set file decriptor as I/O stream. */
+bzen_cbuflock_t* bzen_sbuf_create_file(FILE* file)
+{
+  bzen_cbuflock_t* pcbuflock = NULL;
+
+  if (file == NULL)
+    {
+      /* @todo: error logging */
+      goto CREATE_FAIL;
+    }
+
+  pcbuflock = bzen_sbuf_register(file);
+
+ CREATE_FAIL:
+
+  return pcbuflock;
+}
+
+/* Allocate a stream buffer whose memory grows with its contents. */
+bzen_cbuflock_t* bzen_sbuf_create_growable(size_t size, size_t max_size)
+{
+  cookie_io_functions_t io_functions = 
+    {
+      bzen_sbuf_growable_read,
+      bzen_sbuf_growable_write,
+      bzen_sbuf_growable_seek,
+      bzen_sbuf_growable_close
+    };
+  bzen_cbuflock_t* pcbuflock = NULL;
+  bzen_sbuf_growable_t* growable;
+  FILE* file;
+
+  if ((size == 0) || (max_size < size))
+    {
+      goto CREATE_FAIL;
+    }
+
+  growable = (bzen_sbuf_growable_t*)bzen_malloc_tagged(sizeof(bzen_sbuf_growable_t),
+							BZEN_MEM_TAG_SBUF);
+  memset(growable, 0, sizeof(bzen_sbuf_growable_t));
+  growable->data = (unsigned char*)bzen_malloc_tagged(size, BZEN_MEM_TAG_SBUF);
+  growable->capacity = size;
+  growable->initial = size;
+  growable->max_size = max_size;
+  file = fopencookie(growable, "w+", io_functions);
+  if (file == NULL)
+    {
+      bzen_free(growable->data);
+      bzen_free(growable);
+      goto CREATE_FAIL;
+    }
+
+  /* Contents are in memory already; a stdio buffer would only double it. */
+  setvbuf(file, NULL, _IONBF, 0);
+
+  pcbuflock = bzen_sbuf_create_file(file);
+  if (pcbuflock == NULL)
+    {
+      /* Closing stream frees memory. */
+      fclose(file);
+      goto CREATE_FAIL;
+    }
+  pcbuflock->keep_open = 0;
+  pcbuflock->size = size;
+  pcbuflock->growable = growable;
+  growable->sizeloc = &pcbuflock->size;
+
+ CREATE_FAIL:
+
+  return pcbuflock;
+}
+
+/* Allocate read-only buffer serving contents of a regular file from memory. */
+bzen_cbuflock_t* bzen_sbuf_create_mapped(FILE* file, unsigned int advice)
+{
+  bzen_cbuflock_t* pcbuflock = NULL;
+  bzen_sbuf_map_t* map;
+  struct stat status;
+  void* data;
+  off_t position;
+  int fd;
+
+  if (file == NULL)
+    {
+      goto CREATE_FAIL;
+    }
+
+  /* Streams other than non-empty regular files are read through stdio. */
+  fflush(file);
+  fd = fileno(file);
+  if ((fd < 0) || (fstat(fd, &status) != 0) || !S_ISREG(status.st_mode) ||
+      (status.st_size <= 0))
+    {
+      pcbuflock = bzen_sbuf_create_file(file);
+      goto CREATE_FAIL;
+    }
+  data = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED)
+    {
+      pcbuflock = bzen_sbuf_create_file(file);
+      goto CREATE_FAIL;
+    }
+  if (advice & BZEN_SBUF_MAP_SEQUENTIAL)
+    {
+      madvise(data, (size_t)status.st_size, MADV_SEQUENTIAL);
+    }
+  if (advice & BZEN_SBUF_MAP_WILLNEED)
+    {
+      madvise(data, (size_t)status.st_size, MADV_WILLNEED);
+    }
+
+  /* Reading starts where stream stands. */
+  map = (bzen_sbuf_map_t*)bzen_malloc_tagged(sizeof(bzen_sbuf_map_t),
+					     BZEN_MEM_TAG_SBUF);
+  map->data = (const unsigned char*)data;
+  map->length = (size_t)status.st_size;
+  position = ftello(file);
+  map->position = (position < 0) ? 0 : (size_t)position;
+  if (map->position > map->length)
+    {
+      map->position = map->length;
+    }
+
+  pcbuflock = bzen_sbuf_create_file(file);
+  if (pcbuflock == NULL)
+    {
+      munmap(data, map->length);
+      bzen_free(map);
+      goto CREATE_FAIL;
+    }
+  pcbuflock->size = map->length;
+  pcbuflock->map = map;
+
+ CREATE_FAIL:
+
+  return pcbuflock;
+}
+
+/* Allocate a lock-free ring buffer for one producer and one consumer thread. */
+bzen_cbuflock_t* bzen_sbuf_create_ring(size_t size)
+{
+  bzen_cbuflock_t* pcbuflock = NULL;
+  bzen_sbuf_ring_t* ring;
+  size_t capacity;
+
+  /* Round capacity up to a power of two. */
+  capacity = 1;
+  while (capacity < size)
+    {
+      if (capacity > ((size_t)-1 >> 1))
+	{
+	  goto CREATE_FAIL;
+	}
+      capacity <<= 1;
+    }
+
+  ring = (bzen_sbuf_ring_t*)bzen_malloc_aligned(sizeof(bzen_sbuf_ring_t),
+						BZEN_MEM_CACHE_LINE);
+  memset(ring, 0, sizeof(bzen_sbuf_ring_t));
+  ring->mask = capacity - 1;
+  ring->data = (unsigned char*)bzen_malloc_tagged(capacity, BZEN_MEM_TAG_SBUF);
+
+  /* Ring buffer takes a slot of its own but has no stream. */
+  pcbuflock = bzen_sbuf_register(NULL);
+  if (pcbuflock == NULL)
+    {
+      bzen_free(ring->data);
+      bzen_free(ring);
+      goto CREATE_FAIL;
+    }
+  pcbuflock->size = capacity;
+  pcbuflock->ring = ring;
+
+ CREATE_FAIL:
+
+  return pcbuflock;
+}
+
+/* Thread-safe stream buffer destructor. */
+int bzen_sbuf_destroy(bzen_cbuflock_t* cbuflock, double timeout)
+{
+  int result;
+  bzen_sbuf_slot_t* slot;
+  uint64_t state;
+  struct timespec deadline;
+  long timeout_ms;
+
+  if (cbuflock == NULL)
+    {
+      /* Nothing to do. */
+      result = 0;
+      goto DESTROY_FAIL;
+    }
+
+  /* Ring buffer has no lock to wait for. */
+  if (cbuflock->ring != NULL)
+    {
+      result = bzen_sbuf_destroy_async(cbuflock);
+      goto DESTROY_FAIL;
+    }
+
+  /* Deadline on monotonic clock, to the millisecond. */
+  timeout_ms = (timeout > 0) ? (long)(timeout * 1000 + 0.5) : 0;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+
+  /* Turn away new lockers, then queue for lock like one. Buffer already 
+     being destroyed is left to that call. */
+  slot = bzen_sbuf_slot(cbuflock->id);
+  state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+  do
+    {
+      if (state & (BZEN_SBUF_DOOMED | BZEN_SBUF_DESTROYING))
+	{
+	  result = EBUSY;
+	  goto DESTROY_FAIL;
+	}
+    } while (!__atomic_compare_exchange_n(&slot->state, &state, 
+					  (state | BZEN_SBUF_DESTROYING) + 1, 
+					  0, __ATOMIC_ACQ_REL, 
+					  __ATOMIC_ACQUIRE));
+  result = cbuflock->shared ? 
+    bzen_rwlock_clockwrlock(&cbuflock->rwlock, &deadline) :
+    bzen_mutex_clocklock(&cbuflock->mutex, &deadline);
+  if (result != 0)
+    {
+      /* Undo only what this call set: lockers are let in again and our 
+	 reference is dropped. That frees buffer if bzen_sbuf_destroy_async()
+	 dropped reference of owner meanwhile. */
+      state = __atomic_sub_fetch(&slot->state, BZEN_SBUF_DESTROYING + 1, 
+				 __ATOMIC_ACQ_REL);
+      if ((state & BZEN_SBUF_REFS) == 0)
+	{
+	  result = bzen_sbuf_teardown(cbuflock);
+	}
+      else
+	{
+	  result = (result == ETIMEDOUT) ? EBUSY : result;
+	}
+      goto DESTROY_FAIL;
+    }
+
+  /* Doom buffer, so waiters fail, and drop lock, then our reference and 
+     that of owner unless bzen_sbuf_destroy_async() dropped it meanwhile. 
+     The last waiter frees buffer. */
+  state = __atomic_fetch_or(&slot->state, BZEN_SBUF_DOOMED, __ATOMIC_ACQ_REL);
+  if (cbuflock->shared)
+    {
+      pthread_rwlock_unlock(&cbuflock->rwlock);
+    }
+  else
+    {
+      pthread_mutex_unlock(&cbuflock->mutex);
+    }
+  if (!(state & BZEN_SBUF_DOOMED))
+    {
+      __atomic_sub_fetch(&slot->state, 1, __ATOMIC_ACQ_REL);
+    }
+  result = bzen_sbuf_release(cbuflock);
+
+ DESTROY_FAIL:
+
+  return result;
+}
+
+/* Stream buffer destructor that does not wait. */
+int bzen_sbuf_destroy_async(bzen_cbuflock_t* cbuflock)
+{
+  int result = 0;
+
+  if (cbuflock == NULL)
+    {
+      goto DESTROY_FAIL;
+    }
+
+  /* Drop reference of owner; last holder of lock frees buffer. Buffer 
+     doomed already had it dropped by bzen_sbuf_destroy(). */
+  if (!(__atomic_fetch_or(&bzen_sbuf_slot(cbuflock->id)->state, 
+			  BZEN_SBUF_DOOMED, __ATOMIC_ACQ_REL) & 
+	BZEN_SBUF_DOOMED))
+    {
+      result = bzen_sbuf_release(cbuflock);
+    }
+
+ DESTROY_FAIL:
+
+  return result;
+}
+
+/* Get counters of the given buffer. */
+int bzen_sbuf_get_stats(bzen_cbuflock_t* cbuflock, bzen_sbuf_stats_t* stats)
+{
+  int result = -1;
+
+  if ((cbuflock == NULL) || (cbuflock->stats == NULL) || (stats == NULL))
+    {
+      goto GET_STATS_FAIL;
+    }
+
+  memset(stats, 0, sizeof(bzen_sbuf_stats_t));
+  bzen_sbuf_stats_sum(stats, &cbuflock->stats->stats);
+  stats->id = cbuflock->id;
+  result = 0;
+
+ GET_STATS_FAIL:
+
+  return result;
+}
+
+/* Get counters of all live buffers which keep them. */
+size_t bzen_sbuf_get_stats_all(bzen_sbuf_stats_t* stats, 
+			       size_t n, 
+			       bzen_sbuf_stats_t* totals)
+{
+  bzen_sbuf_slot_t* slot;
+  bzen_sbuf_counters_t* counters;
+  size_t id;
+  size_t end;
+  size_t count = 0;
+
+  if (totals != NULL)
+    {
+      memset(totals, 0, sizeof(bzen_sbuf_stats_t));
+      bzen_sbuf_stats_sum(totals, &stats_retired);
+    }
+
+  /* Slots and their counters are never freed, so they are read unlocked. */
+  end = __atomic_load_n(&buffers_next, __ATOMIC_RELAXED);
+  for (id = 0; id < end; id++)
+    {
+      slot = bzen_sbuf_slot(id);
+      if (slot == NULL)
+	{
+	  continue;
+	}
+      counters = __atomic_load_n(&slot->counters, __ATOMIC_ACQUIRE);
+      if ((counters == NULL) || 
+	  !__atomic_load_n(&counters->live, __ATOMIC_ACQUIRE))
+	{
+	  continue;
+	}
+
+      if (count < n)
+	{
+	  memset(&stats[count], 0, sizeof(bzen_sbuf_stats_t));
+	  bzen_sbuf_stats_sum(&stats[count], &counters->stats);
+	  stats[count].id = (unsigned int)id;
+	}
+      if (totals != NULL)
+	{
+	  bzen_sbuf_stats_sum(totals, &counters->stats);
+	}
+      count++;
+    }
+
+  return count;
+}
+
+/* Get handle of the given buffer. */
+bzen_sbuf_handle_t bzen_sbuf_handle(const bzen_cbuflock_t* cbuflock)
+{
+  bzen_sbuf_handle_t handle = { (unsigned int)-1, 0 };
+
+  if (cbuflock != NULL)
+    {
+      handle.id = cbuflock->id;
+      handle.generation = cbuflock->generation;
+    }
+
+  return handle;
+}
+
+/* Performs safety check on buffer and attempts to lock it. */
+int bzen_sbuf_lock(bzen_cbuflock_t* cbuflock)
+{
+  int buffer_id = -1;
+
+  if ((cbuflock != NULL) && 
+      (bzen_sbuf_lock_mode(cbuflock->id, cbuflock->generation, 0) != NULL))
+    {
+      buffer_id = cbuflock->id;
+    }
+
+  return buffer_id;
+}
+
+/* Lock buffer named by handle. */
+bzen_cbuflock_t* bzen_sbuf_lock_handle(bzen_sbuf_handle_t handle)
+{
+  return bzen_sbuf_lock_mode(handle.id, handle.generation, 0);
+}
+
+/* Lock buffer for read-only access. */
+int bzen_sbuf_lock_shared(bzen_cbuflock_t* cbuflock)
+{
+  int buffer_id = -1;
+
+  if ((cbuflock != NULL) && 
+      (bzen_sbuf_lock_mode(cbuflock->id, cbuflock->generation, 1) != NULL))
+    {
+      buffer_id = cbuflock->id;
+    }
+
+  return buffer_id;
+}
+
+/* Return length in bytes of contents of the given buffer. */
+size_t bzen_sbuf_length(bzen_cbuflock_t* cbuflock)
+{
+  size_t result;
+
+  if (bzen_sbuf_lock_shared(cbuflock) == -1)
+    {
+      result = 0;
+      goto LENGTH_FAIL;
+    }
+
+  if (cbuflock->map != NULL)
+    {
+      result = cbuflock->map->length;
+    }
+  else
+    {
+      result = cbuflock->shared ? cbuflock->length :
+	bzen_sbuf_stream_length(bzen_sbuf_slot(cbuflock->id)->file);
+    }
+
+  bzen_sbuf_unlock(cbuflock);
+
+ LENGTH_FAIL:
+
+  return result;
+}
+
+/* Attempts to unlock the given buffer. */
+int bzen_sbuf_unlock(bzen_cbuflock_t* cbuflock)
+{
+  int unlock_status = -1;
+
+  /* Safety check for null pointer. */
+  if (cbuflock == NULL)
+    {
+      goto LOCK_FAIL;
+    }
+
+  /* Unlock mutex or rwlock. */
+  unlock_status = cbuflock->shared ? 
+    pthread_rwlock_unlock(&cbuflock->rwlock) :
+    pthread_mutex_unlock(&cbuflock->mutex);
+  if (unlock_status != 0)
+    {
+      /* @todo: error loging */
+      goto LOCK_FAIL;
+    }
+
+  /* Buffer is unlocked. Free it if it was destroyed meanwhile. */
+  bzen_sbuf_release(cbuflock);
+
+ LOCK_FAIL:
+
+  return unlock_status;
+}
+
+/* Get a character from the given buffer. */
+int bzen_sbuf_getc(bzen_cbuflock_t* cbuflock)
+{
+  int result;
+  int buffer_id;
+  unsigned char c;
+
+  /* Ring buffer takes no lock. */
+  if ((cbuflock != NULL) && (cbuflock->ring != NULL))
+    {
+      result = (bzen_sbuf_ring_read(cbuflock->ring, &c, 1) == 1) ? c : EOF;
+      bzen_sbuf_count(cbuflock, 0, (result == EOF) ? 0 : 1);
+      goto GETC_FAIL;
+    }
+
+  /* Check buffer safety and attempt to lock it. */
+  buffer_id = bzen_sbuf_lock(cbuflock);
+  if (buffer_id == -1)
+    {
+      result = EOF;
+      goto GETC_FAIL;
+    }
+
+  /* Get character from buffer. */
+  if (cbuflock->map != NULL)
+    {
+      result = (bzen_sbuf_map_read(cbuflock->map, &c, 1) == 1) ? c : EOF;
+    }
+  else
+    {
+      result = fgetc(bzen_sbuf_slot(cbuflock->id)->file);
+    }
+  bzen_sbuf_count(cbuflock, 0, (result == EOF) ? 0 : 1);
+
+  /* Unlock the buffer. */
+  bzen_sbuf_unlock(cbuflock);
+
+ GETC_FAIL:
 
-/* Return a count of the number of buffers currently in use. */
-size_t bzen_sbuf_count_used()
-{
-  return buffers_used;
+  return result;
 }
 
-/* Allocate memory for a new stream buffer. */
-bzen_cbuflock_t* bzen_sbuf_create(size_t size)
+/* Put a character to the given buffer. */
+int bzen_sbuf_putc(int c, bzen_cbuflock_t* cbuflock)
 {
-  /* Create the buffer as an IO stream (FILE) in memory.
-     Passing a NULL pointer to fmemopen is intentional. It results in
-     the function dynamically allocating memory for the buffer, 
-     preventing direct access to it except through stdio functions,
-     thus providing for better built-in thread-safety via FILE locks
-     and also cleans up heap when fclose() is called.  */
-  bzen_cbuflock_t* pcbuflock;
-  FILE* file;
-  size_t new_buffer_size;
+  int result;
+  int buffer_id;
+  unsigned char uc;
 
-  new_buffer_size = BZEN_SIZE(sizeof(int) * size);
-  file = fmemopen(NULL, new_buffer_size, "r+");
-  pcbuflock = bzen_sbuf_create_file(file);
-  if (pcbuflock == NULL)
+  /* Ring buffer takes no lock. */
+  if ((cbuflock != NULL) && (cbuflock->ring != NULL))
     {
-      goto CREATE_FAIL;
+      uc = (unsigned char)c;
+      result = (bzen_sbuf_ring_write(cbuflock->ring, &uc, 1) == 1) ? uc : EOF;
+      bzen_sbuf_count(cbuflock, (result == EOF) ? 0 : 1, 0);
+      goto PUTC_FAIL;
     }
 
-  /* bzen_sbuf_create_file() leaves decision to close stream to application. */
-  pcbuflock->keep_open = 0;
-  pcbuflock->size = new_buffer_size;
+  /* Check buffer safety and attempt to lock it. */
+  buffer_id = bzen_sbuf_lock(cbuflock);
+  if (buffer_id == -1)
+    {
+      result = EOF;
+      goto PUTC_FAIL;
+    }
 
- CREATE_FAIL:
+  /* Put character to buffer. Mappings are read-only. */
+  result = (cbuflock->map != NULL) ? EOF :
+    fputc(c, bzen_sbuf_slot(cbuflock->id)->file);
+  bzen_sbuf_written(cbuflock);
+  bzen_sbuf_count(cbuflock, (result == EOF) ? 0 : 1, 0);
 
-  return pcbuflock;
+  /* Unlock the buffer. */
+  bzen_sbuf_unlock(cbuflock);
+
+ PUTC_FAIL:
+
+  return result;
 }
 
-/* Allocate memory for new character buffer and set file decriptor as I/O stream. */
-bzen_cbuflock_t* bzen_sbuf_create_file(FILE* file)
+/* Get span of up to n readable bytes without consuming them. */
+const void* bzen_sbuf_peek(size_t n, size_t* available, bzen_cbuflock_t* cbuflock)
 {
-  bzen_cbuflock_t* pcbuflock;
+  const void* span = NULL;
+  bzen_sbuf_ring_t* ring;
+  size_t offset;
+  size_t count = 0;
 
-  if (file == NULL)
+  if (cbuflock == NULL)
     {
-      /* @todo: error logging */
-      goto CREATE_FAIL;
+      goto PEEK_FAIL;
     }
 
-  /* Allocate default number of buffers if not already done. */
-  size_t buffer_struct_size;
-  int status;
-  unsigned short int buffer_id;
-  if (buffers == NULL)
+  /* Ring span runs up to end of ring at most. */
+  if (cbuflock->ring != NULL)
     {
-      /* Allocate memory for FILE* pointers to streams. */
-      buffers_allocated = BZEN_DEFAULT_NUMBER_OF_BUFFERS;
-      buffers = (FILE**)bzen_malloc(BZEN_SIZE(sizeof(FILE*)) * buffers_allocated);
+      ring = cbuflock->ring;
+      count = bzen_sbuf_ring_available(ring, n);
+      offset = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) & ring->mask;
+      if (count > ring->mask + 1 - offset)
+	{
+	  count = ring->mask + 1 - offset;
+	}
+      if (count > n)
+	{
+	  count = n;
+	}
+      span = (count > 0) ? ring->data + offset : NULL;
+      goto PEEK_FAIL;
+    }
+
+  /* Stream buffer stays locked until bzen_sbuf_consume(). */
+  if (bzen_sbuf_lock(cbuflock) == -1)
+    {
+      goto PEEK_FAIL;
+    }
+  if (cbuflock->map != NULL)
+    {
+      /* Span of mapping itself (zero copy). */
+      count = cbuflock->map->length - cbuflock->map->position;
+      count = (count > n) ? n : count;
+      span = cbuflock->map->data + cbuflock->map->position;
     }
   else
     {
-      if (buffers_used == buffers_allocated)
-	{
-	  /* Grow by default size. */
-	  buffers_allocated += BZEN_DEFAULT_NUMBER_OF_BUFFERS;
-	  buffers = (FILE**)bzen_realloc(buffers,
-					 &buffers_allocated,
-					 BZEN_SIZEOF(FILE*));
-	}
+      count = fread(bzen_sbuf_stage(cbuflock, n), 1, n, 
+		    bzen_sbuf_slot(cbuflock->id)->file);
+      span = cbuflock->stage;
+    }
+  if (count == 0)
+    {
+      bzen_sbuf_unlock(cbuflock);
+      span = NULL;
+      goto PEEK_FAIL;
     }
+  cbuflock->staged = count;
+  cbuflock->spanned = 1;
 
-  /* Determine size of buffer struct.  */
-  buffer_struct_size = BZEN_SIZEOF(bzen_cbuflock_t);
-  
-  /* Allocate memory for buffer struct. */
-  pcbuflock = (bzen_cbuflock_t*)bzen_malloc(buffer_struct_size);
-  if (pcbuflock == NULL)
+ PEEK_FAIL:
+
+  if (available != NULL)
     {
-      goto CREATE_FAIL;
+      *available = count;
     }
 
-  /* Initialize the mutex. */
-  status = bzen_mutex_init(&pcbuflock->mutex, NULL);
-  if (status != 0)
+  return span;
+}
+
+/* Read up to n bytes from the given buffer. */
+size_t bzen_sbuf_read(void* ptr, size_t n, bzen_cbuflock_t* cbuflock)
+{
+  size_t result;
+  int buffer_id;
+
+  /* Ring buffer takes no lock. */
+  if ((cbuflock != NULL) && (cbuflock->ring != NULL))
     {
-      bzen_free(pcbuflock);
-      pcbuflock = NULL;
-      goto CREATE_FAIL;
+      result = bzen_sbuf_ring_read(cbuflock->ring, (unsigned char*)ptr, n);
+      bzen_sbuf_count(cbuflock, 0, result);
+      goto READ_FAIL;
+    }
+
+  /* Check buffer safety and attempt to lock it. */
+  buffer_id = bzen_sbuf_lock(cbuflock);
+  if (buffer_id == -1)
+    {
+      result = 0;
+      goto READ_FAIL;
     }
 
-  /* Set file descriptor as I/O stream.  */
-  buffer_id = buffers_used++;
-  buffers[buffer_id] = file;
+  /* Read whole span under one lock. */
+  result = (cbuflock->map != NULL) ? 
+    bzen_sbuf_map_read(cbuflock->map, (unsigned char*)ptr, n) :
+    fread(ptr, 1, n, bzen_sbuf_slot(cbuflock->id)->file);
+  bzen_sbuf_count(cbuflock, 0, result);
 
-  /* Initialize other members. */
-  pcbuflock->id = buffer_id;  
-  pcbuflock->keep_open = 1; /* application is responsible for fclose(). */
-  pcbuflock->size = BZEN_FILE_SIZE_UNKNOWN; /* @todo: */
+  /* Unlock the buffer. */
+  bzen_sbuf_unlock(cbuflock);
 
- CREATE_FAIL:
+ READ_FAIL:
 
-  return pcbuflock;
+  return result;
 }
 
-/* Thread-safe stream buffer destructor. */
-int bzen_sbuf_destroy(bzen_cbuflock_t* cbuflock, double timeout)
+/* Read up to n bytes at offset without moving stream position. */
+size_t bzen_sbuf_read_at(void* ptr, size_t n, off_t offset, 
+			 bzen_cbuflock_t* cbuflock)
 {
-  int result;
-  clock_t start_time;
-  clock_t end_time;
-  double wait_time;
+  size_t result = 0;
+  FILE* file;
+  off_t position;
+  ssize_t count;
 
-  if (cbuflock == NULL)
+  if ((offset < 0) || (bzen_sbuf_lock_shared(cbuflock) == -1))
     {
-      /* Nothing to do. */
-      result = 0;
-      goto DESTROY_FAIL;
+      goto READ_AT_FAIL;
     }
+  file = bzen_sbuf_slot(cbuflock->id)->file;
 
-  /* Initialize clock timer.*/
-  start_time = clock();
-
-  do
+  if (cbuflock->map != NULL)
     {
-      /* Attempt to destroy mutex while unlocked. It is safe to destroy an 
-	 initialised mutex that is unlocked. Attempting to destroy a locked 
-	 mutex results in undefined behaviour. */
-      result = bzen_mutex_destroy(&cbuflock->mutex);
-      if (result == 0)
+      /* Mapping does not change, whatever the lock. */
+      if ((size_t)offset < cbuflock->map->length)
 	{
-	  if (cbuflock->keep_open == 0)
-	    {
-	      /* fclose() will free buffer memory on heap. */
-	      result = fclose(buffers[cbuflock->id]);
-	      if (result != 0)
-		{
-		  /* @todo: this leaves us with a file close error and 
-		     a destroyed mutex, which is bad. */
-		  goto DESTROY_FAIL;
-		}
-	    }
-	  buffers[cbuflock->id] = NULL;
-	  bzen_free(cbuflock);
-	  buffers_used--;
-	  break;
+	  result = cbuflock->map->length - (size_t)offset;
+	  result = (result > n) ? n : result;
+	  memcpy(ptr, cbuflock->map->data + offset, result);
+	}
+    }
+  else if (!cbuflock->shared)
+    {
+      /* Exclusive lock, so stream may be moved and put back. */
+      position = ftello(file);
+      if (fseeko(file, offset, SEEK_SET) == 0)
+	{
+	  result = fread(ptr, 1, n, file);
+	}
+      clearerr(file);
+      fseeko(file, position, SEEK_SET);
+    }
+  else if ((size_t)offset < cbuflock->length)
+    {
+      /* Shared lock: contents were flushed by last writer. */
+      if (n > cbuflock->length - (size_t)offset)
+	{
+	  n = cbuflock->length - (size_t)offset;
+	}
+      if (cbuflock->memory != NULL)
+	{
+	  memcpy(ptr, cbuflock->memory + offset, n);
+	  result = n;
+	}
+      else if (cbuflock->growable != NULL)
+	{
+	  /* Memory moves only under exclusive lock. */
+	  memcpy(ptr, cbuflock->growable->data + offset, n);
+	  result = n;
 	}
       else
 	{
-	  if (result == EBUSY)
-	    {
-	      /* Wait a few ticks. */
-	      sleep(BZEN_SBUF_DEFAULT_WAIT);
+	  count = pread(fileno(file), ptr, n, offset);
+	  result = (count < 0) ? 0 : (size_t)count;
+	}
+    }
+  bzen_sbuf_count(cbuflock, 0, result);
+
+  bzen_sbuf_unlock(cbuflock);
+
+ READ_AT_FAIL:
+
+  return result;
+}
+
+/* Read a line from the given buffer. */
+ssize_t bzen_sbuf_readline(char* s, size_t size, bzen_cbuflock_t* cbuflock)
+{
+  ssize_t result;
+  int buffer_id;
+  FILE* file;
+  size_t length;
+  size_t available;
+  const unsigned char* line;
+  int c;
+
+  if ((s == NULL) || (size == 0))
+    {
+      result = -1;
+      goto READLINE_FAIL;
+    }
+
+  /* Ring buffer takes no lock, and gives up only whole lines. */
+  if ((cbuflock != NULL) && (cbuflock->ring != NULL))
+    {
+      available = bzen_sbuf_ring_available(cbuflock->ring, size - 1);
+      if (available > size - 1)
+	{
+	  available = size - 1;
+	}
+      bzen_sbuf_ring_copy(cbuflock->ring, (unsigned char*)s, 0, available);
+      for (length = 0; (length < available) && (s[length] != '\n'); length++)
+	{
+	  /* Scan. */
+	}
+      if (length < available)
+	{
+	  /* Include newline. */
+	  length++;
+	}
+      else if (length < size - 1)
+	{
+	  /* Rest of line is pending. */
+	  errno = EAGAIN;
+	  result = -1;
+	  goto READLINE_FAIL;
+	}
+      bzen_sbuf_ring_consume(cbuflock->ring, length);
+      bzen_sbuf_count(cbuflock, 0, length);
+      s[length] = '\0';
+      result = (ssize_t)length;
+      goto READLINE_FAIL;
+    }
+
+  /* Check buffer safety and attempt to lock it. */
+  buffer_id = bzen_sbuf_lock(cbuflock);
+  if (buffer_id == -1)
+    {
+      result = -1;
+      goto READLINE_FAIL;
+    }
 
-	      /* Check wait time. */
-	      wait_time = ((double)(clock() - start_time))/CLOCKS_PER_SEC;
+  if (cbuflock->map != NULL)
+    {
+      /* Line is found in mapping and copied once. */
+      available = cbuflock->map->length - cbuflock->map->position;
+      available = (available > size - 1) ? size - 1 : available;
+      line = memchr(cbuflock->map->data + cbuflock->map->position, '\n', 
+		    available);
+      length = bzen_sbuf_map_read(cbuflock->map, (unsigned char*)s, 
+				  (line == NULL) ? available : 
+				  (size_t)(line - (cbuflock->map->data + 
+						   cbuflock->map->position)) + 1);
+      c = (length == 0) ? EOF : 0;
+    }
+  else
+    {
+      /* Stream lock is also taken once, so characters are read unlocked. */
+      file = bzen_sbuf_slot(cbuflock->id)->file;
+      flockfile(file);
+      length = 0;
+      c = EOF;
+      while (length < size - 1)
+	{
+	  c = getc_unlocked(file);
+	  if (c == EOF)
+	    {
+	      break;
 	    }
-	  else
+	  s[length++] = (char)c;
+	  if (c == '\n')
 	    {
-	      /* Some other error condition prevented us from destroying mutex.
-	         Error already logged by bzen_thread_destroy, so just bail. */
-	      goto DESTROY_FAIL;
+	      break;
 	    }
 	}
-    } while (wait_time < timeout);
+      funlockfile(file);
+    }
+  bzen_sbuf_count(cbuflock, 0, length);
+  s[length] = '\0';
+  result = ((length == 0) && (c == EOF)) ? -1 : (ssize_t)length;
 
- DESTROY_FAIL:
+  /* Unlock the buffer. */
+  bzen_sbuf_unlock(cbuflock);
+
+ READLINE_FAIL:
 
   return result;
 }
 
-/* Performs safety check on buffer and attempts to lock it. */
-int bzen_sbuf_lock(bzen_cbuflock_t* cbuflock)
+/* Get writable span of up to n bytes to be published by bzen_sbuf_commit(). */
+void* bzen_sbuf_reserve(size_t n, size_t* reserved, bzen_cbuflock_t* cbuflock)
 {
-  int buffer_id;
-  int lock_status;
+  void* span = NULL;
+  bzen_sbuf_ring_t* ring;
+  size_t head;
+  size_t offset;
+  size_t count = 0;
 
-  /* Safety check for null pointer. */
-  if (cbuflock == NULL)
+  if ((cbuflock == NULL) || (n == 0))
     {
-      buffer_id = -1;
-      goto LOCK_FAIL;
+      goto RESERVE_FAIL;
     }
 
-  /* Lock mutex. This will block destruction of buffer via bzen_sbuf_destroy()
-     until mutex is unlocked. */
-  lock_status = pthread_mutex_lock(&cbuflock->mutex);
-  if (lock_status != 0)
+  /* Ring span runs up to end of ring at most. */
+  if (cbuflock->ring != NULL)
     {
-      /* @todo: error loging */
-      buffer_id = -1;
-      goto LOCK_FAIL;
+      ring = cbuflock->ring;
+      head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+      count = ring->mask + 1 - (head - ring->tail_cache);
+      if (count < n)
+	{
+	  /* Refresh view of consumer. */
+	  ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	  count = ring->mask + 1 - (head - ring->tail_cache);
+	}
+      offset = head & ring->mask;
+      if (count > ring->mask + 1 - offset)
+	{
+	  count = ring->mask + 1 - offset;
+	}
+      if (count > n)
+	{
+	  count = n;
+	}
+      span = (count > 0) ? ring->data + offset : NULL;
+      goto RESERVE_FAIL;
     }
 
-  /* Safety check for null buffer. */
-  if ((cbuflock->id >= buffers_used) ||
-      (buffers == NULL) ||
-      (buffers[cbuflock->id] == NULL))
+  /* Stream buffer stays locked until bzen_sbuf_commit(). Mappings are 
+     read-only. */
+  if (bzen_sbuf_lock(cbuflock) == -1)
     {
-      buffer_id = -1;
-      goto LOCK_FAIL;
+      goto RESERVE_FAIL;
+    }
+  if (cbuflock->map != NULL)
+    {
+      bzen_sbuf_unlock(cbuflock);
+      goto RESERVE_FAIL;
     }
+  span = bzen_sbuf_stage(cbuflock, n);
+  cbuflock->staged = n;
+  cbuflock->spanned = 1;
+  count = n;
 
-  /* Buffer is locked and appears to be ready for read/write op. */
-  buffer_id = cbuflock->id;
+ RESERVE_FAIL:
 
- LOCK_FAIL:
+  if (reserved != NULL)
+    {
+      *reserved = count;
+    }
 
-  return buffer_id;
+  return span;
 }
 
-/* Attempts to unlock the given buffer. */
-int bzen_sbuf_unlock(bzen_cbuflock_t* cbuflock)
+/* Empty growable buffer, giving back memory it has not needed lately. */
+int bzen_sbuf_reset(bzen_cbuflock_t* cbuflock)
 {
-  int unlock_status;
+  int result = -1;
+  bzen_sbuf_growable_t* growable;
+  struct timespec now;
+  long idle_ms;
 
-  /* Safety check for null pointer. */
-  if (cbuflock == NULL)
+  if ((cbuflock == NULL) || (cbuflock->growable == NULL) ||
+      (bzen_sbuf_lock(cbuflock) == -1))
     {
-      goto LOCK_FAIL;
+      goto RESET_FAIL;
     }
 
-  /* Unlock mutex. */
-  unlock_status = pthread_mutex_unlock(&cbuflock->mutex);
-  if (unlock_status != 0)
+  /* rewind() brings position of stream in line with cookie. */
+  growable = cbuflock->growable;
+  growable->length = 0;
+  rewind(bzen_sbuf_slot(cbuflock->id)->file);
+  cbuflock->length = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  idle_ms = (now.tv_sec - growable->grown.tv_sec) * 1000L +
+    (now.tv_nsec - growable->grown.tv_nsec) / 1000000L;
+  if (idle_ms >= BZEN_SBUF_SHRINK_IDLE_MS)
     {
-      /* @todo: error loging */
-      goto LOCK_FAIL;
+      bzen_sbuf_growable_shrink(growable);
     }
+  result = 0;
 
-  /* Buffer is unlocked. */
+  bzen_sbuf_unlock(cbuflock);
 
- LOCK_FAIL:
+ RESET_FAIL:
 
-  return unlock_status;
+  return result;
 }
 
-/* Get a character from the given buffer. */
-int bzen_sbuf_getc(bzen_cbuflock_t* cbuflock)
+/* Set file position to beginning of stream and reset error indicator. */
+int  bzen_sbuf_rewind(bzen_cbuflock_t* cbuflock)
 {
   int result;
   int buffer_id;
@@ -312,67 +2259,126 @@ int bzen_sbuf_getc(bzen_cbuflock_t* cbuflock)
   if (buffer_id == -1)
     {
       result = EOF;
-      goto GETC_FAIL;
+      goto REWIND_FAIL;
     }
 
-  /* Put character to buffer. */
-  result = fgetc(buffers[cbuflock->id]);
+  /* rewind() does not return a value. */
+  result = 0;
+  if (cbuflock->map != NULL)
+    {
+      cbuflock->map->position = 0;
+    }
+  else
+    {
+      rewind(bzen_sbuf_slot(cbuflock->id)->file);
+    }
 
   /* Unlock the buffer. */
   bzen_sbuf_unlock(cbuflock);
 
- GETC_FAIL:
+ REWIND_FAIL:
 
   return result;
 }
 
-/* Put a character to the given buffer. */
-int bzen_sbuf_putc(int c, bzen_cbuflock_t* cbuflock)
+/* Switch buffer to reader/writer locking. */
+int bzen_sbuf_set_shared(bzen_cbuflock_t* cbuflock)
 {
-  int result;
-  int buffer_id;
+  int result = -1;
+  FILE* file;
 
-  /* Check buffer safety and attempt to lock it. */
-  buffer_id = bzen_sbuf_lock(cbuflock);
-  if (buffer_id == -1)
+  if ((cbuflock == NULL) || (cbuflock->ring != NULL))
     {
-      result = EOF;
-      goto PUTC_FAIL;
+      goto SHARED_FAIL;
+    }
+  if (cbuflock->shared)
+    {
+      result = 0;
+      goto SHARED_FAIL;
+    }
+
+  /* Readers need memory or a descriptor to read without moving stream. */
+  file = bzen_sbuf_slot(cbuflock->id)->file;
+  if ((file == NULL) || 
+      ((cbuflock->memory == NULL) && (cbuflock->growable == NULL) && 
+       (fileno(file) < 0)))
+    {
+      goto SHARED_FAIL;
+    }
+  if (pthread_rwlock_init(&cbuflock->rwlock, NULL) != 0)
+    {
+      goto SHARED_FAIL;
     }
+  fflush(file);
+  cbuflock->length = bzen_sbuf_stream_length(file);
+  cbuflock->shared = 1;
+  result = 0;
 
-  /* Put character to buffer. */
-  result = fputc(c, buffers[cbuflock->id]);
+ SHARED_FAIL:
+
+  return result;
+}
+
+/* Turn counters of buffers created from now on on or off. */
+int bzen_sbuf_set_stats(int enable)
+{
+  return __atomic_exchange_n(&stats_enabled, (enable != 0), __ATOMIC_RELAXED);
+}
+
+/* Give back memory of growable buffer not needed by its contents. */
+int bzen_sbuf_shrink(bzen_cbuflock_t* cbuflock)
+{
+  int result = -1;
+
+  if ((cbuflock == NULL) || (cbuflock->growable == NULL) ||
+      (bzen_sbuf_lock(cbuflock) == -1))
+    {
+      goto SHRINK_FAIL;
+    }
+
+  bzen_sbuf_growable_shrink(cbuflock->growable);
+  result = 0;
 
-  /* Unlock the buffer. */
   bzen_sbuf_unlock(cbuflock);
 
- PUTC_FAIL:
+ SHRINK_FAIL:
 
   return result;
 }
 
-/* Set file position to beginning of stream and reset error indicator. */
-int  bzen_sbuf_rewind(bzen_cbuflock_t* cbuflock)
+/* Write n bytes to the given buffer. */
+size_t bzen_sbuf_write(const void* ptr, size_t n, bzen_cbuflock_t* cbuflock)
 {
-  int result;
+  size_t result;
   int buffer_id;
 
+  /* Ring buffer takes no lock. */
+  if ((cbuflock != NULL) && (cbuflock->ring != NULL))
+    {
+      result = bzen_sbuf_ring_write(cbuflock->ring, 
+				    (const unsigned char*)ptr, n);
+      bzen_sbuf_count(cbuflock, result, 0);
+      goto WRITE_FAIL;
+    }
+
   /* Check buffer safety and attempt to lock it. */
   buffer_id = bzen_sbuf_lock(cbuflock);
   if (buffer_id == -1)
     {
-      result = EOF;
-      goto REWIND_FAIL;
+      result = 0;
+      goto WRITE_FAIL;
     }
 
-  /* rewind() does not return a value. */
-  result = 0;
-  rewind(buffers[cbuflock->id]);
+  /* Write whole span under one lock. Mappings are read-only. */
+  result = (cbuflock->map != NULL) ? 0 :
+    fwrite(ptr, 1, n, bzen_sbuf_slot(cbuflock->id)->file);
+  bzen_sbuf_written(cbuflock);
+  bzen_sbuf_count(cbuflock, result, 0);
 
   /* Unlock the buffer. */
   bzen_sbuf_unlock(cbuflock);
 
- REWIND_FAIL:
+ WRITE_FAIL:
 
   return result;
 }
@@ -25,12 +25,18 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <dirent.h>
 
 /* libzenc includes */
 #include "bzenmem.h"
 #include "bzensock.h"
 
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
 /* Accept connection request. */
 int bzen_socket_accept(int socket_fd, 
 		       struct sockaddr* address, 
@@ -58,7 +64,8 @@ struct sockaddr_in* bzen_socket_address_in(uint32_t host, uint32_t port)
 
   /* Allocate memory for the data structure. */  
   address_alloc_size = BZEN_SIZEOF(struct sockaddr_in);  
-  address = (struct sockaddr_in*)bzen_malloc(address_alloc_size);
+  address = (struct sockaddr_in*)bzen_malloc_tagged(address_alloc_size,
+						   BZEN_MEM_TAG_SOCK);
   memset(address, 0, address_alloc_size);
   address->sin_family = AF_INET;
 
@@ -88,7 +95,8 @@ struct sockaddr_un* bzen_socket_address_un(const char* name)
 
   /* Allocate memory for the data structure. */  
   address_alloc_size = BZEN_SIZEOF(struct sockaddr_un);  
-  address = (struct sockaddr_un*)bzen_malloc(address_alloc_size);
+  address = (struct sockaddr_un*)bzen_malloc_tagged(address_alloc_size,
+						   BZEN_MEM_TAG_SOCK);
   memset(address, 0, address_alloc_size);
 
   /* Allocate memory with data structure for the path. */
@@ -289,6 +297,35 @@ ssize_t bzen_socket_send(int socket_fd, const void* data, size_t data_size, int
   return result;
 }
 
+/* Send chain to connected peer with one sendmsg() and drop bytes sent. */
+ssize_t bzen_socket_send_iobuf(int socket_fd, bzen_iobuf_t* chain, int flags)
+{
+  struct iovec iov[IOV_MAX];
+  struct msghdr message;
+  ssize_t result = 0;
+
+  memset(&message, 0, BZEN_SIZEOF(struct msghdr));
+  message.msg_iov = iov;
+  message.msg_iovlen = bzen_iobuf_iovec(chain, iov, IOV_MAX);
+  if (message.msg_iovlen == 0)
+    {
+      goto TXMT_FAIL;
+    }
+
+  result = sendmsg(socket_fd, &message, flags);
+  if (result < 0)
+    {
+      perror("sendmsg");
+      goto TXMT_FAIL;
+    }
+
+  bzen_iobuf_consume(chain, (size_t)result);
+
+ TXMT_FAIL:
+
+  return result;
+}
+
 /* Send data to connectionless peer. */
 ssize_t bzen_socket_send_to(int socket_fd, 
 			   const void* data, 
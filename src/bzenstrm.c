@@ -20,9 +20,1388 @@
  */
 
 #include <config.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#include "freadahead.h"
+#include "bzeniobuf.h"
+#include "bzenlz.h"
+#include "bzenmem.h"
 #include "bzenstrm.h"
 
+/**
+ * Size of block of bzen_stream_copy() when copying through user space.
+ */
+#define BZEN_STREAM_COPY_BLOCK (64 * 1024)
+
+/**
+ * Most bytes asked of the kernel in one call of bzen_stream_copy().
+ */
+#define BZEN_STREAM_COPY_CHUNK (1 << 30)
+
+/**
+ * Size of input and of output buffer of a native stream on a descriptor.
+ */
+#define BZEN_STREAM_FD_BUFFER_SIZE (32 * 1024)
+
+/**
+ * Number of struct iovec a native stream gathers on its stack.
+ */
+#define BZEN_STREAM_FD_IOV 16
+
+/**
+ * Size of block a compressed stream compresses at once, at most the reach of
+ * an LZ match so every block stands alone.
+ */
+#define BZEN_STREAM_LZ_BLOCK_SIZE (64 * 1024)
+
+/**
+ * A compressed stream starts with magic; each block with its size in 4 bytes
+ * (little endian), the top bit set if the block is stored uncompressed.
+ */
+#define BZEN_STREAM_LZ_MAGIC "BZL1"
+#define BZEN_STREAM_LZ_HEADER_SIZE 4
+#define BZEN_STREAM_LZ_STORED 0x80000000U
+
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
+/**
+ * Bytes consumed by ungetc() in glibc (as in gnulib freadahead.c).
+ */
+#ifndef _IO_IN_BACKUP
+#define _IO_IN_BACKUP 0x100
+#endif
+
+/**
+ * Ways bzen_stream_copy() may move bytes inside the kernel, tried in order.
+ */
+enum
+  {
+    BZEN_STREAM_COPY_RANGE,
+    BZEN_STREAM_COPY_SENDFILE,
+    BZEN_STREAM_COPY_SPLICE,
+    BZEN_STREAM_COPY_NONE
+  };
+
+/**
+ * Pool of bzen_stream_t structs.
+ */
+static bzen_pool_t* stream_pool = NULL;
+static bzen_pool_t* fdstream_pool = NULL;
+static bzen_pool_t* lzstream_pool = NULL;
+static pthread_once_t stream_pool_once = PTHREAD_ONCE_INIT;
+
+/**
+ * State of a dynamic memory stream.
+ *
+ * Data comes first, so stream->buffer (char**) addresses both the data 
+ * pointer and the state as a whole.
+ */
+typedef struct _bzen_memstream_s
+{
+  /** Contents of stream, always NUL-terminated. */
+  char* data;
+
+  /** Allocated size of data in bytes. */
+  size_t capacity;
+
+  /** Length of contents in bytes. */
+  size_t length;
+
+  /** Current file position. */
+  size_t position;
+
+  /** Where length is published (size of bzen_stream_t). */
+  size_t* sizeloc;
+} bzen_memstream_t;
+
+/**
+ * State of a chunked memory stream.
+ *
+ * Contents are a chain of pooled segments which is only ever appended to, so
+ * views of it stay put and a read may resume at the view of the last read.
+ */
+typedef struct _bzen_chunkstream_s
+{
+  /** Contents of stream. */
+  bzen_iobuf_t* chain;
+
+  /** Current read position. */
+  size_t position;
+
+  /** View of last read and offset of its first byte in contents. */
+  bzen_iobuf_node_t* cursor;
+  size_t cursor_start;
+
+  /** Where length is published (size of bzen_stream_t). */
+  size_t* sizeloc;
+} bzen_chunkstream_t;
+
+/**
+ * State of a native stream on a descriptor.
+ *
+ * Buffers are part of the state, so a stream takes both from the pool at 
+ * once and they are reused by the next stream.
+ */
+typedef struct _bzen_fdstream_s
+{
+  /** Descriptor, closed with stream. */
+  int fd;
+
+  /** Non-zero if descriptor can seek; input and output share a position. */
+  int seekable;
+
+  /** Non-zero once a read returned end of input. */
+  int eof;
+
+  /** Unread bytes of input are from start to end. */
+  size_t start;
+  size_t end;
+
+  /** Number of bytes in output not yet written. */
+  size_t pending;
+
+  unsigned char input[BZEN_STREAM_FD_BUFFER_SIZE];
+  unsigned char output[BZEN_STREAM_FD_BUFFER_SIZE];
+} bzen_fdstream_t;
+
+/**
+ * State of a compressed stream over another stream.
+ *
+ * Buffers are part of the state and taken from the pool with it, as for a
+ * native stream.
+ */
+typedef struct _bzen_lzstream_s
+{
+  /** Stream of compressed blocks, left open with this one. */
+  bzen_stream_t* inner;
+
+  /** Non-zero if stream compresses writes, otherwise it decompresses reads. */
+  int writing;
+
+  /** Non-zero once magic was written or read. */
+  int started;
+
+  /** Plain bytes not yet read, or not yet compressed, are from start to end. */
+  size_t start;
+  size_t end;
+
+  unsigned char plain[BZEN_STREAM_LZ_BLOCK_SIZE];
+  unsigned char packed[BZEN_LZ_BOUND(BZEN_STREAM_LZ_BLOCK_SIZE)];
+} bzen_lzstream_t;
+
+/**
+ * Create pools of bzen_stream_t structs and native stream states (once).
+ *
+ * @return void
+ */
+static void bzen_stream_pool_init()
+{
+  stream_pool = BZEN_POOL_CREATE(bzen_stream_t);
+  fdstream_pool = bzen_pool_create(BZEN_SIZEOF(bzen_fdstream_t), 4);
+  lzstream_pool = bzen_pool_create(BZEN_SIZEOF(bzen_lzstream_t), 2);
+}
+
+/**
+ * Close memstream cookie. Buffer is kept until stream is closed or deleted.
+ *
+ * @param[in] void* cookie Memstream state.
+ *
+ * @return int 0
+ */
+static int bzen_memstream_close(void* cookie)
+{
+  (void)cookie;
+
+  return 0;
+}
+
+/**
+ * Read up to size bytes from memstream at current position.
+ *
+ * @param[in] void* cookie Memstream state.
+ * @param[out] char* buf Destination.
+ * @param[in] size_t size Number of bytes requested.
+ *
+ * @return ssize_t Number of bytes read, 0 at end of contents.
+ */
+static ssize_t bzen_memstream_read(void* cookie, char* buf, size_t size)
+{
+  bzen_memstream_t* memstream = (bzen_memstream_t*)cookie;
+  size_t available = 0;
+
+  if (memstream->position < memstream->length)
+    {
+      available = memstream->length - memstream->position;
+      available = (size < available) ? size : available;
+      memcpy(buf, memstream->data + memstream->position, available);
+      memstream->position += available;
+    }
+
+  return (ssize_t)available;
+}
+
+/**
+ * Set current position of memstream.
+ *
+ * Positions past end of contents are allowed, the gap is zero-filled by the
+ * next write.
+ *
+ * @param[in] void* cookie Memstream state.
+ * @param[in,out] off64_t* offset Offset in, new position out.
+ * @param[in] int whence SEEK_SET, SEEK_CUR or SEEK_END.
+ *
+ * @return int 0 on success otherwise -1.
+ */
+static int bzen_memstream_seek(void* cookie, off64_t* offset, int whence)
+{
+  bzen_memstream_t* memstream = (bzen_memstream_t*)cookie;
+  off64_t position;
+  int result = -1;
+
+  switch (whence)
+    {
+    case SEEK_SET:
+      position = *offset;
+      break;
+    case SEEK_CUR:
+      position = (off64_t)memstream->position + *offset;
+      break;
+    case SEEK_END:
+      position = (off64_t)memstream->length + *offset;
+      break;
+    default:
+      goto SEEK_FAIL;
+    }
+  if (position < 0)
+    {
+      goto SEEK_FAIL;
+    }
+
+  memstream->position = (size_t)position;
+  *offset = position;
+  result = 0;
+
+ SEEK_FAIL:
+
+  return result;
+}
+
+/**
+ * Write size bytes to memstream at current position, growing buffer.
+ *
+ * Buffers past BZEN_MEM_MAP_THRESHOLD are grown by remapping their pages, so
+ * long streams are not copied on every growth.
+ *
+ * @param[in] void* cookie Memstream state.
+ * @param[in] const char* buf Source.
+ * @param[in] size_t size Number of bytes to write.
+ *
+ * @return ssize_t Number of bytes written.
+ */
+static ssize_t bzen_memstream_write(void* cookie, const char* buf, size_t size)
+{
+  bzen_memstream_t* memstream = (bzen_memstream_t*)cookie;
+  size_t end;
+
+  /* Keep room for terminating null. */
+  end = memstream->position + size;
+  memstream->data = (char*)bzen_realloc_grow(memstream->data,
+					     &memstream->capacity,
+					     end + 1,
+					     BZEN_SIZEOF(char),
+					     NULL);
+
+  if (memstream->position > memstream->length)
+    {
+      memset(memstream->data + memstream->length, 0, 
+	     memstream->position - memstream->length);
+    }
+  memcpy(memstream->data + memstream->position, buf, size);
+  memstream->position = end;
+  if (end > memstream->length)
+    {
+      memstream->length = end;
+      memstream->data[end] = '\0';
+    }
+  *memstream->sizeloc = memstream->length;
+
+  return (ssize_t)size;
+}
+
+/**
+ * Close chunked stream cookie and release its contents.
+ *
+ * @param[in] void* cookie Chunked stream state.
+ *
+ * @return int 0
+ */
+static int bzen_chunkstream_close(void* cookie)
+{
+  bzen_chunkstream_t* chunkstream = (bzen_chunkstream_t*)cookie;
+
+  bzen_iobuf_destroy(chunkstream->chain);
+  bzen_free(chunkstream);
+
+  return 0;
+}
+
+/**
+ * Read up to size bytes from chunked stream at current position.
+ *
+ * @param[in] void* cookie Chunked stream state.
+ * @param[out] char* buf Destination.
+ * @param[in] size_t size Number of bytes requested.
+ *
+ * @return ssize_t Number of bytes read, 0 at end of contents.
+ */
+static ssize_t bzen_chunkstream_read(void* cookie, char* buf, size_t size)
+{
+  bzen_chunkstream_t* chunkstream = (bzen_chunkstream_t*)cookie;
+  bzen_iobuf_node_t* node;
+  size_t start, offset, chunk;
+  size_t copied = 0;
+
+  /* Resume at view of last read unless position moved before it. */
+  if (chunkstream->cursor != NULL && 
+      chunkstream->position >= chunkstream->cursor_start)
+    {
+      node = chunkstream->cursor;
+      start = chunkstream->cursor_start;
+    }
+  else
+    {
+      node = chunkstream->chain->head;
+      start = 0;
+    }
+
+  while (node != NULL && copied < size)
+    {
+      if (chunkstream->position >= start + node->length)
+	{
+	  start += node->length;
+	  node = node->next;
+	  continue;
+	}
+      offset = chunkstream->position - start;
+      chunk = node->length - offset;
+      chunk = (size - copied < chunk) ? size - copied : chunk;
+      memcpy(buf + copied, node->seg->data + node->offset + offset, chunk);
+      copied += chunk;
+      chunkstream->position += chunk;
+    }
+  if (node != NULL)
+    {
+      chunkstream->cursor = node;
+      chunkstream->cursor_start = start;
+    }
+
+  return (ssize_t)copied;
+}
+
+/**
+ * Set current read position of chunked stream.
+ *
+ * @param[in] void* cookie Chunked stream state.
+ * @param[in,out] off64_t* offset Offset in, new position out.
+ * @param[in] int whence SEEK_SET, SEEK_CUR or SEEK_END.
+ *
+ * @return int 0 on success otherwise -1.
+ */
+static int bzen_chunkstream_seek(void* cookie, off64_t* offset, int whence)
+{
+  bzen_chunkstream_t* chunkstream = (bzen_chunkstream_t*)cookie;
+  off64_t position;
+  int result = -1;
+
+  switch (whence)
+    {
+    case SEEK_SET:
+      position = *offset;
+      break;
+    case SEEK_CUR:
+      position = (off64_t)chunkstream->position + *offset;
+      break;
+    case SEEK_END:
+      position = (off64_t)chunkstream->chain->length + *offset;
+      break;
+    default:
+      goto SEEK_FAIL;
+    }
+  if (position < 0)
+    {
+      goto SEEK_FAIL;
+    }
+
+  chunkstream->position = (size_t)position;
+  *offset = position;
+  result = 0;
+
+ SEEK_FAIL:
+
+  return result;
+}
+
+/**
+ * Append size bytes to chunked stream.
+ *
+ * Bytes fill the last segment and then new ones from the pool; nothing
+ * written before is moved.
+ *
+ * @param[in] void* cookie Chunked stream state.
+ * @param[in] const char* buf Source.
+ * @param[in] size_t size Number of bytes to write.
+ *
+ * @return ssize_t Number of bytes written or -1 on error.
+ */
+static ssize_t bzen_chunkstream_write(void* cookie, const char* buf, size_t size)
+{
+  bzen_chunkstream_t* chunkstream = (bzen_chunkstream_t*)cookie;
+  ssize_t result = -1;
+
+  if (bzen_iobuf_append(chunkstream->chain, buf, size) == 0)
+    {
+      chunkstream->position = chunkstream->chain->length;
+      *chunkstream->sizeloc = chunkstream->chain->length;
+      result = (ssize_t)size;
+    }
+
+  return result;
+}
+
+/**
+ * Compress pending plain bytes of compressed stream as one block and write it
+ * to the inner stream. Blocks that do not shrink are stored as they are.
+ *
+ * @param[in,out] bzen_lzstream_t* lzstream Compressed stream state.
+ *
+ * @return int 0 on success otherwise -1.
+ */
+static int bzen_lzstream_emit(bzen_lzstream_t* lzstream)
+{
+  struct iovec iov[3];
+  unsigned char header[BZEN_STREAM_LZ_HEADER_SIZE];
+  uint32_t length;
+  size_t total = 0;
+  int i, iovcnt = 0;
+  int result = 0;
+
+  if (lzstream->end == 0)
+    {
+      goto EMIT_DONE;
+    }
+
+  if (!lzstream->started)
+    {
+      iov[iovcnt].iov_base = (void*)BZEN_STREAM_LZ_MAGIC;
+      iov[iovcnt].iov_len = BZEN_STREAM_LZ_HEADER_SIZE;
+      iovcnt++;
+    }
+
+  length = (uint32_t)bzen_lz_compress(lzstream->plain,
+				      lzstream->end,
+				      lzstream->packed,
+				      lzstream->end - 1);
+  iov[iovcnt].iov_base = header;
+  iov[iovcnt].iov_len = BZEN_STREAM_LZ_HEADER_SIZE;
+  iovcnt++;
+  if (length > 0)
+    {
+      iov[iovcnt].iov_base = lzstream->packed;
+      iov[iovcnt].iov_len = length;
+    }
+  else
+    {
+      length = (uint32_t)lzstream->end;
+      iov[iovcnt].iov_base = lzstream->plain;
+      iov[iovcnt].iov_len = length;
+      length |= BZEN_STREAM_LZ_STORED;
+    }
+  iovcnt++;
+  for (i = 0; i < BZEN_STREAM_LZ_HEADER_SIZE; i++)
+    {
+      header[i] = (unsigned char)(length >> (8 * i));
+    }
+
+  for (i = 0; i < iovcnt; i++)
+    {
+      total += iov[i].iov_len;
+    }
+  if (bzen_stream_writev(lzstream->inner, iov, iovcnt) != (ssize_t)total)
+    {
+      result = -1;
+      goto EMIT_DONE;
+    }
+  lzstream->started = 1;
+  lzstream->end = 0;
+
+ EMIT_DONE:
+
+  return result;
+}
+
+/**
+ * Read next block of compressed stream from the inner stream and decompress
+ * it to dst, which holds BZEN_STREAM_LZ_BLOCK_SIZE bytes.
+ *
+ * @param[in,out] bzen_lzstream_t* lzstream Compressed stream state.
+ * @param[out] unsigned char* dst Destination of plain bytes.
+ *
+ * @return ssize_t Number of plain bytes, 0 at end of stream, or -1 if inner
+ * stream fails or does not hold a compressed stream.
+ */
+static ssize_t bzen_lzstream_fill(bzen_lzstream_t* lzstream, unsigned char* dst)
+{
+  unsigned char header[BZEN_STREAM_LZ_HEADER_SIZE];
+  uint32_t length = 0;
+  size_t n;
+  int i;
+  ssize_t result = -1;
+
+  if (!lzstream->started)
+    {
+      n = bzen_stream_read(header, BZEN_STREAM_LZ_HEADER_SIZE, lzstream->inner);
+      if (n == 0)
+	{
+	  result = 0;
+	  goto FILL_DONE;
+	}
+      if (n != BZEN_STREAM_LZ_HEADER_SIZE ||
+	  memcmp(header, BZEN_STREAM_LZ_MAGIC, BZEN_STREAM_LZ_HEADER_SIZE) != 0)
+	{
+	  errno = EILSEQ;
+	  goto FILL_DONE;
+	}
+      lzstream->started = 1;
+    }
+
+  /* No header at all is the end of stream, part of one is not. */
+  n = bzen_stream_read(header, BZEN_STREAM_LZ_HEADER_SIZE, lzstream->inner);
+  if (n == 0)
+    {
+      result = 0;
+      goto FILL_DONE;
+    }
+  if (n != BZEN_STREAM_LZ_HEADER_SIZE)
+    {
+      errno = EILSEQ;
+      goto FILL_DONE;
+    }
+  for (i = 0; i < BZEN_STREAM_LZ_HEADER_SIZE; i++)
+    {
+      length |= (uint32_t)header[i] << (8 * i);
+    }
+
+  if (length & BZEN_STREAM_LZ_STORED)
+    {
+      length &= ~BZEN_STREAM_LZ_STORED;
+      if (length == 0 || length > BZEN_STREAM_LZ_BLOCK_SIZE ||
+	  bzen_stream_read(dst, length, lzstream->inner) != length)
+	{
+	  errno = EILSEQ;
+	  goto FILL_DONE;
+	}
+      result = (ssize_t)length;
+    }
+  else
+    {
+      if (length == 0 || length > sizeof(lzstream->packed) ||
+	  bzen_stream_read(lzstream->packed, length, lzstream->inner) != length)
+	{
+	  errno = EILSEQ;
+	  goto FILL_DONE;
+	}
+      result = bzen_lz_decompress(lzstream->packed,
+				  length,
+				  dst,
+				  BZEN_STREAM_LZ_BLOCK_SIZE);
+      if (result <= 0)
+	{
+	  errno = EILSEQ;
+	  result = -1;
+	}
+    }
+
+ FILL_DONE:
+
+  return result;
+}
+
+/**
+ * Close compressed stream cookie. Last block is written and the inner stream
+ * flushed, but not closed.
+ *
+ * @param[in] void* cookie Compressed stream state.
+ *
+ * @return int 0 on success otherwise -1.
+ */
+static int bzen_lzstream_close(void* cookie)
+{
+  bzen_lzstream_t* lzstream = (bzen_lzstream_t*)cookie;
+  int result = 0;
+
+  if (lzstream->writing)
+    {
+      if (bzen_lzstream_emit(lzstream) != 0 ||
+	  bzen_stream_flush(lzstream->inner) != 0)
+	{
+	  result = -1;
+	}
+    }
+  bzen_pool_free(lzstream_pool, lzstream);
+
+  return result;
+}
+
+/**
+ * Read up to size plain bytes from compressed stream.
+ *
+ * Reads of a whole block or more decompress straight into buf.
+ *
+ * @param[in] void* cookie Compressed stream state.
+ * @param[out] char* buf Destination.
+ * @param[in] size_t size Number of bytes requested.
+ *
+ * @return ssize_t Number of bytes read, 0 at end of stream or -1 on error.
+ */
+static ssize_t bzen_lzstream_read(void* cookie, char* buf, size_t size)
+{
+  bzen_lzstream_t* lzstream = (bzen_lzstream_t*)cookie;
+  size_t chunk;
+  ssize_t result;
+
+  if (lzstream->start == lzstream->end)
+    {
+      if (size >= BZEN_STREAM_LZ_BLOCK_SIZE)
+	{
+	  result = bzen_lzstream_fill(lzstream, (unsigned char*)buf);
+	  goto READ_DONE;
+	}
+      result = bzen_lzstream_fill(lzstream, lzstream->plain);
+      if (result <= 0)
+	{
+	  goto READ_DONE;
+	}
+      lzstream->start = 0;
+      lzstream->end = (size_t)result;
+    }
+
+  chunk = lzstream->end - lzstream->start;
+  chunk = (size < chunk) ? size : chunk;
+  memcpy(buf, lzstream->plain + lzstream->start, chunk);
+  lzstream->start += chunk;
+  result = (ssize_t)chunk;
+
+ READ_DONE:
+
+  return result;
+}
+
+/**
+ * Write size plain bytes to compressed stream, compressing each full block.
+ *
+ * @param[in] void* cookie Compressed stream state.
+ * @param[in] const char* buf Source.
+ * @param[in] size_t size Number of bytes to write.
+ *
+ * @return ssize_t Number of bytes written or -1 on error.
+ */
+static ssize_t bzen_lzstream_write(void* cookie, const char* buf, size_t size)
+{
+  bzen_lzstream_t* lzstream = (bzen_lzstream_t*)cookie;
+  size_t chunk;
+  size_t copied = 0;
+  ssize_t result = -1;
+
+  while (copied < size)
+    {
+      if (lzstream->end == BZEN_STREAM_LZ_BLOCK_SIZE &&
+	  bzen_lzstream_emit(lzstream) != 0)
+	{
+	  goto WRITE_FAIL;
+	}
+      chunk = BZEN_STREAM_LZ_BLOCK_SIZE - lzstream->end;
+      chunk = (size - copied < chunk) ? size - copied : chunk;
+      memcpy(lzstream->plain + lzstream->end, buf + copied, chunk);
+      lzstream->end += chunk;
+      copied += chunk;
+    }
+  result = (ssize_t)size;
+
+ WRITE_FAIL:
+
+  return result;
+}
+
+/**
+ * Write all bytes of iovcnt buffers to fd, resuming after short writes.
+ *
+ * @param[in] int fd Descriptor.
+ * @param[in,out] struct iovec* iov Buffers, consumed as they are written.
+ * @param[in] int iovcnt Number of buffers.
+ *
+ * @return int 0 on success otherwise -1.
+ */
+static int bzen_fdstream_writev_all(int fd, struct iovec* iov, int iovcnt)
+{
+  ssize_t written;
+  int result = -1;
+
+  while (iovcnt > 0)
+    {
+      if (iov->iov_len == 0)
+	{
+	  iov++;
+	  iovcnt--;
+	  continue;
+	}
+      written = writev(fd, iov, (iovcnt < IOV_MAX) ? iovcnt : IOV_MAX);
+      if (written < 0)
+	{
+	  if (errno == EINTR)
+	    {
+	      continue;
+	    }
+	  goto WRITEV_FAIL;
+	}
+      while (iovcnt > 0 && (size_t)written >= iov->iov_len)
+	{
+	  written -= iov->iov_len;
+	  iov++;
+	  iovcnt--;
+	}
+      if (iovcnt > 0)
+	{
+	  iov->iov_base = (char*)iov->iov_base + written;
+	  iov->iov_len -= written;
+	}
+    }
+  result = 0;
+
+ WRITEV_FAIL:
+
+  return result;
+}
+
+/**
+ * Write output of native stream.
+ *
+ * @param[in,out] bzen_fdstream_t* fdstream Native stream.
+ *
+ * @return int 0 on success otherwise -1.
+ */
+static int bzen_fdstream_flush_output(bzen_fdstream_t* fdstream)
+{
+  struct iovec iov;
+  int result = 0;
+
+  if (fdstream->pending > 0)
+    {
+      iov.iov_base = fdstream->output;
+      iov.iov_len = fdstream->pending;
+      result = bzen_fdstream_writev_all(fdstream->fd, &iov, 1);
+      fdstream->pending = 0;
+    }
+
+  return result;
+}
+
+/**
+ * Give back input read ahead, so a write lands at the position of stream.
+ *
+ * Only descriptors which can seek; others keep input and output apart.
+ *
+ * @param[in,out] bzen_fdstream_t* fdstream Native stream.
+ *
+ * @return int 0 on success otherwise -1.
+ */
+static int bzen_fdstream_unread(bzen_fdstream_t* fdstream)
+{
+  int result = 0;
+
+  if (fdstream->seekable && fdstream->end > fdstream->start)
+    {
+      if (lseek(fdstream->fd, 
+		-(off_t)(fdstream->end - fdstream->start), 
+		SEEK_CUR) < 0)
+	{
+	  result = -1;
+	}
+    }
+  if (fdstream->seekable)
+    {
+      fdstream->start = fdstream->end = 0;
+    }
+
+  return result;
+}
+
+/**
+ * Refill empty input of native stream with one read().
+ *
+ * @param[in,out] bzen_fdstream_t* fdstream Native stream.
+ *
+ * @return ssize_t Number of bytes read, 0 at end of input or -1 on error.
+ */
+static ssize_t bzen_fdstream_fill(bzen_fdstream_t* fdstream)
+{
+  ssize_t result = -1;
+
+  /* Output goes first where both share a position. */
+  if (fdstream->seekable && bzen_fdstream_flush_output(fdstream) != 0)
+    {
+      goto FILL_FAIL;
+    }
+  do
+    {
+      result = read(fdstream->fd, fdstream->input, BZEN_STREAM_FD_BUFFER_SIZE);
+    }
+  while (result < 0 && errno == EINTR);
+  fdstream->start = 0;
+  fdstream->end = (result > 0) ? (size_t)result : 0;
+  if (result == 0)
+    {
+      fdstream->eof = 1;
+    }
+
+ FILL_FAIL:
+
+  return result;
+}
+
+/**
+ * Read native stream into iovcnt buffers.
+ *
+ * Buffered input is used first. Requests of at least a buffer are read with
+ * readv() straight into the destination, with input as a last buffer to
+ * catch what follows in the same call.
+ *
+ * @param[in,out] bzen_fdstream_t* fdstream Native stream.
+ * @param[in] const struct iovec* iov Buffers.
+ * @param[in] int iovcnt Number of buffers.
+ *
+ * @return ssize_t Number of bytes read or -1 on error before any byte.
+ */
+static ssize_t bzen_fdstream_readv(bzen_fdstream_t* fdstream, 
+				   const struct iovec* iov, 
+				   int iovcnt)
+{
+  struct iovec direct[2];
+  unsigned char* base;
+  size_t total = 0;
+  size_t done = 0;
+  size_t want, take;
+  ssize_t got;
+  ssize_t result = -1;
+  int i = 0;
+
+  while (i < iovcnt)
+    {
+      if (done == iov[i].iov_len)
+	{
+	  i++;
+	  done = 0;
+	  continue;
+	}
+      base = (unsigned char*)iov[i].iov_base + done;
+      want = iov[i].iov_len - done;
+
+      /* Buffered input first. */
+      if (fdstream->start < fdstream->end)
+	{
+	  take = fdstream->end - fdstream->start;
+	  take = (want < take) ? want : take;
+	  memcpy(base, fdstream->input + fdstream->start, take);
+	  fdstream->start += take;
+	  done += take;
+	  total += take;
+	  continue;
+	}
+      if (fdstream->eof)
+	{
+	  break;
+	}
+
+      if (want < BZEN_STREAM_FD_BUFFER_SIZE)
+	{
+	  got = bzen_fdstream_fill(fdstream);
+	}
+      else
+	{
+	  got = -1;
+	  if (!fdstream->seekable || bzen_fdstream_flush_output(fdstream) == 0)
+	    {
+	      direct[0].iov_base = base;
+	      direct[0].iov_len = want;
+	      direct[1].iov_base = fdstream->input;
+	      direct[1].iov_len = BZEN_STREAM_FD_BUFFER_SIZE;
+	      got = readv(fdstream->fd, direct, 2);
+	    }
+	  if (got == 0)
+	    {
+	      fdstream->eof = 1;
+	    }
+	  else if (got > 0)
+	    {
+	      /* Bytes past the request stay as input. */
+	      if ((size_t)got > want)
+		{
+		  fdstream->start = 0;
+		  fdstream->end = (size_t)got - want;
+		  got = (ssize_t)want;
+		}
+	      done += (size_t)got;
+	      total += (size_t)got;
+	    }
+	}
+      if (got < 0)
+	{
+	  if (errno == EINTR)
+	    {
+	      continue;
+	    }
+	  goto READV_FAIL;
+	}
+    }
+  result = (ssize_t)total;
+
+ READV_FAIL:
+
+  /* Bytes already delivered are not lost to a later error. */
+  if (total > 0)
+    {
+      result = (ssize_t)total;
+    }
+
+  return result;
+}
+
+/**
+ * Write iovcnt buffers to native stream.
+ *
+ * Bytes are collected in output while they fit. Otherwise output and the
+ * buffers go to the descriptor together with one writev().
+ *
+ * @param[in,out] bzen_fdstream_t* fdstream Native stream.
+ * @param[in] const struct iovec* iov Buffers.
+ * @param[in] int iovcnt Number of buffers.
+ *
+ * @return ssize_t Number of bytes written or -1 on error.
+ */
+static ssize_t bzen_fdstream_writev(bzen_fdstream_t* fdstream, 
+				    const struct iovec* iov, 
+				    int iovcnt)
+{
+  struct iovec local[BZEN_STREAM_FD_IOV];
+  struct iovec* gather = local;
+  size_t total = 0;
+  int i, status;
+  ssize_t result = -1;
+
+  for (i = 0; i < iovcnt; i++)
+    {
+      total += iov[i].iov_len;
+    }
+
+  /* Write lands at position of stream, not after input read ahead. */
+  if (bzen_fdstream_unread(fdstream) != 0)
+    {
+      goto WRITEV_FAIL;
+    }
+
+  if (fdstream->pending + total <= BZEN_STREAM_FD_BUFFER_SIZE)
+    {
+      for (i = 0; i < iovcnt; i++)
+	{
+	  memcpy(fdstream->output + fdstream->pending, 
+		 iov[i].iov_base, 
+		 iov[i].iov_len);
+	  fdstream->pending += iov[i].iov_len;
+	}
+    }
+  else
+    {
+      if (iovcnt + 1 > BZEN_STREAM_FD_IOV)
+	{
+	  gather = (struct iovec*)bzen_malloc_tagged((iovcnt + 1) * 
+						     sizeof(struct iovec),
+						     BZEN_MEM_TAG_STREAM);
+	}
+      gather[0].iov_base = fdstream->output;
+      gather[0].iov_len = fdstream->pending;
+      memcpy(gather + 1, iov, iovcnt * sizeof(struct iovec));
+      status = bzen_fdstream_writev_all(fdstream->fd, gather, iovcnt + 1);
+      fdstream->pending = 0;
+      if (gather != local)
+	{
+	  bzen_free(gather);
+	}
+      if (status != 0)
+	{
+	  goto WRITEV_FAIL;
+	}
+    }
+  result = (ssize_t)total;
+
+ WRITEV_FAIL:
+
+  return result;
+}
+
+/**
+ * Grow line buffer of bzen_stream_getline() with realloc(), as getline(3).
+ *
+ * @param[in,out] char** line Address of line buffer.
+ * @param[in,out] size_t* n Address of capacity of line buffer.
+ * @param[in] size_t size Size in bytes needed.
+ *
+ * @return int 0 on success, -1 if out of memory (*line is kept).
+ */
+static int bzen_stream_line_grow(char** line, size_t* n, size_t size)
+{
+  char* grown;
+  size_t capacity;
+  int result = 0;
+
+  if ((*line != NULL) && (size <= *n))
+    {
+      goto GROW_DONE;
+    }
+
+  capacity = (*n < 120) ? 120 : *n;
+  while (capacity < size)
+    {
+      capacity *= 2;
+    }
+  grown = (char*)realloc(*line, capacity);
+  if (grown == NULL)
+    {
+      result = -1;
+      goto GROW_DONE;
+    }
+  *line = grown;
+  *n = capacity;
+
+ GROW_DONE:
+
+  return result;
+}
+
+/**
+ * Read a line from native stream, scanning input a buffer at a time.
+ *
+ * @param[in,out] bzen_fdstream_t* fdstream Native stream.
+ * @param[in,out] char** line Address of line buffer.
+ * @param[in,out] size_t* n Address of capacity of line buffer.
+ *
+ * @return size_t Length of line in bytes, 0 at end of input or on error.
+ */
+static size_t bzen_fdstream_getline(bzen_fdstream_t* fdstream, 
+				    char** line, 
+				    size_t* n)
+{
+  unsigned char* chunk;
+  unsigned char* newline = NULL;
+  size_t length = 0;
+  size_t take;
+
+  while (newline == NULL)
+    {
+      if (fdstream->start == fdstream->end && 
+	  (fdstream->eof || bzen_fdstream_fill(fdstream) <= 0))
+	{
+	  break;
+	}
+      chunk = fdstream->input + fdstream->start;
+      take = fdstream->end - fdstream->start;
+      newline = (unsigned char*)memchr(chunk, '\n', take);
+      if (newline != NULL)
+	{
+	  take = (size_t)(newline - chunk) + 1;
+	}
+
+      /* Keep room for terminating null. */
+      if (bzen_stream_line_grow(line, n, length + take + 1) != 0)
+	{
+	  break;
+	}
+      memcpy(*line + length, chunk, take);
+      fdstream->start += take;
+      length += take;
+    }
+
+  return length;
+}
+
+/**
+ * Read or write n bytes at offset of descriptor with pread() or pwrite().
+ *
+ * @param[in] int fd Descriptor.
+ * @param[in,out] void* ptr Destination or source of n bytes.
+ * @param[in] size_t n Number of bytes.
+ * @param[in] off_t offset Offset in file.
+ * @param[in] int output Non-zero to write.
+ *
+ * @return ssize_t Number of bytes, fewer than n only at end of file, or -1 
+ * on error.
+ */
+static ssize_t bzen_fdstream_pio(int fd, 
+				 void* ptr, 
+				 size_t n, 
+				 off_t offset, 
+				 int output)
+{
+  size_t total = 0;
+  ssize_t moved;
+  ssize_t result = -1;
+
+  while (total < n)
+    {
+      if (output)
+	{
+	  moved = pwrite(fd, (char*)ptr + total, n - total, offset + total);
+	}
+      else
+	{
+	  moved = pread(fd, (char*)ptr + total, n - total, offset + total);
+	}
+      if (moved < 0)
+	{
+	  if (errno == EINTR)
+	    {
+	      continue;
+	    }
+	  goto PIO_FAIL;
+	}
+      if (moved == 0)
+	{
+	  break;
+	}
+      total += (size_t)moved;
+    }
+  result = (ssize_t)total;
+
+ PIO_FAIL:
+
+  return result;
+}
+
+/**
+ * Read or write n bytes at offset of stdio stream and restore position.
+ *
+ * @param[in,out] FILE* file Stream.
+ * @param[in,out] void* ptr Destination or source of n bytes.
+ * @param[in] size_t n Number of bytes.
+ * @param[in] off_t offset Offset in stream.
+ * @param[in] int output Non-zero to write.
+ *
+ * @return ssize_t Number of bytes or -1 on error.
+ */
+static ssize_t bzen_stream_pio(FILE* file, 
+			       void* ptr, 
+			       size_t n, 
+			       off_t offset, 
+			       int output)
+{
+  off_t position;
+  ssize_t result = -1;
+
+  position = ftello(file);
+  if (position < 0 || fseeko(file, offset, SEEK_SET) != 0)
+    {
+      goto PIO_FAIL;
+    }
+  if (output)
+    {
+      result = (fwrite(ptr, 1, n, file) == n) ? (ssize_t)n : -1;
+    }
+  else
+    {
+      result = (ssize_t)fread(ptr, 1, n, file);
+      if (ferror(file))
+	{
+	  result = -1;
+	}
+    }
+  if (fseeko(file, position, SEEK_SET) != 0)
+    {
+      result = -1;
+    }
+
+ PIO_FAIL:
+
+  return result;
+}
+
+/**
+ * Copy up to n bytes from in to out through a buffer in user space.
+ *
+ * @param[in,out] bzen_stream_t* out Stream to write to.
+ * @param[in,out] bzen_stream_t* in Stream to read from.
+ * @param[in] size_t n Number of bytes.
+ *
+ * @return ssize_t Number of bytes copied or -1 on error.
+ */
+static ssize_t bzen_stream_copy_block(bzen_stream_t* out, 
+				      bzen_stream_t* in, 
+				      size_t n)
+{
+  struct iovec iov;
+  ssize_t got;
+  char* block;
+  size_t total = 0;
+  size_t want;
+  ssize_t result = -1;
+
+  block = (char*)bzen_malloc_tagged(BZEN_STREAM_COPY_BLOCK, 
+				    BZEN_MEM_TAG_STREAM);
+  while (total < n)
+    {
+      want = n - total;
+      if (want > BZEN_STREAM_COPY_BLOCK)
+	{
+	  want = BZEN_STREAM_COPY_BLOCK;
+	}
+      iov.iov_base = block;
+      iov.iov_len = want;
+      got = bzen_stream_readv(in, &iov, 1);
+      if (got < 0)
+	{
+	  goto COPY_FAIL;
+	}
+      iov.iov_len = (size_t)got;
+      if (got > 0 && bzen_stream_writev(out, &iov, 1) != got)
+	{
+	  goto COPY_FAIL;
+	}
+      total += (size_t)got;
+      if ((size_t)got < want)
+	{
+	  break;
+	}
+    }
+  result = (ssize_t)total;
+
+ COPY_FAIL:
+
+  bzen_free(block);
+
+  return result;
+}
+
+/**
+ * Move up to n bytes from in_fd to out_fd inside the kernel.
+ *
+ * Starts with copy_file_range() and steps down to sendfile() and splice()
+ * while the pair of descriptors is refused, which is reported before any byte
+ * moves.
+ *
+ * @param[in] int out_fd Descriptor to write to.
+ * @param[in] int in_fd Descriptor to read from.
+ * @param[in] size_t n Number of bytes.
+ * @param[out] size_t* copied Number of bytes moved.
+ *
+ * @return int 1 if n bytes or end of input were reached, 0 if no call fits 
+ * the descriptors, -1 on error.
+ */
+static int bzen_stream_copy_fd(int out_fd, int in_fd, size_t n, size_t* copied)
+{
+  int method = BZEN_STREAM_COPY_RANGE;
+  size_t chunk;
+  ssize_t moved;
+  int result = 1;
+
+  *copied = 0;
+  while (*copied < n)
+    {
+      chunk = n - *copied;
+      if (chunk > BZEN_STREAM_COPY_CHUNK)
+	{
+	  chunk = BZEN_STREAM_COPY_CHUNK;
+	}
+      moved = -1;
+      errno = EINVAL;
+      switch (method)
+	{
+	case BZEN_STREAM_COPY_RANGE:
+#ifdef HAVE_COPY_FILE_RANGE
+	  moved = copy_file_range(in_fd, NULL, out_fd, NULL, chunk, 0);
+#endif
+	  break;
+	case BZEN_STREAM_COPY_SENDFILE:
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+	  moved = sendfile(out_fd, in_fd, NULL, chunk);
+#endif
+	  break;
+	case BZEN_STREAM_COPY_SPLICE:
+#ifdef HAVE_SPLICE
+	  moved = splice(in_fd, NULL, out_fd, NULL, chunk, SPLICE_F_MOVE);
+#endif
+	  break;
+	default:
+	  result = 0;
+	  goto COPY_FD_DONE;
+	}
+      if (moved < 0)
+	{
+	  if (errno == EINTR)
+	    {
+	      continue;
+	    }
+	  /* Descriptors not supported by this call. */
+	  if (errno == EINVAL || errno == EXDEV || errno == ENOSYS ||
+	      errno == EOPNOTSUPP || errno == ESPIPE || errno == EBADF)
+	    {
+	      method++;
+	      continue;
+	    }
+	  result = -1;
+	  goto COPY_FD_DONE;
+	}
+      if (moved == 0)
+	{
+	  break;
+	}
+      *copied += (size_t)moved;
+    }
+
+ COPY_FD_DONE:
+
+  return result;
+}
+
+/**
+ * Resynchronize stdio position of stream with its descriptor.
+ *
+ * Bytes moved by the kernel leave stdio with a stale offset. Streams that
+ * cannot seek have none to keep.
+ *
+ * @param[in,out] FILE* stream Stream.
+ *
+ * @return void
+ */
+static void bzen_stream_resync(FILE* stream)
+{
+  off_t position;
+
+  position = lseek(fileno(stream), 0, SEEK_CUR);
+  if (position >= 0)
+    {
+      fseeko(stream, position, SEEK_SET);
+    }
+}
 
 /* Close stream. */
 int bzen_stream_close(bzen_stream_t* stream)
@@ -32,37 +1411,252 @@ int bzen_stream_close(bzen_stream_t* stream)
   /* Expect non-null pointer. */
   BZEN_ASSERT(stream);
 
+  /* Write output of native stream and close its descriptor. */
+  if (stream->fdstream != NULL)
+    {
+      result = bzen_fdstream_flush_output(stream->fdstream);
+      if (result != 0)
+	{
+	  perror("writev");
+	}
+      if (close(stream->fdstream->fd) != 0)
+	{
+	  perror("close");
+	  result = -1;
+	}
+      bzen_pool_free(fdstream_pool, stream->fdstream);
+      stream->fdstream = NULL;
+      if (result != 0)
+	{
+	  goto CLOSE_FAIL;
+	}
+    }
+
   /* Close the encapsulated stream. */
-  result = fclose(stream->file);
-  if (result != 0)
+  else
+    {
+      result = fclose(stream->file);
+      if (result != 0)
+	{
+	  perror("fclose");
+	  goto CLOSE_FAIL;
+	}
+    }
+
+  /* Release buffer and state of memstream. */
+  if (stream->buffer != NULL)
+    {
+      bzen_free(*stream->buffer);
+      bzen_free(stream->buffer);
+    }
+
+  /* Initialize struct. */
+  memset(stream, 0, BZEN_SIZEOF(bzen_stream_t));
+
+ CLOSE_FAIL:
+
+  return result;
+}
+
+/* Copy n bytes from one stream to another. */
+ssize_t bzen_stream_copy(bzen_stream_t* out, bzen_stream_t* in, size_t n)
+{
+  size_t total = 0;
+  size_t pending, copied;
+  ssize_t moved;
+  int status;
+  ssize_t result = -1;
+
+  /* Expect non-null pointers. */
+  BZEN_ASSERT(out);
+  BZEN_ASSERT(in);
+
+  if ((out->file == NULL && out->fdstream == NULL) || 
+      (in->file == NULL && in->fdstream == NULL))
+    {
+      goto COPY_FAIL;
+    }
+
+  if (in->fdstream != NULL)
+    {
+      pending = in->fdstream->end - in->fdstream->start;
+    }
+  else
+    {
+      pending = freadahead(in->file);
+    }
+  if (bzen_stream_get_fd(out) >= 0 && bzen_stream_get_fd(in) >= 0)
+    {
+      /* Bytes read ahead of the descriptor go first. */
+      if (pending > 0)
+	{
+	  moved = bzen_stream_copy_block(out, in, (pending < n) ? pending : n);
+	  if (moved < 0)
+	    {
+	      goto COPY_FAIL;
+	    }
+	  total = (size_t)moved;
+	}
+
+      /* Descriptors of both streams are now at their stdio positions. */
+      if (total < n && bzen_stream_flush(out) == 0)
+	{
+	  status = bzen_stream_copy_fd(bzen_stream_get_fd(out), 
+				       bzen_stream_get_fd(in), 
+				       n - total, 
+				       &copied);
+	  total += copied;
+	  if (copied > 0 && in->fdstream == NULL)
+	    {
+	      bzen_stream_resync(in->file);
+	    }
+	  if (copied > 0 && out->fdstream == NULL)
+	    {
+	      bzen_stream_resync(out->file);
+	    }
+	  if (status < 0)
+	    {
+	      perror("bzen_stream_copy");
+	      goto COPY_FAIL;
+	    }
+	  if (status > 0)
+	    {
+	      result = (ssize_t)total;
+	      goto COPY_FAIL;
+	    }
+	}
+    }
+
+  /* Streams in memory, or descriptors the kernel cannot copy between. */
+  moved = bzen_stream_copy_block(out, in, n - total);
+  if (moved < 0)
+    {
+      goto COPY_FAIL;
+    }
+  result = (ssize_t)(total + (size_t)moved);
+
+ COPY_FAIL:
+
+  return result;
+}
+
+/* Free memory for given bzen_stream_t struct. */
+int bzen_stream_delete(bzen_stream_t* stream)
+{
+  int result;
+  
+  /* Expect non-null pointer. */
+  BZEN_ASSERT(stream);
+
+  /* Release buffer and state of memstream. */
+  if (stream->buffer != NULL)
+    {
+      bzen_free(*stream->buffer);
+      bzen_free(stream->buffer);
+    }
+
+  /* Release buffers of native stream. */
+  if (stream->fdstream != NULL)
+    {
+      bzen_pool_free(fdstream_pool, stream->fdstream);
+    }
+  bzen_pool_free(stream_pool, stream);
+  result = 0;
+
+  return result;
+}
+
+/* Open stream on a file descriptor without stdio. */
+int bzen_stream_fdopen(bzen_stream_t* stream, int fd)
+{
+  bzen_fdstream_t* fdstream;
+  int result;
+
+  /* Verify that stream is not already open and fd is. */
+  result = bzen_stream_get_file_status(stream);
+  if (result < 0)
+    {
+      result = fcntl(fd, F_GETFL);
+      if (result < 0)
+	{
+	  goto OPEN_FAIL;
+	}
+
+      pthread_once(&stream_pool_once, bzen_stream_pool_init);
+      fdstream = (bzen_fdstream_t*)bzen_pool_alloc(fdstream_pool);
+      if (fdstream == NULL)
+	{
+	  result = -1;
+	  goto OPEN_FAIL;
+	}
+      fdstream->fd = fd;
+      fdstream->seekable = (lseek(fd, 0, SEEK_CUR) >= 0);
+      fdstream->eof = 0;
+      fdstream->start = fdstream->end = 0;
+      fdstream->pending = 0;
+
+      /* Save open attributes. */
+      stream->fdstream = fdstream;
+      stream->size = BZEN_STREAM_FD_BUFFER_SIZE;
+      switch (result & O_ACCMODE)
+	{
+	case O_RDONLY:
+	  memcpy(stream->opentype, "r", 2);
+	  break;
+	case O_WRONLY:
+	  memcpy(stream->opentype, "w", 2);
+	  break;
+	default:
+	  memcpy(stream->opentype, "r+", BZEN_OPENTYPE_SIZE);
+	  break;
+	}
+
+      /* Success. */
+      result = 0;
+    }
+  else
     {
-      perror("fclose");
-      goto CLOSE_FAIL;
+      result = -1;
     }
 
-  /* Initialize struct. */
-  memset(stream, 0, BZEN_SIZEOF(bzen_stream_t));
-
- CLOSE_FAIL:
+ OPEN_FAIL:
 
   return result;
 }
 
-/* Free memory for given bzen_stream_t struct. */
-int bzen_stream_delete(bzen_stream_t* stream)
+/* Write buffered output of stream. */
+int bzen_stream_flush(bzen_stream_t* stream)
 {
-  int result;
-  
+  int result = -1;
+
   /* Expect non-null pointer. */
   BZEN_ASSERT(stream);
 
-  if (stream->buffer != NULL)
+  if (stream->fdstream != NULL)
     {
-      bzen_free(*stream->buffer);
-      bzen_free(stream->buffer);
+      result = bzen_fdstream_flush_output(stream->fdstream);
+      if (bzen_fdstream_unread(stream->fdstream) != 0)
+	{
+	  result = -1;
+	}
+    }
+  else if (stream->lzstream != NULL)
+    {
+      /* Compress what was written so far as a block of its own. */
+      result = fflush(stream->file);
+      if (result == 0 && stream->lzstream->writing)
+	{
+	  if (bzen_lzstream_emit(stream->lzstream) != 0 ||
+	      bzen_stream_flush(stream->lzstream->inner) != 0)
+	    {
+	      result = -1;
+	    }
+	}
+    }
+  else if (stream->file)
+    {
+      result = fflush(stream->file);
     }
-  bzen_free(stream);
-  result = 0;
 
   return result;
 }
@@ -106,16 +1700,10 @@ int bzen_stream_fmemopen(bzen_stream_t* stream,
   result = bzen_stream_get_file_status(stream);
   if (result < 0)
     {
-      /* Allocate buffer. */
+      /* Open stream. Passing a NULL pointer to fmemopen() has the C library
+	 allocate the buffer and free it again when stream is closed. */
       buffer_size = BZEN_SIZE(size * sizeof(char));
-      stream->buffer = (char*)bzen_malloc(buffer_size);
-      if (stream->buffer == NULL)
-	{
-	  goto OPEN_FAIL;
-	}
-
-      /* Open stream. */
-      stream->file = fmemopen(*stream->buffer, buffer_size, type);
+      stream->file = fmemopen(NULL, buffer_size, type);
       if (stream->file == NULL)
 	{
 	  goto OPEN_FAIL;
@@ -137,12 +1725,22 @@ int bzen_stream_fmemopen(bzen_stream_t* stream,
 /* Get a character from the given stream. */
 int bzen_stream_getc(bzen_stream_t* stream)
 {
+  bzen_fdstream_t* fdstream;
   int result = EOF;
 
   /* Expect non-null pointer. */
   BZEN_ASSERT(stream);
 
-  if (stream->file)
+  if (stream->fdstream != NULL)
+    {
+      fdstream = stream->fdstream;
+      if (fdstream->start < fdstream->end || 
+	  (!fdstream->eof && bzen_fdstream_fill(fdstream) > 0))
+	{
+	  result = fdstream->input[fdstream->start++];
+	}
+    }
+  else if (stream->file)
     {
       /* Put character to buffer. */
       result = fgetc(stream->file);
@@ -151,33 +1749,251 @@ int bzen_stream_getc(bzen_stream_t* stream)
   return result;
 }
 
-/* Open stream as a dynamic buffer in memory. */
-int bzen_stream_open_memstream(bzen_stream_t* stream)
+/* Read a line from the given stream. */
+ssize_t bzen_stream_getline(char** line, size_t* n, bzen_stream_t* stream)
 {
-  size_t buffer_size;
+  size_t length = 0;
+  int c = EOF;
+  ssize_t result = -1;
+
+  /* Expect non-null pointers. */
+  BZEN_ASSERT(line);
+  BZEN_ASSERT(n);
+  BZEN_ASSERT(stream);
+
+  if (stream->fdstream != NULL)
+    {
+      length = bzen_fdstream_getline(stream->fdstream, line, n);
+      goto GETLINE_DONE;
+    }
+  if (stream->file == NULL)
+    {
+      goto GETLINE_FAIL;
+    }
+
+  flockfile(stream->file);
+  while ((c = getc_unlocked(stream->file)) != EOF)
+    {
+      /* Keep room for terminating null. */
+      if (bzen_stream_line_grow(line, n, length + 2) != 0)
+	{
+	  ungetc(c, stream->file);
+	  break;
+	}
+      (*line)[length++] = (char)c;
+      if (c == '\n')
+	{
+	  break;
+	}
+    }
+  funlockfile(stream->file);
+
+ GETLINE_DONE:
+
+  if (length > 0)
+    {
+      (*line)[length] = '\0';
+      result = (ssize_t)length;
+    }
+
+ GETLINE_FAIL:
+
+  return result;
+}
+
+/* Describe contents of a stream in memory as array of struct iovec. */
+int bzen_stream_iovec(bzen_stream_t* stream, struct iovec* iov, int iovcnt)
+{
+  int result = -1;
+
+  /* Expect non-null pointer. */
+  BZEN_ASSERT(stream);
+
+  if (stream->file == NULL || fflush(stream->file) != 0)
+    {
+      goto IOVEC_FAIL;
+    }
+
+  if (stream->chunkstream != NULL)
+    {
+      result = bzen_iobuf_iovec(stream->chunkstream->chain, iov, iovcnt);
+    }
+  else if (stream->buffer != NULL)
+    {
+      result = 0;
+      if (stream->size > 0 && iovcnt > 0)
+	{
+	  iov[0].iov_base = *stream->buffer;
+	  iov[0].iov_len = stream->size;
+	  result = 1;
+	}
+    }
+
+ IOVEC_FAIL:
+
+  return result;
+}
+
+/* Open stream as a list of chunks in memory. */
+int bzen_stream_open_chunked(bzen_stream_t* stream)
+{
+  cookie_io_functions_t io_functions = 
+    {
+      bzen_chunkstream_read,
+      bzen_chunkstream_write,
+      bzen_chunkstream_seek,
+      bzen_chunkstream_close
+    };
+  bzen_chunkstream_t* chunkstream;
   int result;
 
   /* Verify that stream is not already open. */
   result = bzen_stream_get_file_status(stream);
   if (result < 0)
     {
-      /* Allocate minimum buffer. */
-      buffer_size = BZEN_SIZE(BZEN_STREAM_MIN_BUFFER_SIZE * sizeof(char));
-      stream->buffer = (char*)bzen_malloc(buffer_size);
-      if (stream->buffer == NULL)
+      chunkstream = (bzen_chunkstream_t*)bzen_malloc_tagged(BZEN_SIZEOF(bzen_chunkstream_t),
+							    BZEN_MEM_TAG_STREAM);
+      chunkstream->chain = bzen_iobuf_create();
+      if (chunkstream->chain == NULL)
+	{
+	  bzen_free(chunkstream);
+	  goto OPEN_FAIL;
+	}
+      chunkstream->position = 0;
+      chunkstream->cursor = NULL;
+      chunkstream->cursor_start = 0;
+      chunkstream->sizeloc = &stream->size;
+
+      /* Writes always append, as with "a+". */
+      stream->file = fopencookie(chunkstream, "a+", io_functions);
+      if (stream->file == NULL)
+	{
+	  bzen_iobuf_destroy(chunkstream->chain);
+	  bzen_free(chunkstream);
+	  goto OPEN_FAIL;
+	}
+
+      /* Save open attributes. */
+      stream->chunkstream = chunkstream;
+      stream->size = 0;
+      memcpy(stream->opentype, "a+", BZEN_OPENTYPE_SIZE);
+
+      /* Success. */
+      result = 0;
+    }
+
+ OPEN_FAIL:
+
+  return result;
+}
+
+/* Open stream compressing to or decompressing from another stream. */
+int bzen_stream_open_compressed(bzen_stream_t* stream,
+				bzen_stream_t* inner,
+				const char* type)
+{
+  cookie_io_functions_t io_functions = 
+    {
+      bzen_lzstream_read,
+      bzen_lzstream_write,
+      NULL,
+      bzen_lzstream_close
+    };
+  bzen_lzstream_t* lzstream;
+  int result;
+
+  /* Expect non-null pointers. */
+  BZEN_ASSERT(inner);
+  BZEN_ASSERT(type);
+
+  /* Verify that stream is not already open and type is one way. */
+  result = bzen_stream_get_file_status(stream);
+  if (result < 0)
+    {
+      if ((type[0] != 'r' && type[0] != 'w') || type[1] != '\0')
 	{
 	  goto OPEN_FAIL;
 	}
 
+      pthread_once(&stream_pool_once, bzen_stream_pool_init);
+      lzstream = (bzen_lzstream_t*)bzen_pool_alloc(lzstream_pool);
+      if (lzstream == NULL)
+	{
+	  goto OPEN_FAIL;
+	}
+      lzstream->inner = inner;
+      lzstream->writing = (type[0] == 'w');
+      lzstream->started = 0;
+      lzstream->start = lzstream->end = 0;
+
+      stream->file = fopencookie(lzstream, type, io_functions);
+      if (stream->file == NULL)
+	{
+	  bzen_pool_free(lzstream_pool, lzstream);
+	  goto OPEN_FAIL;
+	}
+
+      /* Save open attributes. */
+      stream->lzstream = lzstream;
+      stream->size = BZEN_STREAM_LZ_BLOCK_SIZE;
+      memcpy(stream->opentype, type, 2);
+
+      /* Success. */
+      result = 0;
+    }
+  else
+    {
+      result = -1;
+    }
+
+ OPEN_FAIL:
+
+  return result;
+}
+
+/* Open stream as a dynamic buffer in memory. */
+int bzen_stream_open_memstream(bzen_stream_t* stream)
+{
+  cookie_io_functions_t io_functions = 
+    {
+      bzen_memstream_read,
+      bzen_memstream_write,
+      bzen_memstream_seek,
+      bzen_memstream_close
+    };
+  bzen_memstream_t* memstream;
+  int result;
+
+  /* Verify that stream is not already open. */
+  result = bzen_stream_get_file_status(stream);
+  if (result < 0)
+    {
+      /* Stream is a custom stream rather than open_memstream(), so the 
+	 buffer comes from bzenmem and grows without being copied once it is
+	 large. */
+      memstream = (bzen_memstream_t*)bzen_malloc_tagged(BZEN_SIZEOF(bzen_memstream_t),
+							BZEN_MEM_TAG_STREAM);
+      memstream->capacity = BZEN_SIZE(BZEN_STREAM_MIN_BUFFER_SIZE * sizeof(char));
+      memstream->data = (char*)bzen_malloc_tagged(memstream->capacity,
+						  BZEN_MEM_TAG_STREAM);
+      memstream->data[0] = '\0';
+      memstream->length = 0;
+      memstream->position = 0;
+      memstream->sizeloc = &stream->size;
+
       /* Open stream. */
-      stream->file = open_memstream(stream->buffer, &stream->size);
+      stream->file = fopencookie(memstream, "w+", io_functions);
       if (stream->file == NULL)
 	{
+	  bzen_free(memstream->data);
+	  bzen_free(memstream);
 	  goto OPEN_FAIL;
 	}
 
       /* Save open attributes. */
-      stream->size = buffer_size;
+      stream->buffer = &memstream->data;
+      stream->size = 0;
+      memcpy(stream->opentype, "w+", BZEN_OPENTYPE_SIZE);
      
       /* Success. */
       result = 0;
@@ -193,7 +2009,8 @@ int bzen_stream_new(bzen_stream_t** stream)
 {
   int result = 0;
 
-  *stream = (bzen_stream_t*)bzen_malloc(BZEN_SIZEOF(bzen_stream_t));
+  pthread_once(&stream_pool_once, bzen_stream_pool_init);
+  *stream = (bzen_stream_t*)bzen_pool_alloc(stream_pool);
   if (*stream == NULL)
     {
       result = -1;
@@ -208,6 +2025,26 @@ int bzen_stream_new(bzen_stream_t** stream)
   return result;
 }
 
+/* Helper function returns descriptor of stream. */
+int bzen_stream_get_fd(bzen_stream_t* stream)
+{
+  int result = -1;
+
+  /* Expect non-null pointer. */
+  BZEN_ASSERT(stream);
+
+  if (stream->fdstream != NULL)
+    {
+      result = stream->fdstream->fd;
+    }
+  else if (stream->file != NULL)
+    {
+      result = fileno(stream->file);
+    }
+
+  return result;
+}
+
 /* Helper function returns open file flags. */
 int bzen_stream_get_file_status(bzen_stream_t* stream)
 {
@@ -217,9 +2054,9 @@ int bzen_stream_get_file_status(bzen_stream_t* stream)
   /* Expect non-null pointer. */
   BZEN_ASSERT(stream);
 
-  if (stream->file)
+  if (stream->fdstream != NULL || stream->file)
     {
-      fd = fileno(stream->file);
+      fd = bzen_stream_get_fd(stream);
       result = fcntl(fd, F_GETFL);
       if (result < 0)
 	{
@@ -230,15 +2067,54 @@ int bzen_stream_get_file_status(bzen_stream_t* stream)
   return result;
 }
 
+/* Read up to n bytes at offset of stream without changing its position. */
+ssize_t bzen_stream_pread(bzen_stream_t* stream, 
+			  void* ptr, 
+			  size_t n, 
+			  off_t offset)
+{
+  ssize_t result = -1;
+
+  /* Expect non-null pointer. */
+  BZEN_ASSERT(stream);
+
+  if (stream->fdstream != NULL)
+    {
+      /* Buffered output must be in the file to be read. */
+      if (bzen_fdstream_flush_output(stream->fdstream) == 0)
+	{
+	  result = bzen_fdstream_pio(stream->fdstream->fd, ptr, n, offset, 0);
+	}
+    }
+  else if (stream->file)
+    {
+      result = bzen_stream_pio(stream->file, ptr, n, offset, 0);
+    }
+
+  return result;
+}
+
 /* Put a character to the given buffer. */
 int bzen_stream_putc(int c, bzen_stream_t* stream)
 {
+  bzen_fdstream_t* fdstream;
   int result = EOF;
 
   /* Expect non-null pointer. */
   BZEN_ASSERT(stream);
 
-  if (stream->file)
+  if (stream->fdstream != NULL)
+    {
+      fdstream = stream->fdstream;
+      if ((fdstream->pending < BZEN_STREAM_FD_BUFFER_SIZE || 
+	   bzen_fdstream_flush_output(fdstream) == 0) &&
+	  bzen_fdstream_unread(fdstream) == 0)
+	{
+	  fdstream->output[fdstream->pending++] = (unsigned char)c;
+	  result = (unsigned char)c;
+	}
+    }
+  else if (stream->file)
     {
       /* Put character to buffer. */
       result = fputc(c, stream->file);
@@ -247,15 +2123,118 @@ int bzen_stream_putc(int c, bzen_stream_t* stream)
   return result;
 }
 
+/* Write n bytes at offset of stream without changing its position. */
+ssize_t bzen_stream_pwrite(bzen_stream_t* stream, 
+			   const void* ptr, 
+			   size_t n, 
+			   off_t offset)
+{
+  ssize_t result = -1;
+
+  /* Expect non-null pointer. */
+  BZEN_ASSERT(stream);
+
+  if (stream->fdstream != NULL)
+    {
+      /* Keep order of writes and drop input which may be overwritten. */
+      if (bzen_fdstream_flush_output(stream->fdstream) == 0 &&
+	  bzen_fdstream_unread(stream->fdstream) == 0)
+	{
+	  result = bzen_fdstream_pio(stream->fdstream->fd, 
+				     (void*)ptr, 
+				     n, 
+				     offset, 
+				     1);
+	}
+    }
+  else if (stream->file)
+    {
+      result = bzen_stream_pio(stream->file, (void*)ptr, n, offset, 1);
+    }
+
+  return result;
+}
+
+/* Read up to n bytes from the given stream. */
+size_t bzen_stream_read(void* ptr, size_t n, bzen_stream_t* stream)
+{
+  struct iovec iov;
+  ssize_t got;
+  size_t result = 0;
+
+  /* Expect non-null pointer. */
+  BZEN_ASSERT(stream);
+
+  if (stream->fdstream != NULL)
+    {
+      iov.iov_base = ptr;
+      iov.iov_len = n;
+      got = bzen_fdstream_readv(stream->fdstream, &iov, 1);
+      result = (got > 0) ? (size_t)got : 0;
+    }
+  else if (stream->file)
+    {
+      result = fread(ptr, 1, n, stream->file);
+    }
+
+  return result;
+}
+
+/* Read from the given stream into iovcnt buffers, filling each in turn. */
+ssize_t bzen_stream_readv(bzen_stream_t* stream, 
+			  const struct iovec* iov, 
+			  int iovcnt)
+{
+  size_t total = 0;
+  size_t got;
+  int i;
+  ssize_t result = -1;
+
+  /* Expect non-null pointer. */
+  BZEN_ASSERT(stream);
+
+  if (stream->fdstream != NULL)
+    {
+      result = bzen_fdstream_readv(stream->fdstream, iov, iovcnt);
+    }
+  else if (stream->file)
+    {
+      for (i = 0; i < iovcnt; i++)
+	{
+	  got = fread(iov[i].iov_base, 1, iov[i].iov_len, stream->file);
+	  total += got;
+	  if (got < iov[i].iov_len)
+	    {
+	      break;
+	    }
+	}
+      result = (total == 0 && ferror(stream->file)) ? -1 : (ssize_t)total;
+    }
+
+  return result;
+}
+
 /* Set file position to beginning of stream and reset error indicator. */
 int  bzen_stream_rewind(bzen_stream_t* stream)
 {
+  bzen_fdstream_t* fdstream;
   int result = -1;
 
   /* Expect non-null pointer. */
   BZEN_ASSERT(stream);
 
-  if (stream->file)
+  if (stream->fdstream != NULL)
+    {
+      fdstream = stream->fdstream;
+      result = bzen_fdstream_flush_output(fdstream);
+      fdstream->start = fdstream->end = 0;
+      fdstream->eof = 0;
+      if (lseek(fdstream->fd, 0, SEEK_SET) < 0)
+	{
+	  result = -1;
+	}
+    }
+  else if (stream->file)
     {
       /* rewind() does not return a value. */
       rewind(stream->file);
@@ -264,3 +2243,61 @@ int  bzen_stream_rewind(bzen_stream_t* stream)
 
   return result;
 }
+
+/* Write n bytes to the given stream. */
+size_t bzen_stream_write(const void* ptr, size_t n, bzen_stream_t* stream)
+{
+  struct iovec iov;
+  size_t result = 0;
+
+  /* Expect non-null pointer. */
+  BZEN_ASSERT(stream);
+
+  if (stream->fdstream != NULL)
+    {
+      iov.iov_base = (void*)ptr;
+      iov.iov_len = n;
+      result = (bzen_fdstream_writev(stream->fdstream, &iov, 1) < 0) ? 0 : n;
+    }
+  else if (stream->file)
+    {
+      result = fwrite(ptr, 1, n, stream->file);
+    }
+
+  return result;
+}
+
+/* Write iovcnt buffers to the given stream, gathered in order. */
+ssize_t bzen_stream_writev(bzen_stream_t* stream, 
+			   const struct iovec* iov, 
+			   int iovcnt)
+{
+  size_t total = 0;
+  int i;
+  ssize_t result = -1;
+
+  /* Expect non-null pointer. */
+  BZEN_ASSERT(stream);
+
+  if (stream->fdstream != NULL)
+    {
+      result = bzen_fdstream_writev(stream->fdstream, iov, iovcnt);
+    }
+  else if (stream->file)
+    {
+      for (i = 0; i < iovcnt; i++)
+	{
+	  if (fwrite(iov[i].iov_base, 1, iov[i].iov_len, stream->file) != 
+	      iov[i].iov_len)
+	    {
+	      goto WRITEV_FAIL;
+	    }
+	  total += iov[i].iov_len;
+	}
+      result = (ssize_t)total;
+    }
+
+ WRITEV_FAIL:
+
+  return result;
+}
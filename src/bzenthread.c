@@ -24,6 +24,105 @@
 #include <stdio.h>
 #include "bzenthread.h"
 
+/**
+ * Bounds in nanoseconds of sleeps between polls of bzen_mutex_clocklock().
+ */
+#define BZEN_MUTEX_POLL_MIN 50000L
+#define BZEN_MUTEX_POLL_MAX 1000000L
+
+#if !defined(HAVE_PTHREAD_MUTEX_CLOCKLOCK) || \
+  !defined(HAVE_PTHREAD_RWLOCK_CLOCKWRLOCK)
+/**
+ * Poll a lock with sleeps growing up to BZEN_MUTEX_POLL_MAX until deadline.
+ *
+ * @param[in] int (*trylock)(void*) Attempts lock once.
+ * @param[in] void* lock Lock.
+ * @param[in] const struct timespec* deadline Absolute time on CLOCK_MONOTONIC.
+ *
+ * @return int 0 on success, ETIMEDOUT if deadline passed, or errno.
+ */
+static int bzen_lock_poll(int (*trylock)(void*), 
+			  void* lock, 
+			  const struct timespec* deadline)
+{
+  int status;
+  struct timespec now;
+  struct timespec pause;
+  long remaining;
+  long poll = BZEN_MUTEX_POLL_MIN;
+
+  while ((status = trylock(lock)) == EBUSY)
+    {
+      /* Sleep no further than deadline. */
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if ((now.tv_sec > deadline->tv_sec) || 
+	  ((now.tv_sec == deadline->tv_sec) && (now.tv_nsec >= deadline->tv_nsec)))
+	{
+	  status = ETIMEDOUT;
+	  break;
+	}
+      remaining = (deadline->tv_sec - now.tv_sec > 1) ? BZEN_MUTEX_POLL_MAX :
+	(deadline->tv_sec - now.tv_sec) * 1000000000L + 
+	(deadline->tv_nsec - now.tv_nsec);
+      pause.tv_sec = 0;
+      pause.tv_nsec = (poll < remaining) ? poll : remaining;
+      nanosleep(&pause, NULL);
+      if (poll < BZEN_MUTEX_POLL_MAX)
+	{
+	  poll *= 2;
+	}
+    }
+
+  return status;
+}
+#endif
+
+#ifndef HAVE_PTHREAD_MUTEX_CLOCKLOCK
+/**
+ * Adapt pthread_mutex_trylock() to bzen_lock_poll().
+ *
+ * @param[in] void* lock Mutex.
+ *
+ * @return int 0 on success or errno.
+ */
+static int bzen_mutex_trylock(void* lock)
+{
+  return pthread_mutex_trylock((pthread_mutex_t*)lock);
+}
+#endif
+
+#ifndef HAVE_PTHREAD_RWLOCK_CLOCKWRLOCK
+/**
+ * Adapt pthread_rwlock_trywrlock() to bzen_lock_poll().
+ *
+ * @param[in] void* lock Rwlock.
+ *
+ * @return int 0 on success or errno.
+ */
+static int bzen_rwlock_trywrlock(void* lock)
+{
+  return pthread_rwlock_trywrlock((pthread_rwlock_t*)lock);
+}
+#endif
+
+/* Lock mutex, waiting no later than a CLOCK_MONOTONIC deadline. */
+int bzen_mutex_clocklock(pthread_mutex_t* mutex, const struct timespec* deadline)
+{
+  int status;
+
+#ifdef HAVE_PTHREAD_MUTEX_CLOCKLOCK
+  status = pthread_mutex_clocklock(mutex, CLOCK_MONOTONIC, deadline);
+#else
+  status = bzen_lock_poll(bzen_mutex_trylock, mutex, deadline);
+#endif
+  if ((status != 0) && (status != ETIMEDOUT))
+    {
+      bzen_thread_print_error("pthread_mutex_clocklock", status);
+    }
+
+  return status;
+}
+
 /* Supplement pthread_mutex_destroy() with error logging. */
 int bzen_mutex_destroy(pthread_mutex_t* mutex)
 {
@@ -53,6 +152,25 @@ int bzen_mutex_init(pthread_mutex_t* mutex, const pthread_mutexattr_t* attr)
   return status;
 }
 
+/* Write-lock rwlock, waiting no later than a CLOCK_MONOTONIC deadline. */
+int bzen_rwlock_clockwrlock(pthread_rwlock_t* rwlock, 
+			    const struct timespec* deadline)
+{
+  int status;
+
+#ifdef HAVE_PTHREAD_RWLOCK_CLOCKWRLOCK
+  status = pthread_rwlock_clockwrlock(rwlock, CLOCK_MONOTONIC, deadline);
+#else
+  status = bzen_lock_poll(bzen_rwlock_trywrlock, rwlock, deadline);
+#endif
+  if ((status != 0) && (status != ETIMEDOUT))
+    {
+      bzen_thread_print_error("pthread_rwlock_clockwrlock", status);
+    }
+
+  return status;
+}
+
 /* Encapsulates pthread_create(). */
 int bzen_thread_create(pthread_t *thread, 
 		       const pthread_attr_t *attr,
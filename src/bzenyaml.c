@@ -34,7 +34,8 @@ bzen_yaml_event_t* bzen_yaml_event_create()
 
   /* Allocate memory for event. */
   event_size = BZEN_SIZEOF(bzen_yaml_event_t);
-  event = (bzen_yaml_event_t*)bzen_malloc(event_size);
+  event = (bzen_yaml_event_t*)bzen_malloc_tagged(event_size,
+						 BZEN_MEM_TAG_YAML);
   if (event == NULL)
     {
       goto CREATE_FAIL;
@@ -100,7 +101,8 @@ bzen_yaml_parser_t* bzen_yaml_parser_create()
 
   /* Allocate memory for parser. */
   parser_size = BZEN_SIZEOF(bzen_yaml_parser_t);
-  parser = (bzen_yaml_parser_t*)bzen_malloc(parser_size);
+  parser = (bzen_yaml_parser_t*)bzen_malloc_tagged(parser_size,
+						   BZEN_MEM_TAG_YAML);
   if (parser == NULL)
     {
       goto CREATE_FAIL;
@@ -215,8 +217,9 @@ void bzen_yaml_parser_set_input_file(bzen_yaml_parser_t* parser, FILE* file)
       goto SET_INPUT_FAIL;
     }
   
-  /** Set buffer input. */
-  parser->input = bzen_sbuf_create_file(file);
+  /** Set buffer input. Regular files are read straight from memory. */
+  parser->input = bzen_sbuf_create_mapped(file, BZEN_SBUF_MAP_SEQUENTIAL | 
+					  BZEN_SBUF_MAP_WILLNEED);
   if (parser->input == NULL)
     {
       /* Failed to allocate memory for bzen_cbuflock_t. */
@@ -0,0 +1,259 @@
+/**
+ * @file:	bzentest_aio.c
+ * @brief:	Unit test asynchronous reads and writes of streams.
+ *
+ * @copyright:	Copyright (C) 2017 Kuhrman Technology Solutions LLC
+ * @license:	GPLv3+: GNU GPL version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* libbzenc */
+#include "bzentest.h"
+#include "bzenaio.h"
+#include "bzenstrm.h"
+
+#define BZENTEST_AIO_FILENAME "bzentest_aio.dat"
+#define BZENTEST_AIO_ENTRIES 8
+#define BZENTEST_AIO_BLOCKS 20
+#define BZENTEST_AIO_BLOCK 4096
+
+/* Completions seen by callback. */
+static int completed = 0;
+static ssize_t transferred = 0;
+static ssize_t last_result = 0;
+
+/* Blocks written from a registered buffer and read back to another. */
+static unsigned char source[BZENTEST_AIO_BLOCKS * BZENTEST_AIO_BLOCK];
+static unsigned char target[BZENTEST_AIO_BLOCKS * BZENTEST_AIO_BLOCK];
+
+/* Count completion of request. */
+static void bzentest_aio_done(ssize_t result, void* arg)
+{
+  completed++;
+  if (result > 0)
+    {
+      transferred += result;
+    }
+  last_result = result;
+  *(int*)arg += 1;
+}
+
+/* Write, read back and fail requests with context created with flags. */
+static int bzentest_aio_run(const char* name, unsigned int flags)
+{
+  bzen_aio_t* aio = NULL;
+  bzen_stream_t file;
+  bzen_stream_t memory;
+  bzen_stream_t reader;
+  bzen_stream_t* streams[1];
+  struct iovec buffers[1];
+  int calls[BZENTEST_AIO_BLOCKS];
+  int extra = 0;
+  int i, status;
+  int result = BZEN_TEST_EVAL_FAIL;
+
+  memset(&file, 0, sizeof(file));
+  memset(&memory, 0, sizeof(memory));
+  memset(&reader, 0, sizeof(reader));
+  memset(calls, 0, sizeof(calls));
+  memset(target, 0, sizeof(target));
+  completed = 0;
+  transferred = 0;
+
+  aio = bzen_aio_create(BZENTEST_AIO_ENTRIES, flags);
+  if ((BZENPASS != BZENTEST_TRUE(aio != NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_fdopen(&file, open(name, O_RDWR | O_CREAT | O_TRUNC, 0600)))))
+    {
+      goto END_SUBTEST;
+    }
+  if (flags & BZEN_AIO_EMULATE)
+    {
+      if (BZENPASS != BZENTEST_EQUALS_N(1, bzen_aio_emulated(aio)))
+	{
+	  goto END_SUBTEST;
+	}
+    }
+  else
+    {
+      fprintf(stderr, "\n\tio_uring %s\n",
+	      bzen_aio_emulated(aio) ? "not available" : "in use");
+    }
+
+  /* Registered stream and buffer are used where requests fit them. */
+  streams[0] = &file;
+  buffers[0].iov_base = source;
+  buffers[0].iov_len = sizeof(source);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_aio_register_streams(aio, streams, 1))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_aio_register_buffers(aio, buffers, 1))))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* More writes than entries: context submits and reaps to make room. */
+  for (i = 0; i < BZENTEST_AIO_BLOCKS; i++)
+    {
+      memset(source + i * BZENTEST_AIO_BLOCK, 'a' + i, BZENTEST_AIO_BLOCK);
+      status = bzen_aio_write(aio,
+			      &file,
+			      source + i * BZENTEST_AIO_BLOCK,
+			      BZENTEST_AIO_BLOCK,
+			      (off_t)i * BZENTEST_AIO_BLOCK,
+			      bzentest_aio_done,
+			      &calls[i]);
+      if (BZENPASS != BZENTEST_EQUALS_N(0, status))
+	{
+	  goto END_SUBTEST;
+	}
+    }
+  status = bzen_aio_wait(aio, BZENTEST_AIO_BLOCKS);
+  if ((BZENPASS != BZENTEST_TRUE(status >= 0)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(BZENTEST_AIO_BLOCKS, completed)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(sizeof(source), transferred)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_aio_poll(aio))))
+    {
+      goto END_SUBTEST;
+    }
+  for (i = 0; i < BZENTEST_AIO_BLOCKS; i++)
+    {
+      if (BZENPASS != BZENTEST_EQUALS_N(1, calls[i]))
+	{
+	  goto END_SUBTEST;
+	}
+    }
+
+  /* Read back in one batch, polling until all are in. */
+  for (i = 0; i < BZENTEST_AIO_ENTRIES; i++)
+    {
+      status = bzen_aio_read(aio,
+			     &file,
+			     target + i * BZENTEST_AIO_BLOCK,
+			     BZENTEST_AIO_BLOCK,
+			     (off_t)i * BZENTEST_AIO_BLOCK,
+			     bzentest_aio_done,
+			     &calls[i]);
+      if (BZENPASS != BZENTEST_EQUALS_N(0, status))
+	{
+	  goto END_SUBTEST;
+	}
+    }
+  if (BZENPASS != BZENTEST_EQUALS_N(BZENTEST_AIO_ENTRIES, bzen_aio_submit(aio)))
+    {
+      goto END_SUBTEST;
+    }
+  while (completed < BZENTEST_AIO_BLOCKS + BZENTEST_AIO_ENTRIES)
+    {
+      if (bzen_aio_poll(aio) == 0)
+	{
+	  sched_yield();
+	}
+    }
+  if (BZENPASS != BZENTEST_EQUALS_N(0, memcmp(source, target, BZENTEST_AIO_ENTRIES * BZENTEST_AIO_BLOCK)))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Read at end of file is short, then empty. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_aio_read(aio, &file, target, 2 * BZENTEST_AIO_BLOCK, sizeof(source) - 10, bzentest_aio_done, &extra))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(1, bzen_aio_wait(aio, 1))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(10, last_result)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_aio_read(aio, &file, target, BZENTEST_AIO_BLOCK, sizeof(source), bzentest_aio_done, &extra))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(1, bzen_aio_wait(aio, 1))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, last_result)))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Errors come back through the callback; streams in memory are refused. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_fdopen(&reader, open(name, O_RDONLY)))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_aio_write(aio, &reader, source, 1, 0, bzentest_aio_done, &extra))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(1, bzen_aio_wait(aio, 1))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(-EBADF, last_result)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_open_memstream(&memory))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(-1, bzen_aio_read(aio, &memory, target, 1, 0, bzentest_aio_done, &extra))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(3, extra)))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Requests left in flight complete when context is destroyed. */
+  if (BZENPASS != BZENTEST_EQUALS_N(0, bzen_aio_read(aio, &file, target, 1, 0, bzentest_aio_done, &extra)))
+    {
+      goto END_SUBTEST;
+    }
+  bzen_aio_destroy(aio);
+  aio = NULL;
+  if (BZENPASS != BZENTEST_EQUALS_N(4, extra))
+    {
+      goto END_SUBTEST;
+    }
+
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_SUBTEST:
+
+  bzen_aio_destroy(aio);
+  if (memory.file != NULL)
+    {
+      bzen_stream_close(&memory);
+    }
+  if (reader.fdstream != NULL)
+    {
+      bzen_stream_close(&reader);
+    }
+  if (file.fdstream != NULL)
+    {
+      bzen_stream_close(&file);
+    }
+  unlink(name);
+
+  return result;
+}
+
+int main (int argc, char *argv[])
+{
+  int result = BZEN_TEST_EVAL_PASS;
+  char name[1024];
+
+  sprintf(name, "%s/%s", getenv("BZENTEST_TEMP_DIR"), BZENTEST_AIO_FILENAME);
+
+  /* io_uring where the kernel offers it. */
+  if (BZENPASS != BZENTEST_EQUALS_N(BZEN_TEST_EVAL_PASS,
+				    bzentest_aio_run(name, 0)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Threads behind the same interface. */
+  if (BZENPASS != BZENTEST_EQUALS_N(BZEN_TEST_EVAL_PASS,
+				    bzentest_aio_run(name, BZEN_AIO_EMULATE)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+ END_TEST:
+
+  return result;
+}
@@ -0,0 +1,348 @@
+/**
+ * @file:	bzentest_iobuf.c
+ * @brief:	Unit test chains of reference counted segments.
+ *
+ * @copyright:	Copyright (C) 2017 Kuhrman Technology Solutions LLC
+ * @license:	GPLv3+: GNU GPL version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* libbzenc */
+#include "bzentest.h"
+#include "bzeniobuf.h"
+#include "bzensock.h"
+
+#define BZENTEST_PAYLOAD_SIZE (3 * BZEN_IOBUF_SEGMENT_SIZE + 100)
+#define BZENTEST_HEADER "HDR1"
+#define BZENTEST_HEADER_SIZE 4
+
+/* Number of times release was called for application memory. */
+static int released = 0;
+
+/* Count release of application memory. */
+static void bzentest_iobuf_release(void* arg)
+{
+  released += *(int*)arg;
+}
+
+/* Compare contents of chain with expected bytes. */
+static int bzentest_iobuf_equals(const bzen_iobuf_t* chain,
+				 const unsigned char* expected,
+				 size_t n)
+{
+  unsigned char* actual;
+  int result;
+
+  if (chain->length != n)
+    {
+      return BZENFAIL;
+    }
+
+  actual = (unsigned char*)malloc(n + 1);
+  if (actual == NULL)
+    {
+      return BZENFAIL;
+    }
+
+  result = ((bzen_iobuf_copy(chain, 0, actual, n) == n) &&
+	    (memcmp(actual, expected, n) == 0)) ? BZENPASS : BZENFAIL;
+  free(actual);
+
+  return result;
+}
+
+int main (int argc, char *argv[])
+{
+  int result = BZEN_TEST_EVAL_PASS;
+  int status;
+  int i;
+  int weight = 1;
+  int sockets[2];
+  ssize_t nbytes;
+  size_t offset;
+  unsigned char payload[BZENTEST_PAYLOAD_SIZE];
+  unsigned char expected[BZENTEST_PAYLOAD_SIZE + 2 * BZENTEST_HEADER_SIZE];
+  unsigned char received[BZENTEST_PAYLOAD_SIZE + 2 * BZENTEST_HEADER_SIZE];
+  struct iovec iov[16];
+  bzen_iobuf_t* chain = NULL;
+  bzen_iobuf_t* rest = NULL;
+  bzen_iobuf_t* copy = NULL;
+  bzen_iobuf_seg_t* seg;
+
+  for (i = 0; i < BZENTEST_PAYLOAD_SIZE; i++)
+    {
+      payload[i] = (unsigned char)(i * 7);
+    }
+
+  chain = bzen_iobuf_create();
+  rest = bzen_iobuf_create();
+  copy = bzen_iobuf_create();
+  if ((BZENPASS != BZENTEST_TRUE(chain != NULL)) ||
+      (BZENPASS != BZENTEST_TRUE(rest != NULL)) ||
+      (BZENPASS != BZENTEST_TRUE(copy != NULL)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Small appends fill one segment before another is taken. */
+  status = bzen_iobuf_append(chain, payload, 10);
+  status |= bzen_iobuf_append(chain, payload + 10, 20);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, status)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(1, (int)chain->count)) ||
+      (BZENPASS != bzentest_iobuf_equals(chain, payload, 30)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Large append spans segments, filling the tail segment first. */
+  status = bzen_iobuf_append(chain, payload + 30, BZENTEST_PAYLOAD_SIZE - 30);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, status)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(4, (int)chain->count)) ||
+      (BZENPASS != bzentest_iobuf_equals(chain, payload,
+					 BZENTEST_PAYLOAD_SIZE)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* First header needs a segment; second fits in front of it. */
+  status = bzen_iobuf_prepend(chain, BZENTEST_HEADER, BZENTEST_HEADER_SIZE);
+  status |= bzen_iobuf_prepend(chain, BZENTEST_HEADER, BZENTEST_HEADER_SIZE);
+  memcpy(expected, BZENTEST_HEADER BZENTEST_HEADER, 2 * BZENTEST_HEADER_SIZE);
+  memcpy(expected + 2 * BZENTEST_HEADER_SIZE, payload, BZENTEST_PAYLOAD_SIZE);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, status)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(5, (int)chain->count)) ||
+      (BZENPASS != bzentest_iobuf_equals(chain, expected,
+					 BZENTEST_PAYLOAD_SIZE +
+					 2 * BZENTEST_HEADER_SIZE)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Payload is not copied into the header segment. */
+  if (BZENPASS != BZENTEST_TRUE(chain->head->next->seg->data ==
+				(unsigned char*)(chain->head->next->seg + 1)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Export as iovec covers whole chain. */
+  status = bzen_iobuf_iovec(chain, iov, 16);
+  offset = 0;
+  for (i = 0; i < status; i++)
+    {
+      if (memcmp(iov[i].iov_base, expected + offset, iov[i].iov_len) != 0)
+	{
+	  break;
+	}
+      offset += iov[i].iov_len;
+    }
+  if ((BZENPASS != BZENTEST_EQUALS_N(5, status)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(status, i)) ||
+      (BZENPASS != BZENTEST_TRUE(offset == chain->length)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Short iovec array covers start of chain. */
+  if (BZENPASS != BZENTEST_EQUALS_N(2, bzen_iobuf_iovec(chain, iov, 2)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Split inside a segment shares it between both chains. */
+  offset = 2 * BZENTEST_HEADER_SIZE + 1000;
+  status = bzen_iobuf_split(chain, offset, rest);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, status)) ||
+      (BZENPASS != bzentest_iobuf_equals(chain, expected, offset)) ||
+      (BZENPASS != bzentest_iobuf_equals(rest, expected + offset,
+					 sizeof(expected) - offset)) ||
+      (BZENPASS != BZENTEST_TRUE(chain->tail->seg == rest->head->seg)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(2, (int)chain->tail->seg->refs)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Shared segment is not written; append takes a new segment. */
+  status = bzen_iobuf_append(chain, "x", 1);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, status)) ||
+      (BZENPASS != bzentest_iobuf_equals(rest, expected + offset,
+					 sizeof(expected) - offset)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(3, (int)chain->count)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  bzen_iobuf_consume(chain, offset);
+  if ((BZENPASS != BZENTEST_EQUALS_N(1, (int)chain->length)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(1, (int)chain->count)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  bzen_iobuf_consume(chain, 1);
+
+  /* Split at a view boundary and at either end. */
+  status = bzen_iobuf_split(rest, rest->head->length, chain);
+  status |= bzen_iobuf_split(rest, rest->length, chain);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, status)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(1, (int)rest->count)) ||
+      (BZENPASS != BZENTEST_TRUE(rest->length + chain->length ==
+				 sizeof(expected) - offset)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(-1, bzen_iobuf_split(rest, rest->length + 1,
+							   chain))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  bzen_iobuf_append_chain(rest, chain);
+  status = bzen_iobuf_split(rest, 0, chain);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, status)) ||
+      (BZENPASS != BZENTEST_TRUE(rest->head == NULL)) ||
+      (BZENPASS != BZENTEST_TRUE(rest->tail == NULL)) ||
+      (BZENPASS != bzentest_iobuf_equals(chain, expected + offset,
+					 sizeof(expected) - offset)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Clone shares segments; header prepended to clone does not show through. */
+  status = bzen_iobuf_clone(copy, chain);
+  status |= bzen_iobuf_prepend(copy, BZENTEST_HEADER, BZENTEST_HEADER_SIZE);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, status)) ||
+      (BZENPASS != BZENTEST_TRUE(copy->head->next->seg == chain->head->seg)) ||
+      (BZENPASS != bzentest_iobuf_equals(chain, expected + offset,
+					 sizeof(expected) - offset)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  bzen_iobuf_destroy(copy);
+  copy = NULL;
+  if (BZENPASS != BZENTEST_EQUALS_N(1, (int)chain->head->seg->refs))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  bzen_iobuf_consume(chain, chain->length);
+
+  /* Application memory is released once, after last view goes. */
+  status = bzen_iobuf_append_ref(chain, payload, 100,
+				 bzentest_iobuf_release, &weight);
+  status |= bzen_iobuf_split(chain, 40, rest);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, status)) ||
+      (BZENPASS != BZENTEST_TRUE(chain->head->seg->data == payload)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  seg = chain->head->seg;
+  bzen_iobuf_consume(chain, 40);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, released)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(1, (int)seg->refs)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  bzen_iobuf_consume(rest, 60);
+  if (BZENPASS != BZENTEST_EQUALS_N(1, released))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Header, payload and trailer go out in one sendmsg(). */
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  status = bzen_iobuf_append_ref(chain, payload, 1000, NULL, NULL);
+  status |= bzen_iobuf_prepend(chain, BZENTEST_HEADER, BZENTEST_HEADER_SIZE);
+  status |= bzen_iobuf_append(chain, BZENTEST_HEADER, BZENTEST_HEADER_SIZE);
+  memcpy(expected, BZENTEST_HEADER, BZENTEST_HEADER_SIZE);
+  memcpy(expected + BZENTEST_HEADER_SIZE, payload, 1000);
+  memcpy(expected + BZENTEST_HEADER_SIZE + 1000, BZENTEST_HEADER,
+	 BZENTEST_HEADER_SIZE);
+  nbytes = bzen_socket_send_iobuf(sockets[0], chain, 0);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, status)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(1000 + 2 * BZENTEST_HEADER_SIZE,
+				     (int)nbytes)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, (int)chain->length)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto CLOSE_SOCKETS;
+    }
+
+  /* Chain written with writev() arrives whole, in order. */
+  status = bzen_iobuf_append(chain, payload, 500);
+  nbytes = bzen_iobuf_write(sockets[0], chain);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, status)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(500, (int)nbytes)) ||
+      (BZENPASS != BZENTEST_TRUE(chain->head == NULL)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto CLOSE_SOCKETS;
+    }
+
+  offset = 0;
+  while (offset < 1500 + 2 * BZENTEST_HEADER_SIZE)
+    {
+      nbytes = read(sockets[1], received + offset,
+		    1500 + 2 * BZENTEST_HEADER_SIZE - offset);
+      if (nbytes <= 0)
+	{
+	  break;
+	}
+      offset += nbytes;
+    }
+  if ((BZENPASS != BZENTEST_TRUE(offset == 1500 + 2 * BZENTEST_HEADER_SIZE)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, memcmp(received, expected,
+					       1000 + 2 * BZENTEST_HEADER_SIZE))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, memcmp(received + 1000 +
+					       2 * BZENTEST_HEADER_SIZE,
+					       payload, 500))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+    }
+
+ CLOSE_SOCKETS:
+
+  close(sockets[0]);
+  close(sockets[1]);
+
+ END_TEST:
+
+  bzen_iobuf_destroy(chain);
+  bzen_iobuf_destroy(rest);
+  bzen_iobuf_destroy(copy);
+
+  return result;
+}
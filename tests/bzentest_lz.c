@@ -0,0 +1,142 @@
+/**
+ * @file:	bzentest_lz.c
+ * @brief:	Unit test LZ block compression.
+ *
+ * @copyright:	Copyright (C) 2017 Kuhrman Technology Solutions LLC
+ * @license:	GPLv3+: GNU GPL version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* libbzenc */
+#include "bzentest.h"
+#include "bzenlz.h"
+
+#define BZENTEST_LZ_SIZE (200 * 1024)
+#define BZENTEST_LZ_LINE "2017-06-01 12:00:00 bzend[42]: connection accepted\n"
+
+/* Input, compressed and decompressed bytes. */
+static unsigned char plain[BZENTEST_LZ_SIZE];
+static unsigned char packed[BZEN_LZ_BOUND(BZENTEST_LZ_SIZE)];
+static unsigned char unpacked[BZENTEST_LZ_SIZE];
+
+/* Compress n bytes of plain and decompress them again, giving packed size. */
+static int bzentest_lz_roundtrip(size_t n, size_t* packed_size)
+{
+  ssize_t unpacked_size;
+
+  memset(unpacked, 0, sizeof(unpacked));
+  *packed_size = bzen_lz_compress(plain, n, packed, BZEN_LZ_BOUND(n));
+  if (*packed_size == 0 || *packed_size > BZEN_LZ_BOUND(n))
+    {
+      return BZENFAIL;
+    }
+  unpacked_size = bzen_lz_decompress(packed, *packed_size, unpacked, n);
+
+  return ((unpacked_size == (ssize_t)n) &&
+	  (memcmp(plain, unpacked, n) == 0)) ? BZENPASS : BZENFAIL;
+}
+
+int main (int argc, char *argv[])
+{
+  int result = BZEN_TEST_EVAL_PASS;
+  size_t line = strlen(BZENTEST_LZ_LINE);
+  size_t packed_size;
+  size_t i;
+  unsigned int seed = 1;
+  unsigned char bad[8];
+
+  /* Empty and short inputs are literals only. */
+  memcpy(plain, "abcabcabcab", 11);
+  if ((BZENPASS != BZENTEST_EQUALS_N(BZENPASS, bzentest_lz_roundtrip(0, &packed_size))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(1, packed_size)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(BZENPASS, bzentest_lz_roundtrip(11, &packed_size))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(12, packed_size)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Repeated log lines compress several-fold. */
+  for (i = 0; i + line <= BZENTEST_LZ_SIZE; i += line)
+    {
+      memcpy(plain + i, BZENTEST_LZ_LINE, line);
+      plain[i + 17] = '0' + (i / line) % 10;
+    }
+  memset(plain + i, '\n', BZENTEST_LZ_SIZE - i);
+  if ((BZENPASS != BZENTEST_EQUALS_N(BZENPASS, bzentest_lz_roundtrip(BZENTEST_LZ_SIZE, &packed_size))) ||
+      (BZENPASS != BZENTEST_TRUE(packed_size < BZENTEST_LZ_SIZE / 4)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Runs of one byte are matches that overlap their own output. */
+  memset(plain, 'x', BZENTEST_LZ_SIZE);
+  plain[1000] = 'y';
+  if ((BZENPASS != BZENTEST_EQUALS_N(BZENPASS, bzentest_lz_roundtrip(BZENTEST_LZ_SIZE, &packed_size))) ||
+      (BZENPASS != BZENTEST_TRUE(packed_size < 2048)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Random bytes fit the bound, and not a smaller destination. */
+  for (i = 0; i < BZENTEST_LZ_SIZE; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      plain[i] = (unsigned char)(seed >> 16);
+    }
+  if ((BZENPASS != BZENTEST_EQUALS_N(BZENPASS, bzentest_lz_roundtrip(BZENTEST_LZ_SIZE, &packed_size))) ||
+      (BZENPASS != BZENTEST_TRUE(packed_size >= BZENTEST_LZ_SIZE)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_lz_compress(plain, BZENTEST_LZ_SIZE, packed, BZENTEST_LZ_SIZE - 1))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Repeats beyond 64 KiB are not reachable and stay literals. */
+  memcpy(plain + 100000, plain, 50000);
+  if (BZENPASS != BZENTEST_EQUALS_N(BZENPASS, bzentest_lz_roundtrip(BZENTEST_LZ_SIZE, &packed_size)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Malformed blocks and small destinations are refused, not overrun. */
+  memset(plain, 'z', 64);
+  packed_size = bzen_lz_compress(plain, 64, packed, sizeof(packed));
+  bad[0] = 0x14;
+  bad[1] = 'a';
+  bad[2] = 2;
+  bad[3] = 0;
+  if ((BZENPASS != BZENTEST_EQUALS_N(-1, bzen_lz_decompress(packed, packed_size, unpacked, 63))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(-1, bzen_lz_decompress(packed, packed_size - 1, unpacked, sizeof(unpacked)))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(-1, bzen_lz_decompress(bad, 3, unpacked, sizeof(unpacked)))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(-1, bzen_lz_decompress(bad, 4, unpacked, sizeof(unpacked)))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(64, bzen_lz_decompress(packed, packed_size, unpacked, 64))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+ END_TEST:
+
+  return result;
+}
@@ -0,0 +1,921 @@
+/**
+ * @file:	bzentest_mem.c
+ * @brief:	Unit test dynamic memory management functions.
+ *
+ * @copyright:	Copyright (C) 2017 Kuhrman Technology Solutions LLC
+ * @license:	GPLv3+: GNU GPL version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+/* libbzenc */
+#include "bzentest.h"
+#include "bzenmem.h"
+#include "bzenthread.h"
+
+#define BZENTEST_ARENA_CHUNK_SIZE 256
+#define BZENTEST_ARENA_N_BLOCKS 64
+#define BZENTEST_ARENA_BLOCK_SIZE 24
+#define BZENTEST_ARENA_ALIGNMENT 64
+#define BZENTEST_POOL_OBJECT_SIZE 40
+#define BZENTEST_POOL_N_OBJECTS 200
+#define BZENTEST_POOL_N_THREADS 4
+
+/* Helper function tests tagged allocation accounting. */
+int bzentest_mem_accounting();
+
+/* Helper function tests aligned and node-local allocation. */
+int bzentest_mem_aligned();
+
+/* Helper function tests arena allocator. */
+int bzentest_mem_arena();
+
+/* Helper function tests debug allocator checks. */
+int bzentest_mem_debug();
+
+/* Helper function tests bzen_malloc(), bzen_realloc() and bzen_free(). */
+int bzentest_mem_malloc();
+
+/* Helper function tests blocks with a mapping of their own. */
+int bzentest_mem_mapped();
+
+/* Helper function tests object pool. */
+int bzentest_mem_pool();
+
+/* Helper function tests arenas and pools on huge pages. */
+int bzentest_mem_hugepages();
+
+/* Helper function tests sampling allocation profiler. */
+int bzentest_mem_profile();
+
+/* Helper function tests bzen_realloc_grow() policies. */
+int bzentest_mem_realloc_grow();
+
+/* Thread routine allocates and frees pool objects. */
+void* bzentest_mem_pool_routine(void* arg);
+
+int main (int argc, char *argv[])
+{
+  int result = BZEN_TEST_EVAL_PASS;
+  int status;
+
+  /* Test tagged allocation accounting. */
+  status = bzentest_mem_accounting();
+  if (BZENPASS != BZENTEST_EQUALS_N(0, status))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+
+  /* Test aligned and node-local allocation. */
+  status = bzentest_mem_aligned();
+  if (BZENPASS != BZENTEST_EQUALS_N(0, status))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+
+  /* Test arena allocator. */
+  status = bzentest_mem_arena();
+  if (BZENPASS != BZENTEST_EQUALS_N(0, status))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+
+  /* Test debug allocator. */
+  status = bzentest_mem_debug();
+  if (BZENPASS != BZENTEST_EQUALS_N(0, status))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+
+  /* Test bzen_malloc() magazines and heap blocks. */
+  status = bzentest_mem_malloc();
+  if (BZENPASS != BZENTEST_EQUALS_N(0, status))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+
+  /* Test huge pages. */
+  status = bzentest_mem_hugepages();
+  if (BZENPASS != BZENTEST_EQUALS_N(0, status))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+
+  /* Test mapped blocks. */
+  status = bzentest_mem_mapped();
+  if (BZENPASS != BZENTEST_EQUALS_N(0, status))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+
+  /* Test object pool. */
+  status = bzentest_mem_pool();
+  if (BZENPASS != BZENTEST_EQUALS_N(0, status))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+
+  /* Test allocation profiler. */
+  status = bzentest_mem_profile();
+  if (BZENPASS != BZENTEST_EQUALS_N(0, status))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+
+  /* Test growth policies. */
+  status = bzentest_mem_realloc_grow();
+  if (BZENPASS != BZENTEST_EQUALS_N(0, status))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+
+  return result;
+}
+
+/* Helper function tests tagged allocation accounting. */
+int bzentest_mem_accounting()
+{
+  int result = BZEN_TEST_EVAL_FAIL;
+  bzen_mem_stats_t before;
+  bzen_mem_stats_t after;
+  bzen_mem_stats_t total;
+  char* small;
+  char* large;
+  char* dump = NULL;
+  size_t dump_size;
+  size_t nelem;
+  FILE* stream;
+  int status;
+
+  status = bzen_malloc_get_stats(BZEN_MEM_TAG_SOCK, &before);
+  if (BZENPASS != BZENTEST_EQUALS_N(0, status))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* One block from a magazine and one from the heap. */
+  small = (char*)bzen_malloc_tagged(BZENTEST_POOL_OBJECT_SIZE, BZEN_MEM_TAG_SOCK);
+  large = (char*)bzen_malloc_tagged(4 * BZEN_MEM_MAGAZINE_MAX, BZEN_MEM_TAG_SOCK);
+  bzen_malloc_get_stats(BZEN_MEM_TAG_SOCK, &after);
+  if ((BZENPASS != BZENTEST_EQUALS_N(before.allocs + 2, after.allocs)) ||
+      (BZENPASS != BZENTEST_TRUE(after.live_bytes >= before.live_bytes + 
+				 BZENTEST_POOL_OBJECT_SIZE + 
+				 4 * BZEN_MEM_MAGAZINE_MAX)) ||
+      (BZENPASS != BZENTEST_TRUE(after.peak_bytes >= after.live_bytes)))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Block moved or resized by bzen_realloc() keeps its tag. */
+  nelem = 4 * BZEN_MEM_MAGAZINE_MAX;
+  large = (char*)bzen_realloc(large, &nelem, 1);
+  nelem = BZENTEST_POOL_OBJECT_SIZE;
+  small = (char*)bzen_realloc(small, &nelem, 1);
+  bzen_free(large);
+  bzen_free(small);
+  bzen_malloc_get_stats(BZEN_MEM_TAG_SOCK, &after);
+  if ((BZENPASS != BZENTEST_EQUALS_N(before.live_bytes, after.live_bytes)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(after.allocs, after.frees)))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Total covers every tag. */
+  bzen_malloc_get_stats(BZEN_MEM_TAG_COUNT, &total);
+  if (BZENPASS != BZENTEST_TRUE(total.allocs >= after.allocs))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Reject unknown tag. */
+  status = bzen_malloc_get_stats(BZEN_MEM_TAG_COUNT + 1, &after);
+  if (BZENPASS != BZENTEST_EQUALS_N(-1, status))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Dump is parseable key=value lines. */
+  stream = open_memstream(&dump, &dump_size);
+  if (BZENPASS != BZENTEST_TRUE(stream != NULL))
+    {
+      goto END_SUBTEST;
+    }
+  bzen_malloc_print_stats(stream);
+  fclose(stream);
+  if ((BZENPASS != BZENTEST_TRUE(strstr(dump, "mem.sock.live_bytes=") != NULL)) ||
+      (BZENPASS != BZENTEST_TRUE(strstr(dump, "mem.total.peak_bytes=") != NULL)) ||
+      (BZENPASS != BZENTEST_TRUE(strstr(dump, "heap.in_use_bytes=") != NULL)))
+    {
+      goto END_SUBTEST;
+    }
+
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_SUBTEST:
+
+  free(dump);
+
+  return result;
+}
+
+/* Helper function tests aligned and node-local allocation. */
+int bzentest_mem_aligned()
+{
+  int result = BZEN_TEST_EVAL_FAIL;
+  bzen_pool_t* pool = NULL;
+  char* objects[2];
+  char* block;
+  size_t nelem;
+
+  /* Reject alignment which is not a power of two. */
+  if (BZENPASS != BZENTEST_TRUE(bzen_malloc_aligned(16, 48) == NULL))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Cache line aligned block keeps alignment and content when it moves. */
+  block = (char*)bzen_malloc_aligned(BZENTEST_POOL_OBJECT_SIZE, BZEN_MEM_CACHE_LINE);
+  if (BZENPASS != BZENTEST_TRUE(((uintptr_t)block % BZEN_MEM_CACHE_LINE) == 0))
+    {
+      goto END_SUBTEST;
+    }
+  memset(block, 'x', BZENTEST_POOL_OBJECT_SIZE);
+  nelem = BZENTEST_POOL_OBJECT_SIZE;
+  block = (char*)bzen_realloc_grow(block, &nelem, 4 * BZEN_MEM_MAGAZINE_MAX, 1, NULL);
+  if ((BZENPASS != BZENTEST_TRUE(((uintptr_t)block % BZEN_MEM_CACHE_LINE) == 0)) ||
+      (BZENPASS != BZENTEST_TRUE(block[BZENTEST_POOL_OBJECT_SIZE - 1] == 'x')))
+    {
+      goto END_SUBTEST;
+    }
+  bzen_free(block);
+
+  /* Pool objects of a cache line each. */
+  pool = bzen_pool_create_aligned(BZENTEST_POOL_OBJECT_SIZE, 0, BZEN_MEM_CACHE_LINE);
+  if (BZENPASS != BZENTEST_TRUE(pool != NULL))
+    {
+      goto END_SUBTEST;
+    }
+  objects[0] = (char*)bzen_pool_alloc(pool);
+  objects[1] = (char*)bzen_pool_alloc(pool);
+  if ((BZENPASS != BZENTEST_TRUE(((uintptr_t)objects[0] % BZEN_MEM_CACHE_LINE) == 0)) ||
+      (BZENPASS != BZENTEST_TRUE(((uintptr_t)objects[1] % BZEN_MEM_CACHE_LINE) == 0)))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Node-local block is usable whether or not system has NUMA support. */
+  if (BZENPASS != BZENTEST_TRUE(bzen_malloc_node(16, BZEN_MEM_MAX_NODES) == NULL))
+    {
+      goto END_SUBTEST;
+    }
+  block = (char*)bzen_malloc_node(BZEN_MEM_MAP_THRESHOLD, BZEN_MEM_NODE_LOCAL);
+  if (BZENPASS != BZENTEST_TRUE(block != NULL))
+    {
+      goto END_SUBTEST;
+    }
+  memset(block, 'y', BZEN_MEM_MAP_THRESHOLD);
+  bzen_free(block);
+
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_SUBTEST:
+
+  bzen_pool_destroy(pool);
+
+  return result;
+}
+
+/* Helper function tests arena allocator. */
+int bzentest_mem_arena()
+{
+  int result = BZEN_TEST_EVAL_FAIL;
+  bzen_arena_t* arena;
+  char* blocks[BZENTEST_ARENA_N_BLOCKS];
+  char* block;
+  void* first;
+  int nblock;
+
+  arena = bzen_arena_create(BZENTEST_ARENA_CHUNK_SIZE);
+  if (BZENPASS != BZENTEST_TRUE(arena != NULL))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Fill several chunks and verify blocks do not overlap. */
+  for (nblock = 0; nblock < BZENTEST_ARENA_N_BLOCKS; nblock++)
+    {
+      blocks[nblock] = (char*)bzen_arena_alloc(arena, BZENTEST_ARENA_BLOCK_SIZE);
+      if ((BZENPASS != BZENTEST_TRUE(blocks[nblock] != NULL)) ||
+	  (BZENPASS != BZENTEST_TRUE(((uintptr_t)blocks[nblock] % 
+				      BZEN_MEM_ALIGNMENT) == 0)))
+	{
+	  fprintf(stderr, "\n\tbzen_arena_alloc() failed on block %d\n", nblock);
+	  goto END_SUBTEST;
+	}
+      memset(blocks[nblock], nblock, BZENTEST_ARENA_BLOCK_SIZE);
+    }
+  for (nblock = 0; nblock < BZENTEST_ARENA_N_BLOCKS; nblock++)
+    {
+      if ((BZENPASS != BZENTEST_EQUALS_N(nblock, blocks[nblock][0])) ||
+	  (BZENPASS != BZENTEST_EQUALS_N(nblock, 
+					 blocks[nblock][BZENTEST_ARENA_BLOCK_SIZE - 1])))
+	{
+	  fprintf(stderr, "\n\tarena block %d was overwritten\n", nblock);
+	  goto END_SUBTEST;
+	}
+    }
+
+  /* Aligned allocation. */
+  block = (char*)bzen_arena_alloc_aligned(arena, 1, BZENTEST_ARENA_ALIGNMENT);
+  if ((BZENPASS != BZENTEST_TRUE(block != NULL)) ||
+      (BZENPASS != BZENTEST_TRUE(((uintptr_t)block % BZENTEST_ARENA_ALIGNMENT) == 0)))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Alignment which is not a power of two is rejected. */
+  block = (char*)bzen_arena_alloc_aligned(arena, 1, 3);
+  if (BZENPASS != BZENTEST_TRUE(block == NULL))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Oversized request is satisfied by a dedicated chunk. */
+  block = (char*)bzen_arena_alloc(arena, BZENTEST_ARENA_CHUNK_SIZE * 4);
+  if (BZENPASS != BZENTEST_TRUE(block != NULL))
+    {
+      goto END_SUBTEST;
+    }
+  memset(block, 0, BZENTEST_ARENA_CHUNK_SIZE * 4);
+
+  /* After reset, memory of first chunk is handed out again. */
+  bzen_arena_reset(arena);
+  first = bzen_arena_alloc(arena, BZENTEST_ARENA_BLOCK_SIZE);
+  if (BZENPASS != BZENTEST_TRUE(first == (void*)blocks[0]))
+    {
+      fprintf(stderr, "\n\tbzen_arena_reset() did not recycle first chunk\n");
+      goto END_SUBTEST;
+    }
+
+  bzen_arena_destroy(arena);
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_SUBTEST:
+
+  return result;
+}
+
+/* Helper function tests debug allocator checks. */
+int bzentest_mem_debug()
+{
+  int result = BZEN_TEST_EVAL_FAIL;
+  const bzen_mem_policy_t exact = { BZEN_MEM_GROW_EXACT, 0 };
+  unsigned int previous;
+  size_t capacity;
+  long page_size;
+  char* small;
+  char* large;
+  pid_t child;
+  int status;
+
+  page_size = sysconf(_SC_PAGESIZE);
+  previous = bzen_mem_set_debug(BZEN_MEM_DEBUG_ALL);
+
+  /* New blocks are poisoned. */
+  small = (char*)bzen_malloc(10);
+  if ((BZENPASS != BZENTEST_TRUE((unsigned char)small[0] == 0xAB)) ||
+      (BZENPASS != BZENTEST_TRUE((unsigned char)small[9] == 0xAB)))
+    {
+      goto END_SUBTEST;
+    }
+  memcpy(small, "debugging", 10);
+
+  /* Page sized block ends against guard page (up to alignment). */
+  large = (char*)bzen_malloc(page_size);
+  if ((BZENPASS != BZENTEST_TRUE(large != NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, ((uintptr_t)large + page_size) % 
+				      page_size)))
+    {
+      goto END_SUBTEST;
+    }
+  memset(large, 'x', page_size);
+
+  /* Debug blocks move on resize and keep their contents. */
+  capacity = 10;
+  small = (char*)bzen_realloc_grow(small, &capacity, 100, 1, &exact);
+  capacity = page_size;
+  large = (char*)bzen_realloc_grow(large, &capacity, 2 * page_size, 1, &exact);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, strcmp(small, "debugging"))) ||
+      (BZENPASS != BZENTEST_TRUE(large[page_size - 1] == 'x')) ||
+      (BZENPASS != BZENTEST_TRUE((unsigned char)large[page_size] == 0xAB)))
+    {
+      goto END_SUBTEST;
+    }
+  bzen_free(small);
+  bzen_free(large);
+
+  /* Overflow by one byte aborts child when block is freed. */
+  fflush(stdout);
+  fflush(stderr);
+  child = fork();
+  if (child == 0)
+    {
+      /* Keep report out of test output. */
+      freopen("/dev/null", "w", stderr);
+      small = (char*)bzen_malloc(24);
+      small[24] = 0;
+      bzen_free(small);
+      _exit(0);
+    }
+  if ((BZENPASS != BZENTEST_TRUE(child == waitpid(child, &status, 0))) ||
+      (BZENPASS != BZENTEST_TRUE(WIFSIGNALED(status))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(SIGABRT, WTERMSIG(status))))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* So does double free. */
+  child = fork();
+  if (child == 0)
+    {
+      /* Keep report out of test output. */
+      freopen("/dev/null", "w", stderr);
+      small = (char*)bzen_malloc(24);
+      bzen_free(small);
+      bzen_free(small);
+      _exit(0);
+    }
+  if ((BZENPASS != BZENTEST_TRUE(child == waitpid(child, &status, 0))) ||
+      (BZENPASS != BZENTEST_TRUE(WIFSIGNALED(status))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(SIGABRT, WTERMSIG(status))))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Blocks allocated with checks on may be freed with checks off. */
+  small = (char*)bzen_malloc(32);
+  bzen_mem_set_debug(0);
+  bzen_free(small);
+
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_SUBTEST:
+
+  bzen_mem_set_debug(previous);
+
+  return result;
+}
+
+/* Helper function tests bzen_malloc(), bzen_realloc() and bzen_free(). */
+int bzentest_mem_malloc()
+{
+  int result = BZEN_TEST_EVAL_FAIL;
+  unsigned char* block;
+  void* first;
+  void* second;
+  size_t nelem;
+  size_t prev_nelem;
+  size_t nbyte;
+
+  /* Small block freed by a thread is reused by the same thread. */
+  first = bzen_malloc(BZENTEST_POOL_OBJECT_SIZE);
+  if ((BZENPASS != BZENTEST_TRUE(first != NULL)) ||
+      (BZENPASS != BZENTEST_TRUE(((uintptr_t)first % BZEN_MEM_ALIGNMENT) == 0)))
+    {
+      goto END_SUBTEST;
+    }
+  bzen_free(first);
+  second = bzen_malloc(BZENTEST_POOL_OBJECT_SIZE);
+  if (BZENPASS != BZENTEST_TRUE(first == second))
+    {
+      fprintf(stderr, "\n\tbzen_malloc() did not reuse magazine block\n");
+      goto END_SUBTEST;
+    }
+  bzen_free(second);
+  bzen_free(NULL);
+
+  /* Grow a block from smallest size class past magazine limit and verify 
+     content survives each move. */
+  nelem = 1;
+  block = (unsigned char*)bzen_realloc(NULL, &nelem, 1);
+  block[0] = 0;
+  while (nelem <= 4 * BZEN_MEM_MAGAZINE_MAX)
+    {
+      prev_nelem = nelem;
+      block = (unsigned char*)bzen_realloc(block, &nelem, 1);
+      if (BZENPASS != BZENTEST_TRUE(nelem > prev_nelem))
+	{
+	  goto END_SUBTEST;
+	}
+      for (nbyte = 0; nbyte < prev_nelem; nbyte++)
+	{
+	  if (block[nbyte] != (unsigned char)nbyte)
+	    {
+	      fprintf(stderr, "\n\tbzen_realloc() lost byte %zu\n", nbyte);
+	      goto END_SUBTEST;
+	    }
+	}
+      for (nbyte = prev_nelem; nbyte < nelem; nbyte++)
+	{
+	  block[nbyte] = (unsigned char)nbyte;
+	}
+    }
+  bzen_free(block);
+
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_SUBTEST:
+
+  return result;
+}
+
+/* Helper function tests arenas and pools on huge pages. */
+int bzentest_mem_hugepages()
+{
+  int result = BZEN_TEST_EVAL_FAIL;
+  bzen_arena_t* arena;
+  bzen_pool_t* pool = NULL;
+  char* block;
+  int status;
+
+  arena = bzen_arena_create(BZENTEST_ARENA_CHUNK_SIZE);
+  if (BZENPASS != BZENTEST_TRUE(arena != NULL))
+    {
+      goto END_SUBTEST;
+    }
+  status = bzen_arena_set_pages(arena, BZEN_MEM_PAGES_HUGETLB + 1);
+  if (BZENPASS != BZENTEST_EQUALS_N(-1, status))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Chunk is a whole huge page on a huge page boundary. */
+  status = bzen_arena_set_pages(arena, BZEN_MEM_PAGES_TRANSPARENT);
+  block = (char*)bzen_arena_alloc(arena, BZENTEST_ARENA_BLOCK_SIZE);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, status)) ||
+      (BZENPASS != BZENTEST_TRUE(block != NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(BZEN_MEM_HUGEPAGE_SIZE, arena->head->mapped)) ||
+      (BZENPASS != BZENTEST_TRUE(((uintptr_t)arena->head % BZEN_MEM_HUGEPAGE_SIZE) == 0)))
+    {
+      goto END_SUBTEST;
+    }
+  memset(block, 'h', BZENTEST_ARENA_BLOCK_SIZE);
+
+  /* Reserved huge pages fall back when there are none. */
+  bzen_arena_set_pages(arena, BZEN_MEM_PAGES_HUGETLB);
+  block = (char*)bzen_arena_alloc(arena, BZEN_MEM_HUGEPAGE_SIZE);
+  if ((BZENPASS != BZENTEST_TRUE(block != NULL)) ||
+      (BZENPASS != BZENTEST_TRUE(arena->large->mapped >= 2 * BZEN_MEM_HUGEPAGE_SIZE)))
+    {
+      goto END_SUBTEST;
+    }
+  memset(block, 'h', BZEN_MEM_HUGEPAGE_SIZE);
+  bzen_arena_reset(arena);
+  bzen_arena_destroy(arena);
+
+  /* Pools created while default is set inherit it. */
+  bzen_mem_set_default_pages(BZEN_MEM_PAGES_TRANSPARENT);
+  pool = bzen_pool_create(BZENTEST_POOL_OBJECT_SIZE, 0);
+  bzen_mem_set_default_pages(BZEN_MEM_PAGES_DEFAULT);
+  if ((BZENPASS != BZENTEST_TRUE(pool != NULL)) ||
+      (BZENPASS != BZENTEST_TRUE(bzen_pool_alloc(pool) != NULL)) ||
+      (BZENPASS != BZENTEST_TRUE(pool->arena->head->mapped > 0)))
+    {
+      goto END_SUBTEST;
+    }
+  status = bzen_pool_set_pages(pool, BZEN_MEM_PAGES_DEFAULT);
+  if (BZENPASS != BZENTEST_EQUALS_N(0, status))
+    {
+      goto END_SUBTEST;
+    }
+
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_SUBTEST:
+
+  bzen_pool_destroy(pool);
+
+  return result;
+}
+
+/* Helper function tests blocks with a mapping of their own. */
+int bzentest_mem_mapped()
+{
+  int result = BZEN_TEST_EVAL_FAIL;
+  bzen_mem_stats_t stats;
+  size_t page_size;
+  size_t capacity = 0;
+  size_t nbyte;
+  unsigned char* block;
+
+  page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+  /* Block past threshold starts one header past a page boundary and owns 
+     whole pages. */
+  block = (unsigned char*)bzen_realloc_grow(NULL, &capacity, 
+					    BZEN_MEM_MAP_THRESHOLD, 1, NULL);
+  if ((BZENPASS != BZENTEST_TRUE(((uintptr_t)block % page_size) == 
+				 sizeof(bzen_mem_header_t))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, (capacity + sizeof(bzen_mem_header_t)) % 
+				     page_size)))
+    {
+      goto END_SUBTEST;
+    }
+  for (nbyte = 0; nbyte < capacity; nbyte++)
+    {
+      block[nbyte] = (unsigned char)nbyte;
+    }
+
+  /* Grow by remapping, content preserved. */
+  block = (unsigned char*)bzen_realloc_grow(block, &capacity, 
+					    64 * BZEN_MEM_MAP_THRESHOLD, 1, NULL);
+  if (BZENPASS != BZENTEST_TRUE(capacity >= 64 * BZEN_MEM_MAP_THRESHOLD))
+    {
+      goto END_SUBTEST;
+    }
+  for (nbyte = 0; nbyte < BZEN_MEM_MAP_THRESHOLD; nbyte++)
+    {
+      if (block[nbyte] != (unsigned char)nbyte)
+	{
+	  fprintf(stderr, "\n\tremap lost byte %zu\n", nbyte);
+	  goto END_SUBTEST;
+	}
+    }
+  block[capacity - 1] = 1;
+
+  bzen_malloc_get_stats(BZEN_MEM_TAG_OTHER, &stats);
+  if (BZENPASS != BZENTEST_TRUE(stats.live_bytes >= capacity))
+    {
+      goto END_SUBTEST;
+    }
+  bzen_free(block);
+
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_SUBTEST:
+
+  return result;
+}
+
+/* Helper function tests object pool. */
+int bzentest_mem_pool()
+{
+  int result = BZEN_TEST_EVAL_FAIL;
+  bzen_pool_t* pool;
+  pthread_t threads[BZENTEST_POOL_N_THREADS];
+  void* thread_result;
+  void* first;
+  void* second;
+  int nthread;
+  int status;
+
+  pool = bzen_pool_create(BZENTEST_POOL_OBJECT_SIZE, 0);
+  if (BZENPASS != BZENTEST_TRUE(pool != NULL))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Freed object is handed out again by calling thread's cache. */
+  first = bzen_pool_alloc(pool);
+  if (BZENPASS != BZENTEST_TRUE(first != NULL))
+    {
+      goto END_SUBTEST;
+    }
+  bzen_pool_free(pool, first);
+  second = bzen_pool_alloc(pool);
+  if (BZENPASS != BZENTEST_TRUE(first == second))
+    {
+      fprintf(stderr, "\n\tbzen_pool_alloc() did not recycle freed object\n");
+      goto END_SUBTEST;
+    }
+  bzen_pool_free(pool, second);
+
+  /* Several threads share the pool. */
+  for (nthread = 0; nthread < BZENTEST_POOL_N_THREADS; nthread++)
+    {
+      status = bzen_thread_create(&threads[nthread], 
+				  NULL,
+				  bzentest_mem_pool_routine,
+				  pool);
+      if (BZENPASS != BZENTEST_EQUALS_N(0, status))
+	{
+	  goto END_SUBTEST;
+	}
+    }
+  for (nthread = 0; nthread < BZENTEST_POOL_N_THREADS; nthread++)
+    {
+      status = bzen_thread_join(threads[nthread], &thread_result);
+      if ((BZENPASS != BZENTEST_EQUALS_N(0, status)) ||
+	  (BZENPASS != BZENTEST_EQUALS_N(BZEN_TEST_EVAL_PASS,
+					 (int)(uintptr_t)thread_result)))
+	{
+	  fprintf(stderr, "\n\tpool thread %d failed\n", nthread);
+	  goto END_SUBTEST;
+	}
+    }
+
+  bzen_pool_destroy(pool);
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_SUBTEST:
+
+  return result;
+}
+
+/* Thread routine allocates and frees pool objects. */
+void* bzentest_mem_pool_routine(void* arg)
+{
+  bzen_pool_t* pool = (bzen_pool_t*)arg;
+  unsigned char* objects[BZENTEST_POOL_N_OBJECTS];
+  uintptr_t result = BZEN_TEST_EVAL_FAIL;
+  int nobj;
+  int nbyte;
+
+  for (nobj = 0; nobj < BZENTEST_POOL_N_OBJECTS; nobj++)
+    {
+      objects[nobj] = (unsigned char*)bzen_pool_alloc(pool);
+      if (objects[nobj] == NULL)
+	{
+	  goto END_ROUTINE;
+	}
+      memset(objects[nobj], nobj, BZENTEST_POOL_OBJECT_SIZE);
+    }
+
+  /* No object may have been handed out twice. */
+  for (nobj = 0; nobj < BZENTEST_POOL_N_OBJECTS; nobj++)
+    {
+      for (nbyte = 0; nbyte < BZENTEST_POOL_OBJECT_SIZE; nbyte++)
+	{
+	  if (objects[nobj][nbyte] != (unsigned char)nobj)
+	    {
+	      goto END_ROUTINE;
+	    }
+	}
+      bzen_pool_free(pool, objects[nobj]);
+    }
+
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_ROUTINE:
+
+  return (void*)result;
+}
+
+/* Helper function tests sampling allocation profiler. */
+int bzentest_mem_profile()
+{
+  int result = BZEN_TEST_EVAL_FAIL;
+  char* dump = NULL;
+  char* line;
+  char* bytes;
+  size_t dump_size;
+  size_t total = 0;
+  size_t previous;
+  void* block;
+  FILE* stream;
+  int nblock;
+  int status;
+
+  status = bzen_malloc_print_profile(NULL);
+  if (BZENPASS != BZENTEST_EQUALS_N(-1, status))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Sample every 64 bytes, so each 64 byte block is one sample. */
+  previous = bzen_malloc_set_sample_interval(64);
+  for (nblock = 0; nblock < BZENTEST_POOL_N_OBJECTS; nblock++)
+    {
+      block = bzen_malloc(64);
+      bzen_free(block);
+    }
+  bzen_malloc_set_sample_interval(previous);
+
+  stream = open_memstream(&dump, &dump_size);
+  if (BZENPASS != BZENTEST_TRUE(stream != NULL))
+    {
+      goto END_SUBTEST;
+    }
+  status = bzen_malloc_print_profile(stream);
+  fclose(stream);
+  if (BZENPASS != BZENTEST_EQUALS_N(0, status))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Every line is "frame;frame;... bytes". */
+  for (line = strtok(dump, "\n"); line != NULL; line = strtok(NULL, "\n"))
+    {
+      bytes = strrchr(line, ' ');
+      if (BZENPASS != BZENTEST_TRUE((bytes != NULL) && (bytes != line)))
+	{
+	  fprintf(stderr, "\n\tmalformed profile line '%s'\n", line);
+	  goto END_SUBTEST;
+	}
+      total += strtoul(bytes + 1, NULL, 10);
+    }
+  if (BZENPASS != BZENTEST_TRUE(total >= 64 * BZENTEST_POOL_N_OBJECTS))
+    {
+      goto END_SUBTEST;
+    }
+
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_SUBTEST:
+
+  free(dump);
+
+  return result;
+}
+
+/* Helper function tests bzen_realloc_grow() policies. */
+int bzentest_mem_realloc_grow()
+{
+  int result = BZEN_TEST_EVAL_FAIL;
+  bzen_mem_policy_t exact = { BZEN_MEM_GROW_EXACT, 0 };
+  bzen_mem_policy_t geometric = { BZEN_MEM_GROW_GEOMETRIC, 200 };
+  bzen_mem_policy_t page = { BZEN_MEM_GROW_PAGE, 0 };
+  size_t page_size;
+  size_t capacity = 0;
+  size_t previous;
+  char* block;
+  char* same;
+
+  /* Exact growth reports real capacity, slack of size class included. */
+  block = (char*)bzen_realloc_grow(NULL, &capacity, 20, 1, &exact);
+  if (BZENPASS != BZENTEST_EQUALS_N(32, capacity))
+    {
+      goto END_SUBTEST;
+    }
+  memset(block, 'a', capacity);
+
+  /* No-op while capacity suffices. */
+  same = (char*)bzen_realloc_grow(block, &capacity, 30, 1, &exact);
+  if ((BZENPASS != BZENTEST_TRUE(same == block)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(32, capacity)))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Geometric growth by factor, content preserved. */
+  block = (char*)bzen_realloc_grow(block, &capacity, 33, 1, &geometric);
+  if ((BZENPASS != BZENTEST_EQUALS_N(64, capacity)) ||
+      (BZENPASS != BZENTEST_TRUE(block[31] == 'a')))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Page growth fills whole pages, on the heap and when resized there. */
+  page_size = (size_t)sysconf(_SC_PAGESIZE);
+  block = (char*)bzen_realloc_grow(block, &capacity, 2 * page_size, 1, &page);
+  if ((BZENPASS != BZENTEST_TRUE(capacity >= 2 * page_size)) ||
+      (BZENPASS != BZENTEST_TRUE(capacity < 3 * page_size)) ||
+      (BZENPASS != BZENTEST_TRUE(block[31] == 'a')))
+    {
+      goto END_SUBTEST;
+    }
+  previous = capacity;
+  block = (char*)bzen_realloc_grow(block, &capacity, previous + 1, 1, &page);
+  if ((BZENPASS != BZENTEST_TRUE(capacity > previous)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(previous + page_size, capacity)))
+    {
+      goto END_SUBTEST;
+    }
+  bzen_free(block);
+
+  /* Capacity counts objects, not bytes. */
+  capacity = 0;
+  block = (char*)bzen_realloc_grow(NULL, &capacity, 3, sizeof(double), NULL);
+  if (BZENPASS != BZENTEST_EQUALS_N(4, capacity))
+    {
+      goto END_SUBTEST;
+    }
+  bzen_free(block);
+
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_SUBTEST:
+
+  return result;
+}
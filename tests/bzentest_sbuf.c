@@ -21,14 +21,23 @@
 
 #include <config.h>
 #include <stdio.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdio_ext.h>
 
 /* libbzenc */
 #include "bzentest.h"
+#include "bzenmem.h"
 #include "bzensbuf.h"
 
-const unsigned short int BZENTEST_BUFFER_SIZE = 128;
+const unsigned short int BZENTEST_BUFFER_SIZE = 256;
 const unsigned short int BZENTEST_N_BUFFERS = 8;
 
 const char* sbuf_test_data = 
@@ -43,6 +52,140 @@ const char* file_test_data = "AaBbCcDdEeFfGgHhIiJjKkLlMmNnOoPpQqRrSsTtUuVvWwXxYy
 
 const char* file_test_name = "bzentest_sbuf.txt";
 
+const size_t BZENTEST_RING_SIZE = 100;
+const size_t BZENTEST_RING_TRANSFER = 1024 * 1024;
+
+#define BZENTEST_CHURN_THREADS 4
+const int BZENTEST_CHURN_ROUNDS = 2000;
+const size_t BZENTEST_MANY_BUFFERS = 70000;
+#define BZENTEST_STATS_ENTRIES 8
+#define BZENTEST_GROWABLE_MESSAGE 5000
+#define BZENTEST_GROWABLE_MAX 12000
+
+const char* span_test_data = "first line\nsecond\0line\nlast line";
+
+/* Thread routine produces test pattern into ring buffer. */
+void* bzentest_sbuf_ring_producer(void* arg)
+{
+  bzen_cbuflock_t* ring = (bzen_cbuflock_t*)arg;
+  unsigned char span[37];
+  size_t sent = 0;
+  size_t n;
+
+  while (sent < BZENTEST_RING_TRANSFER)
+    {
+      /* Alternate spans and single characters. */
+      if (sent % 2)
+	{
+	  if (bzen_sbuf_putc((unsigned char)(sent * 7), ring) != EOF)
+	    {
+	      sent++;
+	    }
+	  else
+	    {
+	      /* Ring is full, let consumer run. */
+	      sched_yield();
+	    }
+	  continue;
+	}
+      for (n = 0; n < sizeof(span); n++)
+	{
+	  span[n] = (unsigned char)((sent + n) * 7);
+	}
+      n = sizeof(span);
+      if (n > BZENTEST_RING_TRANSFER - sent)
+	{
+	  n = BZENTEST_RING_TRANSFER - sent;
+	}
+      n = bzen_sbuf_write(span, n, ring);
+      if (n == 0)
+	{
+	  sched_yield();
+	}
+      sent += n;
+    }
+
+  return NULL;
+}
+
+/* Thread routine creates and destroys buffers. */
+void* bzentest_sbuf_churn(void* arg)
+{
+  bzen_cbuflock_t* cbuflock;
+  int round;
+
+  for (round = 0; round < BZENTEST_CHURN_ROUNDS; round++)
+    {
+      cbuflock = (round % 2) ? bzen_sbuf_create_ring(16) : bzen_sbuf_create(16);
+      if ((cbuflock == NULL) ||
+	  (bzen_sbuf_putc('c', cbuflock) != 'c') ||
+	  (bzen_sbuf_destroy(cbuflock, 1) != 0))
+	{
+	  return arg;
+	}
+    }
+
+  return NULL;
+}
+
+/* Thread routine destroys buffer, giving up before holder lets go. */
+void* bzentest_sbuf_destroyer(void* arg)
+{
+  return (void*)(intptr_t)bzen_sbuf_destroy((bzen_cbuflock_t*)arg, 0.1);
+}
+
+/* Thread routine holds buffer locked for a while. */
+void* bzentest_sbuf_holder(void* arg)
+{
+  bzen_cbuflock_t* cbuflock = (bzen_cbuflock_t*)arg;
+  size_t count;
+  void* span;
+
+  span = bzen_sbuf_reserve(1, &count, cbuflock);
+  if (span != NULL)
+    {
+      usleep(200000);
+      bzen_sbuf_commit(0, cbuflock);
+    }
+
+  return span;
+}
+
+/* Thread routine reads shared buffer without moving its position. */
+void* bzentest_sbuf_reader(void* arg)
+{
+  bzen_cbuflock_t* cbuflock = (bzen_cbuflock_t*)arg;
+  char payload[64];
+  size_t length;
+  int round;
+
+  for (round = 0; round < 100; round++)
+    {
+      length = bzen_sbuf_length(cbuflock);
+      if ((length != BZENTEST_BUFFER_SIZE) ||
+	  (bzen_sbuf_read_at(payload, sizeof(payload), 10, cbuflock) != 
+	   sizeof(payload)) ||
+	  (memcmp(payload, file_test_data + 10, 
+		  strlen(file_test_data) - 10) != 0) ||
+	  (payload[strlen(file_test_data) - 10] != '\0'))
+	{
+	  return arg;
+	}
+    }
+
+  return NULL;
+}
+
+/* Helper function returns monotonic time in seconds. */
+double bzentest_sbuf_now()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
 int main (int argc, char *argv[])
 {
   int result = BZEN_TEST_EVAL_PASS;
@@ -54,6 +197,12 @@ int main (int argc, char *argv[])
   int sbuf_test_data_len;
   int file_test_data_len;
   int nchar, expected, actual;
+  char span[BZENTEST_BUFFER_SIZE];
+  size_t span_len;
+  ssize_t line_len;
+  unsigned char* wspan;
+  const unsigned char* rspan;
+  size_t count;
 
   /* Check counters. */
   if ((BZEN_TEST_EVAL_FAIL ==
@@ -175,6 +324,238 @@ int main (int argc, char *argv[])
 	}
     }
 
+  /* Write a span with embedded null character and read it back by line. */
+  span_len = sizeof("first line\nsecond\0line\nlast line") - 1;
+  if ((BZENPASS != BZENTEST_EQUALS_N(span_len, bzen_sbuf_write(span_test_data,
+								span_len,
+								cbuflock[1]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_rewind(cbuflock[1]))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  line_len = bzen_sbuf_readline(span, sizeof(span), cbuflock[1]);
+  if ((BZENPASS != BZENTEST_EQUALS_N(11, line_len)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, strcmp(span, "first line\n"))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  line_len = bzen_sbuf_readline(span, sizeof(span), cbuflock[1]);
+  if ((BZENPASS != BZENTEST_EQUALS_N(12, line_len)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, memcmp(span, "second\0line\n", 13))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Short destination truncates line, remainder is read next. */
+  line_len = bzen_sbuf_readline(span, 5, cbuflock[1]);
+  if ((BZENPASS != BZENTEST_EQUALS_N(4, line_len)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, strcmp(span, "last"))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Bulk read of rest of span. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(5, bzen_sbuf_read(span, 5, cbuflock[1]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, memcmp(span, " line", 5))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Two-phase write and partial consume on stream buffer. */
+  bzen_sbuf_rewind(cbuflock[1]);
+  wspan = (unsigned char*)bzen_sbuf_reserve(6, &count, cbuflock[1]);
+  if ((BZENPASS != BZENTEST_TRUE(wspan != NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(6, count)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  memcpy(wspan, "FIRST!", 6);
+  if (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_commit(5, cbuflock[1])))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  bzen_sbuf_rewind(cbuflock[1]);
+  rspan = (const unsigned char*)bzen_sbuf_peek(8, &count, cbuflock[1]);
+  if ((BZENPASS != BZENTEST_TRUE(rspan != NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(8, count)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, memcmp(rspan, "FIRST li", 8))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_consume(6, cbuflock[1]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N('l', bzen_sbuf_getc(cbuflock[1]))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Commit or consume without a span is refused and leaves lock alone. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(-1, bzen_sbuf_commit(0, cbuflock[1]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(-1, bzen_sbuf_consume(0, cbuflock[1]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(cbuflock[1]->id, 
+				     bzen_sbuf_lock(cbuflock[1]))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  bzen_sbuf_unlock(cbuflock[1]);
+
+  /* Whole span in one read. */
+  bzen_sbuf_rewind(cbuflock[1]);
+  if ((BZENPASS != BZENTEST_EQUALS_N(span_len, bzen_sbuf_read(span, span_len,
+							       cbuflock[1]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, memcmp(span, "FIRST", 5))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, memcmp(span + 5, span_test_data + 5, 
+					      span_len - 5))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Ring buffer rounds up to power of two and cannot be rewound. */
+  bzen_cbuflock_t* ring = bzen_sbuf_create_ring(BZENTEST_RING_SIZE);
+  if ((BZENPASS != BZENTEST_TRUE(ring != NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(128, ring->size)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(-1, bzen_sbuf_lock(ring))) ||
+      (BZENPASS != BZENTEST_TRUE(bzen_sbuf_rewind(ring) != 0)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(EOF, bzen_sbuf_getc(ring))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Ring gives up whole lines only. */
+  bzen_sbuf_write("ab\nc", 4, ring);
+  line_len = bzen_sbuf_readline(span, sizeof(span), ring);
+  if ((BZENPASS != BZENTEST_EQUALS_N(3, line_len)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, strcmp(span, "ab\n"))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  errno = 0;
+  line_len = bzen_sbuf_readline(span, sizeof(span), ring);
+  if ((BZENPASS != BZENTEST_EQUALS_N(-1, line_len)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(EAGAIN, errno)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  bzen_sbuf_putc('d', ring);
+  bzen_sbuf_putc('\n', ring);
+  line_len = bzen_sbuf_readline(span, sizeof(span), ring);
+  if ((BZENPASS != BZENTEST_EQUALS_N(3, line_len)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, strcmp(span, "cd\n"))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Full ring refuses more. */
+  memset(span, 'x', sizeof(span));
+  if ((BZENPASS != BZENTEST_EQUALS_N(128, bzen_sbuf_write(span, sizeof(span),
+							   ring))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(EOF, bzen_sbuf_putc('y', ring))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(128, bzen_sbuf_read(span, sizeof(span),
+							  ring))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Zero-copy span stops at end of ring (134 bytes went through so far, so
+     head is now at 234, 22 bytes before end); rest follows in next span. */
+  bzen_sbuf_write(span, 100, ring);
+  bzen_sbuf_read(span, 100, ring);
+  wspan = (unsigned char*)bzen_sbuf_reserve(64, &count, ring);
+  if ((BZENPASS != BZENTEST_TRUE(wspan != NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(22, count)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  memset(wspan, 'r', count);
+  bzen_sbuf_commit(count, ring);
+  wspan = (unsigned char*)bzen_sbuf_reserve(64, &count, ring);
+  if ((BZENPASS != BZENTEST_TRUE(wspan != NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(64, count)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  memset(wspan, 's', count);
+  bzen_sbuf_commit(10, ring);
+  rspan = (const unsigned char*)bzen_sbuf_peek(64, &count, ring);
+  if ((BZENPASS != BZENTEST_TRUE(rspan != NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(22, count)) ||
+      (BZENPASS != BZENTEST_TRUE(rspan[21] == 'r')))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  bzen_sbuf_consume(count, ring);
+  rspan = (const unsigned char*)bzen_sbuf_peek(64, &count, ring);
+  if ((BZENPASS != BZENTEST_TRUE(rspan != NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(10, count)) ||
+      (BZENPASS != BZENTEST_TRUE(rspan[9] == 's')) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_consume(count, ring))) ||
+      (BZENPASS != BZENTEST_TRUE(bzen_sbuf_peek(64, &count, ring) == NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, count)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Stream pattern from producer thread through ring, across its end. */
+  pthread_t producer;
+  size_t received = 0;
+  size_t n;
+  pthread_create(&producer, NULL, bzentest_sbuf_ring_producer, ring);
+  while (received < BZENTEST_RING_TRANSFER)
+    {
+      if (received % 3)
+	{
+	  actual = bzen_sbuf_getc(ring);
+	  if (actual == EOF)
+	    {
+	      /* Ring is empty, let producer run. */
+	      sched_yield();
+	      continue;
+	    }
+	  span[0] = (char)actual;
+	  n = 1;
+	}
+      else
+	{
+	  n = bzen_sbuf_read(span, 53, ring);
+	  if (n == 0)
+	    {
+	      sched_yield();
+	    }
+	}
+      for (nchar = 0; nchar < (int)n; nchar++, received++)
+	{
+	  if ((unsigned char)span[nchar] != (unsigned char)(received * 7))
+	    {
+	      fprintf(stderr, "\n\tring mismatch at byte %zu\n", received);
+	      result = BZEN_TEST_EVAL_FAIL;
+	      goto END_TEST;
+	    }
+	}
+    }
+  pthread_join(producer, NULL);
+
+  status = bzen_sbuf_destroy(ring, 1);
+  if (BZENPASS != BZENTEST_EQUALS_N(0, status))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
   /* destroy buffers. */
   timeout = 1;
   for (cbuflock_id = 0; cbuflock_id < num_test_buffers; cbuflock_id++)
@@ -190,6 +571,355 @@ int main (int argc, char *argv[])
 	}
     }
 
+  /* Create and destroy buffers from several threads; slots are reused. */
+  pthread_t churn[BZENTEST_CHURN_THREADS];
+  void* churn_status;
+  for (cbuflock_id = 0; cbuflock_id < BZENTEST_CHURN_THREADS; cbuflock_id++)
+    {
+      pthread_create(&churn[cbuflock_id], NULL, bzentest_sbuf_churn, churn);
+    }
+  for (cbuflock_id = 0; cbuflock_id < BZENTEST_CHURN_THREADS; cbuflock_id++)
+    {
+      pthread_join(churn[cbuflock_id], &churn_status);
+      if (BZENPASS != BZENTEST_TRUE(churn_status == NULL))
+	{
+	  result = BZEN_TEST_EVAL_FAIL;
+	  goto END_TEST;
+	}
+    }
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_count_used())) ||
+      (BZENPASS != BZENTEST_EQUALS_N(1024, bzen_sbuf_count_allocated())))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* More buffers than fit in 16 bits. Stale handle of a reused slot fails. */
+  bzen_cbuflock_t** many;
+  bzen_sbuf_handle_t stale;
+  many = (bzen_cbuflock_t**)bzen_malloc(sizeof(bzen_cbuflock_t*) * 
+					BZENTEST_MANY_BUFFERS);
+  for (count = 0; count < BZENTEST_MANY_BUFFERS; count++)
+    {
+      many[count] = bzen_sbuf_create_ring(1);
+      if (BZENPASS != BZENTEST_TRUE(many[count] != NULL))
+	{
+	  result = BZEN_TEST_EVAL_FAIL;
+	  goto END_TEST;
+	}
+    }
+  if ((BZENPASS != BZENTEST_EQUALS_N(BZENTEST_MANY_BUFFERS, 
+				     bzen_sbuf_count_used())) ||
+      (BZENPASS != BZENTEST_TRUE(many[BZENTEST_MANY_BUFFERS - 1]->id > 65535)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  for (count = 0; count < BZENTEST_MANY_BUFFERS; count++)
+    {
+      bzen_sbuf_destroy(many[count], 1);
+    }
+  bzen_free(many);
+  cbuflock[0] = bzen_sbuf_create(BZENTEST_BUFFER_SIZE);
+  stale = bzen_sbuf_handle(cbuflock[0]);
+  bzen_sbuf_destroy(cbuflock[0], 1);
+  cbuflock[0] = bzen_sbuf_create(BZENTEST_BUFFER_SIZE);
+  if ((BZENPASS != BZENTEST_EQUALS_N(stale.id, cbuflock[0]->id)) ||
+      (BZENPASS != BZENTEST_TRUE(bzen_sbuf_lock_handle(stale) == NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(cbuflock[0]->id, 
+				     bzen_sbuf_lock(cbuflock[0]))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  bzen_sbuf_unlock(cbuflock[0]);
+  stale = bzen_sbuf_handle(cbuflock[0]);
+  if (BZENPASS != BZENTEST_TRUE(bzen_sbuf_lock_handle(stale) == cbuflock[0]))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  bzen_sbuf_unlock(cbuflock[0]);
+  bzen_sbuf_destroy(cbuflock[0], 1);
+
+  /* Destroy of a held buffer gives up at its deadline, leaving it intact. */
+  pthread_t holder;
+  double started;
+  cbuflock[0] = bzen_sbuf_create(BZENTEST_BUFFER_SIZE);
+  pthread_create(&holder, NULL, bzentest_sbuf_holder, cbuflock[0]);
+  usleep(50000);
+  started = bzentest_sbuf_now();
+  status = bzen_sbuf_destroy(cbuflock[0], 0.02);
+  if ((BZENPASS != BZENTEST_EQUALS_N(EBUSY, status)) ||
+      (BZENPASS != BZENTEST_TRUE(bzentest_sbuf_now() - started < 0.1)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Asynchronous destroy leaves freeing to holder, and handles fail. A 
+     destroy timing out meanwhile does not undo it. */
+  pthread_t destroyer;
+  void* destroyer_status;
+  stale = bzen_sbuf_handle(cbuflock[0]);
+  pthread_create(&destroyer, NULL, bzentest_sbuf_destroyer, cbuflock[0]);
+  usleep(20000);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_destroy_async(cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(1, bzen_sbuf_count_used())) ||
+      (BZENPASS != BZENTEST_TRUE(bzen_sbuf_lock_handle(stale) == NULL)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  pthread_join(destroyer, &destroyer_status);
+  if ((BZENPASS != BZENTEST_EQUALS_N(EBUSY, (intptr_t)destroyer_status)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(1, bzen_sbuf_count_used())) ||
+      (BZENPASS != BZENTEST_TRUE(bzen_sbuf_lock_handle(stale) == NULL)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  pthread_join(holder, &churn_status);
+  if ((BZENPASS != BZENTEST_TRUE(churn_status != NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_count_used())))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Buffer left by a destroy that timed out can be locked again. */
+  cbuflock[0] = bzen_sbuf_create(BZENTEST_BUFFER_SIZE);
+  pthread_create(&holder, NULL, bzentest_sbuf_holder, cbuflock[0]);
+  usleep(50000);
+  if ((BZENPASS != BZENTEST_EQUALS_N(EBUSY, bzen_sbuf_destroy(cbuflock[0], 
+							      0.02))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(cbuflock[0]->id, 
+				     bzen_sbuf_lock(cbuflock[0]))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  bzen_sbuf_unlock(cbuflock[0]);
+  pthread_join(holder, &churn_status);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_destroy(cbuflock[0], 1))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_count_used())))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Destroy returns as soon as holder lets go, not a whole second later. */
+  cbuflock[0] = bzen_sbuf_create(BZENTEST_BUFFER_SIZE);
+  pthread_create(&holder, NULL, bzentest_sbuf_holder, cbuflock[0]);
+  usleep(50000);
+  started = bzentest_sbuf_now();
+  status = bzen_sbuf_destroy(cbuflock[0], 5);
+  pthread_join(holder, &churn_status);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, status)) ||
+      (BZENPASS != BZENTEST_TRUE(bzentest_sbuf_now() - started < 0.5)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_count_used())))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Positional read leaves stream where it was. */
+  cbuflock[0] = bzen_sbuf_create(BZENTEST_BUFFER_SIZE);
+  bzen_sbuf_write(file_test_data, strlen(file_test_data), cbuflock[0]);
+  bzen_sbuf_rewind(cbuflock[0]);
+  bzen_sbuf_getc(cbuflock[0]);
+  if ((BZENPASS != BZENTEST_EQUALS_N(BZENTEST_BUFFER_SIZE, 
+				     bzen_sbuf_length(cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(4, bzen_sbuf_read_at(span, 4, 2, 
+							  cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, memcmp(span, "BbCc", 4))) ||
+      (BZENPASS != BZENTEST_EQUALS_N('a', bzen_sbuf_getc(cbuflock[0]))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Readers of shared buffer run alongside each other: they finish while 
+     this thread holds a read lock too. */
+  pthread_t readers[BZENTEST_CHURN_THREADS];
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_set_shared(cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(cbuflock[0]->id, 
+				     bzen_sbuf_lock_shared(cbuflock[0]))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  for (cbuflock_id = 0; cbuflock_id < BZENTEST_CHURN_THREADS; cbuflock_id++)
+    {
+      pthread_create(&readers[cbuflock_id], NULL, bzentest_sbuf_reader, 
+		     cbuflock[0]);
+    }
+  for (cbuflock_id = 0; cbuflock_id < BZENTEST_CHURN_THREADS; cbuflock_id++)
+    {
+      pthread_join(readers[cbuflock_id], &churn_status);
+      if (BZENPASS != BZENTEST_TRUE(churn_status == NULL))
+	{
+	  result = BZEN_TEST_EVAL_FAIL;
+	  goto END_TEST;
+	}
+    }
+  bzen_sbuf_unlock(cbuflock[0]);
+
+  /* Writers still get the buffer to themselves, and readers see their data
+     (write at position 2 overwrites, then one past the data fills zeroes). */
+  bzen_sbuf_write("!", 1, cbuflock[0]);
+  bzen_sbuf_read(span, strlen(file_test_data) - 3, cbuflock[0]);
+  bzen_sbuf_write("?", 1, cbuflock[0]);
+  if ((BZENPASS != BZENTEST_EQUALS_N(BZENTEST_BUFFER_SIZE, 
+				     bzen_sbuf_length(cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(1, bzen_sbuf_read_at(span, 1, 2, 
+							  cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_TRUE(span[0] == '!')) ||
+      (BZENPASS != BZENTEST_EQUALS_N(1, bzen_sbuf_read_at(span, 1, 
+							  strlen(file_test_data),
+							  cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_TRUE(span[0] == '?')) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_destroy(cbuflock[0], 1))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Growable buffer starts small and grows by pages up to its cap. */
+  unsigned char pattern[BZENTEST_GROWABLE_MESSAGE];
+  for (count = 0; count < BZENTEST_GROWABLE_MESSAGE; count++)
+    {
+      pattern[count] = (unsigned char)(count * 13);
+    }
+  cbuflock[1] = bzen_sbuf_create(BZENTEST_BUFFER_SIZE);
+  cbuflock[0] = bzen_sbuf_create_growable(BZENTEST_BUFFER_SIZE, 
+					  BZENTEST_GROWABLE_MAX);
+  if ((BZENPASS != BZENTEST_TRUE(bzen_sbuf_create_growable(0, 1) == NULL)) ||
+      (BZENPASS != BZENTEST_TRUE(bzen_sbuf_create_growable(2, 1) == NULL)) ||
+      (BZENPASS != BZENTEST_TRUE(cbuflock[0] != NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(BZENTEST_BUFFER_SIZE, cbuflock[0]->size)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(BZENTEST_GROWABLE_MESSAGE,
+				     bzen_sbuf_write(pattern, 
+						     BZENTEST_GROWABLE_MESSAGE,
+						     cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_TRUE(cbuflock[0]->size >= 
+				 BZENTEST_GROWABLE_MESSAGE)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(BZENTEST_GROWABLE_MESSAGE,
+				     bzen_sbuf_length(cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(100, bzen_sbuf_read_at(span, 100, 4000,
+							    cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, memcmp(span, pattern + 4000, 100))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Writes stop at cap. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(BZENTEST_GROWABLE_MAX - 
+				     BZENTEST_GROWABLE_MESSAGE,
+				     bzen_sbuf_write(pattern, 
+						     BZENTEST_GROWABLE_MESSAGE,
+						     cbuflock[0]) +
+				     bzen_sbuf_write(pattern, 
+						     BZENTEST_GROWABLE_MESSAGE,
+						     cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(BZENTEST_GROWABLE_MAX,
+				     bzen_sbuf_length(cbuflock[0]))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Reset empties buffer; memory needed a moment ago is kept until it has
+     been idle, or until shrink. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_reset(cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_length(cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_TRUE(cbuflock[0]->size >= BZENTEST_GROWABLE_MAX)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_shrink(cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(BZENTEST_BUFFER_SIZE, cbuflock[0]->size)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(-1, bzen_sbuf_reset(cbuflock[1]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(-1, bzen_sbuf_shrink(cbuflock[1]))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Small message after shrink, read back and shared. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(10, bzen_sbuf_write(pattern, 10, 
+							 cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_rewind(cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(10, bzen_sbuf_read(span, sizeof(span), 
+							cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, memcmp(span, pattern, 10))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_set_shared(cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(5, bzen_sbuf_read_at(span, 100, 5,
+							  cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, memcmp(span, pattern + 5, 5))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_reset(cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_read_at(span, 100, 0,
+							  cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_destroy(cbuflock[0], 1))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_destroy(cbuflock[1], 1))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Counters are kept only for buffers created while statistics are on. */
+  bzen_sbuf_stats_t stats;
+  bzen_sbuf_stats_t all[BZENTEST_STATS_ENTRIES];
+  cbuflock[1] = bzen_sbuf_create(BZENTEST_BUFFER_SIZE);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_set_stats(1))) ||
+      ((cbuflock[0] = bzen_sbuf_create(BZENTEST_BUFFER_SIZE)) == NULL) ||
+      (BZENPASS != BZENTEST_EQUALS_N(1, bzen_sbuf_set_stats(0))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(-1, bzen_sbuf_get_stats(cbuflock[1], 
+							     &stats))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Bytes in and out, locks, and contention while holder has buffer. */
+  bzen_sbuf_write("0123456789", 10, cbuflock[0]);
+  bzen_sbuf_rewind(cbuflock[0]);
+  bzen_sbuf_read(span, 4, cbuflock[0]);
+  bzen_sbuf_getc(cbuflock[0]);
+  bzen_sbuf_putc('x', cbuflock[0]);
+  pthread_create(&holder, NULL, bzentest_sbuf_holder, cbuflock[0]);
+  usleep(50000);
+  bzen_sbuf_putc('y', cbuflock[0]);
+  pthread_join(holder, &churn_status);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_get_stats(cbuflock[0], 
+							    &stats))) ||
+      (BZENPASS != BZENTEST_TRUE(stats.id == cbuflock[0]->id)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(12, stats.bytes_in)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(5, stats.bytes_out)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(7, stats.locks)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(1, stats.contended)) ||
+      (BZENPASS != BZENTEST_TRUE(stats.wait_ns > 0)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(10, stats.high_water)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
+  /* Snapshot lists live buffers; sums outlive them. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(1, bzen_sbuf_get_stats_all(all, 
+								BZENTEST_STATS_ENTRIES,
+								NULL))) ||
+      (BZENPASS != BZENTEST_TRUE(all[0].id == cbuflock[0]->id)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_destroy(cbuflock[0], 1))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_destroy(cbuflock[1], 1))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_get_stats_all(all, 
+								BZENTEST_STATS_ENTRIES,
+								&stats))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(12, stats.bytes_in)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(1, stats.contended)))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+
   /* Test buffer with a file from storage. */
   char tempfile[1024];
   char* tempdir = getenv("BZENTEST_TEMP_DIR");
@@ -249,6 +979,86 @@ int main (int argc, char *argv[])
        BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
      }
 
+  /* Mapped file is served from memory, starting at position of stream. */
+  fbuf = fopen(tempfile, "w+");
+  fwrite(span_test_data, 1, span_len, fbuf);
+  fseek(fbuf, 6, SEEK_SET);
+  cbuflock[0] = bzen_sbuf_create_mapped(fbuf, BZEN_SBUF_MAP_SEQUENTIAL |
+					BZEN_SBUF_MAP_WILLNEED);
+  if ((BZENPASS != BZENTEST_TRUE(cbuflock[0] != NULL)) ||
+      (BZENPASS != BZENTEST_TRUE(cbuflock[0]->map != NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(span_len, 
+				     bzen_sbuf_length(cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N('l', bzen_sbuf_getc(cbuflock[0]))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  rspan = (const unsigned char*)bzen_sbuf_peek(3, &count, cbuflock[0]);
+  if ((BZENPASS != BZENTEST_TRUE(rspan != NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(3, count)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, memcmp(rspan, "ine", 3))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_consume(2, cbuflock[0]))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  line_len = bzen_sbuf_readline(span, sizeof(span), cbuflock[0]);
+  if ((BZENPASS != BZENTEST_EQUALS_N(2, line_len)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, strcmp(span, "e\n"))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(EOF, bzen_sbuf_putc('x', cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_write("x", 1, cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_TRUE(bzen_sbuf_reserve(1, &count, 
+						   cbuflock[0]) == NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(4, bzen_sbuf_read_at(span, 4, 
+							  span_len - 4,
+							  cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, memcmp(span, "line", 4))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  line_len = bzen_sbuf_readline(span, sizeof(span), cbuflock[0]);
+  if ((BZENPASS != BZENTEST_EQUALS_N(12, line_len)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, memcmp(span, "second\0line\n", 12))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(9, bzen_sbuf_readline(span, sizeof(span), 
+							   cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(-1, bzen_sbuf_readline(span, sizeof(span), 
+							    cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(EOF, bzen_sbuf_getc(cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_rewind(cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(span_len,
+				     bzen_sbuf_read(span, sizeof(span), 
+						    cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_destroy(cbuflock[0], 1))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  fclose(fbuf);
+
+  /* Pipes are read through stdio. */
+  int pipe_fds[2];
+  FILE* fpipe;
+  if (pipe(pipe_fds) != 0)
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+  write(pipe_fds[1], "ab", 2);
+  close(pipe_fds[1]);
+  fpipe = fdopen(pipe_fds[0], "r");
+  cbuflock[0] = bzen_sbuf_create_mapped(fpipe, 0);
+  if ((BZENPASS != BZENTEST_TRUE(cbuflock[0] != NULL)) ||
+      (BZENPASS != BZENTEST_TRUE(cbuflock[0]->map == NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(2, bzen_sbuf_read(span, sizeof(span), 
+						       cbuflock[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_sbuf_destroy(cbuflock[0], 1))))
+    {
+      result = BZEN_TEST_EVAL_FAIL;
+      goto END_TEST;
+    }
+  fclose(fpipe);
+
  END_TEST:
 
   return result;
@@ -20,6 +20,10 @@
  */
 
 #include <config.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 /* libzenc includes */
 #include "bzentest.h"
@@ -31,6 +35,36 @@
 #define BZEN_TEST_FILESIZE \
   BZEN_SIZE( BZEN_TEST_ASCII_HI + 1 - BZEN_TEST_ASCII_LO )
 #define BZEN_TEST_FILENAME "bzentest_sbuf.txt"
+#define BZEN_TEST_MEMSTREAM_SIZE (1024 * 1024)
+#define BZEN_TEST_COPY_SOURCE "bzentest_strm_source.txt"
+#define BZEN_TEST_COPY_TARGET "bzentest_strm_target.txt"
+#define BZEN_TEST_COPY_LINES 20000
+#define BZEN_TEST_COPY_HEAD 7
+#define BZEN_TEST_FD_FILENAME "bzentest_strm_fd.txt"
+#define BZEN_TEST_FD_BLOCK (100 * 1024)
+#define BZEN_TEST_CHUNKED_PIECE 1000
+#define BZEN_TEST_CHUNKED_IOV 1024
+#define BZEN_TEST_LZ_FILENAME "bzentest_strm_lz.dat"
+#define BZEN_TEST_LZ_LINES 20000
+#define BZEN_TEST_LZ_BLOCK (200 * 1024)
+
+/* Helper function tests block read/write and getline. */
+int bzentest_stream_block(bzen_stream_t* stream);
+
+/* Helper function tests copy between files, memory and pipes. */
+int bzentest_stream_copy(const char* directory);
+
+/* Helper function tests chunked memory stream and its export. */
+int bzentest_stream_chunked(bzen_stream_t* stream);
+
+/* Helper function tests compressed streams over other streams. */
+int bzentest_stream_compressed(const char* directory);
+
+/* Helper function tests native streams on descriptors. */
+int bzentest_stream_fd(const char* directory);
+
+/* Helper function tests growth of a dynamic buffer to large size. */
+int bzentest_stream_memstream_large(bzen_stream_t* stream);
 
 /* Helper funtion tests putc, rewind, getc */
 int bzentest_stream_rw(bzen_stream_t* stream);
@@ -98,6 +132,72 @@ int main (int argc, char *argv[])
       BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
     }
 
+  /* Test block read/write and getline on a dynamic buffer. */
+  status = bzen_stream_open_memstream(stream);
+  if (BZENPASS != BZENTEST_EQUALS_N(status, 0))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+  status = bzentest_stream_block(stream);
+  if (BZENPASS != BZENTEST_EQUALS_N(status, 0))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+  status = bzen_stream_close(stream);
+  if (BZENPASS != BZENTEST_EQUALS_N(status, 0))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+
+  /* Test a chunked stream in memory. */
+  status = bzen_stream_open_chunked(stream);
+  if (BZENPASS != BZENTEST_EQUALS_N(status, 0))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+  status = bzentest_stream_rw(stream);
+  if (BZENPASS != BZENTEST_EQUALS_N(status, 0))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+  status = bzen_stream_close(stream);
+  if (BZENPASS != BZENTEST_EQUALS_N(status, 0))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+  status = bzen_stream_open_chunked(stream);
+  if (BZENPASS != BZENTEST_EQUALS_N(status, 0))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+  status = bzentest_stream_chunked(stream);
+  if (BZENPASS != BZENTEST_EQUALS_N(status, 0))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+  status = bzen_stream_close(stream);
+  if (BZENPASS != BZENTEST_EQUALS_N(status, 0))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+
+  /* Test a large dynamic buffer in memory. */
+  status = bzen_stream_open_memstream(stream);
+  if (BZENPASS != BZENTEST_EQUALS_N(status, 0))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+  status = bzentest_stream_memstream_large(stream);
+  if (BZENPASS != BZENTEST_EQUALS_N(status, 0))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+  status = bzen_stream_close(stream);
+  if (BZENPASS != BZENTEST_EQUALS_N(status, 0))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+
   /* Test a file from storage. */
   sprintf(tempfile, "%s/%s", getenv("BZENTEST_TEMP_DIR"), BZEN_TEST_FILENAME);
   status = bzen_stream_fopen(stream, tempfile, BZEN_TEST_OPENTYPE);
@@ -120,6 +220,27 @@ int main (int argc, char *argv[])
       BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
     }
 
+  /* Test copy between streams. */
+  status = bzentest_stream_copy(getenv("BZENTEST_TEMP_DIR"));
+  if (BZENPASS != BZENTEST_EQUALS_N(status, 0))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+
+  /* Test native streams on descriptors. */
+  status = bzentest_stream_fd(getenv("BZENTEST_TEMP_DIR"));
+  if (BZENPASS != BZENTEST_EQUALS_N(status, 0))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+
+  /* Test compressed streams over other streams. */
+  status = bzentest_stream_compressed(getenv("BZENTEST_TEMP_DIR"));
+  if (BZENPASS != BZENTEST_EQUALS_N(status, 0))
+    {
+      BZENTEST_EXIT_FAIL(__FILE__, __LINE__);
+    }
+
   /* Delete the stream struct. */
   status = bzen_stream_delete(stream);
   if (BZENPASS != BZENTEST_EQUALS_N(status, 0))
@@ -130,6 +251,571 @@ int main (int argc, char *argv[])
   return result;
 }
 
+/* Helper function tests block read/write and getline. */
+int bzentest_stream_block(bzen_stream_t* stream)
+{
+  const char data[] = "first\nsec\0nd\nlast";
+  char buffer[sizeof(data)];
+  struct iovec iov;
+  char* line = NULL;
+  size_t capacity = 0;
+  int result = BZEN_TEST_EVAL_FAIL;
+
+  if (BZENPASS != BZENTEST_EQUALS_N(sizeof(data) - 1, 
+				    bzen_stream_write(data, sizeof(data) - 1, stream)))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Lines keep their newline and embedded null. */
+  bzen_stream_rewind(stream);
+  if ((BZENPASS != BZENTEST_EQUALS_N(6, bzen_stream_getline(&line, &capacity, stream))) ||
+      (BZENPASS != BZENTEST_TRUE(strcmp(line, "first\n") == 0)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(7, bzen_stream_getline(&line, &capacity, stream))) ||
+      (BZENPASS != BZENTEST_TRUE(memcmp(line, "sec\0nd\n", 8) == 0)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(4, bzen_stream_getline(&line, &capacity, stream))) ||
+      (BZENPASS != BZENTEST_TRUE(strcmp(line, "last") == 0)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(-1, bzen_stream_getline(&line, &capacity, stream))))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Dynamic buffer is one view. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(1, bzen_stream_iovec(stream, &iov, 1))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(sizeof(data) - 1, iov.iov_len)) ||
+      (BZENPASS != BZENTEST_TRUE(iov.iov_base == *stream->buffer)))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Short read at end of stream. */
+  bzen_stream_rewind(stream);
+  if ((BZENPASS != BZENTEST_EQUALS_N(sizeof(data) - 1, 
+				     bzen_stream_read(buffer, sizeof(buffer), stream))) ||
+      (BZENPASS != BZENTEST_TRUE(memcmp(buffer, data, sizeof(data) - 1) == 0)))
+    {
+      goto END_SUBTEST;
+    }
+
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_SUBTEST:
+
+  free(line);
+
+  return result;
+}
+
+/* Helper function tests copy between files, memory and pipes. */
+int bzentest_stream_copy(const char* directory)
+{
+  char source_name[1024];
+  char target_name[1024];
+  char* line = NULL;
+  size_t capacity = 0;
+  size_t total = 0;
+  ssize_t length;
+  int pipe_fd[2] = {-1, -1};
+  int i;
+  bzen_stream_t source, target, memory, pipe_in;
+  int result = BZEN_TEST_EVAL_FAIL;
+
+  memset(&source, 0, sizeof(source));
+  memset(&target, 0, sizeof(target));
+  memset(&memory, 0, sizeof(memory));
+  memset(&pipe_in, 0, sizeof(pipe_in));
+  sprintf(source_name, "%s/%s", directory, BZEN_TEST_COPY_SOURCE);
+  sprintf(target_name, "%s/%s", directory, BZEN_TEST_COPY_TARGET);
+
+  /* Source file of numbered lines. */
+  if (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_fopen(&source, source_name, "w+")))
+    {
+      goto END_SUBTEST;
+    }
+  for (i = 0; i < BZEN_TEST_COPY_LINES; i++)
+    {
+      total += fprintf(source.file, "line %d\n", i);
+    }
+
+  /* File to file after a line was read, so stdio holds bytes read ahead. */
+  bzen_stream_rewind(&source);
+  length = bzen_stream_getline(&line, &capacity, &source);
+  if ((BZENPASS != BZENTEST_EQUALS_N(BZEN_TEST_COPY_HEAD, length)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_fopen(&target, target_name, "w+"))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(total - BZEN_TEST_COPY_HEAD, 
+				     bzen_stream_copy(&target, &source, BZEN_STREAM_COPY_ALL))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(total - BZEN_TEST_COPY_HEAD, ftello(target.file))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(total, ftello(source.file))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(EOF, bzen_stream_getc(&source))))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Target picks up writing where the copy ended. */
+  if ((BZENPASS != BZENTEST_EQUALS_N('!', bzen_stream_putc('!', &target))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_rewind(&target))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(7, bzen_stream_getline(&line, &capacity, &target))) ||
+      (BZENPASS != BZENTEST_TRUE(strcmp(line, "line 1\n") == 0)))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* File to memory, n bytes. */
+  bzen_stream_rewind(&source);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_open_memstream(&memory))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(100, bzen_stream_copy(&memory, &source, 100))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, fflush(memory.file))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(100, memory.size)) ||
+      (BZENPASS != BZENTEST_TRUE(strncmp(*memory.buffer, "line 0\nline 1\n", 14) == 0)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(100, ftello(source.file))))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Memory to pipe, pipe to file. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, pipe(pipe_fd))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(100, write(pipe_fd[1], *memory.buffer, 100))))
+    {
+      goto END_SUBTEST;
+    }
+  close(pipe_fd[1]);
+  pipe_fd[1] = -1;
+  pipe_in.file = fdopen(pipe_fd[0], "r");
+  pipe_fd[0] = -1;
+  fseeko(target.file, 0, SEEK_SET);
+  if ((BZENPASS != BZENTEST_TRUE(pipe_in.file != NULL)) ||
+      (BZENPASS != BZENTEST_EQUALS_N('l', bzen_stream_getc(&pipe_in))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(99, bzen_stream_copy(&target, &pipe_in, BZEN_STREAM_COPY_ALL))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_rewind(&target))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(6, bzen_stream_getline(&line, &capacity, &target))) ||
+      (BZENPASS != BZENTEST_TRUE(strcmp(line, "ine 0\n") == 0)))
+    {
+      goto END_SUBTEST;
+    }
+
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_SUBTEST:
+
+  if (pipe_fd[0] >= 0)
+    {
+      close(pipe_fd[0]);
+    }
+  if (pipe_fd[1] >= 0)
+    {
+      close(pipe_fd[1]);
+    }
+  if (pipe_in.file != NULL)
+    {
+      fclose(pipe_in.file);
+    }
+  if (memory.file != NULL)
+    {
+      bzen_stream_close(&memory);
+    }
+  if (target.file != NULL)
+    {
+      bzen_stream_close(&target);
+    }
+  if (source.file != NULL)
+    {
+      bzen_stream_close(&source);
+    }
+  free(line);
+  unlink(source_name);
+  unlink(target_name);
+
+  return result;
+}
+
+/* Helper function tests chunked memory stream and its export. */
+int bzentest_stream_chunked(bzen_stream_t* stream)
+{
+  char piece[BZEN_TEST_CHUNKED_PIECE];
+  char back[BZEN_TEST_CHUNKED_PIECE];
+  struct iovec iov[BZEN_TEST_CHUNKED_IOV];
+  size_t offset, total;
+  int count, i;
+  int result = BZEN_TEST_EVAL_FAIL;
+
+  /* Grow to a large size a piece at a time. */
+  for (offset = 0; offset < BZEN_TEST_MEMSTREAM_SIZE; offset += BZEN_TEST_CHUNKED_PIECE)
+    {
+      for (i = 0; i < BZEN_TEST_CHUNKED_PIECE; i++)
+	{
+	  piece[i] = 'a' + (char)((offset + i) % 26);
+	}
+      if (BZENPASS != BZENTEST_EQUALS_N(BZEN_TEST_CHUNKED_PIECE, 
+					bzen_stream_write(piece, BZEN_TEST_CHUNKED_PIECE, stream)))
+	{
+	  goto END_SUBTEST;
+	}
+    }
+
+  /* Export covers all contents in order without flattening. */
+  count = bzen_stream_iovec(stream, iov, BZEN_TEST_CHUNKED_IOV);
+  if ((BZENPASS != BZENTEST_EQUALS_N(offset, stream->size)) ||
+      (BZENPASS != BZENTEST_TRUE(count > 1 && count < BZEN_TEST_CHUNKED_IOV)))
+    {
+      goto END_SUBTEST;
+    }
+  for (total = 0, i = 0; i < count; i++)
+    {
+      if (((char*)iov[i].iov_base)[0] != 'a' + (char)(total % 26))
+	{
+	  fprintf(stderr, "\n\tview %d out of place\n", i);
+	  goto END_SUBTEST;
+	}
+      total += iov[i].iov_len;
+    }
+  if (BZENPASS != BZENTEST_EQUALS_N(offset, total))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Read from the middle, then back to the start. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, fseeko(stream->file, 4999, SEEK_SET))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(BZEN_TEST_CHUNKED_PIECE, 
+				     bzen_stream_read(back, BZEN_TEST_CHUNKED_PIECE, stream))) ||
+      (BZENPASS != BZENTEST_EQUALS_N('a' + 4999 % 26, back[0])) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_rewind(stream))) ||
+      (BZENPASS != BZENTEST_EQUALS_N('a', bzen_stream_getc(stream))))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Writes append wherever the read position is. */
+  if ((BZENPASS != BZENTEST_EQUALS_N('!', bzen_stream_putc('!', stream))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, fflush(stream->file))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(offset + 1, stream->size)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, fseeko(stream->file, -1, SEEK_END))) ||
+      (BZENPASS != BZENTEST_EQUALS_N('!', bzen_stream_getc(stream))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(EOF, bzen_stream_getc(stream))))
+    {
+      goto END_SUBTEST;
+    }
+
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_SUBTEST:
+
+  return result;
+}
+
+/* Helper function tests compressed streams over other streams. */
+int bzentest_stream_compressed(const char* directory)
+{
+  char name[1024];
+  char expected[64];
+  char* line = NULL;
+  char* block = NULL;
+  char* back = NULL;
+  size_t capacity = 0;
+  size_t offset;
+  size_t plain = 0;
+  unsigned int seed = 1;
+  int i, n;
+  bzen_stream_t inner, outer, garbage;
+  int result = BZEN_TEST_EVAL_FAIL;
+
+  memset(&inner, 0, sizeof(inner));
+  memset(&outer, 0, sizeof(outer));
+  memset(&garbage, 0, sizeof(garbage));
+  sprintf(name, "%s/%s", directory, BZEN_TEST_LZ_FILENAME);
+  block = (char*)malloc(BZEN_TEST_LZ_BLOCK);
+  back = (char*)malloc(BZEN_TEST_LZ_BLOCK);
+
+  /* Log lines over a chunked stream shrink several-fold. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_open_chunked(&inner))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(-1, bzen_stream_open_compressed(&outer, &inner, "r+"))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_open_compressed(&outer, &inner, "w"))))
+    {
+      goto END_SUBTEST;
+    }
+  for (i = 0; i < BZEN_TEST_LZ_LINES; i++)
+    {
+      n = fprintf(outer.file, "bzend[%d]: request %d served\n", 42, i);
+      if (BZENPASS != BZENTEST_TRUE(n > 0))
+	{
+	  goto END_SUBTEST;
+	}
+      plain += (size_t)n;
+    }
+
+  /* Flush hands the reader all lines so far. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_flush(&outer))) ||
+      (BZENPASS != BZENTEST_TRUE(inner.size > 0)) ||
+      (BZENPASS != BZENTEST_TRUE(inner.size < plain / 4)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_close(&outer))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_rewind(&inner))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_open_compressed(&outer, &inner, "r"))))
+    {
+      goto END_SUBTEST;
+    }
+  for (i = 0; i < BZEN_TEST_LZ_LINES; i++)
+    {
+      sprintf(expected, "bzend[%d]: request %d served\n", 42, i);
+      if ((BZENPASS != BZENTEST_EQUALS_N(strlen(expected), bzen_stream_getline(&line, &capacity, &outer))) ||
+	  (BZENPASS != BZENTEST_EQUALS_N(0, strcmp(expected, line))))
+	{
+	  goto END_SUBTEST;
+	}
+    }
+  if ((BZENPASS != BZENTEST_EQUALS_N(-1, bzen_stream_getline(&line, &capacity, &outer))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, ferror(outer.file))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_close(&outer))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_close(&inner))))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Random bytes over a native stream are stored, and read back whole. */
+  for (offset = 0; offset < BZEN_TEST_LZ_BLOCK; offset++)
+    {
+      seed = seed * 1103515245 + 12345;
+      block[offset] = (char)(seed >> 16);
+    }
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_fdopen(&inner, open(name, O_WRONLY | O_CREAT | O_TRUNC, 0600)))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_open_compressed(&outer, &inner, "w"))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(BZEN_TEST_LZ_BLOCK, bzen_stream_write(block, BZEN_TEST_LZ_BLOCK, &outer))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_close(&outer))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_close(&inner))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_fdopen(&inner, open(name, O_RDONLY)))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_open_compressed(&outer, &inner, "r"))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(BZEN_TEST_LZ_BLOCK, bzen_stream_read(back, BZEN_TEST_LZ_BLOCK, &outer))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, memcmp(block, back, BZEN_TEST_LZ_BLOCK))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(EOF, bzen_stream_getc(&outer))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_close(&outer))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_close(&inner))))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Bytes that are not a compressed stream are an error, not data. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_open_memstream(&garbage))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(12, bzen_stream_write("not blocks\n\n", 12, &garbage))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_rewind(&garbage))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_open_compressed(&outer, &garbage, "r"))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(EOF, bzen_stream_getc(&outer))) ||
+      (BZENPASS != BZENTEST_TRUE(ferror(outer.file) != 0)))
+    {
+      goto END_SUBTEST;
+    }
+
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_SUBTEST:
+
+  if (outer.file != NULL)
+    {
+      bzen_stream_close(&outer);
+    }
+  if (inner.file != NULL || inner.fdstream != NULL)
+    {
+      bzen_stream_close(&inner);
+    }
+  if (garbage.file != NULL)
+    {
+      bzen_stream_close(&garbage);
+    }
+  free(block);
+  free(back);
+  free(line);
+  unlink(name);
+
+  return result;
+}
+
+/* Helper function tests native streams on descriptors. */
+int bzentest_stream_fd(const char* directory)
+{
+  char name[1024];
+  char copy_name[1024];
+  char head[8];
+  char tail[8];
+  char* block = NULL;
+  char* back = NULL;
+  char* line = NULL;
+  size_t capacity = 0;
+  struct iovec iov[3];
+  int pipe_fd[2] = {-1, -1};
+  size_t offset;
+  bzen_stream_t file, copy, reader, writer;
+  int result = BZEN_TEST_EVAL_FAIL;
+
+  memset(&file, 0, sizeof(file));
+  memset(&copy, 0, sizeof(copy));
+  memset(&reader, 0, sizeof(reader));
+  memset(&writer, 0, sizeof(writer));
+  sprintf(name, "%s/%s", directory, BZEN_TEST_FD_FILENAME);
+  sprintf(copy_name, "%s/%s", directory, BZEN_TEST_COPY_TARGET);
+  block = (char*)malloc(BZEN_TEST_FD_BLOCK);
+  back = (char*)malloc(BZEN_TEST_FD_BLOCK);
+  for (offset = 0; offset < BZEN_TEST_FD_BLOCK; offset++)
+    {
+      block[offset] = 'a' + (char)(offset % 26);
+    }
+
+  /* Same putc, rewind, getc behavior as stdio streams. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_fdopen(&file, open(name, O_RDWR | O_CREAT | O_TRUNC, 0600)))) ||
+      (BZENPASS != BZENTEST_TRUE(strcmp(file.opentype, "r+") == 0)) ||
+      (BZENPASS != BZENTEST_TRUE(bzen_stream_get_file_status(&file) >= 0)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzentest_stream_rw(&file))))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Small writes are gathered, large ones go straight to the file. */
+  iov[0].iov_base = "\nhead";
+  iov[0].iov_len = 5;
+  iov[1].iov_base = "er\n";
+  iov[1].iov_len = 3;
+  iov[2].iov_base = block;
+  iov[2].iov_len = BZEN_TEST_FD_BLOCK;
+  if ((BZENPASS != BZENTEST_EQUALS_N(8, bzen_stream_writev(&file, iov, 2))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(BZEN_TEST_FD_BLOCK, bzen_stream_writev(&file, iov + 2, 1))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(2, bzen_stream_write("\nz", 2, &file))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_flush(&file))))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Positional I/O leaves position alone. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(4, bzen_stream_pwrite(&file, "HEAD", 4, BZEN_TEST_FILESIZE - BZEN_TEST_ASCII_LO + 1))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(7, bzen_stream_pread(&file, head, 7, BZEN_TEST_FILESIZE - BZEN_TEST_ASCII_LO))) ||
+      (BZENPASS != BZENTEST_TRUE(memcmp(head, "\nHEADer", 7) == 0)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(EOF, bzen_stream_getc(&file))))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Lines, then a large read straight into place and a short one at end. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_rewind(&file))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(BZEN_TEST_FILESIZE - BZEN_TEST_ASCII_LO + 1, 
+				     bzen_stream_getline(&line, &capacity, &file))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(7, bzen_stream_getline(&line, &capacity, &file))) ||
+      (BZENPASS != BZENTEST_TRUE(strcmp(line, "HEADer\n") == 0)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(BZEN_TEST_FD_BLOCK, bzen_stream_read(back, BZEN_TEST_FD_BLOCK, &file))) ||
+      (BZENPASS != BZENTEST_TRUE(memcmp(back, block, BZEN_TEST_FD_BLOCK) == 0)))
+    {
+      goto END_SUBTEST;
+    }
+  iov[0].iov_base = tail;
+  iov[0].iov_len = 1;
+  iov[1].iov_base = tail + 1;
+  iov[1].iov_len = sizeof(tail) - 1;
+  if ((BZENPASS != BZENTEST_EQUALS_N(2, bzen_stream_readv(&file, iov, 2))) ||
+      (BZENPASS != BZENTEST_TRUE(memcmp(tail, "\nz", 2) == 0)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(-1, bzen_stream_getline(&line, &capacity, &file))))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Native to native copy after a line was read ahead. */
+  bzen_stream_rewind(&file);
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_fdopen(&copy, open(copy_name, O_RDWR | O_CREAT | O_TRUNC, 0600)))) ||
+      (BZENPASS != BZENTEST_TRUE(bzen_stream_getline(&line, &capacity, &file) > 0)) ||
+      (BZENPASS != BZENTEST_EQUALS_N(BZEN_TEST_FD_BLOCK + 9, 
+				     bzen_stream_copy(&copy, &file, BZEN_STREAM_COPY_ALL))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_rewind(&copy))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(7, bzen_stream_getline(&line, &capacity, &copy))) ||
+      (BZENPASS != BZENTEST_TRUE(strcmp(line, "HEADer\n") == 0)))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Pipes keep input and output apart. */
+  if ((BZENPASS != BZENTEST_EQUALS_N(0, pipe(pipe_fd))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_fdopen(&reader, pipe_fd[0]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_fdopen(&writer, pipe_fd[1]))) ||
+      (BZENPASS != BZENTEST_EQUALS_N('x', bzen_stream_putc('x', &writer))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_flush(&writer))) ||
+      (BZENPASS != BZENTEST_EQUALS_N('x', bzen_stream_getc(&reader))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(0, bzen_stream_close(&writer))) ||
+      (BZENPASS != BZENTEST_EQUALS_N(EOF, bzen_stream_getc(&reader))))
+    {
+      goto END_SUBTEST;
+    }
+
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_SUBTEST:
+
+  if (writer.fdstream != NULL)
+    {
+      bzen_stream_close(&writer);
+    }
+  if (reader.fdstream != NULL)
+    {
+      bzen_stream_close(&reader);
+    }
+  if (copy.fdstream != NULL)
+    {
+      bzen_stream_close(&copy);
+    }
+  if (file.fdstream != NULL)
+    {
+      bzen_stream_close(&file);
+    }
+  free(block);
+  free(back);
+  free(line);
+  unlink(name);
+  unlink(copy_name);
+
+  return result;
+}
+
+/* Helper function tests growth of a dynamic buffer to large size. */
+int bzentest_stream_memstream_large(bzen_stream_t* stream)
+{
+  int result = BZEN_TEST_EVAL_FAIL;
+  size_t offset;
+  int status;
+
+  /* Grow well past the size at which buffer is mapped. */
+  for (offset = 0; offset < BZEN_TEST_MEMSTREAM_SIZE; offset++)
+    {
+      status = bzen_stream_putc('a' + (int)(offset % 26), stream);
+      if (BZENPASS != BZENTEST_EQUALS_N('a' + (int)(offset % 26), status))
+	{
+	  goto END_SUBTEST;
+	}
+    }
+  fflush(stream->file);
+  if (BZENPASS != BZENTEST_EQUALS_N(BZEN_TEST_MEMSTREAM_SIZE, stream->size))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Contents survive every growth. */
+  for (offset = 0; offset < BZEN_TEST_MEMSTREAM_SIZE; offset++)
+    {
+      if ((*stream->buffer)[offset] != 'a' + (char)(offset % 26))
+	{
+	  fprintf(stderr, "\n\tlost byte %zu of memstream\n", offset);
+	  goto END_SUBTEST;
+	}
+    }
+  if (BZENPASS != BZENTEST_TRUE((*stream->buffer)[offset] == '\0'))
+    {
+      goto END_SUBTEST;
+    }
+
+  /* Read back from start. */
+  bzen_stream_rewind(stream);
+  if (BZENPASS != BZENTEST_EQUALS_N('a', bzen_stream_getc(stream)))
+    {
+      goto END_SUBTEST;
+    }
+
+  result = BZEN_TEST_EVAL_PASS;
+
+ END_SUBTEST:
+
+  return result;
+}
+
 /* Helper funtion tests putc, rewind, getc */
 int bzentest_stream_rw(bzen_stream_t* stream)
 {